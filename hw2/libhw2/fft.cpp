@@ -0,0 +1,149 @@
+#define _USE_MATH_DEFINES
+#include "fft.h"
+#include <math.h>
+
+//=============================================================================
+// std::complex multiply checks for NaN and infinity, this does not
+//=============================================================================
+static inline std::complex<float> cmul(std::complex<float> a, std::complex<float> b)
+{
+	return std::complex<float>(a.real() * b.real() - a.imag() * b.imag(),
+	                           a.real() * b.imag() + a.imag() * b.real());
+}
+
+//=============================================================================
+//=============================================================================
+void fft_init(FftPlan & plan, int n)
+{
+	int half = n / 2;
+	int bits = 0;
+	while ((1 << bits) < half)
+	{
+		++bits;
+	}
+
+	plan.n = n;
+	plan.bitrev.resize(half);
+	for (int i = 0; i < half; ++i)
+	{
+		int r = 0;
+		for (int b = 0; b < bits; ++b)
+		{
+			r |= ((i >> b) & 1) << (bits - 1 - b);
+		}
+		plan.bitrev[i] = r;
+	}
+
+	// Twiddles of the Half Size Complex FFT
+	plan.twiddle.resize(half / 2);
+	for (int k = 0; k < half / 2; ++k)
+	{
+		double angle = -2.0 * M_PI * k / half;
+		plan.twiddle[k] = std::complex<float>((float)cos(angle), (float)sin(angle));
+	}
+
+	// Twiddles to Split the Even & Odd Samples Back Apart
+	plan.real_twiddle.resize(half + 1);
+	for (int k = 0; k <= half; ++k)
+	{
+		double angle = -2.0 * M_PI * k / n;
+		plan.real_twiddle[k] = std::complex<float>((float)cos(angle), (float)sin(angle));
+	}
+}
+
+//=============================================================================
+//=============================================================================
+static void fft_complex(const FftPlan & plan, std::complex<float> z[])
+{
+	int n = plan.n / 2;
+
+	for (int i = 0; i < n; ++i)
+	{
+		int j = plan.bitrev[i];
+		if (i < j)
+		{
+			std::swap(z[i], z[j]);
+		}
+	}
+
+	for (int size = 2; size <= n; size *= 2)
+	{
+		int half = size / 2;
+		int step = n / size;
+
+		for (int start = 0; start < n; start += size)
+		{
+			std::complex<float> * lo = &z[start];
+			std::complex<float> * hi = &z[start + half];
+
+			for (int k = 0; k < half; ++k)
+			{
+				std::complex<float> t = cmul(plan.twiddle[k * step], hi[k]);
+				hi[k] = lo[k] - t;
+				lo[k] += t;
+			}
+		}
+	}
+}
+
+//=============================================================================
+//=============================================================================
+void fft_real(const FftPlan & plan, const float x[], std::complex<float> X[])
+{
+	int half = plan.n / 2;
+
+	// Even Samples are the Real Part, Odd Samples the Imaginary Part
+	for (int i = 0; i < half; ++i)
+	{
+		X[i] = std::complex<float>(x[2 * i], x[2 * i + 1]);
+	}
+	fft_complex(plan, X);
+
+	// X[k] = E[k] + W^k O[k], Each Pair k & half - k at Once
+	std::complex<float> z0 = X[0];
+	X[0] = std::complex<float>(z0.real() + z0.imag(), 0.0f);
+	X[half] = std::complex<float>(z0.real() - z0.imag(), 0.0f);
+
+	for (int k = 1; k <= half / 2; ++k)
+	{
+		std::complex<float> a = X[k];
+		std::complex<float> b = std::conj(X[half - k]);
+		std::complex<float> even = 0.5f * (a + b);
+		std::complex<float> odd = cmul(std::complex<float>(0.0f, -0.5f), a - b);
+
+		X[k] = even + cmul(plan.real_twiddle[k], odd);
+		X[half - k] = std::conj(even - cmul(plan.real_twiddle[k], odd));
+	}
+}
+
+//=============================================================================
+//=============================================================================
+void ifft_real(const FftPlan & plan, std::complex<float> X[], float x[])
+{
+	int half = plan.n / 2;
+
+	// Z[k] = E[k] + i O[k], the Reverse of fft_real, Conjugated so the
+	// Forward FFT Does the Inverse
+	std::complex<float> x0 = X[0];
+	std::complex<float> xh = X[half];
+	X[0] = std::conj(0.5f * std::complex<float>(x0.real() + xh.real(), x0.real() - xh.real()));
+
+	for (int k = 1; k <= half / 2; ++k)
+	{
+		std::complex<float> a = X[k];
+		std::complex<float> b = std::conj(X[half - k]);
+		std::complex<float> even = 0.5f * (a + b);
+		std::complex<float> odd = cmul(0.5f * (a - b), std::conj(plan.real_twiddle[k]));
+
+		X[k] = std::conj(even + cmul(std::complex<float>(0.0f, 1.0f), odd));
+		X[half - k] = std::conj(std::conj(even) + cmul(std::complex<float>(0.0f, 1.0f), std::conj(odd)));
+	}
+
+	fft_complex(plan, X);
+
+	for (int i = 0; i < half; ++i)
+	{
+		x[2 * i] = X[i].real();
+		x[2 * i + 1] = -X[i].imag();
+	}
+}
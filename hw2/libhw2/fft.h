@@ -0,0 +1,31 @@
+#pragma once
+
+#include <complex>
+#include <vector>
+
+//=============================================================================
+// Radix-2 FFT of a real signal, done as a complex FFT of half the size
+//=============================================================================
+struct FftPlan
+{
+	int n;
+	std::vector<int> bitrev;
+	std::vector<std::complex<float>> twiddle;
+	std::vector<std::complex<float>> real_twiddle;
+};
+
+//=============================================================================
+// n must be a power of 2, at least 4
+//=============================================================================
+void fft_init(FftPlan & plan, int n);
+
+//=============================================================================
+// Forward transform of n samples to the n / 2 + 1 bins from DC to Nyquist
+//=============================================================================
+void fft_real(const FftPlan & plan, const float x[], std::complex<float> X[]);
+
+//=============================================================================
+// Inverse transform of n / 2 + 1 bins, X is overwritten and the output is
+// scaled by n / 2
+//=============================================================================
+void ifft_real(const FftPlan & plan, std::complex<float> X[], float x[]);
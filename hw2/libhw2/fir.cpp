@@ -0,0 +1,173 @@
+#include "fir.h"
+#include <algorithm>
+#include <vector>
+
+#if defined(_MSC_VER) && (defined(_M_X64) || defined(_M_IX86))
+#include <intrin.h>
+#define FIR_X86
+#define FIR_AVX2
+#elif defined(__x86_64__) || defined(__i386__)
+#include <immintrin.h>
+#define FIR_X86
+#define FIR_AVX2 __attribute__((target("avx2,fma")))
+#endif
+
+//=============================================================================
+// Outputs computed together, 4 AVX registers of 8
+//=============================================================================
+#define FIR_BLOCK 32
+
+//=============================================================================
+// Warm-up, the outputs before the whole kernel is inside x
+//=============================================================================
+static void fir_prefix(const float x[], int L, const float h[], int M, float y[])
+{
+	int end = (M - 1 < L) ? M - 1 : L;
+	for (int i = 0; i < end; ++i)
+	{
+		float sum = 0.0f;
+		for (int k = 0; k <= i; ++k)
+		{
+			sum += h[k] * x[i - k];
+		}
+		y[i] = sum;
+	}
+}
+
+//=============================================================================
+//=============================================================================
+static void fir_scalar(const float x[], int L, const float h[], int M, float y[])
+{
+	fir_prefix(x, L, h, M, y);
+	for (int i = M - 1; i < L; ++i)
+	{
+		float sum = 0.0f;
+		for (int k = 0; k < M; ++k)
+		{
+			sum += h[k] * x[i - k];
+		}
+		y[i] = sum;
+	}
+}
+
+#ifdef FIR_X86
+//=============================================================================
+// Outputs begin to end, where x[begin - M + 1] is the first sample read.
+// Each tap is broadcast once and multiplied into FIR_BLOCK outputs held in
+// registers.
+//=============================================================================
+FIR_AVX2 static void fir_steady_avx2(const float x[], int begin, int end, const float h[], int M, float y[])
+{
+	int i = begin;
+	for (; i + FIR_BLOCK <= end; i += FIR_BLOCK)
+	{
+		__m256 acc0 = _mm256_setzero_ps();
+		__m256 acc1 = _mm256_setzero_ps();
+		__m256 acc2 = _mm256_setzero_ps();
+		__m256 acc3 = _mm256_setzero_ps();
+		const float * src = &x[i];
+
+		for (int k = 0; k < M; ++k)
+		{
+			__m256 tap = _mm256_broadcast_ss(&h[k]);
+			acc0 = _mm256_fmadd_ps(tap, _mm256_loadu_ps(src - k), acc0);
+			acc1 = _mm256_fmadd_ps(tap, _mm256_loadu_ps(src - k + 8), acc1);
+			acc2 = _mm256_fmadd_ps(tap, _mm256_loadu_ps(src - k + 16), acc2);
+			acc3 = _mm256_fmadd_ps(tap, _mm256_loadu_ps(src - k + 24), acc3);
+		}
+
+		_mm256_storeu_ps(&y[i], acc0);
+		_mm256_storeu_ps(&y[i + 8], acc1);
+		_mm256_storeu_ps(&y[i + 16], acc2);
+		_mm256_storeu_ps(&y[i + 24], acc3);
+	}
+
+	// Last Outputs, 8 at a Time Then One at a Time
+	for (; i + 8 <= end; i += 8)
+	{
+		__m256 acc = _mm256_setzero_ps();
+		for (int k = 0; k < M; ++k)
+		{
+			acc = _mm256_fmadd_ps(_mm256_broadcast_ss(&h[k]), _mm256_loadu_ps(&x[i - k]), acc);
+		}
+		_mm256_storeu_ps(&y[i], acc);
+	}
+
+	for (; i < end; ++i)
+	{
+		float sum = 0.0f;
+		for (int k = 0; k < M; ++k)
+		{
+			sum += h[k] * x[i - k];
+		}
+		y[i] = sum;
+	}
+}
+
+//=============================================================================
+//=============================================================================
+FIR_AVX2 static void fir_avx2(const float x[], int L, const float h[], int M, float y[])
+{
+	// Warm-up on a Copy of x With M - 1 Zeros in Front
+	int warm = std::max(0, std::min(M - 1, L));
+	if (warm > 0)
+	{
+		std::vector<float> padded(M - 1 + warm, 0.0f);
+		std::copy(x, x + warm, padded.begin() + (M - 1));
+		fir_steady_avx2(&padded[M - 1], 0, warm, h, M, y);
+	}
+
+	fir_steady_avx2(x, warm, L, h, M, y);
+}
+
+//=============================================================================
+// AVX2 & FMA, with the YMM registers saved by the OS
+//=============================================================================
+static bool has_avx2()
+{
+#if defined(_MSC_VER)
+	int regs[4];
+	__cpuid(regs, 0);
+	if (regs[0] < 7)
+	{
+		return false;
+	}
+
+	__cpuid(regs, 1);
+	bool fma = (regs[2] >> 12) & 1;
+	bool osxsave = (regs[2] >> 27) & 1;
+	bool avx = (regs[2] >> 28) & 1;
+	if (!fma || !osxsave || !avx || ((_xgetbv(0) & 6) != 6))
+	{
+		return false;
+	}
+
+	__cpuidex(regs, 7, 0);
+	return (regs[1] >> 5) & 1;
+#else
+	return __builtin_cpu_supports("avx2") && __builtin_cpu_supports("fma");
+#endif
+}
+#endif
+
+//=============================================================================
+//=============================================================================
+void fir(const float x[], int L, const float h[], int M, float y[])
+{
+	// No Taps, Every Output is Zero
+	if (M <= 0)
+	{
+		std::fill(y, y + std::max(L, 0), 0.0f);
+		return;
+	}
+
+#ifdef FIR_X86
+	static const bool avx2 = has_avx2();
+	if (avx2)
+	{
+		fir_avx2(x, L, h, M, y);
+		return;
+	}
+#endif
+	fir_scalar(x, L, h, M, y);
+}
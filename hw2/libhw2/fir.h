@@ -0,0 +1,7 @@
+#pragma once
+
+//=============================================================================
+// y[i] = sum of h[k] * x[i - k] for k < M and k <= i, for the first L
+// outputs. Uses AVX2 & FMA when the CPU has them.
+//=============================================================================
+void fir(const float x[], int L, const float h[], int M, float y[]);
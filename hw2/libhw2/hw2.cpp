@@ -1,49 +1,174 @@
 #include "hw2.h"
+#include "fir.h"
 #include <stdio.h>
+#include <math.h>
+#include <algorithm>
 
 //=============================================================================
 //=============================================================================
 void filter(float b[], int M, float a[], int N, float x[], int L, float y[])
 {
+	// Feed-Forward Part, Then the Recursion Adds Onto It in Order
+	fir(x, L, b, M, y);
+
 	for (int i = 0; i < L; ++i)
 	{
-		float x_part = 0.0f;
-		for (int k = 0; k < M; ++k)
+		int taps = (N < i) ? N : i;
+
+		float y_part = 0.0f;
+		for (int k = 0; k < taps; ++k)
 		{
-			if ((i - k) >= 0)
-			{
-				x_part += b[k] * x[i - k];
-			}
+			y_part -= a[k] * y[i - k - 1];
 		}
 
-		float y_part = 0.0f;
-		for (int k = 0; k < N; ++k)
+		y[i] = y[i] + y_part;
+	}
+}
+
+//=============================================================================
+// Cost in multiply-adds of the direct loop, the warm-up outputs run every
+// tap on zeros so each output costs M
+//=============================================================================
+static double direct_cost(int L, int M)
+{
+	return (double)L * M;
+}
+
+//=============================================================================
+// Cost of overlap-add with an n point FFT, a forward and an inverse FFT
+// and the spectrum multiply for each block
+//=============================================================================
+static double fft_cost(int L, int M, int n)
+{
+	int block = n - M + 1;
+	double blocks = (double)((L + block - 1) / block);
+	return blocks * (FFT_COST * n * log2((double)n) + n);
+}
+
+//=============================================================================
+// The FFT size with the lowest cost, from the smallest that fits the kernel
+// up to the one that does the whole signal in one block
+//=============================================================================
+static int fft_size(int L, int M)
+{
+	int best = 4;
+	while (best < 2 * M)
+	{
+		best *= 2;
+	}
+
+	for (int n = best * 2; n / 2 < L + M - 1; n *= 2)
+	{
+		if (fft_cost(L, M, n) < fft_cost(L, M, best))
 		{
-			if ((i - k - 1) >= 0)
-			{
-				y_part -= a[k] * y[i - k - 1];
-			}
+			best = n;
 		}
+	}
+	return best;
+}
 
-		y[i] = x_part + y_part;
+//=============================================================================
+//=============================================================================
+static bool use_fft(int L, int M)
+{
+	if ((M < FFT_MIN_TAPS) || (L < FFT_MIN_TAPS))
+	{
+		return false;
 	}
+	return fft_cost(L, M, fft_size(L, M)) < direct_cost(L, M);
 }
 
 //=============================================================================
 //=============================================================================
-void conv(float x[], int L, float h[], int M, float y[])
+ConvKernel * conv_prepare(float h[], int M, int L)
 {
-	for (int i = 0; i < L; ++i)
+	ConvKernel * kernel = new ConvKernel;
+	kernel->h.assign(h, h + M);
+	kernel->L = L;
+	kernel->fft = use_fft(L, M);
+	if (!kernel->fft)
+	{
+		return kernel;
+	}
+
+	// Spectrum of the Zero Padded Kernel, With the Inverse FFT Scale
+	int n = fft_size(L, M);
+	fft_init(kernel->plan, n);
+
+	std::vector<float> padded(n, 0.0f);
+	std::copy(h, h + M, padded.begin());
+	kernel->spectrum.resize(n / 2 + 1);
+	fft_real(kernel->plan, &padded[0], &kernel->spectrum[0]);
+	for (int k = 0; k <= n / 2; ++k)
 	{
-		y[i] = 0;
-		for (int k = 0; k < M; ++k)
+		kernel->spectrum[k] *= 2.0f / n;
+	}
+	return kernel;
+}
+
+//=============================================================================
+//=============================================================================
+void conv_apply(ConvKernel * kernel, float x[], int L, float y[])
+{
+	int M = (int)kernel->h.size();
+
+	if (!kernel->fft || (L != kernel->L && !use_fft(L, M)))
+	{
+		fir(x, L, kernel->h.data(), M, y);
+		return;
+	}
+
+	// Overlap-Add, Each Block of x Adds n Outputs Starting at the Block
+	int n = kernel->plan.n;
+	int block = n - M + 1;
+	std::vector<float> buffer(n);
+	std::vector<std::complex<float>> X(n / 2 + 1);
+
+	std::fill(y, y + L, 0.0f);
+	for (int start = 0; start < L; start += block)
+	{
+		int count = std::min(block, L - start);
+		std::copy(x + start, x + start + count, buffer.begin());
+		std::fill(buffer.begin() + count, buffer.end(), 0.0f);
+
+		fft_real(kernel->plan, &buffer[0], &X[0]);
+		for (int k = 0; k <= n / 2; ++k)
 		{
-			if ((i - k) >= 0)
-			{
-				y[i] += h[k] * x[i - k];
-			}
+			std::complex<float> a = X[k];
+			std::complex<float> b = kernel->spectrum[k];
+			X[k] = std::complex<float>(a.real() * b.real() - a.imag() * b.imag(),
+			                           a.real() * b.imag() + a.imag() * b.real());
 		}
+		ifft_real(kernel->plan, &X[0], &buffer[0]);
+
+		int outputs = std::min(n, L - start);
+		for (int i = 0; i < outputs; ++i)
+		{
+			y[start + i] += buffer[i];
+		}
+	}
+}
+
+//=============================================================================
+//=============================================================================
+void conv_free(ConvKernel * kernel)
+{
+	delete kernel;
+}
+
+//=============================================================================
+//=============================================================================
+void conv(float x[], int L, float h[], int M, float y[])
+{
+	if (!use_fft(L, M))
+	{
+		fir(x, L, h, M, y);
+		return;
 	}
+
+	ConvKernel * kernel = conv_prepare(h, M, L);
+	conv_apply(kernel, x, L, y);
+	conv_free(kernel);
 }
 
 //=============================================================================
@@ -4,10 +4,47 @@
 //=============================================================================
 void filter(float b[], int M, float a[], int N, float x[], int L, float y[]);
 
+#include <vector>
+#include "fft.h"
+
+//=============================================================================
+// conv uses FFT overlap-add instead of the direct loop when it is cheaper,
+// FFT_COST is the cost of n log2(n) FFT work in direct multiply-adds of
+// the AVX2 loop in fir.cpp
+//=============================================================================
+#define FFT_MIN_TAPS 256
+#define FFT_COST     32.0
+
+//=============================================================================
+// A kernel prepared for conv_apply, the spectrum is kept between calls
+//=============================================================================
+struct ConvKernel
+{
+	std::vector<float> h;
+	int L;
+	bool fft;
+	FftPlan plan;
+	std::vector<std::complex<float>> spectrum;
+};
+
 //=============================================================================
 //=============================================================================
 void conv(float x[], int L, float h[], int M, float y[]);
 
+//=============================================================================
+// L is the input length the kernel will be used with, it picks the method
+// and the FFT size
+//=============================================================================
+ConvKernel * conv_prepare(float h[], int M, int L);
+
+//=============================================================================
+//=============================================================================
+void conv_apply(ConvKernel * kernel, float x[], int L, float y[]);
+
+//=============================================================================
+//=============================================================================
+void conv_free(ConvKernel * kernel);
+
 //=============================================================================
 //=============================================================================
 void printy(float y[], int length);
\ No newline at end of file
@@ -0,0 +1,213 @@
+//==========================================================================
+// This file implements the arena allocator used for the image planes and
+// the per-encode scratch memory.
+//==========================================================================
+
+#include "arena.h"
+
+#include <stdio.h>
+#include <stdlib.h>
+
+#if defined(_WIN32)
+#include <malloc.h>
+#elif defined(__linux__)
+#include <sys/mman.h>
+#endif
+
+//==========================================================================
+// Size of a transparent huge page
+//==========================================================================
+#define HUGE_PAGE_SIZE ((size_t)2 * 1024 * 1024)
+
+//==========================================================================
+// Helper function that will allocate the memory for a chunk.
+//
+// Parameters:
+//  size  - The number of bytes needed, may be rounded up
+//  flags - The arena flags
+//
+// Return:
+//  A pointer to the new chunk
+//==========================================================================
+ArenaChunk * chunk_alloc(size_t size, unsigned int flags)
+{
+    ArenaChunk * chunk = (ArenaChunk *)malloc(sizeof(ArenaChunk));
+    if (chunk == NULL)
+    {
+        printf("Out of Memory\n");
+        exit(-1);
+    }
+
+    chunk->next = NULL;
+    chunk->data = NULL;
+    chunk->size = (size + ARENA_ALIGN - 1) & ~(size_t)(ARENA_ALIGN - 1);
+    chunk->offset = 0;
+    chunk->mapped = 0;
+
+#if defined(__linux__) && defined(MADV_HUGEPAGE)
+    if (flags & ARENA_HUGE_PAGES)
+    {
+        // Round up to a whole number of huge pages and ask the kernel
+        // to back the mapping with them.
+        size_t map_size = (size + HUGE_PAGE_SIZE - 1) & ~(HUGE_PAGE_SIZE - 1);
+        void * data = mmap(NULL, map_size, PROT_READ | PROT_WRITE, MAP_PRIVATE | MAP_ANONYMOUS, -1, 0);
+        if (data != MAP_FAILED)
+        {
+            madvise(data, map_size, MADV_HUGEPAGE);
+            chunk->data = (unsigned char *)data;
+            chunk->size = map_size;
+            chunk->mapped = 1;
+        }
+    }
+#endif
+
+    // Fall Back to an Aligned Heap Allocation
+    if (chunk->data == NULL)
+    {
+#if defined(_WIN32)
+        chunk->data = (unsigned char *)_aligned_malloc(chunk->size, ARENA_ALIGN);
+#else
+        void * data = NULL;
+        if (posix_memalign(&data, ARENA_ALIGN, chunk->size) == 0)
+        {
+            chunk->data = (unsigned char *)data;
+        }
+#endif
+    }
+
+    if (chunk->data == NULL)
+    {
+        printf("Out of Memory: %lu bytes\n", (unsigned long)chunk->size);
+        exit(-1);
+    }
+
+    return chunk;
+}
+
+//==========================================================================
+// Helper function that will free a chunk.
+//
+// Parameters:
+//  chunk - The chunk to free
+//==========================================================================
+void chunk_free(ArenaChunk * chunk)
+{
+#if defined(__linux__) && defined(MADV_HUGEPAGE)
+    if (chunk->mapped)
+    {
+        munmap(chunk->data, chunk->size);
+        free(chunk);
+        return;
+    }
+#endif
+
+#if defined(_WIN32)
+    _aligned_free(chunk->data);
+#else
+    free(chunk->data);
+#endif
+    free(chunk);
+}
+
+//==========================================================================
+// Initialize an arena. No memory is allocated until the first call to
+// arena_alloc.
+//
+// Parameters:
+//  arena - The arena to initialize
+//  size  - The minimum size of each chunk of memory
+//  flags - Any of the ARENA_* flags
+//==========================================================================
+void arena_init(Arena * arena, size_t size, unsigned int flags)
+{
+    arena->chunks = NULL;
+    arena->chunk_size = size;
+    arena->flags = flags;
+}
+
+//==========================================================================
+// Allocate memory from the arena. The memory is aligned to ARENA_ALIGN
+// bytes. If the arena is out of memory a new chunk is added to it.
+//
+// Parameters:
+//  arena - The arena to allocate from
+//  size  - The number of bytes to allocate
+//
+// Return:
+//  A pointer to the allocated memory
+//==========================================================================
+void * arena_alloc(Arena * arena, size_t size)
+{
+    ArenaChunk * chunk = arena->chunks;
+
+    // Round Up to Keep the Next Allocation Aligned
+    size = (size + ARENA_ALIGN - 1) & ~(size_t)(ARENA_ALIGN - 1);
+
+    // Add a New Chunk if the Current One is Full
+    if ((chunk == NULL) || (chunk->size - chunk->offset < size))
+    {
+        size_t chunk_size = (size > arena->chunk_size) ? size : arena->chunk_size;
+        chunk = chunk_alloc(chunk_size, arena->flags);
+        chunk->next = arena->chunks;
+        arena->chunks = chunk;
+    }
+
+    void * ptr = &chunk->data[chunk->offset];
+    chunk->offset += size;
+    return ptr;
+}
+
+//==========================================================================
+// Release all of the allocations at once. If more than one chunk was
+// needed they are replaced by a single chunk large enough to hold all of
+// them, so that the next image of the same size needs no new memory.
+//
+// Parameters:
+//  arena - The arena to reset
+//==========================================================================
+void arena_reset(Arena * arena)
+{
+    ArenaChunk * chunk = arena->chunks;
+
+    if (chunk == NULL)
+    {
+        return;
+    }
+
+    if (chunk->next != NULL)
+    {
+        // Total Size of All the Chunks
+        size_t total = 0;
+        for (ArenaChunk * c = chunk; c != NULL; c = c->next)
+        {
+            total += c->size;
+        }
+
+        arena_free(arena);
+        arena->chunks = chunk_alloc(total, arena->flags);
+    }
+    else
+    {
+        chunk->offset = 0;
+    }
+}
+
+//==========================================================================
+// Free all of the memory owned by the arena.
+//
+// Parameters:
+//  arena - The arena to free
+//==========================================================================
+void arena_free(Arena * arena)
+{
+    ArenaChunk * chunk = arena->chunks;
+
+    while (chunk != NULL)
+    {
+        ArenaChunk * next = chunk->next;
+        chunk_free(chunk);
+        chunk = next;
+    }
+
+    arena->chunks = NULL;
+}
@@ -0,0 +1,98 @@
+//==========================================================================
+// This file contains a simple arena allocator that is used for the image
+// planes and the per-encode scratch memory. All of the memory handed out
+// is aligned to 64 bytes (a cache line) and it is released all at once by
+// resetting the arena, so it can be reused between images.
+//==========================================================================
+
+#ifndef ARENA_H
+#define ARENA_H
+
+#include <stddef.h>
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+//==========================================================================
+// Alignment of every allocation handed out by the arena.
+//==========================================================================
+#define ARENA_ALIGN 64
+
+//==========================================================================
+// Flags for arena_init
+//
+//  ARENA_HUGE_PAGES - Back the arena with transparent huge pages when the
+//                     platform supports it.
+//==========================================================================
+#define ARENA_HUGE_PAGES 0x1
+
+//==========================================================================
+// Structure to hold a chunk of memory owned by the arena
+//==========================================================================
+typedef struct ArenaChunk
+{
+    struct ArenaChunk * next;
+    unsigned char * data;
+    size_t size;
+    size_t offset;
+    int mapped;
+} ArenaChunk;
+
+//==========================================================================
+// Structure to hold the arena information
+//==========================================================================
+typedef struct
+{
+    ArenaChunk * chunks;
+    size_t chunk_size;
+    unsigned int flags;
+} Arena;
+
+//==========================================================================
+// Initialize an arena. No memory is allocated until the first call to
+// arena_alloc.
+//
+// Parameters:
+//  arena - The arena to initialize
+//  size  - The minimum size of each chunk of memory
+//  flags - Any of the ARENA_* flags
+//==========================================================================
+void arena_init(Arena * arena, size_t size, unsigned int flags);
+
+//==========================================================================
+// Allocate memory from the arena. The memory is aligned to ARENA_ALIGN
+// bytes. If the arena is out of memory a new chunk is added to it.
+//
+// Parameters:
+//  arena - The arena to allocate from
+//  size  - The number of bytes to allocate
+//
+// Return:
+//  A pointer to the allocated memory
+//==========================================================================
+void * arena_alloc(Arena * arena, size_t size);
+
+//==========================================================================
+// Release all of the allocations at once. If more than one chunk was
+// needed they are replaced by a single chunk large enough to hold all of
+// them, so that the next image of the same size needs no new memory.
+//
+// Parameters:
+//  arena - The arena to reset
+//==========================================================================
+void arena_reset(Arena * arena);
+
+//==========================================================================
+// Free all of the memory owned by the arena.
+//
+// Parameters:
+//  arena - The arena to free
+//==========================================================================
+void arena_free(Arena * arena);
+
+#ifdef __cplusplus
+}
+#endif
+
+#endif /* ARENA_H */
@@ -0,0 +1,542 @@
+//==========================================================================
+// This file implements the arithmetic entropy coder. The coding and the
+// probability estimation follow T.81 Annex D and the coding of the DC
+// differences and AC coefficients follows Annex F (F.1.4), so any decoder
+// that supports SOF9 can read the scans.
+//==========================================================================
+
+#include "arith.h"
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+//==========================================================================
+// Table D.2 of T.81, the probability estimation state machine. Each entry
+// holds the Qe value, the next state after an MPS, whether the MPS sense
+// switches after an LPS and the next state after an LPS, packed as
+// Qe << 16 | Next_Index_MPS << 8 | Switch_MPS << 7 | Next_Index_LPS. The
+// last entry is a fixed probability of 0.5 that never adapts.
+//==========================================================================
+#define QE(qe, nlps, nmps, sw) (((unsigned int)(qe) << 16) | ((nmps) << 8) | ((sw) << 7) | (nlps))
+
+static const unsigned int qe_table[114] =
+{
+    QE(0x5A1D,   1,   1, 1), // 0
+    QE(0x2586,  14,   2, 0), // 1
+    QE(0x1114,  16,   3, 0), // 2
+    QE(0x080B,  18,   4, 0), // 3
+    QE(0x03D8,  20,   5, 0), // 4
+    QE(0x01DA,  23,   6, 0), // 5
+    QE(0x00E5,  25,   7, 0), // 6
+    QE(0x006F,  28,   8, 0), // 7
+    QE(0x0036,  30,   9, 0), // 8
+    QE(0x001A,  33,  10, 0), // 9
+    QE(0x000D,  35,  11, 0), // 10
+    QE(0x0006,   9,  12, 0), // 11
+    QE(0x0003,  10,  13, 0), // 12
+    QE(0x0001,  12,  13, 0), // 13
+    QE(0x5A7F,  15,  15, 1), // 14
+    QE(0x3F25,  36,  16, 0), // 15
+    QE(0x2CF2,  38,  17, 0), // 16
+    QE(0x207C,  39,  18, 0), // 17
+    QE(0x17B9,  40,  19, 0), // 18
+    QE(0x1182,  42,  20, 0), // 19
+    QE(0x0CEF,  43,  21, 0), // 20
+    QE(0x09A1,  45,  22, 0), // 21
+    QE(0x072F,  46,  23, 0), // 22
+    QE(0x055C,  48,  24, 0), // 23
+    QE(0x0406,  49,  25, 0), // 24
+    QE(0x0303,  51,  26, 0), // 25
+    QE(0x0240,  52,  27, 0), // 26
+    QE(0x01B1,  54,  28, 0), // 27
+    QE(0x0144,  56,  29, 0), // 28
+    QE(0x00F5,  57,  30, 0), // 29
+    QE(0x00B7,  59,  31, 0), // 30
+    QE(0x008A,  60,  32, 0), // 31
+    QE(0x0068,  62,  33, 0), // 32
+    QE(0x004E,  63,  34, 0), // 33
+    QE(0x003B,  32,  35, 0), // 34
+    QE(0x002C,  33,   9, 0), // 35
+    QE(0x5AE1,  37,  37, 1), // 36
+    QE(0x484C,  64,  38, 0), // 37
+    QE(0x3A0D,  65,  39, 0), // 38
+    QE(0x2EF1,  67,  40, 0), // 39
+    QE(0x261F,  68,  41, 0), // 40
+    QE(0x1F33,  69,  42, 0), // 41
+    QE(0x19A8,  70,  43, 0), // 42
+    QE(0x1518,  72,  44, 0), // 43
+    QE(0x1177,  73,  45, 0), // 44
+    QE(0x0E74,  74,  46, 0), // 45
+    QE(0x0BFB,  75,  47, 0), // 46
+    QE(0x09F8,  77,  48, 0), // 47
+    QE(0x0861,  78,  49, 0), // 48
+    QE(0x0706,  79,  50, 0), // 49
+    QE(0x05CD,  48,  51, 0), // 50
+    QE(0x04DE,  50,  52, 0), // 51
+    QE(0x040F,  50,  53, 0), // 52
+    QE(0x0363,  51,  54, 0), // 53
+    QE(0x02D4,  52,  55, 0), // 54
+    QE(0x025C,  53,  56, 0), // 55
+    QE(0x01F8,  54,  57, 0), // 56
+    QE(0x01A4,  55,  58, 0), // 57
+    QE(0x0160,  56,  59, 0), // 58
+    QE(0x0125,  57,  60, 0), // 59
+    QE(0x00F6,  58,  61, 0), // 60
+    QE(0x00CB,  59,  62, 0), // 61
+    QE(0x00AB,  61,  63, 0), // 62
+    QE(0x008F,  61,  32, 0), // 63
+    QE(0x5B12,  65,  65, 1), // 64
+    QE(0x4D04,  80,  66, 0), // 65
+    QE(0x412C,  81,  67, 0), // 66
+    QE(0x37D8,  82,  68, 0), // 67
+    QE(0x2FE8,  83,  69, 0), // 68
+    QE(0x293C,  84,  70, 0), // 69
+    QE(0x2379,  86,  71, 0), // 70
+    QE(0x1EDF,  87,  72, 0), // 71
+    QE(0x1AA9,  87,  73, 0), // 72
+    QE(0x174E,  72,  74, 0), // 73
+    QE(0x1424,  72,  75, 0), // 74
+    QE(0x119C,  74,  76, 0), // 75
+    QE(0x0F6B,  74,  77, 0), // 76
+    QE(0x0D51,  75,  78, 0), // 77
+    QE(0x0BB6,  77,  79, 0), // 78
+    QE(0x0A40,  77,  48, 0), // 79
+    QE(0x5832,  80,  81, 1), // 80
+    QE(0x4D1C,  88,  82, 0), // 81
+    QE(0x438E,  89,  83, 0), // 82
+    QE(0x3BDD,  90,  84, 0), // 83
+    QE(0x34EE,  91,  85, 0), // 84
+    QE(0x2EAE,  92,  86, 0), // 85
+    QE(0x299A,  93,  87, 0), // 86
+    QE(0x2516,  86,  71, 0), // 87
+    QE(0x5570,  88,  89, 1), // 88
+    QE(0x4CA9,  95,  90, 0), // 89
+    QE(0x44D9,  96,  91, 0), // 90
+    QE(0x3E22,  97,  92, 0), // 91
+    QE(0x3824,  99,  93, 0), // 92
+    QE(0x32B4,  99,  94, 0), // 93
+    QE(0x2E17,  93,  86, 0), // 94
+    QE(0x56A8,  95,  96, 1), // 95
+    QE(0x4F46, 101,  97, 0), // 96
+    QE(0x47E5, 102,  98, 0), // 97
+    QE(0x41CF, 103,  99, 0), // 98
+    QE(0x3C3D, 104, 100, 0), // 99
+    QE(0x375E,  99,  93, 0), // 100
+    QE(0x5231, 105, 102, 0), // 101
+    QE(0x4C0F, 106, 103, 0), // 102
+    QE(0x4639, 107, 104, 0), // 103
+    QE(0x415E, 103,  99, 0), // 104
+    QE(0x5627, 105, 106, 1), // 105
+    QE(0x50E7, 108, 107, 0), // 106
+    QE(0x4B85, 109, 103, 0), // 107
+    QE(0x5597, 110, 109, 0), // 108
+    QE(0x504F, 111, 107, 0), // 109
+    QE(0x5A10, 110, 111, 1), // 110
+    QE(0x5522, 112, 109, 0), // 111
+    QE(0x59EB, 112, 111, 1), // 112
+    QE(0x5A1D, 113, 113, 0)  // 113
+};
+
+//==========================================================================
+// Create an arithmetic coder for a scan.
+//
+// Parameters:
+//  channels - The number of channels, 1 for grayscale or 3 for YCbCr 4:2:0
+//
+// Return:
+//  The coder, it must be released with free
+//==========================================================================
+ArithCoder * arith_open(unsigned int channels)
+{
+    ArithCoder * coder = (ArithCoder *)malloc(sizeof(ArithCoder));
+    if (coder == NULL)
+    {
+        printf("Out of Memory\n");
+        exit(-1);
+    }
+
+    arith_reset(coder, channels);
+    return coder;
+}
+
+//==========================================================================
+// Reset the coder and its statistics for the start of a new scan.
+//
+// Parameters:
+//  coder    - The arithmetic coder
+//  channels - The number of channels in the scan
+//==========================================================================
+void arith_reset(ArithCoder * coder, unsigned int channels)
+{
+    memset(coder, 0, sizeof(ArithCoder));
+
+    // Initial Encoder State (T.81 D.1.7)
+    coder->a = 0x10000;
+    coder->ct = 11;
+    coder->buffer = -1;
+    coder->channels = channels;
+
+    // Every Bin Starts in State 0 With an MPS of 0, Except the Fixed Bin
+    coder->fixed_bin[0] = 113;
+}
+
+//==========================================================================
+// Helper function that will output the bytes held back by the coder, the
+// zero bytes first and then the buffered byte.
+//
+// Parameters:
+//  coder  - The arithmetic coder
+//  value  - The buffered byte
+//  stream - The output stream
+//==========================================================================
+static inline void put_buffer(ArithCoder * coder, int value, OutStream * stream)
+{
+    for (; coder->zc > 0; coder->zc--)
+    {
+        stream_put(stream, 0x00);
+    }
+
+    stream_put(stream, (unsigned char)value);
+    if (value == 0xFF)
+    {
+        stream_put(stream, 0x00);
+    }
+}
+
+//==========================================================================
+// Helper function that will output the buffered byte and the stacked
+// 0xFF bytes once a byte that can not carry into them is ready (the
+// carry case is handled by the caller). Zero bytes are only counted, so
+// a run of them at the end of the scan can be dropped.
+//
+// Parameters:
+//  coder  - The arithmetic coder
+//  stream - The output stream
+//==========================================================================
+static inline void flush_stack(ArithCoder * coder, OutStream * stream)
+{
+    if (coder->buffer == 0)
+    {
+        coder->zc++;
+    }
+    else if (coder->buffer > 0)
+    {
+        put_buffer(coder, coder->buffer, stream);
+    }
+
+    if (coder->sc > 0)
+    {
+        for (; coder->zc > 0; coder->zc--)
+        {
+            stream_put(stream, 0x00);
+        }
+
+        for (; coder->sc > 0; coder->sc--)
+        {
+            stream_put(stream, 0xFF);
+            stream_put(stream, 0x00);
+        }
+    }
+}
+
+//==========================================================================
+// Helper function that will propagate a carry into the buffered byte,
+// which turns the stacked 0xFF bytes into 0x00 bytes.
+//
+// Parameters:
+//  coder  - The arithmetic coder
+//  stream - The output stream
+//==========================================================================
+static inline void carry_stack(ArithCoder * coder, OutStream * stream)
+{
+    if (coder->buffer >= 0)
+    {
+        put_buffer(coder, coder->buffer + 1, stream);
+    }
+
+    coder->zc += coder->sc;
+    coder->sc = 0;
+}
+
+//==========================================================================
+// Encode one binary decision and update its statistics bin (T.81 D.1.4,
+// D.1.5 & D.1.6).
+//
+// Parameters:
+//  coder  - The arithmetic coder
+//  st     - The statistics bin, the state index and the MPS in bit 7
+//  value  - The decision, 0 or 1
+//  stream - The output stream
+//==========================================================================
+static inline void encode_decision(ArithCoder * coder, unsigned char * st, int value, OutStream * stream)
+{
+    unsigned int sv = *st;
+    unsigned int entry = qe_table[sv & 0x7F];
+    unsigned int qe = entry >> 16;
+    unsigned int nl = entry & 0xFF;
+    unsigned int nm = (entry >> 8) & 0xFF;
+
+    coder->a -= qe;
+    if (value != (int)(sv >> 7))
+    {
+        // Less Probable Symbol, the Larger Interval Goes to the LPS
+        if (coder->a >= qe)
+        {
+            coder->c += coder->a;
+            coder->a = qe;
+        }
+        *st = (unsigned char)((sv & 0x80) ^ nl);
+    }
+    else
+    {
+        // More Probable Symbol, No Renormalization While A >= 0x8000
+        if (coder->a >= 0x8000)
+        {
+            return;
+        }
+
+        if (coder->a < qe)
+        {
+            coder->c += coder->a;
+            coder->a = qe;
+        }
+        *st = (unsigned char)((sv & 0x80) ^ nm);
+    }
+
+    // Renormalize & Output the Finished Bytes
+    do
+    {
+        coder->a <<= 1;
+        coder->c <<= 1;
+
+        if (--coder->ct == 0)
+        {
+            unsigned int byte = coder->c >> 19;
+
+            if (byte > 0xFF)
+            {
+                // Carry Into the Buffered & Stacked Bytes, the Spacer Bits
+                // Mean the New Byte Can Not be 0xFF
+                carry_stack(coder, stream);
+                coder->buffer = byte & 0xFF;
+            }
+            else if (byte == 0xFF)
+            {
+                // Might Still Carry
+                coder->sc++;
+            }
+            else
+            {
+                flush_stack(coder, stream);
+                coder->buffer = byte;
+            }
+
+            coder->c &= 0x7FFFF;
+            coder->ct += 8;
+        }
+    } while (coder->a < 0x8000);
+}
+
+//==========================================================================
+// Helper function that will encode the magnitude category and the bits of
+// a non zero value (T.81 F.1.4.1, Figures F.8 & F.9).
+//
+// Parameters:
+//  coder  - The arithmetic coder
+//  st     - The first magnitude bin (SP/SN for DC, S0 + 2 for AC)
+//  x1     - The bin of the second magnitude decision (X1)
+//  x2     - The bins of the rest of the magnitude decisions (X2...)
+//  v      - The magnitude of the value minus one
+//  stream - The output stream
+//
+// Return:
+//  The magnitude category, the largest power of 2 not above v (0 for 0)
+//==========================================================================
+static inline int encode_magnitude(ArithCoder * coder, unsigned char * st, unsigned char * x1, unsigned char * x2,
+                                   int v, OutStream * stream)
+{
+    int m = 0;
+
+    if (v != 0)
+    {
+        encode_decision(coder, st, 1, stream);
+        m = 1;
+        st = x1;
+
+        int v2 = v >> 1;
+        if (v2 != 0)
+        {
+            encode_decision(coder, x1, 1, stream);
+            m <<= 1;
+            st = x2;
+
+            while ((v2 >>= 1) != 0)
+            {
+                encode_decision(coder, st, 1, stream);
+                m <<= 1;
+                st++;
+            }
+        }
+    }
+    encode_decision(coder, st, 0, stream);
+
+    // Magnitude Bits Below the Leading One
+    int category = m;
+    st += 14;
+    while ((m >>= 1) != 0)
+    {
+        encode_decision(coder, st, (m & v) ? 1 : 0, stream);
+    }
+
+    return category;
+}
+
+//==========================================================================
+// Encode the next block of the scan (T.81 F.1.4).
+//
+// Parameters:
+//  coder  - The arithmetic coder
+//  zz     - The quantized block in zig-zag order (see quant_zigzag)
+//  stream - The output stream
+//==========================================================================
+void arith_encode_block(ArithCoder * coder, const short * zz, OutStream * stream)
+{
+    // Channel & Table of the Block From its Place in the MCU
+    unsigned int channel = 0;
+    if (coder->channels > 1)
+    {
+        channel = (coder->block_idx < 4) ? 0 : coder->block_idx - 3;
+        coder->block_idx = (coder->block_idx + 1) % 6;
+    }
+    unsigned int table = (channel == 0) ? 0 : 1;
+
+    // DC Difference, Conditioned on the Last Difference (F.1.4.1)
+    unsigned char * dc_stats = coder->dc_stats[table];
+    unsigned char * st = &dc_stats[coder->dc_context[channel]];
+    int v = zz[0] - coder->last_dc[channel];
+
+    if (v == 0)
+    {
+        encode_decision(coder, st, 0, stream);
+        coder->dc_context[channel] = 0;
+    }
+    else
+    {
+        coder->last_dc[channel] = zz[0];
+        encode_decision(coder, st, 1, stream);
+
+        // Sign, Then the Magnitude in the Bins for That Sign
+        if (v > 0)
+        {
+            encode_decision(coder, st + 1, 0, stream);
+            st += 2;
+            coder->dc_context[channel] = 4;
+        }
+        else
+        {
+            v = -v;
+            encode_decision(coder, st + 1, 1, stream);
+            st += 3;
+            coder->dc_context[channel] = 8;
+        }
+
+        int m = encode_magnitude(coder, st, &dc_stats[20], &dc_stats[21], v - 1, stream);
+
+        // Small Differences are Treated as Zero, Large Ones Get Their Own Bins
+        if (m < ((1 << ARITH_DC_L) >> 1))
+            coder->dc_context[channel] = 0;
+        else if (m > ((1 << ARITH_DC_U) >> 1))
+            coder->dc_context[channel] += 8;
+    }
+
+    // AC Coefficients up to the Last Non Zero One (F.1.4.2)
+    unsigned char * ac_stats = coder->ac_stats[table];
+    int end = 63;
+    while ((end > 0) && (zz[end] == 0))
+    {
+        end--;
+    }
+
+    int k;
+    for (k = 1; k <= end; k++)
+    {
+        st = &ac_stats[3 * (k - 1)];
+        encode_decision(coder, st, 0, stream);
+
+        // Zero Run
+        while ((v = zz[k]) == 0)
+        {
+            encode_decision(coder, st + 1, 0, stream);
+            st += 3;
+            k++;
+        }
+        encode_decision(coder, st + 1, 1, stream);
+
+        // The Sign Has an Even Chance
+        if (v > 0)
+        {
+            encode_decision(coder, coder->fixed_bin, 0, stream);
+        }
+        else
+        {
+            v = -v;
+            encode_decision(coder, coder->fixed_bin, 1, stream);
+        }
+
+        unsigned char * x2 = &ac_stats[(k <= ARITH_AC_K) ? 189 : 217];
+        encode_magnitude(coder, st + 2, st + 2, x2, v - 1, stream);
+    }
+
+    // End of Block, Unless the Last Coefficient Ended it
+    if (k <= 63)
+    {
+        encode_decision(coder, &ac_stats[3 * (k - 1)], 1, stream);
+    }
+}
+
+//==========================================================================
+// Flush the coder at the end of the scan (T.81 D.1.8).
+//
+// Parameters:
+//  coder  - The arithmetic coder
+//  stream - The output stream
+//==========================================================================
+void arith_finish(ArithCoder * coder, OutStream * stream)
+{
+    // Pick the Value in the Interval With the Most Trailing Zero Bits
+    unsigned int temp = (coder->a - 1 + coder->c) & 0xFFFF0000;
+    if (temp < coder->c)
+        coder->c = temp + 0x8000;
+    else
+        coder->c = temp;
+
+    // Output the Held Back Bytes
+    coder->c <<= coder->ct;
+    if (coder->c & 0xF8000000)
+    {
+        carry_stack(coder, stream);
+    }
+    else
+    {
+        flush_stack(coder, stream);
+    }
+
+    // The Final Bytes are Only Output if They are Not Zero
+    if (coder->c & 0x7FFF800)
+    {
+        for (; coder->zc > 0; coder->zc--)
+        {
+            stream_put(stream, 0x00);
+        }
+
+        put_buffer(coder, (coder->c >> 19) & 0xFF, stream);
+        if (coder->c & 0x7F800)
+        {
+            put_buffer(coder, (coder->c >> 11) & 0xFF, stream);
+        }
+    }
+
+    // The Next Scan Starts From the Beginning of an MCU
+    coder->block_idx = 0;
+}
@@ -0,0 +1,111 @@
+//==========================================================================
+// This file contains the arithmetic entropy coder, the adaptive binary
+// QM-coder of ITU T.81 Annex D used by the arithmetic coded sequential
+// DCT process (SOF9). It codes the same quantized zig-zag ordered blocks
+// as the Huffman coder with the decision trees of Annex F.
+//==========================================================================
+
+#ifndef ARITH_H
+#define ARITH_H
+
+#include "writer.h"
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+//==========================================================================
+// Number of statistics bins in each conditioning table (T.81 F.1.4.4)
+//==========================================================================
+#define ARITH_DC_STAT_BINS 64
+#define ARITH_AC_STAT_BINS 256
+
+//==========================================================================
+// Conditioning values written in the DAC segment. These are the T.81
+// defaults: DC differences of magnitude 0 (L) up to 1 (U) are small, and
+// the AC magnitude bins are split at zig-zag index 5 (Kx).
+//==========================================================================
+#define ARITH_DC_L 0
+#define ARITH_DC_U 1
+#define ARITH_AC_K 5
+
+//==========================================================================
+// Structure to hold the arithmetic coder state of a scan
+//
+//  c, a        - The code and interval registers (T.81 D.1.3)
+//  sc          - The number of stacked 0xFF bytes that a carry may change
+//  zc          - The number of 0x00 bytes held back, they are dropped if
+//                they end the scan
+//  ct          - The number of shifts until the next byte is output
+//  buffer      - The last byte that is not 0xFF, -1 if there is none
+//  channels    - The number of channels in the scan
+//  block_idx   - The index of the next block in its MCU
+//  last_dc     - The last DC value of each channel
+//  dc_context  - The DC conditioning of each channel (T.81 F.1.4.4.1.2)
+//  dc_stats    - The DC statistics of each table
+//  ac_stats    - The AC statistics of each table
+//  fixed_bin   - The fixed probability bin used for the AC signs
+//==========================================================================
+typedef struct ArithCoder
+{
+    unsigned int c;
+    unsigned int a;
+    int sc;
+    int zc;
+    int ct;
+    int buffer;
+    unsigned int channels;
+    unsigned int block_idx;
+    int last_dc[3];
+    int dc_context[3];
+    unsigned char dc_stats[2][ARITH_DC_STAT_BINS];
+    unsigned char ac_stats[2][ARITH_AC_STAT_BINS];
+    unsigned char fixed_bin[4];
+} ArithCoder;
+
+//==========================================================================
+// Create an arithmetic coder for a scan.
+//
+// Parameters:
+//  channels - The number of channels, 1 for grayscale or 3 for YCbCr 4:2:0
+//
+// Return:
+//  The coder, it must be released with free
+//==========================================================================
+ArithCoder * arith_open(unsigned int channels);
+
+//==========================================================================
+// Reset the coder and its statistics for the start of a new scan.
+//
+// Parameters:
+//  coder    - The arithmetic coder
+//  channels - The number of channels in the scan
+//==========================================================================
+void arith_reset(ArithCoder * coder, unsigned int channels);
+
+//==========================================================================
+// Encode the next block of the scan. The blocks have to be in MCU order,
+// four luminance blocks then a Cb and a Cr block for color, so the coder
+// knows which channel and tables each one belongs to.
+//
+// Parameters:
+//  coder  - The arithmetic coder
+//  zz     - The quantized block in zig-zag order (see quant_zigzag)
+//  stream - The output stream
+//==========================================================================
+void arith_encode_block(ArithCoder * coder, const short * zz, OutStream * stream);
+
+//==========================================================================
+// Flush the coder at the end of the scan (T.81 D.1.8).
+//
+// Parameters:
+//  coder  - The arithmetic coder
+//  stream - The output stream
+//==========================================================================
+void arith_finish(ArithCoder * coder, OutStream * stream);
+
+#ifdef __cplusplus
+}
+#endif
+
+#endif /* ARITH_H */
@@ -0,0 +1,441 @@
+//==========================================================================
+// This file contains a small client and load generator for the encoder
+// server (see server.h). The image is read once and copied into a shared
+// memory segment for each connection, and then the same image is encoded
+// over and over by one thread per connection to measure the throughput
+// and latency of the server.
+//
+// Usage: jpeg_client [socket path] [pgm/ppm input file] [output file] [options]
+// Options:
+//    -n requests       - Number of requests on each connection (default 1)
+//    -c connections    - Number of connections at the same time (default 1)
+//==========================================================================
+
+#if defined(__linux__) && !defined(_GNU_SOURCE)
+#define _GNU_SOURCE
+#endif
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <errno.h>
+#include <fcntl.h>
+#include <pthread.h>
+#include <unistd.h>
+#include <sys/mman.h>
+#include <sys/socket.h>
+#include <sys/un.h>
+
+#include "server.h"
+#include "reader.h"
+#include "mjpeg.h"
+
+//==========================================================================
+// Limit on the number of connections
+//==========================================================================
+#define CLIENT_MAX_CONNECTIONS 256
+
+//==========================================================================
+// Structure to hold the image that is sent to the server
+//==========================================================================
+typedef struct
+{
+    unsigned char * pixels;
+    unsigned int width;
+    unsigned int height;
+    unsigned int channels;
+    size_t size;
+} ClientImage;
+
+//==========================================================================
+// Structure to hold a connection
+//
+//  segment      - The shared memory segment, the pixels and then the
+//                 output region
+//  segment_fd   - The memfd of the segment
+//  send_fd      - Not 0 if the next request has to pass the segment
+//  jpeg         - The last JPEG, copied out of the segment
+//==========================================================================
+typedef struct
+{
+    const char * socket_path;
+    const ClientImage * image;
+    unsigned int requests;
+    int fd;
+    unsigned char * segment;
+    size_t segment_size;
+    int segment_fd;
+    int send_fd;
+    unsigned char * jpeg;
+    size_t jpeg_size;
+    int error;
+    LatencyLog log;
+    pthread_t thread;
+} ClientConnection;
+
+//==========================================================================
+// Helper function that will read an image into memory as 8-bit
+// grayscale or packed 24-bit RGB rows.
+//
+// Parameters:
+//  file_name - The PGM or PPM file
+//  image     - The image to fill in
+//
+// Return:
+//  0 on success, -1 if the image could not be read
+//==========================================================================
+int load_image(const char * file_name, ClientImage * image)
+{
+    ImageReader reader;
+
+    if (reader_open(&reader, file_name, FORMAT_PNM, 0, 0, 0) != 0)
+    {
+        return -1;
+    }
+
+    image->width = reader.width;
+    image->height = reader.height;
+    image->channels = reader.channels;
+    image->size = (size_t)reader.width * reader.height * reader.channels;
+    image->pixels = (unsigned char *)malloc(image->size);
+    if (image->pixels == NULL)
+    {
+        printf("Out of Memory\n");
+        exit(-1);
+    }
+
+    size_t row_size = (size_t)reader.width * reader.channels;
+    for (unsigned int y = 0; y < reader.height; y++)
+    {
+        memcpy(&image->pixels[y * row_size], reader_read_row(&reader), row_size);
+    }
+
+    reader_close(&reader);
+    return 0;
+}
+
+//==========================================================================
+// Helper function that will create the shared memory segment of a
+// connection with the pixels at the start of it. The segment is sealed so
+// it can not shrink while the server is using it.
+//
+// Parameters:
+//  conn        - The connection
+//  output_size - The size of the output region
+//
+// Return:
+//  0 on success, -1 if the segment could not be created
+//==========================================================================
+int create_segment(ClientConnection * conn, size_t output_size)
+{
+    size_t size = conn->image->size + output_size;
+
+    if (conn->segment != NULL)
+    {
+        munmap(conn->segment, conn->segment_size);
+        close(conn->segment_fd);
+        conn->segment = NULL;
+    }
+
+    conn->segment_fd = memfd_create("jpeg_client", MFD_CLOEXEC | MFD_ALLOW_SEALING);
+    if (conn->segment_fd < 0)
+    {
+        printf("Failed to Create the Segment\n");
+        return -1;
+    }
+
+    if ((ftruncate(conn->segment_fd, (off_t)size) != 0) || (fcntl(conn->segment_fd, F_ADD_SEALS, F_SEAL_SHRINK) != 0))
+    {
+        printf("Failed to Size the Segment\n");
+        close(conn->segment_fd);
+        return -1;
+    }
+
+    void * memory = mmap(NULL, size, PROT_READ | PROT_WRITE, MAP_SHARED, conn->segment_fd, 0);
+    if (memory == MAP_FAILED)
+    {
+        printf("Failed to Map the Segment\n");
+        close(conn->segment_fd);
+        return -1;
+    }
+
+    conn->segment = (unsigned char *)memory;
+    conn->segment_size = size;
+    conn->send_fd = 1;
+    memcpy(conn->segment, conn->image->pixels, conn->image->size);
+
+    return 0;
+}
+
+//==========================================================================
+// Helper function that will send a request and wait for the reply. The
+// segment is passed along with the request when it is new.
+//
+// Parameters:
+//  conn  - The connection
+//  reply - The reply to fill in
+//
+// Return:
+//  0 on success, -1 if the server could not be reached
+//==========================================================================
+int send_request(ClientConnection * conn, ServerReply * reply)
+{
+    union
+    {
+        struct cmsghdr header;
+        char data[CMSG_SPACE(sizeof(int))];
+    } control;
+    ServerRequest request;
+    struct iovec iov;
+    struct msghdr msg;
+
+    memset(&request, 0, sizeof(request));
+    request.magic = SERVER_MAGIC;
+    request.width = conn->image->width;
+    request.height = conn->image->height;
+    request.channels = conn->image->channels;
+    request.input_offset = 0;
+    request.output_offset = conn->image->size;
+    request.output_size = conn->segment_size - conn->image->size;
+
+    memset(&msg, 0, sizeof(msg));
+    iov.iov_base = &request;
+    iov.iov_len = sizeof(request);
+    msg.msg_iov = &iov;
+    msg.msg_iovlen = 1;
+
+    if (conn->send_fd)
+    {
+        memset(&control, 0, sizeof(control));
+        msg.msg_control = control.data;
+        msg.msg_controllen = sizeof(control.data);
+
+        struct cmsghdr * cmsg = CMSG_FIRSTHDR(&msg);
+        cmsg->cmsg_level = SOL_SOCKET;
+        cmsg->cmsg_type = SCM_RIGHTS;
+        cmsg->cmsg_len = CMSG_LEN(sizeof(int));
+        memcpy(CMSG_DATA(cmsg), &conn->segment_fd, sizeof(int));
+    }
+
+    if (sendmsg(conn->fd, &msg, MSG_NOSIGNAL) != sizeof(request))
+    {
+        return -1;
+    }
+    conn->send_fd = 0;
+
+    ssize_t length;
+    do
+    {
+        length = recv(conn->fd, reply, sizeof(ServerReply), 0);
+    } while ((length < 0) && (errno == EINTR));
+
+    return (length == sizeof(ServerReply)) ? 0 : -1;
+}
+
+//==========================================================================
+// The connection thread. It sends the requests one after another and logs
+// the latency of each one.
+//
+// Parameters:
+//  arg - The connection
+//==========================================================================
+void * client_thread(void * arg)
+{
+    ClientConnection * conn = (ClientConnection *)arg;
+    struct sockaddr_un addr;
+
+    memset(&addr, 0, sizeof(addr));
+    addr.sun_family = AF_UNIX;
+    strncpy(addr.sun_path, conn->socket_path, sizeof(addr.sun_path) - 1);
+
+    conn->fd = socket(AF_UNIX, SOCK_SEQPACKET | SOCK_CLOEXEC, 0);
+    if ((conn->fd < 0) || (connect(conn->fd, (struct sockaddr *)&addr, sizeof(addr)) != 0))
+    {
+        printf("Failed to Connect to %s\n", conn->socket_path);
+        conn->error = -1;
+        return NULL;
+    }
+
+    // Start With Room for a JPEG Larger Than the Pixels
+    if (create_segment(conn, conn->image->size + 64 * 1024) != 0)
+    {
+        conn->error = -1;
+        return NULL;
+    }
+
+    for (unsigned int i = 0; i < conn->requests; i++)
+    {
+        ServerReply reply;
+        double start = mjpeg_clock();
+
+        if (send_request(conn, &reply) != 0)
+        {
+            printf("Lost the Connection to the Server\n");
+            conn->error = -1;
+            break;
+        }
+
+        // Grow the Output Region and Try Again
+        if ((reply.status == SERVER_TOO_SMALL) &&
+            ((create_segment(conn, (size_t)reply.size) != 0) || (send_request(conn, &reply) != 0)))
+        {
+            conn->error = -1;
+            break;
+        }
+
+        if (reply.status != SERVER_OK)
+        {
+            printf("Request Failed: Status %u\n", reply.status);
+            conn->error = -1;
+            break;
+        }
+
+        log_latency(&conn->log, mjpeg_clock() - start);
+
+        // Keep the Last JPEG, After the Timing
+        if (i == conn->requests - 1)
+        {
+            conn->jpeg_size = (size_t)reply.size;
+            conn->jpeg = (unsigned char *)malloc(conn->jpeg_size);
+            if (conn->jpeg == NULL)
+            {
+                printf("Out of Memory\n");
+                exit(-1);
+            }
+            memcpy(conn->jpeg, &conn->segment[conn->image->size], conn->jpeg_size);
+        }
+    }
+
+    // Hand the Worker Back to the Other Connections
+    close(conn->fd);
+    conn->fd = -1;
+
+    return NULL;
+}
+
+//==========================================================================
+// This is the main entry point to the client. The image is encoded by the
+// server the requested number of times on each connection and the last
+// JPEG of the first connection is written to the output file.
+//==========================================================================
+int main(int argc, char * argv[])
+{
+    const char * args[3];
+    int arg_cnt = 0;
+    unsigned int requests = 1;
+    unsigned int connections = 1;
+    int bad_args = 0;
+    ClientImage image;
+    static ClientConnection conns[CLIENT_MAX_CONNECTIONS];
+
+    // Process Command Line Options
+    for (int i = 1; (i < argc) && !bad_args; i++)
+    {
+        if (argv[i][0] != '-')
+        {
+            if (arg_cnt < 3)
+                args[arg_cnt++] = argv[i];
+            else
+                bad_args = 1;
+        }
+        else if ((strcmp(argv[i], "-n") == 0) && (i + 1 < argc))
+        {
+            requests = atoi(argv[++i]);
+            bad_args = (requests < 1);
+        }
+        else if ((strcmp(argv[i], "-c") == 0) && (i + 1 < argc))
+        {
+            connections = atoi(argv[++i]);
+            bad_args = (connections < 1) || (connections > CLIENT_MAX_CONNECTIONS);
+        }
+        else
+        {
+            bad_args = 1;
+        }
+    }
+
+    if (bad_args || (arg_cnt != 3))
+    {
+        printf("Usage: %s [socket path] [pgm/ppm input file] [output file] [options]\n", argv[0]);
+        printf("Options:\n");
+        printf("   -n requests       - Number of requests on each connection (default 1)\n");
+        printf("   -c connections    - Number of connections at the same time (default 1)\n\n");
+        exit(-1);
+    }
+
+    if (load_image(args[1], &image) != 0)
+    {
+        exit(-1);
+    }
+
+    // Run the Connections at the Same Time
+    double start = mjpeg_clock();
+    for (unsigned int i = 0; i < connections; i++)
+    {
+        conns[i].socket_path = args[0];
+        conns[i].image = &image;
+        conns[i].requests = requests;
+        conns[i].fd = -1;
+        conns[i].segment_fd = -1;
+        if (pthread_create(&conns[i].thread, NULL, client_thread, &conns[i]) != 0)
+        {
+            printf("Failed to Start Connection %u\n", i);
+            exit(-1);
+        }
+    }
+
+    LatencyLog log = { NULL, 0, 0 };
+    int error = 0;
+    for (unsigned int i = 0; i < connections; i++)
+    {
+        pthread_join(conns[i].thread, NULL);
+        error |= conns[i].error;
+
+        for (unsigned long j = 0; j < conns[i].log.count; j++)
+        {
+            log_latency(&log, conns[i].log.samples[j]);
+        }
+    }
+    double elapsed = mjpeg_clock() - start;
+
+    print_latency(&log, "Requests", elapsed);
+    if (elapsed > 0.0)
+    {
+        printf("Throughput: %.1f MB/s of pixels\n", log.count * (double)image.size / elapsed / 1e6);
+    }
+
+    // Write the Last JPEG of the First Connection
+    if (conns[0].jpeg != NULL)
+    {
+        FILE * file = fopen(args[2], "wb");
+        if ((file == NULL) || (fwrite(conns[0].jpeg, 1, conns[0].jpeg_size, file) != conns[0].jpeg_size))
+        {
+            printf("Failed to Write %s\n", args[2]);
+            error = -1;
+        }
+        if (file != NULL)
+        {
+            fclose(file);
+        }
+    }
+
+    // Clean Up
+    for (unsigned int i = 0; i < connections; i++)
+    {
+        if (conns[i].segment != NULL)
+        {
+            munmap(conns[i].segment, conns[i].segment_size);
+            close(conns[i].segment_fd);
+        }
+        if (conns[i].fd >= 0)
+        {
+            close(conns[i].fd);
+        }
+        free(conns[i].jpeg);
+        free(conns[i].log.samples);
+    }
+    free(log.samples);
+    free(image.pixels);
+
+    return (error == 0) ? 0 : -1;
+}
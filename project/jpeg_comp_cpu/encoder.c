@@ -10,10 +10,18 @@
 #include "encoder.h"
 
 #include <stdlib.h>
+#include <string.h>
 #include <math.h>
 
+#if defined(__SSE2__) || defined(_M_X64)
+#include <emmintrin.h>
+#endif
+
 #include "tables.h"
 #include "jpeg_file.h"
+#include "kernels.h"
+#include "reader.h"
+#include "arith.h"
 
 //==========================================================================
 // Local Variables to hold the scaled quantization tables.
@@ -22,17 +30,68 @@ static unsigned char yqTable[8 * 8];
 static unsigned char cqTable[8 * 8];
 
 //==========================================================================
-// Provided a uniform scaling factor to the quantization table.
+// Local Variables to hold the flat block thresholds for the luminance and
+// chrominance tables. A block whose sum of absolute deviation is at or
+// below this value will have all of its AC coefficients quantized to zero.
+//==========================================================================
+static unsigned int y_flat_sad;
+static unsigned int c_flat_sad;
+
+//==========================================================================
+// Local Variables to hold the orientation. The coefficient at index i of
+// an oriented block is orient_sign[i] times coefficient orient_index[i]
+// of the source block, and the source block grid is orient_cols x
+// orient_rows blocks (or MCUs) once the flipped axes are trimmed.
+//==========================================================================
+static unsigned int orient_flags = ORIENT_NONE;
+static unsigned char orient_index[8 * 8];
+static float orient_sign[8 * 8];
+static unsigned int orient_cols;
+static unsigned int orient_rows;
+
+//==========================================================================
+// Local Variable to hold the entropy coder of the output streams
+//==========================================================================
+static unsigned int entropy_coder = ENTROPY_HUFFMAN;
+
+//==========================================================================
+// Helper function that will calculate the flat block threshold for a
+// quantization table. Every DCT basis function (as scaled by dct2d) has a
+// weight of at most 1 per pixel, and the AC terms ignore the block mean,
+// so an AC coefficient is bounded by the sum of absolute deviation (SAD)
+// of the block. quant_zigzag only produces a non zero value once the
+// coefficient reaches 3.5 times the table entry, so a SAD of no more than
+// 3 times the smallest AC entry leaves some margin for rounding.
 //
-// Parameter:
-//      quality - an integer from 1 to 100 that specifies the ammont of
-//                scaling to apply to the quantization table.
+// Parameters:
+//  qTable - A pointer to a 8x8 table of quaniztation values
 //
-//                100 = Highest Quality, Least Compression
-//                50  = Normal Quality
-//                1   = Least Quality, Highest Compression
+// Return:
+//  The largest SAD that is guaranteed to quantize all AC terms to zero
 //==========================================================================
-void init_qtable(unsigned int quality)
+unsigned int flat_threshold(const unsigned char * qTable)
+{
+    unsigned int qmin = 255;
+
+    for (int i = 1; i < 8 * 8; i++)
+    {
+        qmin = min(qmin, qTable[i]);
+    }
+
+    return 3 * qmin;
+}
+
+//==========================================================================
+// Scale the Annex K quantization tables by a quality factor without
+// changing the current tables, so several qualities can be worked on at
+// the same time.
+//
+// Parameters:
+//  quality - an integer from 1 to 100, see init_qtable
+//  yq      - A pointer to a 8x8 table to store the luminance table in
+//  cq      - A pointer to a 8x8 table to store the chrominance table in
+//==========================================================================
+void scale_qtables(unsigned int quality, unsigned char * yq, unsigned char * cq)
 {
     quality = max(1, min(100, quality));
 
@@ -45,14 +104,208 @@ void init_qtable(unsigned int quality)
     {
         unsigned int value = (unsigned int)((y_qTable[i] * quality + 50.0f) / 100.0f);
         value = max(1, min(255, value));
-        yqTable[i] = (unsigned char)value;
+        yq[i] = (unsigned char)value;
 
         value = (unsigned int)((cr_qTable[i] * quality + 50.0f) / 100.0f);
         value = max(1, min(255, value));
-        cqTable[i] = (unsigned char)value;
+        cq[i] = (unsigned char)value;
+    }
+}
+
+// Populates the IDCT basis used to measure the quality (see below)
+void init_idct_cos();
+
+//==========================================================================
+// Provided a uniform scaling factor to the quantization table.
+//
+// Parameter:
+//      quality - an integer from 1 to 100 that specifies the ammont of
+//                scaling to apply to the quantization table.
+//
+//                100 = Highest Quality, Least Compression
+//                50  = Normal Quality
+//                1   = Least Quality, Highest Compression
+//==========================================================================
+void init_qtable(unsigned int quality)
+{
+    scale_qtables(quality, yqTable, cqTable);
+
+    y_flat_sad = flat_threshold(yqTable);
+    c_flat_sad = flat_threshold(cqTable);
+
+    // The Huffman Tables, Kernels and IDCT Basis are Shared by Every Encode
+    init_huffman_tables();
+    get_kernels();
+    init_idct_cos();
+}
+
+//==========================================================================
+// Replace the quantization tables, such as with tables tuned for an image
+// (see tune_qtable). init_qtable must still be called first.
+//
+// Parameters:
+//  yq - The luminance table in the same order as the Annex K tables
+//  cq - The chrominance table in the same order as the Annex K tables
+//==========================================================================
+void set_qtable(const unsigned char * yq, const unsigned char * cq)
+{
+    memcpy(yqTable, yq, sizeof(yqTable));
+    memcpy(cqTable, cq, sizeof(cqTable));
+
+    y_flat_sad = flat_threshold(yqTable);
+    c_flat_sad = flat_threshold(cqTable);
+}
+
+//==========================================================================
+// Helper function that will convert an orientation name to its flags.
+//
+// Parameters:
+//  name - The orientation name (none, fliph, flipv, rot90, rot180, rot270,
+//         transpose or transverse), rotations are clockwise
+//
+// Return:
+//  The ORIENT_* flags or -1 if the name is not known
+//==========================================================================
+int orientation_id(const char * name)
+{
+    if (strcmp(name, "none") == 0)
+        return ORIENT_NONE;
+    if (strcmp(name, "fliph") == 0)
+        return ORIENT_FLIP_X;
+    if (strcmp(name, "flipv") == 0)
+        return ORIENT_FLIP_Y;
+    if (strcmp(name, "rot90") == 0)
+        return ORIENT_TRANSPOSE | ORIENT_FLIP_Y;
+    if (strcmp(name, "rot180") == 0)
+        return ORIENT_FLIP_X | ORIENT_FLIP_Y;
+    if (strcmp(name, "rot270") == 0)
+        return ORIENT_TRANSPOSE | ORIENT_FLIP_X;
+    if (strcmp(name, "transpose") == 0)
+        return ORIENT_TRANSPOSE;
+    if (strcmp(name, "transverse") == 0)
+        return ORIENT_TRANSPOSE | ORIENT_FLIP_X | ORIENT_FLIP_Y;
+
+    return -1;
+}
+
+//==========================================================================
+// Set the orientation of the encoded images. Flipping an axis of a block
+// negates the odd frequencies along it, and transposing the block
+// transposes its coefficients.
+//
+// Parameters:
+//  orientation - Any of the ORIENT_* flags
+//==========================================================================
+void set_orientation(unsigned int orientation)
+{
+    orient_flags = orientation;
+
+    for (unsigned int v = 0; v < 8; v++)
+    {
+        for (unsigned int u = 0; u < 8; u++)
+        {
+            // Source Frequencies (Horizontal, Vertical)
+            unsigned int su = (orient_flags & ORIENT_TRANSPOSE) ? v : u;
+            unsigned int sv = (orient_flags & ORIENT_TRANSPOSE) ? u : v;
+            unsigned int odd = 0;
+
+            if (orient_flags & ORIENT_FLIP_X)
+                odd += su;
+            if (orient_flags & ORIENT_FLIP_Y)
+                odd += sv;
+
+            orient_index[v * 8 + u] = (unsigned char)(sv * 8 + su);
+            orient_sign[v * 8 + u] = (odd % 2) ? -1.0f : 1.0f;
+        }
     }
 }
 
+//==========================================================================
+// Work out the size of an image once it is oriented and set up the source
+// block grid for it.
+//
+// Parameters:
+//  width    - A pointer to the image width, it is replaced by the output
+//             width
+//  height   - A pointer to the image height, it is replaced by the output
+//             height
+//  channels - The number of channels in the image
+//
+// Return:
+//  0 on success, -1 if the trimmed image would be empty
+//==========================================================================
+int orient_image(unsigned int * width, unsigned int * height, unsigned int channels)
+{
+    unsigned int mcu = (channels == 1) ? 8 : 16;
+    unsigned int src_width = *width;
+    unsigned int src_height = *height;
+
+    // Trim the Partial MCU From the Flipped Axes
+    if (orient_flags & ORIENT_FLIP_X)
+        src_width = (src_width / mcu) * mcu;
+    if (orient_flags & ORIENT_FLIP_Y)
+        src_height = (src_height / mcu) * mcu;
+
+    if ((src_width == 0) || (src_height == 0))
+    {
+        printf("Image is Smaller Than an MCU Along a Flipped Axis\n");
+        return -1;
+    }
+
+    orient_cols = (src_width + mcu - 1) / mcu;
+    orient_rows = (src_height + mcu - 1) / mcu;
+
+    *width = (orient_flags & ORIENT_TRANSPOSE) ? src_height : src_width;
+    *height = (orient_flags & ORIENT_TRANSPOSE) ? src_width : src_height;
+    return 0;
+}
+
+//==========================================================================
+// Set the entropy coder of the output streams.
+//
+// Parameters:
+//  coder - One of the ENTROPY_* values
+//==========================================================================
+void set_entropy_coder(unsigned int coder)
+{
+    entropy_coder = coder;
+}
+
+//==========================================================================
+// Helper function for fetching the entropy coder of the output streams.
+//
+// Return:
+//  One of the ENTROPY_* values
+//==========================================================================
+unsigned int get_entropy_coder()
+{
+    return entropy_coder;
+}
+
+//==========================================================================
+// Helper function that will find the source block (or MCU) of a block of
+// the oriented image.
+//
+// Parameters:
+//  x    - The column of the block in the oriented image
+//  y    - The row of the block in the oriented image
+//  cols - The number of columns in the source grid
+//  rows - The number of rows in the source grid
+//  sx   - A pointer to store the source column in
+//  sy   - A pointer to store the source row in
+//==========================================================================
+static inline void orient_block(unsigned int x, unsigned int y, unsigned int cols, unsigned int rows,
+                                unsigned int * sx, unsigned int * sy)
+{
+    *sx = (orient_flags & ORIENT_TRANSPOSE) ? y : x;
+    *sy = (orient_flags & ORIENT_TRANSPOSE) ? x : y;
+
+    if (orient_flags & ORIENT_FLIP_X)
+        *sx = cols - 1 - *sx;
+    if (orient_flags & ORIENT_FLIP_Y)
+        *sy = rows - 1 - *sy;
+}
+
 //==========================================================================
 // Helper function for fetching the currect luminance quantization table.
 //
@@ -87,22 +340,24 @@ const unsigned char * get_read_pattern()
 }
 
 //==========================================================================
-// Local Variables to hold the luminance DC & AC Huffman Codes
-//==========================================================================
-static HuffInfo y_dc_table[12];
-static HuffInfo y_ac_table[256];
-
-//==========================================================================
-// Local Variables to hold the chrominance DC & AC Huffman Codes
+// Local Variables to hold the luminance & chrominance DC & AC Huffman Codes
 //==========================================================================
-static HuffInfo c_dc_table[12];
-static HuffInfo c_ac_table[256];
+#ifdef CONSTEXPR_TABLES
+static constexpr HuffTable y_dc_table = make_huffman_table(y_dc_codes_per_len, y_dc_values);
+static constexpr HuffTable y_ac_table = make_huffman_table(y_ac_codes_per_len, y_ac_values);
+static constexpr HuffTable c_dc_table = make_huffman_table(c_dc_codes_per_len, c_dc_values);
+static constexpr HuffTable c_ac_table = make_huffman_table(c_ac_codes_per_len, c_ac_values);
+#else
+static HuffTable y_dc_table;
+static HuffTable y_ac_table;
+static HuffTable c_dc_table;
+static HuffTable c_ac_table;
 
 //==========================================================================
 // Helper function that will take the huffman table specifcation and
 // populate the huffman table.
 //==========================================================================
-void load_huffman_table(const unsigned char * codes_per_len, const unsigned char * values, HuffInfo * table)
+void load_huffman_table(const unsigned char * codes_per_len, const unsigned char * values, HuffTable * table)
 {
     unsigned short code = 0;
     unsigned int pos = 0;
@@ -111,14 +366,57 @@ void load_huffman_table(const unsigned char * codes_per_len, const unsigned char
     {
         for (int j = 0; j < codes_per_len[i]; j++)
         {
-            table[values[pos]].length = i + 1;
-            table[values[pos]].value = code;
+            table->code[values[pos]].length = i + 1;
+            table->code[values[pos]].value = code;
             pos++;
             code++;
         }
         code <<= 1;
     }
 }
+#endif
+
+//==========================================================================
+// Generate the Huffman code tables. The tables only depend on the Annex K
+// specification so they are generated once (or at compile time for C++
+// builds). This is called by init_qtable, so the tables are ready before
+// any images are compressed on other threads.
+//==========================================================================
+void init_huffman_tables()
+{
+#ifndef CONSTEXPR_TABLES
+    static int loaded = 0;
+
+    if (loaded == 0)
+    {
+        load_huffman_table(y_dc_codes_per_len, y_dc_values, &y_dc_table);
+        load_huffman_table(y_ac_codes_per_len, y_ac_values, &y_ac_table);
+        load_huffman_table(c_dc_codes_per_len, c_dc_values, &c_dc_table);
+        load_huffman_table(c_ac_codes_per_len, c_ac_values, &c_ac_table);
+        loaded = 1;
+    }
+#endif
+}
+
+//==========================================================================
+// Helper function for fetching the Huffman code tables
+//
+// Parameters:
+//  isDC    - Flag for we are requesting the DC codes
+//  channel - The codes for this specified channel
+//
+// Return:
+//  Huffman code table
+//==========================================================================
+const HuffTable * get_huffman_table(unsigned char isDC, unsigned int channel)
+{
+    if (isDC == 1)
+    {
+        return (channel == 0) ? &y_dc_table : &c_dc_table;
+    }
+
+    return (channel == 0) ? &y_ac_table : &c_ac_table;
+}
 
 //==========================================================================
 // Helper function for fetching the Huffman code length array
@@ -379,6 +677,20 @@ void zero_shift(unsigned char * input, float * output)
     }
 }
 
+//==========================================================================
+// This function zero shifts and performs the 2D-DCT on an 8x8 block. It is
+// the scalar reference for the fdct kernel.
+//
+// Parameters:
+//  block  - A pointer to a 8x8 pixels
+//  output - A pointer to the 8x8 DCT coefficients
+//==========================================================================
+void fdct(const unsigned char * block, float * output)
+{
+    zero_shift((unsigned char *)block, output);
+    dct2d(output);
+}
+
 //==========================================================================
 // This functio performs the quantization and readout re-ordering. It also
 // divides by 4 to take out the 2x scaling in the 1D-DCT. This function will
@@ -389,7 +701,7 @@ void zero_shift(unsigned char * input, float * output)
 //  qTable - A pointer to a 8x8 table of quaniztation values
 //  output - A pointer to a 8x8 pixels
 //==========================================================================
-void quant_zigzag(float * input, const unsigned char * qTable, short * output)
+void quant_zigzag(const float * input, const unsigned char * qTable, short * output)
 {
     for (int i = 0; i < 8 * 8; i++)
     {
@@ -438,7 +750,7 @@ int num_bits(int value)
 //            updated with the current DC component value after the DPCM
 //            was caluclated.
 //==========================================================================
-void zero_rle(short * input, RLEInfo * output, unsigned int * length, short * prev_dc)
+void zero_rle(const short * input, RLEInfo * output, unsigned int * length, short * prev_dc)
 {
     // Get Diff (DCPM)
     int diff = input[0] - *prev_dc;
@@ -476,7 +788,7 @@ void zero_rle(short * input, RLEInfo * output, unsigned int * length, short * pr
                 output[idx].num_bits = 0;
                 output[idx].value = 0;
                 idx++;
-                zero_cnt -= 15;
+                zero_cnt -= 16;
             }
 
             output[idx].zero_cnt = zero_cnt;
@@ -487,11 +799,14 @@ void zero_rle(short * input, RLEInfo * output, unsigned int * length, short * pr
         }
     }
 
-    // Add EOF
-    idx++;
-    output[idx].zero_cnt = 0;
-    output[idx].num_bits = 0;
-    output[idx].value = 0;
+    // Add EOB, Unless the Last Term is Non Zero
+    if (input[63] == 0)
+    {
+        idx++;
+        output[idx].zero_cnt = 0;
+        output[idx].num_bits = 0;
+        output[idx].value = 0;
+    }
 
     // Return RLE Length
     *length = idx + 1;
@@ -505,9 +820,9 @@ void zero_rle(short * input, RLEInfo * output, unsigned int * length, short * pr
 //  rle        - a pointer to the input buffer of run-length ecoded data
 //  rle_length - the size of the rle data
 //  table      - Huffman Code Table
-//  fid        - output file id
+//  stream     - The output stream
 //==========================================================================
-void encode(RLEInfo * rle, unsigned int rle_length, const HuffInfo * table, FILE * fid)
+void encode(const RLEInfo * rle, unsigned int rle_length, const HuffTable * table, OutStream * stream)
 {
     EncodeInfo item;
 
@@ -528,108 +843,1446 @@ void encode(RLEInfo * rle, unsigned int rle_length, const HuffInfo * table, FILE
         int code_idx = (rle[i].zero_cnt << 4) + num_bits;
 
         // Code
-        item.value = table[code_idx].value;
+        item.value = table->code[code_idx].value;
 
         // Length
-        item.length = table[code_idx].length;
+        item.length = table->code[code_idx].length;
 
         // Write
-        write_stream(fid, &item);
+        write_stream(stream, &item);
     }
 }
 
 //==========================================================================
-// Compress an 8x8 Block
+// Count the bytes the Huffman encoding of the run length encoding would
+// write, see encode. Nothing is written, the bytes are only checked for
+// 0xFF so the stuffed 0x00 bytes are counted as well.
 //
 // Parameters:
-//  block   - A pointer to a 8x8 pixels layed out linearly
-//            8x8 Memory Layout
-//               00 = Pixel @ Row 0, Column 0
-//               [ 00, 01, ..., 07, 10, 11, ..., 77]
-//  prev_dc - A pointer to the location of the prev dc value
-//  fid     - The output file id
+//  rle        - a pointer to the input buffer of run-length ecoded data
+//  rle_length - the size of the rle data
+//  table      - Huffman Code Table
+//  counter    - The bit counter
 //==========================================================================
-void compress_8x8(unsigned char * block, const unsigned char * qTable, const HuffInfo * dc_table, const HuffInfo * ac_table, short * prev_dc, FILE * fid)
+void count_bits(const RLEInfo * rle, unsigned int rle_length, const HuffTable * table, BitCounter * counter)
 {
-    float input[8 * 8];
-    short zz[8 * 8];
-    RLEInfo rle[256];
-    unsigned int rle_length;
+    unsigned int bit_cnt = counter->bit_cnt;
+    unsigned long long bits = counter->bits;
+    size_t bytes = counter->bytes;
 
-    // Zero-Shift
-    zero_shift(block, input);
-
-    // Calculate 2D DCT
-    dct2d(input);
+    for (unsigned int i = 0; i < rle_length; i++)
+    {
+        unsigned int num_bits = rle[i].num_bits;
+        int additional = rle[i].value;
+        if (additional < 0)
+        {
+            additional += (1 << num_bits) - 1;
+        }
 
-    // Quantization 
-    quant_zigzag(input, qTable, zz);
+        // Code Followed by the Additional Bits
+        const HuffInfo * info = &table->code[(rle[i].zero_cnt << 4) + num_bits];
+        unsigned int length = info->length;
+        unsigned int code = ((info->value & ((1u << length) - 1)) << num_bits) |
+                            ((unsigned int)additional & ((1u << num_bits) - 1));
 
-    // Zero Run-Length Encode
-    zero_rle(zz, rle, &rle_length, prev_dc);
+        bits = (bits << (length + num_bits)) | code;
+        bit_cnt += length + num_bits;
 
-    // DC Huffman Encoding
-    encode(rle, 1, dc_table, fid);
+        // Count the Full Bytes, 0xFF is Followed by a Stuffed 0x00
+        while (bit_cnt >= 8)
+        {
+            bit_cnt -= 8;
+            bytes += (((bits >> bit_cnt) & 0xFF) == 0xFF) ? 2 : 1;
+        }
+        bits &= (1ull << bit_cnt) - 1;
+    }
 
-    // AC Huffman Encoding
-    encode(&rle[1], rle_length - 1, ac_table, fid);
+    counter->bits = bits;
+    counter->bit_cnt = bit_cnt;
+    counter->bytes = bytes;
 }
 
 //==========================================================================
-// Compress a full image
+// Helper function that will Huffman encode the AC terms of a block into
+// its cache entry. The bits are packed the same way as the output stream
+// but without the stuffed bytes, since the bits before them in the stream
+// can be different the next time they are used.
 //
 // Parameters:
-//  channels - The number of channels in the image
-//  info     - A pointer to an array that stores the channel information
-//  fid      - The output file id
+//  rle        - a pointer to the AC terms of the run length encoding
+//  rle_length - the number of AC terms in the rle data
+//  table      - Huffman Code Table
+//  cached     - The cache entry to store the bits in
 //==========================================================================
-void compress_img(unsigned int channels, ChannelInfo * info, FILE * fid)
+static inline void pack_ac_bits(const RLEInfo * rle, unsigned int rle_length, const HuffTable * table, CachedBlock * cached)
 {
-    // Load Huffman Tables
-    load_huffman_table(y_dc_codes_per_len, y_dc_values, y_dc_table);
-    load_huffman_table(y_ac_codes_per_len, y_ac_values, y_ac_table);
+    unsigned int bit_cnt = 0;
+    unsigned long long bits = 0;
+    unsigned int bytes = 0;
 
-    if (channels > 1)
+    for (unsigned int i = 0; i < rle_length; i++)
     {
-        load_huffman_table(c_dc_codes_per_len, c_dc_values, c_dc_table);
-        load_huffman_table(c_ac_codes_per_len, c_ac_values, c_ac_table);
-    }
+        unsigned int num_bits = rle[i].num_bits;
+        int additional = rle[i].value;
+        if (additional < 0)
+        {
+            additional += (1 << num_bits) - 1;
+        }
 
-    // Calcualte number x blocks
-    unsigned int xblocks = info[0].width / 8;
-    unsigned int yblocks = info[0].height / 8;
+        // Code Followed by the Additional Bits
+        const HuffInfo * info = &table->code[(rle[i].zero_cnt << 4) + num_bits];
+        unsigned int length = info->length;
+        unsigned int code = ((info->value & ((1u << length) - 1)) << num_bits) |
+                            ((unsigned int)additional & ((1u << num_bits) - 1));
 
-    // Previous DC Values
-    short y_prev_dc = 0;
-    short cb_prev_dc = 0;
-    short cr_prev_dc = 0;
-    
-    // Process Blocks
-    if (channels == 1)
-    {
-        for (unsigned i = 0; i < xblocks * yblocks; i++)
+        bits = (bits << (length + num_bits)) | code;
+        bit_cnt += length + num_bits;
+
+        while (bit_cnt >= 8)
         {
-            compress_8x8(&info[0].data[i * 64], yqTable, y_dc_table, y_ac_table, &y_prev_dc, fid);
+            bit_cnt -= 8;
+            cached->ac[bytes++] = (unsigned char)(bits >> bit_cnt);
         }
+        bits &= (1ull << bit_cnt) - 1;
     }
-    else
+
+    // Last Partial Byte, Left Aligned
+    if (bit_cnt > 0)
     {
-        for (unsigned int row = 0; row < yblocks; row += 2)
-        {
-            for (unsigned int col = 0; col < xblocks; col += 2)
-            {
-                // Process 4 Luminance Blocks
-                compress_8x8(&info[0].data[row       * xblocks       * 64 + col       * 64], yqTable, y_dc_table, y_ac_table, &y_prev_dc, fid);
-                compress_8x8(&info[0].data[row       * xblocks       * 64 + (col + 1) * 64], yqTable, y_dc_table, y_ac_table, &y_prev_dc, fid);
-                compress_8x8(&info[0].data[(row + 1) * xblocks       * 64 + col       * 64], yqTable, y_dc_table, y_ac_table, &y_prev_dc, fid);
-                compress_8x8(&info[0].data[(row + 1) * xblocks       * 64 + (col + 1) * 64], yqTable, y_dc_table, y_ac_table, &y_prev_dc, fid);
+        cached->ac[bytes] = (unsigned char)(bits << (8 - bit_cnt));
+    }
+    cached->ac_bits = (unsigned short)(bytes * 8 + bit_cnt);
+}
+
+//==========================================================================
+// Helper function that will write the coded AC terms of a cache entry to
+// the stream, after the bits that are already in the stream.
+//
+// Parameters:
+//  stream - The output stream
+//  cached - The cache entry
+//==========================================================================
+static inline void write_cached_bits(OutStream * stream, const CachedBlock * cached)
+{
+    unsigned int bit_cnt = stream->current_bit_cnt;
+    unsigned int bits = stream->current_byte >> (8 - bit_cnt);
+    unsigned int bytes = (cached->ac_bits + 7) / 8;
 
-                // Process 1 Cb Block
-                compress_8x8(&info[1].data[(row / 2) * (xblocks / 2) * 64 + (col / 2) * 64], cqTable, c_dc_table, c_ac_table, &cb_prev_dc, fid);
+    // A Byte at a Time, 0xFF is Followed by a Stuffed 0x00
+    for (unsigned int i = 0; i < bytes; i++)
+    {
+        unsigned int length = min(8, cached->ac_bits - i * 8);
+
+        bits = (bits << length) | (cached->ac[i] >> (8 - length));
+        bit_cnt += length;
 
-                // Process 1 Cr Block
-                compress_8x8(&info[2].data[(row / 2) * (xblocks / 2) * 64 + (col / 2) * 64], cqTable, c_dc_table, c_ac_table, &cr_prev_dc, fid);
+        if (bit_cnt >= 8)
+        {
+            bit_cnt -= 8;
+            unsigned char value = (unsigned char)(bits >> bit_cnt);
+            stream_put(stream, value);
+            if (value == 0xFF)
+            {
+                stream_put(stream, 0);
             }
+            bits &= (1u << bit_cnt) - 1;
         }
     }
+
+    stream->current_byte = (unsigned char)(bits << (8 - bit_cnt));
+    stream->current_bit_cnt = (unsigned char)bit_cnt;
+}
+
+//==========================================================================
+// This function checks if a block is flat enough that all of its AC
+// coefficients will quantize to zero. The block mean is rounded to an
+// integer and the sum of absolute deviation against it is compared to the
+// threshold from flat_threshold.
+//
+// Parameters:
+//  block     - A pointer to a 8x8 pixels
+//  threshold - The flat block threshold for the quantization table
+//
+// Return:
+//  1 if the block is flat, otherwise 0
+//==========================================================================
+int is_flat_block(const unsigned char * block, unsigned int threshold)
+{
+    unsigned int sum = 0;
+    unsigned int sad = 0;
+
+#if defined(__SSE2__) || defined(_M_X64)
+    __m128i zero = _mm_setzero_si128();
+    __m128i r0 = _mm_loadu_si128((const __m128i *)&block[0]);
+    __m128i r1 = _mm_loadu_si128((const __m128i *)&block[16]);
+    __m128i r2 = _mm_loadu_si128((const __m128i *)&block[32]);
+    __m128i r3 = _mm_loadu_si128((const __m128i *)&block[48]);
+
+    // Sum of the Pixels
+    __m128i acc = _mm_add_epi64(_mm_add_epi64(_mm_sad_epu8(r0, zero), _mm_sad_epu8(r1, zero)),
+                                _mm_add_epi64(_mm_sad_epu8(r2, zero), _mm_sad_epu8(r3, zero)));
+    sum = (unsigned int)(_mm_cvtsi128_si32(acc) + _mm_cvtsi128_si32(_mm_srli_si128(acc, 8)));
+
+    // Sum of Absolute Deviation Against the Rounded Mean
+    __m128i mean = _mm_set1_epi8((char)((sum + 32) >> 6));
+    acc = _mm_add_epi64(_mm_add_epi64(_mm_sad_epu8(r0, mean), _mm_sad_epu8(r1, mean)),
+                        _mm_add_epi64(_mm_sad_epu8(r2, mean), _mm_sad_epu8(r3, mean)));
+    sad = (unsigned int)(_mm_cvtsi128_si32(acc) + _mm_cvtsi128_si32(_mm_srli_si128(acc, 8)));
+#else
+    for (int i = 0; i < 8 * 8; i++)
+    {
+        sum += block[i];
+    }
+
+    int mean = (int)((sum + 32) >> 6);
+    for (int i = 0; i < 8 * 8; i++)
+    {
+        sad += abs(block[i] - mean);
+    }
+#endif
+
+    return sad <= threshold;
+}
+
+//==========================================================================
+// This function calculates only the DC term of the 2D-DCT. It performs the
+// same operations in the same order as rdct1d & cdct1d do for the first
+// output so the result matches dct2d exactly.
+//
+// Parameters:
+//  block - A pointer to a 8x8 pixels
+//
+// Return:
+//  The DC coefficient (scaled the same as dct2d)
+//==========================================================================
+float dct_dc(const unsigned char * block)
+{
+    float row[8];
+
+    // Row DC Terms
+    for (unsigned int i = 0; i < 8; i++)
+    {
+        const unsigned char * p = &block[8 * i];
+        float s07 = ((float)p[0] - 128.0f) + ((float)p[7] - 128.0f);
+        float s12 = ((float)p[1] - 128.0f) + ((float)p[2] - 128.0f);
+        float s34 = ((float)p[3] - 128.0f) + ((float)p[4] - 128.0f);
+        float s56 = ((float)p[5] - 128.0f) + ((float)p[6] - 128.0f);
+        row[i] = C(4) * ((s07 + s34) + (s12 + s56));
+    }
+
+    // Column DC Term
+    float s07 = row[0] + row[7];
+    float s12 = row[1] + row[2];
+    float s34 = row[3] + row[4];
+    float s56 = row[5] + row[6];
+    return C(4) * ((s07 + s34) + (s12 + s56));
+}
+
+//==========================================================================
+// Local Variable to hold the 8-point IDCT basis, indexed by [frequency]
+// [output position] and including the C(u) / 2 factor.
+//==========================================================================
+static float idct_cos[8][8];
+
+//==========================================================================
+// Helper function that will populate the 8-point IDCT basis.
+//==========================================================================
+void init_idct_cos()
+{
+    for (unsigned int x = 0; x < 8; x++)
+    {
+        for (unsigned int u = 0; u < 8; u++)
+        {
+            float cu = (u == 0) ? (1.0f / sqrtf(2.0f)) : 1.0f;
+            idct_cos[u][x] = 0.5f * cu * cosf((2 * x + 1) * u * 3.14159265f / 16.0f);
+        }
+    }
+}
+
+//==========================================================================
+// Start measuring the reconstruction quality of an image.
+//
+// Parameters:
+//  quality  - The quality stats to initialize
+//  width    - The image width (before any orientation)
+//  height   - The image height (before any orientation)
+//  channels - The number of channels in the image
+//  ssim     - If not 0 the SSIM of each 8x8 block is measured as well
+//==========================================================================
+void init_quality_stats(QualityStats * quality, unsigned int width, unsigned int height,
+                        unsigned int channels, int ssim)
+{
+    memset(quality, 0, sizeof(QualityStats));
+    quality->ssim = ssim;
+    quality->channels = channels;
+
+    for (unsigned int i = 0; i < channels; i++)
+    {
+        quality->channel[i].width = (i == 0) ? width : (width + 1) / 2;
+        quality->channel[i].height = (i == 0) ? height : (height + 1) / 2;
+    }
+}
+
+//==========================================================================
+// Get the PSNR from the quality stats.
+//
+// Parameters:
+//  quality - The quality stats of the image
+//  channel - The channel or -1 for all of the channels together
+//
+// Return:
+//  The PSNR in dB
+//==========================================================================
+double quality_psnr(const QualityStats * quality, int channel)
+{
+    double sse = 0.0;
+    double samples = 0.0;
+
+    for (unsigned int i = 0; i < quality->channels; i++)
+    {
+        if ((channel < 0) || (channel == (int)i))
+        {
+            sse += quality->channel[i].sse;
+            samples += quality->channel[i].samples;
+        }
+    }
+
+    if (sse == 0.0)
+    {
+        return 99.0;
+    }
+
+    return 10.0 * log10(samples * 255.0 * 255.0 / sse);
+}
+
+//==========================================================================
+// Get the mean SSIM of the 8x8 blocks from the quality stats.
+//
+// Parameters:
+//  quality - The quality stats of the image
+//  channel - The channel or -1 for all of the channels together
+//
+// Return:
+//  The mean SSIM
+//==========================================================================
+double quality_ssim(const QualityStats * quality, int channel)
+{
+    double ssim = 0.0;
+    double blocks = 0.0;
+
+    for (unsigned int i = 0; i < quality->channels; i++)
+    {
+        if ((channel < 0) || (channel == (int)i))
+        {
+            ssim += quality->channel[i].ssim;
+            blocks += quality->channel[i].blocks;
+        }
+    }
+
+    return (blocks > 0.0) ? ssim / blocks : 0.0;
+}
+
+//==========================================================================
+// Reconstruct a block the way a decoder would and add its error to the
+// quality stats. The quantized coefficients are taken back out of the run
+// length encoding, so this works for the flat blocks as well, and the
+// orientation is undone so the block lines up with the source pixels.
+//
+// Parameters:
+//  block   - A pointer to the 8x8 source pixels
+//  qTable  - The quantization table the block was encoded with
+//  rle     - The run length encoding of the block
+//  dc      - The quantized DC term of the block
+//  cols    - The number of columns of the block inside the image
+//  rows    - The number of rows of the block inside the image
+//  ssim    - If not 0 the SSIM of the block is measured as well
+//  quality - The quality stats of the channel
+//==========================================================================
+void measure_block(const unsigned char * block, const unsigned char * qTable, const RLEInfo * rle, short dc,
+                   unsigned int cols, unsigned int rows, int ssim, ChannelQuality * quality)
+{
+    short zz[8 * 8];
+    float coeffs[8 * 8];
+    float tmp[8 * 8];
+    unsigned char recon[8 * 8];
+
+    // Undo the Run Length Encoding
+    memset(zz, 0, sizeof(zz));
+    zz[0] = dc;
+    for (unsigned int i = 1, pos = 1; pos < 64; i++)
+    {
+        if ((rle[i].zero_cnt == 0) && (rle[i].num_bits == 0))
+        {
+            break;
+        }
+
+        pos += rle[i].zero_cnt;
+        if (rle[i].num_bits != 0)
+        {
+            zz[pos] = rle[i].value;
+        }
+        pos++;
+    }
+
+    // Dequantize & Undo the Orientation
+    for (unsigned int i = 0; i < 8 * 8; i++)
+    {
+        float value = (float)(zz[output_pattern[i]] * qTable[i]);
+
+        if (orient_flags != ORIENT_NONE)
+            coeffs[orient_index[i]] = orient_sign[i] * value;
+        else
+            coeffs[i] = value;
+    }
+
+    // Row IDCT, Only the Non Zero Coefficients are Added In
+    unsigned char used_rows[8];
+    memset(tmp, 0, sizeof(tmp));
+    for (unsigned int v = 0; v < 8; v++)
+    {
+        used_rows[v] = 0;
+        for (unsigned int u = 0; u < 8; u++)
+        {
+            float value = coeffs[v * 8 + u];
+            if (value != 0.0f)
+            {
+                for (unsigned int x = 0; x < 8; x++)
+                {
+                    tmp[v * 8 + x] += value * idct_cos[u][x];
+                }
+                used_rows[v] = 1;
+            }
+        }
+    }
+
+    // Column IDCT & Level Shift
+    float pixels[8 * 8];
+    for (unsigned int y = 0; y < 8; y++)
+    {
+        for (unsigned int x = 0; x < 8; x++)
+        {
+            pixels[y * 8 + x] = 128.0f;
+        }
+
+        for (unsigned int v = 0; v < 8; v++)
+        {
+            if (used_rows[v])
+            {
+                float basis = idct_cos[v][y];
+                for (unsigned int x = 0; x < 8; x++)
+                {
+                    pixels[y * 8 + x] += basis * tmp[v * 8 + x];
+                }
+            }
+        }
+    }
+
+    for (unsigned int y = 0; y < rows; y++)
+    {
+        for (unsigned int x = 0; x < cols; x++)
+        {
+            float value = roundf(pixels[y * 8 + x]);
+            recon[y * 8 + x] = (unsigned char)max(0.0f, min(255.0f, value));
+        }
+    }
+
+    // Squared Error
+    unsigned int sse = 0;
+    for (unsigned int y = 0; y < rows; y++)
+    {
+        for (unsigned int x = 0; x < cols; x++)
+        {
+            int diff = (int)block[y * 8 + x] - (int)recon[y * 8 + x];
+            sse += diff * diff;
+        }
+    }
+    quality->sse += sse;
+    quality->samples += cols * rows;
+
+    // SSIM of the Block (C1 = (0.01 * 255)^2, C2 = (0.03 * 255)^2)
+    if (ssim)
+    {
+        unsigned int sa = 0, sb = 0, saa = 0, sbb = 0, sab = 0;
+        for (unsigned int y = 0; y < rows; y++)
+        {
+            for (unsigned int x = 0; x < cols; x++)
+            {
+                unsigned int a = block[y * 8 + x];
+                unsigned int b = recon[y * 8 + x];
+                sa += a;
+                sb += b;
+                saa += a * a;
+                sbb += b * b;
+                sab += a * b;
+            }
+        }
+
+        double n = cols * rows;
+        double ma = sa / n;
+        double mb = sb / n;
+        double va = saa / n - ma * ma;
+        double vb = sbb / n - mb * mb;
+        double cov = sab / n - ma * mb;
+        double c1 = 6.5025;
+        double c2 = 58.5225;
+        quality->ssim += ((2.0 * ma * mb + c1) * (2.0 * cov + c2)) / ((ma * ma + mb * mb + c1) * (va + vb + c2));
+        quality->blocks++;
+    }
+}
+
+//==========================================================================
+// Helper function that will measure a block if it has any samples inside
+// the image.
+//
+// Parameters:
+//  block   - A pointer to the 8x8 source pixels
+//  qTable  - The quantization table the block was encoded with
+//  rle     - The run length encoding of the block
+//  dc      - The quantized DC term of the block
+//  x       - The column of the block in the source plane
+//  y       - The row of the block in the source plane
+//  quality - The quality stats of the image
+//  channel - The channel of the block
+//==========================================================================
+void measure_source_block(const unsigned char * block, const unsigned char * qTable, const RLEInfo * rle, short dc,
+                          unsigned int x, unsigned int y, QualityStats * quality, unsigned int channel)
+{
+    ChannelQuality * plane = &quality->channel[channel];
+
+    if ((x * 8 < plane->width) && (y * 8 < plane->height))
+    {
+        measure_block(block, qTable, rle, dc, min(8, plane->width - x * 8), min(8, plane->height - y * 8),
+                      quality->ssim, plane);
+    }
+}
+
+//==========================================================================
+// Structure to hold the per-block scratch memory. It is allocated once per
+// encode from the arena so that it is cache line aligned and reused for
+// every block.
+//==========================================================================
+typedef struct
+{
+    float input[8 * 8];
+    short zz[8 * 8];
+    RLEInfo rle[256];
+    float coeffs[8 * 8];
+} BlockScratch;
+
+//==========================================================================
+// Helper function that will run length encode a flat block, which is
+// just the DC term followed by an end of block.
+//
+// Parameters:
+//  dc      - The DC term of the block (see dct_dc)
+//  qTable  - A pointer to a 8x8 table of quaniztation values
+//  prev_dc - A pointer to the location of the prev dc value
+//  rle     - The array to store the run length encoding in
+//
+// Return:
+//  The length of the run length encoding
+//==========================================================================
+static inline unsigned int flat_rle(float dc, const unsigned char * qTable, short * prev_dc, RLEInfo * rle)
+{
+    // Quantize DC (Same as quant_zigzag)
+    short value = ((short)roundf(dc / (float)qTable[0])) / 4;
+    int diff = value - *prev_dc;
+    *prev_dc = value;
+
+    // DC Followed By EOB
+    rle[0].zero_cnt = 0;
+    rle[0].num_bits = num_bits(diff);
+    rle[0].value = diff;
+    rle[1].zero_cnt = 0;
+    rle[1].num_bits = 0;
+    rle[1].value = 0;
+
+    return 2;
+}
+
+//==========================================================================
+// Compress an 8x8 Block
+//
+// Parameters:
+//  block   - A pointer to a 8x8 pixels layed out linearly
+//            8x8 Memory Layout
+//               00 = Pixel @ Row 0, Column 0
+//               [ 00, 01, ..., 07, 10, 11, ..., 77]
+//  flat_sad - The flat block threshold for the quantization table
+//  prev_dc - A pointer to the location of the prev dc value
+//  scratch - The scratch memory for the block
+//  coeffs  - If not NULL the DCT coefficients are copied here
+//  kernels - The kernel function table
+//  counter - If not NULL the bits are counted instead of written
+//  cache   - If not NULL the block is looked up in and added to the cache
+//  idx     - The index of the block in the cache
+//  stream  - The output stream
+//==========================================================================
+static inline void compress_8x8(unsigned char * block, const unsigned char * qTable, const HuffTable * dc_table, const HuffTable * ac_table, unsigned int flat_sad, short * prev_dc, BlockScratch * scratch, float * coeffs, const Kernels * kernels, BitCounter * counter, BlockCache * cache, size_t idx, OutStream * stream)
+{
+    float * input = scratch->input;
+    short * zz = scratch->zz;
+    RLEInfo * rle = scratch->rle;
+    unsigned int rle_length;
+
+    // Unchanged Since the Last Frame, Only the DC Difference is New
+    if ((cache != NULL) && cache->blocks[idx].valid && (memcmp(cache->blocks[idx].pixels, block, 8 * 8) == 0))
+    {
+        CachedBlock * cached = &cache->blocks[idx];
+        int diff = cached->dc - *prev_dc;
+        *prev_dc = cached->dc;
+
+        rle[0].zero_cnt = 0;
+        rle[0].num_bits = num_bits(diff);
+        rle[0].value = diff;
+        kernels->encode(rle, 1, dc_table, stream);
+        write_cached_bits(stream, cached);
+
+        cache->hits++;
+        return;
+    }
+
+    // Flat Block, Only DC Term is Needed
+    if (is_flat_block(block, flat_sad))
+    {
+        float dc = dct_dc(block);
+
+        // The AC terms would be quantized away, so the scaled outputs
+        // only get the DC term as well.
+        if (coeffs != NULL)
+        {
+            memset(coeffs, 0, sizeof(scratch->input));
+            coeffs[0] = dc;
+        }
+
+        rle_length = flat_rle(dc, qTable, prev_dc, rle);
+
+        // The Arithmetic Coder Codes the Quantized Block
+        if ((stream != NULL) && (stream->arith != NULL))
+        {
+            memset(zz, 0, sizeof(scratch->zz));
+            zz[0] = *prev_dc;
+        }
+    }
+    else
+    {
+        // Zero-Shift & Calculate 2D DCT
+        kernels->fdct(block, input);
+
+        // Rotate / Flip the Block, Before Quantization so Each
+        // Coefficient Uses the Table Entry of its New Position
+        if (orient_flags != ORIENT_NONE)
+        {
+            float source[8 * 8];
+            memcpy(source, input, sizeof(source));
+
+            for (unsigned int i = 0; i < 8 * 8; i++)
+            {
+                input[i] = orient_sign[i] * source[orient_index[i]];
+            }
+        }
+
+        // Save Coefficients
+        if (coeffs != NULL)
+        {
+            memcpy(coeffs, input, sizeof(scratch->input));
+        }
+
+        // Quantization
+        kernels->quantize(input, qTable, zz);
+
+        // Zero Run-Length Encode
+        kernels->rle(zz, rle, &rle_length, prev_dc);
+    }
+
+    // Dry Run
+    if (counter != NULL)
+    {
+        count_bits(rle, 1, dc_table, counter);
+        count_bits(&rle[1], rle_length - 1, ac_table, counter);
+        return;
+    }
+
+    // Arithmetic Encoding
+    if (stream->arith != NULL)
+    {
+        arith_encode_block(stream->arith, zz, stream);
+        return;
+    }
+
+    // Keep the AC Codes for the Next Frame
+    if (cache != NULL)
+    {
+        CachedBlock * cached = &cache->blocks[idx];
+        memcpy(cached->pixels, block, 8 * 8);
+        cached->dc = *prev_dc;
+        cached->valid = 1;
+        pack_ac_bits(&rle[1], rle_length - 1, ac_table, cached);
+
+        kernels->encode(rle, 1, dc_table, stream);
+        write_cached_bits(stream, cached);
+
+        cache->misses++;
+        return;
+    }
+
+    // DC Huffman Encoding
+    kernels->encode(rle, 1, dc_table, stream);
+
+    // AC Huffman Encoding
+    kernels->encode(&rle[1], rle_length - 1, ac_table, stream);
+}
+
+
+//==========================================================================
+// Local Variable to hold the reduced size IDCT basis. The table is indexed
+// by [size][output position][frequency] and includes the C(u) factor.
+//==========================================================================
+static float scale_cos[3][4][4];
+
+//==========================================================================
+// Helper function that will populate the reduced size IDCT basis for the
+// 1, 2 and 4 point outputs.
+//==========================================================================
+void init_scale_cos()
+{
+    for (unsigned int s = 0; s < 3; s++)
+    {
+        unsigned int size = 1 << s;
+
+        for (unsigned int x = 0; x < size; x++)
+        {
+            for (unsigned int u = 0; u < size; u++)
+            {
+                float cu = (u == 0) ? (1.0f / sqrtf(2.0f)) : 1.0f;
+                scale_cos[s][x][u] = cu * cosf((2 * x + 1) * u * 3.14159265f / (2 * size));
+            }
+        }
+    }
+}
+
+//==========================================================================
+// This function produces a reduced size block directly from the DCT
+// coefficients. Only the low frequency KxK coefficients are used and they
+// are passed through a K-point IDCT, where K is 8 / factor. The DCT output
+// is scaled by 4 (see quant_zigzag) so the IDCT scaling of 1/4 becomes
+// 1/16. For a factor of 8 this reduces to the block mean.
+//
+// Parameters:
+//  coeffs - A pointer to the 8x8 DCT coefficients
+//  factor - The reduction factor (2, 4 or 8)
+//  output - A pointer to the first output pixel
+//  stride - The width of the output plane
+//==========================================================================
+void downscale_block(const float * coeffs, unsigned int factor, unsigned char * output, unsigned int stride)
+{
+    unsigned int size = 8 / factor;
+    unsigned int s = (factor == 8) ? 0 : (factor == 4) ? 1 : 2;
+    float tmp[4 * 4];
+
+    // Row IDCT of the Low Frequency Coefficients
+    for (unsigned int v = 0; v < size; v++)
+    {
+        for (unsigned int x = 0; x < size; x++)
+        {
+            float sum = 0.0f;
+            for (unsigned int u = 0; u < size; u++)
+            {
+                sum += scale_cos[s][x][u] * coeffs[v * 8 + u];
+            }
+            tmp[v * 4 + x] = sum;
+        }
+    }
+
+    // Column IDCT & Level Shift
+    for (unsigned int y = 0; y < size; y++)
+    {
+        for (unsigned int x = 0; x < size; x++)
+        {
+            float sum = 0.0f;
+            for (unsigned int v = 0; v < size; v++)
+            {
+                sum += scale_cos[s][y][v] * tmp[v * 4 + x];
+            }
+
+            float value = roundf(sum / 16.0f + 128.0f);
+            output[y * stride + x] = (unsigned char)max(0.0f, min(255.0f, value));
+        }
+    }
+}
+
+//==========================================================================
+// Allocate the planes for a reduced size copy of the image.
+//
+// Parameters:
+//  factor   - The reduction factor, valid values are 2, 4 or 8
+//  channels - The number of channels in the image
+//  info     - The channel information of the full size image
+//  scaled   - The scaled image to initialize
+//  arena    - The arena to allocate the planes from
+//==========================================================================
+void init_scaled_img(unsigned int factor, unsigned int channels, ChannelInfo * info,
+                     ScaledImage * scaled, Arena * arena)
+{
+    if ((factor != 2) && (factor != 4) && (factor != 8))
+    {
+        printf("Invalid Scale Factor: %d (2,4,8 are the only valid options)\n", factor);
+        exit(-1);
+    }
+
+    init_scale_cos();
+
+    scaled->factor = factor;
+    for (unsigned int i = 0; i < channels; i++)
+    {
+        scaled->info[i].width = info[i].width / factor;
+        scaled->info[i].height = info[i].height / factor;
+        scaled->info[i].data = (unsigned char *)arena_alloc(arena, scaled->info[i].width * scaled->info[i].height);
+    }
+}
+
+//==========================================================================
+// Convert a scaled image into block ordered planes so that it can be
+// passed to compress_img. The edges are padded out by repeating the last
+// row and column of the scaled image.
+//
+// Parameters:
+//  scaled   - The filled in scaled image
+//  channels - The number of channels in the image
+//  width    - The width of the scaled output image
+//  height   - The height of the scaled output image
+//  info     - An array of structures to store the block ordered planes in
+//  arena    - The arena to allocate the planes from
+//==========================================================================
+void scaled_to_blocks(const ScaledImage * scaled, unsigned int channels,
+                      unsigned int width, unsigned int height, ChannelInfo * info, Arena * arena)
+{
+    // Calculate Bounds (Same as file_read)
+    unsigned int div = (channels > 1) ? 16 : 8;
+    unsigned int aWidth = ((width + div - 1) / div) * div;
+    unsigned int aHeight = ((height + div - 1) / div) * div;
+
+    for (unsigned int i = 0; i < channels; i++)
+    {
+        const ChannelInfo * src = &scaled->info[i];
+        unsigned int xblocks;
+
+        info[i].width = aWidth;
+        info[i].height = aHeight;
+
+        if (i != 0)
+        {
+            info[i].width /= 2;
+            info[i].height /= 2;
+        }
+
+        info[i].data = (unsigned char *)arena_alloc(arena, info[i].width * info[i].height);
+        xblocks = info[i].width / 8;
+
+        // Copy Pixels Into Blocks, Clamp to the Source Edges
+        for (unsigned int y = 0; y < info[i].height; y++)
+        {
+            unsigned int sy = min(y, src->height - 1);
+
+            for (unsigned int x = 0; x < info[i].width; x++)
+            {
+                unsigned int sx = min(x, src->width - 1);
+                unsigned int offset = ((y / 8) * xblocks + (x / 8)) * 64 + (y % 8) * 8 + (x % 8);
+                info[i].data[offset] = src->data[sy * src->width + sx];
+            }
+        }
+    }
+}
+
+//==========================================================================
+// Helper function that will write the reduced size blocks for the block
+// at the specified position into all of the scaled images.
+//
+// Parameters:
+//  coeffs     - A pointer to the 8x8 DCT coefficients of the block
+//  scaled     - An array of scaled images
+//  scaled_cnt - The number of scaled images in the array
+//  channel    - The channel the block belongs to
+//  xblock     - The horizontal block index
+//  yblock     - The vertical block index
+//==========================================================================
+void scale_block(const float * coeffs, ScaledImage * scaled, unsigned int scaled_cnt,
+                 unsigned int channel, unsigned int xblock, unsigned int yblock)
+{
+    for (unsigned int i = 0; i < scaled_cnt; i++)
+    {
+        ChannelInfo * plane = &scaled[i].info[channel];
+        unsigned int size = 8 / scaled[i].factor;
+        unsigned char * output = &plane->data[yblock * size * plane->width + xblock * size];
+
+        downscale_block(coeffs, scaled[i].factor, output, plane->width);
+    }
+}
+
+//==========================================================================
+// Compress a full image
+//
+// Parameters:
+//  channels - The number of channels in the image
+//  info     - A pointer to an array that stores the channel information
+//  arena    - The arena to allocate the scratch memory from
+//  stream   - The output stream
+//==========================================================================
+void compress_img(unsigned int channels, ChannelInfo * info, Arena * arena, OutStream * stream)
+{
+    compress_img_scaled(channels, info, arena, stream, NULL, 0, NULL);
+}
+
+//==========================================================================
+// Compress a grayscale image. Each MCU is a single luminance block.
+//
+// Parameters:
+//  info       - A pointer to an array that stores the channel information
+//  scratch    - The scratch memory for the blocks
+//  counter    - If not NULL the bits are counted instead of written
+//  cache      - If not NULL the blocks of the last frame (see BlockCache)
+//  stream     - The output stream
+//  scaled     - An array of scaled images created by init_scaled_img
+//  scaled_cnt - The number of scaled images in the array
+//  quality    - If not NULL the reconstruction quality is added to this
+//==========================================================================
+void compress_gray(ChannelInfo * info, BlockScratch * scratch, BitCounter * counter, BlockCache * cache, OutStream * stream, ScaledImage * scaled, unsigned int scaled_cnt,
+        QualityStats * quality)
+{
+    float * coeffs = scratch->coeffs;
+    float * cptr = (scaled_cnt > 0) ? coeffs : NULL;
+    unsigned int xblocks = info[0].width / 8;
+    unsigned int yblocks = info[0].height / 8;
+    const Kernels * kernels = get_kernels();
+    short y_prev_dc = 0;
+    size_t row_start = 0;
+
+    // Source Block Grid (see orient_image)
+    unsigned int cols = (orient_flags != ORIENT_NONE) ? orient_cols : xblocks;
+    unsigned int rows = (orient_flags != ORIENT_NONE) ? orient_rows : yblocks;
+    if (orient_flags & ORIENT_TRANSPOSE)
+    {
+        xblocks = rows;
+        yblocks = cols;
+    }
+    else
+    {
+        xblocks = cols;
+        yblocks = rows;
+    }
+
+    for (unsigned i = 0; i < xblocks * yblocks; i++)
+    {
+        unsigned int sx;
+        unsigned int sy;
+        orient_block(i % xblocks, i / xblocks, cols, rows, &sx, &sy);
+
+        unsigned char * block = &info[0].data[(sy * (info[0].width / 8) + sx) * 64];
+        compress_8x8(block, yqTable, &y_dc_table, &y_ac_table, y_flat_sad, &y_prev_dc, scratch, cptr, kernels, counter, cache, i, stream);
+        if (quality != NULL)
+        {
+            measure_source_block(block, yqTable, scratch->rle, y_prev_dc, sx, sy, quality, 0);
+        }
+        scale_block(coeffs, scaled, scaled_cnt, 0, i % xblocks, i / xblocks);
+
+        // Bytes Added by the MCU Row
+        if ((counter != NULL) && (counter->row_bytes != NULL) && ((i % xblocks) == xblocks - 1))
+        {
+            counter->row_bytes[counter->row_cnt++] = counter->bytes - row_start;
+            row_start = counter->bytes;
+        }
+    }
+}
+
+//==========================================================================
+// Compress a YCbCr 4:2:0 image. Each MCU is four luminance blocks followed
+// by one Cb and one Cr block.
+//
+// Parameters:
+//  info       - A pointer to an array that stores the channel information
+//  scratch    - The scratch memory for the blocks
+//  counter    - If not NULL the bits are counted instead of written
+//  cache      - If not NULL the blocks of the last frame (see BlockCache)
+//  stream     - The output stream
+//  scaled     - An array of scaled images created by init_scaled_img
+//  scaled_cnt - The number of scaled images in the array
+//  quality    - If not NULL the reconstruction quality is added to this
+//==========================================================================
+void compress_yuv420(ChannelInfo * info, BlockScratch * scratch, BitCounter * counter, BlockCache * cache, OutStream * stream, ScaledImage * scaled, unsigned int scaled_cnt,
+        QualityStats * quality)
+{
+    float * coeffs = scratch->coeffs;
+    float * cptr = (scaled_cnt > 0) ? coeffs : NULL;
+    unsigned int xblocks = info[0].width / 8;
+    unsigned int yblocks = info[0].height / 8;
+    const Kernels * kernels = get_kernels();
+
+    // Previous DC Values
+    short y_prev_dc = 0;
+    short cb_prev_dc = 0;
+    short cr_prev_dc = 0;
+    size_t row_start = 0;
+
+    // Source MCU Grid (see orient_image)
+    unsigned int cols = (orient_flags != ORIENT_NONE) ? orient_cols : xblocks / 2;
+    unsigned int rows = (orient_flags != ORIENT_NONE) ? orient_rows : yblocks / 2;
+    unsigned int mcu_cols = (orient_flags & ORIENT_TRANSPOSE) ? rows : cols;
+    unsigned int mcu_rows = (orient_flags & ORIENT_TRANSPOSE) ? cols : rows;
+
+    for (unsigned int row = 0; row < mcu_rows * 2; row += 2)
+    {
+        for (unsigned int col = 0; col < mcu_cols * 2; col += 2)
+        {
+            unsigned int mcu_x;
+            unsigned int mcu_y;
+            orient_block(col / 2, row / 2, cols, rows, &mcu_x, &mcu_y);
+
+            // First Cache Entry of the MCU
+            size_t mcu = ((size_t)(row / 2) * mcu_cols + col / 2) * 6;
+
+            // Process 4 Luminance Blocks
+            for (unsigned int i = 0; i < 4; i++)
+            {
+                unsigned int sx;
+                unsigned int sy;
+                orient_block(i % 2, i / 2, 2, 2, &sx, &sy);
+                sx += mcu_x * 2;
+                sy += mcu_y * 2;
+
+                unsigned char * block = &info[0].data[sy * xblocks * 64 + sx * 64];
+                compress_8x8(block, yqTable, &y_dc_table, &y_ac_table, y_flat_sad, &y_prev_dc, scratch, cptr, kernels, counter, cache, mcu + i, stream);
+                if (quality != NULL)
+                {
+                    measure_source_block(block, yqTable, scratch->rle, y_prev_dc, sx, sy, quality, 0);
+                }
+                scale_block(coeffs, scaled, scaled_cnt, 0, col + i % 2, row + i / 2);
+            }
+
+            // Process 1 Cb Block
+            unsigned char * cb_block = &info[1].data[mcu_y * (xblocks / 2) * 64 + mcu_x * 64];
+            compress_8x8(cb_block, cqTable, &c_dc_table, &c_ac_table, c_flat_sad, &cb_prev_dc, scratch, cptr, kernels, counter, cache, mcu + 4, stream);
+            scale_block(coeffs, scaled, scaled_cnt, 1, col / 2, row / 2);
+            if (quality != NULL)
+            {
+                measure_source_block(cb_block, cqTable, scratch->rle, cb_prev_dc, mcu_x, mcu_y, quality, 1);
+            }
+
+            // Process 1 Cr Block
+            unsigned char * cr_block = &info[2].data[mcu_y * (xblocks / 2) * 64 + mcu_x * 64];
+            compress_8x8(cr_block, cqTable, &c_dc_table, &c_ac_table, c_flat_sad, &cr_prev_dc, scratch, cptr, kernels, counter, cache, mcu + 5, stream);
+            scale_block(coeffs, scaled, scaled_cnt, 2, col / 2, row / 2);
+            if (quality != NULL)
+            {
+                measure_source_block(cr_block, cqTable, scratch->rle, cr_prev_dc, mcu_x, mcu_y, quality, 2);
+            }
+        }
+
+        // Bytes Added by the MCU Row
+        if ((counter != NULL) && (counter->row_bytes != NULL))
+        {
+            counter->row_bytes[counter->row_cnt++] = counter->bytes - row_start;
+            row_start = counter->bytes;
+        }
+    }
+}
+
+//==========================================================================
+// Compress a color image straight from its RGB rows. Sixteen rows are read
+// at a time and each 16x16 tile is converted to the blocks of its MCU
+// (see store_rgb_mcu) and compressed while they are still in the cache,
+// so the image is never stored as planes. The tiles are padded out by
+// repeating the last row and column, the same as reader_read_planes.
+//
+// Parameters:
+//  reader - The opened input image, 3 channels and not FORMAT_YUV420
+//  arena  - The arena to allocate the rows & scratch memory from
+//  stream - The output stream
+//
+// Return:
+//  0 on success, -1 if the image could not be read
+//==========================================================================
+int compress_rgb_rows(ImageReader * reader, Arena * arena, OutStream * stream)
+{
+    unsigned int width = reader->width;
+    unsigned int height = reader->height;
+    unsigned int mcu_cols = (width + 15) / 16;
+    unsigned int mcu_rows = (height + 15) / 16;
+    size_t stride = (size_t)mcu_cols * 16 * 3;
+    unsigned char * strip = (unsigned char *)arena_alloc(arena, stride * 16);
+    unsigned char * blocks = (unsigned char *)arena_alloc(arena, 6 * 8 * 8);
+    BlockScratch * scratch = (BlockScratch *)arena_alloc(arena, sizeof(BlockScratch));
+    const Kernels * kernels = get_kernels();
+
+    // Previous DC Values
+    short y_prev_dc = 0;
+    short cb_prev_dc = 0;
+    short cr_prev_dc = 0;
+
+    // Generate Huffman Tables
+    init_huffman_tables();
+
+    for (unsigned int my = 0; my < mcu_rows; my++)
+    {
+        // Read the Strip, Rows Past the Bottom Repeat the Last Row
+        for (unsigned int r = 0; r < 16; r++)
+        {
+            unsigned char * row = &strip[r * stride];
+
+            if (my * 16 + r >= height)
+            {
+                memcpy(row, &strip[(r - 1) * stride], stride);
+                continue;
+            }
+
+            const unsigned char * src = reader_read_row(reader);
+            if (src == NULL)
+            {
+                printf("Error Reading File\n");
+                return -1;
+            }
+
+            // Repeat the Last Column
+            memcpy(row, src, width * 3);
+            for (unsigned int x = width; x < mcu_cols * 16; x++)
+            {
+                memcpy(&row[x * 3], &row[(width - 1) * 3], 3);
+            }
+        }
+
+        for (unsigned int mx = 0; mx < mcu_cols; mx++)
+        {
+            kernels->rgb_mcu(&strip[mx * 16 * 3], stride, blocks);
+
+            // Process 4 Luminance Blocks
+            for (unsigned int i = 0; i < 4; i++)
+            {
+                compress_8x8(&blocks[i * 64], yqTable, &y_dc_table, &y_ac_table, y_flat_sad, &y_prev_dc, scratch, NULL, kernels, NULL, NULL, 0, stream);
+            }
+
+            // Process 1 Cb & 1 Cr Block
+            compress_8x8(&blocks[4 * 64], cqTable, &c_dc_table, &c_ac_table, c_flat_sad, &cb_prev_dc, scratch, NULL, kernels, NULL, NULL, 0, stream);
+            compress_8x8(&blocks[5 * 64], cqTable, &c_dc_table, &c_ac_table, c_flat_sad, &cr_prev_dc, scratch, NULL, kernels, NULL, NULL, 0, stream);
+        }
+    }
+
+    return 0;
+}
+
+//==========================================================================
+// Compress a full image and fill in the reduced size copies of the image
+// from the DCT coefficients in the same pass.
+//
+// Parameters:
+//  channels   - The number of channels in the image
+//  info       - A pointer to an array that stores the channel information
+//  arena      - The arena to allocate the scratch memory from
+//  stream     - The output stream
+//  scaled     - An array of scaled images created by init_scaled_img
+//  scaled_cnt - The number of scaled images in the array
+//  quality    - If not NULL the reconstruction quality is added to this
+//==========================================================================
+void compress_img_scaled(unsigned int channels, ChannelInfo * info, Arena * arena, OutStream * stream,
+                         ScaledImage * scaled, unsigned int scaled_cnt, QualityStats * quality)
+{
+    BlockScratch * scratch = (BlockScratch *)arena_alloc(arena, sizeof(BlockScratch));
+
+    // Generate Huffman Tables
+    init_huffman_tables();
+
+    // Process Blocks
+    if (channels == 1)
+    {
+        compress_gray(info, scratch, NULL, NULL, stream, scaled, scaled_cnt, quality);
+    }
+    else
+    {
+        compress_yuv420(info, scratch, NULL, NULL, stream, scaled, scaled_cnt, quality);
+    }
+}
+
+//==========================================================================
+// Compress the next frame of a sequence, copying the AC codes of the
+// blocks that have not changed since the last frame from the cache.
+//
+// Parameters:
+//  channels - The number of channels in the image
+//  info     - A pointer to an array that stores the channel information
+//  arena    - The arena to allocate the scratch memory from
+//  cache    - The blocks of the last frame, release with free_block_cache
+//  stream   - The output stream
+//==========================================================================
+void compress_img_cached(unsigned int channels, ChannelInfo * info, Arena * arena, BlockCache * cache,
+                         OutStream * stream)
+{
+    BlockScratch * scratch;
+    size_t block_cnt = (size_t)(info[0].width / 8) * (info[0].height / 8);
+
+    // Four Luminance Blocks Have Two Chrominance Blocks
+    if (channels > 1)
+        block_cnt += block_cnt / 2;
+
+    // The Adaptive Arithmetic Codes Can't be Reused
+    if (stream->arith != NULL)
+    {
+        compress_img(channels, info, arena, stream);
+        return;
+    }
+
+    // New Frame Size, Start With an Empty Cache
+    if (cache->block_cnt != block_cnt)
+    {
+        free(cache->blocks);
+        cache->blocks = (CachedBlock *)calloc(block_cnt, sizeof(CachedBlock));
+        if (cache->blocks == NULL)
+        {
+            printf("Out of Memory\n");
+            exit(-1);
+        }
+        cache->block_cnt = block_cnt;
+    }
+    scratch = (BlockScratch *)arena_alloc(arena, sizeof(BlockScratch));
+
+    // Generate Huffman Tables
+    init_huffman_tables();
+
+    // Process Blocks
+    if (channels == 1)
+    {
+        compress_gray(info, scratch, NULL, cache, stream, NULL, 0, NULL);
+    }
+    else
+    {
+        compress_yuv420(info, scratch, NULL, cache, stream, NULL, 0, NULL);
+    }
+}
+
+//==========================================================================
+// Release the memory held by a block cache.
+//
+// Parameters:
+//  cache - The block cache from compress_img_cached
+//==========================================================================
+void free_block_cache(BlockCache * cache)
+{
+    free(cache->blocks);
+    cache->blocks = NULL;
+    cache->block_cnt = 0;
+}
+
+//==========================================================================
+// Run the encoder without writing anything and return the exact size the
+// entropy coded scan would be. The Huffman codes, the additional bits and
+// the stuffed bytes are counted instead of being packed into a stream.
+//
+// Parameters:
+//  channels  - The number of channels in the image
+//  info      - A pointer to an array that stores the channel information
+//  arena     - The arena to allocate the scratch memory from
+//  row_bytes - If not NULL an array with one entry per MCU row to store the
+//              number of bytes each row adds to the scan (the bits left
+//              over from a row are counted in the row that completes them
+//              and the padded last byte in the last row, so the rows add
+//              up to the scan size)
+//
+// Return:
+//  The size of the scan in bytes, including the padded last byte
+//==========================================================================
+size_t count_img(unsigned int channels, ChannelInfo * info, Arena * arena, size_t * row_bytes)
+{
+    BlockScratch * scratch = (BlockScratch *)arena_alloc(arena, sizeof(BlockScratch));
+    BitCounter counter;
+
+    memset(&counter, 0, sizeof(BitCounter));
+    counter.row_bytes = row_bytes;
+
+    // Generate Huffman Tables
+    init_huffman_tables();
+
+    // Count Blocks
+    if (channels == 1)
+    {
+        compress_gray(info, scratch, &counter, NULL, NULL, NULL, 0, NULL);
+    }
+    else
+    {
+        compress_yuv420(info, scratch, &counter, NULL, NULL, NULL, 0, NULL);
+    }
+
+    // The Last Partial Byte is Padded Out
+    if (counter.bit_cnt > 0)
+    {
+        counter.bytes++;
+        if ((row_bytes != NULL) && (counter.row_cnt > 0))
+        {
+            row_bytes[counter.row_cnt - 1]++;
+        }
+    }
+    return counter.bytes;
+}
+
+//==========================================================================
+// Calculate the DCT of every block of an image once, so the image can be
+// counted at several qualities (see count_img_coeffs) without repeating
+// the DCT. The coefficients of each channel follow each other in the
+// same block order as the planes.
+//
+// Parameters:
+//  channels - The number of channels in the image
+//  info     - A pointer to an array that stores the channel information
+//  arena    - The arena to allocate the coefficients from
+//
+// Return:
+//  The coefficients, 64 per block
+//==========================================================================
+float * dct_img(unsigned int channels, ChannelInfo * info, Arena * arena)
+{
+    const Kernels * kernels = get_kernels();
+    size_t block_cnt = 0;
+
+    for (unsigned int c = 0; c < channels; c++)
+    {
+        block_cnt += (size_t)(info[c].width / 8) * (info[c].height / 8);
+    }
+
+    float * coeffs = (float *)arena_alloc(arena, block_cnt * 64 * sizeof(float));
+    float * output = coeffs;
+
+    for (unsigned int c = 0; c < channels; c++)
+    {
+        unsigned int plane_blocks = (info[c].width / 8) * (info[c].height / 8);
+
+        for (unsigned int i = 0; i < plane_blocks; i++)
+        {
+            kernels->fdct(&info[c].data[i * 64], output);
+            output += 64;
+        }
+    }
+
+    return coeffs;
+}
+
+//==========================================================================
+// Helper function that will count the bits of one block from its DCT.
+// Flat blocks take the same path as compress_8x8, so the count is the
+// same as the encoder's.
+//
+// Parameters:
+//  block    - A pointer to the 8x8 source pixels
+//  dct      - The DCT of the block (see dct_img)
+//  qTable   - A pointer to a 8x8 table of quaniztation values
+//  dc_table - The DC Huffman table
+//  ac_table - The AC Huffman table
+//  flat_sad - The flat block threshold for the quantization table
+//  prev_dc  - A pointer to the location of the prev dc value
+//  scratch  - The scratch memory for the block
+//  kernels  - The kernel function table
+//  counter  - The bit counter
+//==========================================================================
+static inline void count_8x8(const unsigned char * block, const float * dct, const unsigned char * qTable,
+                             const HuffTable * dc_table, const HuffTable * ac_table, unsigned int flat_sad,
+                             short * prev_dc, BlockScratch * scratch, const Kernels * kernels, BitCounter * counter)
+{
+    RLEInfo * rle = scratch->rle;
+    unsigned int rle_length;
+
+    if (is_flat_block(block, flat_sad))
+    {
+        rle_length = flat_rle(dct_dc(block), qTable, prev_dc, rle);
+    }
+    else
+    {
+        kernels->quantize(dct, qTable, scratch->zz);
+        kernels->rle(scratch->zz, rle, &rle_length, prev_dc);
+    }
+
+    count_bits(rle, 1, dc_table, counter);
+    count_bits(&rle[1], rle_length - 1, ac_table, counter);
+}
+
+//==========================================================================
+// Count the exact size of the entropy coded scan of an image from its
+// DCT with a pair of quantization tables, see count_img. Only the tables
+// passed in are used, so images can be counted with different tables on
+// several threads at once. The image is never oriented.
+//
+// Parameters:
+//  channels - The number of channels in the image
+//  info     - A pointer to an array that stores the channel information
+//  coeffs   - The DCT of the image from dct_img
+//  yq       - The luminance quantization table
+//  cq       - The chrominance quantization table
+//  arena    - The arena to allocate the scratch memory from
+//  quality  - If not NULL the reconstruction quality is added to this
+//
+// Return:
+//  The size of the scan in bytes, including the padded last byte
+//==========================================================================
+size_t count_img_coeffs(unsigned int channels, ChannelInfo * info, const float * coeffs, const unsigned char * yq,
+                        const unsigned char * cq, Arena * arena, QualityStats * quality)
+{
+    BlockScratch * scratch = (BlockScratch *)arena_alloc(arena, sizeof(BlockScratch));
+    const Kernels * kernels = get_kernels();
+    unsigned int y_sad = flat_threshold(yq);
+    unsigned int c_sad = flat_threshold(cq);
+    unsigned int xblocks = info[0].width / 8;
+    unsigned int yblocks = info[0].height / 8;
+    short prev_dc[3] = { 0, 0, 0 };
+    BitCounter counter;
+
+    memset(&counter, 0, sizeof(BitCounter));
+
+    if (channels == 1)
+    {
+        for (unsigned int i = 0; i < xblocks * yblocks; i++)
+        {
+            unsigned char * block = &info[0].data[i * 64];
+            count_8x8(block, &coeffs[i * 64], yq, &y_dc_table, &y_ac_table, y_sad, &prev_dc[0], scratch, kernels, &counter);
+            if (quality != NULL)
+            {
+                measure_source_block(block, yq, scratch->rle, prev_dc[0], i % xblocks, i / xblocks, quality, 0);
+            }
+        }
+    }
+    else
+    {
+        // The Chroma Coefficients Follow the Luma Coefficients
+        const float * cb_coeffs = &coeffs[(size_t)xblocks * yblocks * 64];
+        const float * cr_coeffs = &cb_coeffs[(size_t)(xblocks / 2) * (yblocks / 2) * 64];
+
+        for (unsigned int my = 0; my < yblocks / 2; my++)
+        {
+            for (unsigned int mx = 0; mx < xblocks / 2; mx++)
+            {
+                // 4 Luminance Blocks
+                for (unsigned int i = 0; i < 4; i++)
+                {
+                    unsigned int sx = mx * 2 + i % 2;
+                    unsigned int sy = my * 2 + i / 2;
+                    size_t offset = ((size_t)sy * xblocks + sx) * 64;
+
+                    count_8x8(&info[0].data[offset], &coeffs[offset], yq, &y_dc_table, &y_ac_table, y_sad, &prev_dc[0], scratch, kernels, &counter);
+                    if (quality != NULL)
+                    {
+                        measure_source_block(&info[0].data[offset], yq, scratch->rle, prev_dc[0], sx, sy, quality, 0);
+                    }
+                }
+
+                // 1 Cb & 1 Cr Block
+                size_t offset = ((size_t)my * (xblocks / 2) + mx) * 64;
+                for (unsigned int c = 1; c < 3; c++)
+                {
+                    const float * dct = (c == 1) ? &cb_coeffs[offset] : &cr_coeffs[offset];
+
+                    count_8x8(&info[c].data[offset], dct, cq, &c_dc_table, &c_ac_table, c_sad, &prev_dc[c], scratch, kernels, &counter);
+                    if (quality != NULL)
+                    {
+                        measure_source_block(&info[c].data[offset], cq, scratch->rle, prev_dc[c], mx, my, quality, c);
+                    }
+                }
+            }
+        }
+    }
+
+    // The Last Partial Byte is Padded Out
+    return counter.bytes + ((counter.bit_cnt > 0) ? 1 : 0);
 }
@@ -11,6 +11,14 @@
 #include <stdio.h>
 #include <stdlib.h>
 
+#include "arena.h"
+#include "writer.h"
+
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
 //==========================================================================
 // Macros For Min & Max if not defined elsewhere.
 //==========================================================================
@@ -22,6 +30,23 @@
 #define max(a, b) ((a > b) ? a : b)
 #endif
 
+//==========================================================================
+// Orientation flags, the output is the source with its axes swapped
+// (ORIENT_TRANSPOSE) and then the source columns and/or rows reversed.
+// These are combined into the usual named orientations by orientation_id.
+//==========================================================================
+#define ORIENT_NONE      0x0
+#define ORIENT_FLIP_X    0x1
+#define ORIENT_FLIP_Y    0x2
+#define ORIENT_TRANSPOSE 0x4
+
+//==========================================================================
+// Entropy coders, baseline Huffman coding (SOF0) or the adaptive
+// arithmetic coding of the extended sequential process (SOF9)
+//==========================================================================
+#define ENTROPY_HUFFMAN    0
+#define ENTROPY_ARITHMETIC 1
+
 //==========================================================================
 // Structure to hold the Color Channel Information
 //==========================================================================
@@ -43,6 +68,112 @@ typedef struct
     unsigned char  add_length;
 } EncodeInfo;
 
+//==========================================================================
+// Structure to hold a reduced size copy of the image. The planes are
+// filled in from the DCT coefficients while the full size image is being
+// compressed and are stored in raster order (not block order).
+//==========================================================================
+typedef struct
+{
+    unsigned int factor;
+    ChannelInfo info[3];
+} ScaledImage;
+
+//==========================================================================
+// Structure to hold the state of a dry run encode (see count_img). The
+// bits are packed the same way the output stream packs them so the 0xFF
+// bytes that need a stuffed 0x00 can be counted exactly.
+//
+//  bits      - The bits that have not made up a full byte yet
+//  bit_cnt   - The number of bits in bits
+//  bytes     - The number of bytes the scan would have so far
+//  row_bytes - If not NULL the bytes added by each MCU row are stored here
+//  row_cnt   - The number of MCU rows stored in row_bytes
+//==========================================================================
+typedef struct
+{
+    unsigned long long bits;
+    unsigned int bit_cnt;
+    size_t bytes;
+    size_t * row_bytes;
+    unsigned int row_cnt;
+} BitCounter;
+
+//==========================================================================
+// Size of the coded AC terms of a cached block. The longest AC code is 16
+// bits, with up to 11 additional bits, for each of the 63 AC terms.
+//==========================================================================
+#define CACHE_AC_BYTES ((63 * (16 + 11) + 7) / 8)
+
+//==========================================================================
+// Structure to hold a coded block of the last frame (see BlockCache)
+//
+//  pixels  - The source samples of the block
+//  dc      - The quantized DC term
+//  ac_bits - The number of bits in ac
+//  valid   - Not 0 once the block has been coded
+//  ac      - The Huffman coded AC terms, without the stuffed bytes
+//==========================================================================
+typedef struct
+{
+    unsigned char pixels[8 * 8];
+    short dc;
+    unsigned short ac_bits;
+    unsigned int valid;
+    unsigned char ac[CACHE_AC_BYTES];
+} CachedBlock;
+
+//==========================================================================
+// Structure to hold the coded blocks of the last frame of a sequence, so
+// a block whose samples have not changed skips the DCT, quantization and
+// AC coding. Start with all of the fields set to 0.
+//
+//  blocks    - One entry per block, in the order the blocks are coded
+//  block_cnt - The number of entries
+//  hits      - The number of blocks copied from the cache
+//  misses    - The number of blocks that were coded
+//==========================================================================
+typedef struct
+{
+    CachedBlock * blocks;
+    size_t block_cnt;
+    unsigned long hits;
+    unsigned long misses;
+} BlockCache;
+
+//==========================================================================
+// Structure to hold the reconstruction quality of one channel. The
+// blocks are dequantized and passed through an IDCT as they are encoded
+// and compared to the source samples inside the image (not the padding).
+//
+//  width   - The number of samples in each row of the channel
+//  height  - The number of rows in the channel
+//  sse     - The sum of the squared error
+//  samples - The number of samples in the sum
+//  ssim    - The sum of the SSIM of each 8x8 block
+//  blocks  - The number of blocks in the SSIM sum
+//==========================================================================
+typedef struct
+{
+    unsigned int width;
+    unsigned int height;
+    double sse;
+    unsigned long samples;
+    double ssim;
+    unsigned long blocks;
+} ChannelQuality;
+
+//==========================================================================
+// Structure to hold the reconstruction quality of an image, see
+// init_quality_stats.
+//==========================================================================
+typedef struct
+{
+    int ssim;
+    unsigned int channels;
+    ChannelQuality channel[3];
+} QualityStats;
+
 //==========================================================================
 // Provided a uniform scaling factor to the quantization table.
 //
@@ -56,15 +187,292 @@ typedef struct
 //==========================================================================
 void init_qtable(unsigned int quality_factor);
 
+//==========================================================================
+// Scale the Annex K quantization tables by a quality factor without
+// changing the current tables, so several qualities can be worked on at
+// the same time.
+//
+// Parameters:
+//  quality - an integer from 1 to 100, see init_qtable
+//  yq      - A pointer to a 8x8 table to store the luminance table in
+//  cq      - A pointer to a 8x8 table to store the chrominance table in
+//==========================================================================
+void scale_qtables(unsigned int quality, unsigned char * yq, unsigned char * cq);
+
+//==========================================================================
+// Replace the quantization tables, such as with tables tuned for an image
+// (see tune_qtable). init_qtable must still be called first.
+//
+// Parameters:
+//  yq - The luminance table in the same order as the Annex K tables
+//  cq - The chrominance table in the same order as the Annex K tables
+//==========================================================================
+void set_qtable(const unsigned char * yq, const unsigned char * cq);
+
+//==========================================================================
+// Helper function that will convert an orientation name to its flags.
+//
+// Parameters:
+//  name - The orientation name (none, fliph, flipv, rot90, rot180, rot270,
+//         transpose or transverse), rotations are clockwise
+//
+// Return:
+//  The ORIENT_* flags or -1 if the name is not known
+//==========================================================================
+int orientation_id(const char * name);
+
+//==========================================================================
+// Set the orientation of the encoded images. The blocks are visited in
+// the order of the rotated / flipped image and the DCT coefficients of
+// each block are transposed and their odd frequencies negated, so there
+// is no extra pass over the pixels. orient_image must be called before
+// each image size is compressed.
+//
+// Parameters:
+//  orientation - Any of the ORIENT_* flags
+//==========================================================================
+void set_orientation(unsigned int orientation);
+
+//==========================================================================
+// Work out the size of an image once it is oriented. A partial MCU can't
+// be moved from the end of a row or column to the start of it, so a
+// flipped axis is trimmed to a whole number of MCUs (like jpegtran -trim).
+//
+// Parameters:
+//  width    - A pointer to the image width, it is replaced by the output
+//             width
+//  height   - A pointer to the image height, it is replaced by the output
+//             height
+//  channels - The number of channels in the image
+//
+// Return:
+//  0 on success, -1 if the trimmed image would be empty
+//==========================================================================
+int orient_image(unsigned int * width, unsigned int * height, unsigned int channels);
+
+//==========================================================================
+// Set the entropy coder of the output streams. The arithmetic coder needs
+// no tables, it adapts to the image as it is coded, so the files are
+// smaller but not every decoder can read them. It only applies to the
+// streams opened by jpeg_file.h, the dry run always counts Huffman codes.
+//
+// Parameters:
+//  coder - One of the ENTROPY_* values
+//==========================================================================
+void set_entropy_coder(unsigned int coder);
+
+//==========================================================================
+// Helper function for fetching the entropy coder of the output streams.
+//
+// Return:
+//  One of the ENTROPY_* values
+//==========================================================================
+unsigned int get_entropy_coder();
+
+//==========================================================================
+// Generate the Huffman code tables. The tables only depend on the Annex K
+// specification so they are generated once (or at compile time for C++
+// builds). This is called by init_qtable, so the tables are ready before
+// any images are compressed on other threads.
+//==========================================================================
+void init_huffman_tables();
+
 //==========================================================================
 // Compress a full image
 //
 // Parameters:
 //  channels - The number of channels in the image
 //  info     - A pointer to an array that stores the channel information
-//  fid      - The output file id
+//  arena    - The arena to allocate the scratch memory from
+//  stream   - The output stream
+//==========================================================================
+void compress_img(unsigned int channels, ChannelInfo * info, Arena * arena, OutStream * stream);
+
+//==========================================================================
+// Compress the next frame of a sequence. A block with the same samples as
+// the block in its place in the last frame has the same quantized terms,
+// so its AC codes are copied from the cache and only the difference to
+// the DC term before it is coded again. The output is the same as
+// compress_img. The quantization tables and orientation must not change
+// while the cache is in use and it only works with Huffman coding, for
+// arithmetic coded streams the cache is not used.
+//
+// Parameters:
+//  channels - The number of channels in the image
+//  info     - A pointer to an array that stores the channel information
+//  arena    - The arena to allocate the scratch memory from
+//  cache    - The blocks of the last frame, release with free_block_cache
+//  stream   - The output stream
+//==========================================================================
+void compress_img_cached(unsigned int channels, ChannelInfo * info, Arena * arena, BlockCache * cache,
+                         OutStream * stream);
+
+//==========================================================================
+// Release the memory held by a block cache.
+//
+// Parameters:
+//  cache - The block cache from compress_img_cached
+//==========================================================================
+void free_block_cache(BlockCache * cache);
+
+struct ImageReader;
+
+//==========================================================================
+// Compress a color image straight from its RGB rows. Sixteen rows are read
+// at a time and each 16x16 tile is converted to the blocks of its MCU and
+// compressed while they are still in the cache, so the image is never
+// stored as planes. The tiles are padded out by repeating the last row and
+// column, the same as reader_read_planes.
+//
+// Parameters:
+//  reader - The opened input image, 3 channels and not FORMAT_YUV420
+//  arena  - The arena to allocate the rows & scratch memory from
+//  stream - The output stream
+//
+// Return:
+//  0 on success, -1 if the image could not be read
+//==========================================================================
+int compress_rgb_rows(struct ImageReader * reader, Arena * arena, OutStream * stream);
+
+//==========================================================================
+// Compress a full image and fill in the reduced size copies of the image
+// from the DCT coefficients in the same pass.
+//
+// Parameters:
+//  channels   - The number of channels in the image
+//  info       - A pointer to an array that stores the channel information
+//  arena      - The arena to allocate the scratch memory from
+//  stream     - The output stream
+//  scaled     - An array of scaled images created by init_scaled_img
+//  scaled_cnt - The number of scaled images in the array
+//  quality    - If not NULL the reconstruction quality is added to this
+//==========================================================================
+void compress_img_scaled(unsigned int channels, ChannelInfo * info, Arena * arena, OutStream * stream,
+                         ScaledImage * scaled, unsigned int scaled_cnt, QualityStats * quality);
+
+//==========================================================================
+// Start measuring the reconstruction quality of an image. The chroma
+// channels are measured against the subsampled planes, so the results are
+// for the YCbCr samples that are coded.
+//
+// Parameters:
+//  quality  - The quality stats to initialize
+//  width    - The image width (before any orientation)
+//  height   - The image height (before any orientation)
+//  channels - The number of channels in the image
+//  ssim     - If not 0 the SSIM of each 8x8 block is measured as well
+//==========================================================================
+void init_quality_stats(QualityStats * quality, unsigned int width, unsigned int height,
+                        unsigned int channels, int ssim);
+
+//==========================================================================
+// Get the PSNR from the quality stats.
+//
+// Parameters:
+//  quality - The quality stats of the image
+//  channel - The channel or -1 for all of the channels together
+//
+// Return:
+//  The PSNR in dB
+//==========================================================================
+double quality_psnr(const QualityStats * quality, int channel);
+
+//==========================================================================
+// Get the mean SSIM of the 8x8 blocks from the quality stats.
+//
+// Parameters:
+//  quality - The quality stats of the image
+//  channel - The channel or -1 for all of the channels together
+//
+// Return:
+//  The mean SSIM
+//==========================================================================
+double quality_ssim(const QualityStats * quality, int channel);
+
+//==========================================================================
+// Run the encoder without writing anything and return the exact size the
+// entropy coded scan would be. The Huffman codes, the additional bits and
+// the stuffed bytes are counted instead of being packed into a stream.
+//
+// Parameters:
+//  channels  - The number of channels in the image
+//  info      - A pointer to an array that stores the channel information
+//  arena     - The arena to allocate the scratch memory from
+//  row_bytes - If not NULL an array with one entry per MCU row to store the
+//              number of bytes each row adds to the scan (the bits left
+//              over from a row are counted in the row that completes them
+//              and the padded last byte in the last row, so the rows add
+//              up to the scan size)
+//
+// Return:
+//  The size of the scan in bytes, including the padded last byte
+//==========================================================================
+size_t count_img(unsigned int channels, ChannelInfo * info, Arena * arena, size_t * row_bytes);
+
+//==========================================================================
+// Calculate the DCT of every block of an image once, so the image can be
+// counted at several qualities (see count_img_coeffs) without repeating
+// the DCT.
+//
+// Parameters:
+//  channels - The number of channels in the image
+//  info     - A pointer to an array that stores the channel information
+//  arena    - The arena to allocate the coefficients from
+//
+// Return:
+//  The coefficients, 64 per block
+//==========================================================================
+float * dct_img(unsigned int channels, ChannelInfo * info, Arena * arena);
+
+//==========================================================================
+// Count the exact size of the entropy coded scan of an image from its
+// DCT with a pair of quantization tables, see count_img. Only the tables
+// passed in are used, so images can be counted with different tables on
+// several threads at once. The image is never oriented.
+//
+// Parameters:
+//  channels - The number of channels in the image
+//  info     - A pointer to an array that stores the channel information
+//  coeffs   - The DCT of the image from dct_img
+//  yq       - The luminance quantization table
+//  cq       - The chrominance quantization table
+//  arena    - The arena to allocate the scratch memory from
+//  quality  - If not NULL the reconstruction quality is added to this
+//
+// Return:
+//  The size of the scan in bytes, including the padded last byte
+//==========================================================================
+size_t count_img_coeffs(unsigned int channels, ChannelInfo * info, const float * coeffs, const unsigned char * yq,
+                        const unsigned char * cq, Arena * arena, QualityStats * quality);
+
+//==========================================================================
+// Allocate the planes for a reduced size copy of the image.
+//
+// Parameters:
+//  factor   - The reduction factor, valid values are 2, 4 or 8
+//  channels - The number of channels in the image
+//  info     - The channel information of the full size image
+//  scaled   - The scaled image to initialize
+//  arena    - The arena to allocate the planes from
 //==========================================================================
-void compress_img(unsigned int channels, ChannelInfo * info, FILE * fid);
+void init_scaled_img(unsigned int factor, unsigned int channels, ChannelInfo * info,
+                     ScaledImage * scaled, Arena * arena);
+
+//==========================================================================
+// Convert a scaled image into block ordered planes so that it can be
+// passed to compress_img. The edges are padded out by repeating the last
+// row and column of the scaled image.
+//
+// Parameters:
+//  scaled   - The filled in scaled image
+//  channels - The number of channels in the image
+//  width    - The width of the scaled output image
+//  height   - The height of the scaled output image
+//  info     - An array of structures to store the block ordered planes in
+//  arena    - The arena to allocate the planes from
+//==========================================================================
+void scaled_to_blocks(const ScaledImage * scaled, unsigned int channels,
+                      unsigned int width, unsigned int height, ChannelInfo * info, Arena * arena);
 
 //==========================================================================
 // Helper function for fetching the Huffman code length array
@@ -125,4 +533,8 @@ const unsigned char * get_cqtable();
 //==========================================================================
 const unsigned char * get_read_pattern();
 
+#ifdef __cplusplus
+}
+#endif
+
 #endif /* ENCODER_H */
@@ -9,6 +9,8 @@
 #include <math.h>
 
 #include "jpeg_file.h"
+#include "reader.h"
+#include "arith.h"
 
 //==========================================================================
 // Helper Macros for getting the MSB and LSB out of a short
@@ -16,21 +18,14 @@
 #define MSB(X) ((X >> 8) & 0xFF)
 #define LSB(X) (X & 0xFF)
 
-//==========================================================================
-// Local Variables for Storing the current byte and its bit count
-//==========================================================================
-static unsigned char current_byte = 0;
-static unsigned char current_bit_cnt = 0;
-
-
 //==========================================================================
 // Writes the quantization tables out to file.
 //
 // Parameters:
-//  fid         - The output file id
+//  stream      - The output stream
 //  channels    - The number of color channels in the image
 //==========================================================================
-void write_quantization(FILE * fid, unsigned int channels)
+void write_quantization(OutStream * stream, unsigned int channels)
 {
     unsigned char data[4];
     unsigned char qtable[64];
@@ -49,31 +44,31 @@ void write_quantization(FILE * fid, unsigned int channels)
     // Set Header Length
     data[2] = MSB(length);
     data[3] = LSB(length);
-    fwrite(data, 1, 4, fid);
+    stream_write(stream, data, 4);
 
     // Luminance Table Info
     data[0] = 0;
-    fwrite(data, 1, 1, fid);
+    stream_write(stream, data, 1);
 
     // Write Luminance Table
     for (int i = 0; i < 64; i++)
     {
         qtable[read_ptrn[i]] = yq[i];
     }
-    fwrite(qtable, 1, 64, fid);
+    stream_write(stream, qtable, 64);
 
     if (channels > 1)
     {
         // Chrominance Table Info
         data[0] = 1;
-        fwrite(data, 1, 1, fid);
+        stream_write(stream, data, 1);
 
         // Write Chrominance Table
         for (int i = 0; i < 64; i++)
         {
             qtable[read_ptrn[i]] = cq[i];
         }
-        fwrite(qtable, 1, 64, fid);
+        stream_write(stream, qtable, 64);
     }
 }
 
@@ -81,20 +76,20 @@ void write_quantization(FILE * fid, unsigned int channels)
 // Writes the start of frame (SOF) to file
 //
 // Parameters:
-//  fid         - The output file id
+//  stream      - The output stream
 //  width       - The image width
 //  height      - The image height
 //  info        - The individual color channel information
 //  channels    - The number of color channels in the image
 //==========================================================================
-void write_start_of_frame(FILE * fid, unsigned int width, unsigned int height, ChannelInfo * info, unsigned int channels)
+void write_start_of_frame(OutStream * stream, unsigned int width, unsigned int height, ChannelInfo * info, unsigned int channels)
 {
     unsigned short length = 8 + (3 * channels);
     unsigned char data[20];
 
-    // Start of Frame Marker
+    // Start of Frame Marker, Baseline or Arithmetic Sequential
     data[0] = 0xFF;
-    data[1] = 0xC0;
+    data[1] = (get_entropy_coder() == ENTROPY_ARITHMETIC) ? 0xC9 : 0xC0;
     
     // Header Length
     
@@ -148,19 +143,19 @@ void write_start_of_frame(FILE * fid, unsigned int width, unsigned int height, C
     }
 
     // Write Data
-    fwrite(data, 1, length+2, fid);
+    stream_write(stream, data, length+2);
 }
 
 //==========================================================================
 // Writes the Huffman codes and values to file
 //
 // Parameters:
-//  fid         - The output file id
+//  stream      - The output stream
 //  code_cnt    - Huffman Code Count
 //  lengths     - Array of Code Lengths
 //  values      - Array of Code Values
 //==========================================================================
-void write_huffman(FILE * fid, unsigned char id, unsigned int code_cnt, const unsigned char * lengths, const unsigned char * values)
+void write_huffman(OutStream * stream, unsigned char id, unsigned int code_cnt, const unsigned char * lengths, const unsigned char * values)
 {
     unsigned char data[5];
     unsigned short len;
@@ -176,23 +171,59 @@ void write_huffman(FILE * fid, unsigned char id, unsigned int code_cnt, const un
     
     // ID
     data[4] = id;
-    fwrite(data, 1, 5, fid);
+    stream_write(stream, data, 5);
 
     // Write Lengths
-    fwrite(lengths, 1, 16, fid);
+    stream_write(stream, lengths, 16);
 
     // Write Values
-    fwrite(values, 1, code_cnt, fid);
+    stream_write(stream, values, code_cnt);
+}
+
+//==========================================================================
+// Writes the arithmetic coding conditioning tables (DAC) to file. There is
+// a DC and an AC table for luminance and another pair for chrominance.
+//
+// Parameters:
+//  stream      - The output stream
+//  channels    - The number of color channels in the image
+//==========================================================================
+void write_arith_conditioning(OutStream * stream, unsigned int channels)
+{
+    unsigned char data[4];
+    unsigned int tables = (channels > 1) ? 2 : 1;
+    unsigned short len = 2 + 2 * 2 * tables;
+
+    // Arithmetic Conditioning Marker
+    data[0] = 0xFF;
+    data[1] = 0xCC;
+
+    // Length
+    data[2] = MSB(len);
+    data[3] = LSB(len);
+    stream_write(stream, data, 4);
+
+    for (unsigned int i = 0; i < tables; i++)
+    {
+        // DC Table, Upper & Lower Bounds of the Small Differences
+        data[0] = (unsigned char)i;
+        data[1] = (ARITH_DC_U << 4) | ARITH_DC_L;
+
+        // AC Table, Split Between the Low & High Frequency Bins
+        data[2] = (unsigned char)(0x10 | i);
+        data[3] = ARITH_AC_K;
+        stream_write(stream, data, 4);
+    }
 }
 
 //==========================================================================
 // Writes the start of scan (SOS) to file
 //
 // Parameters:
-//  fid         - The output file id
+//  stream      - The output stream
 //  channels    - The number of color channels in the image
 //==========================================================================
-void write_scan_header(FILE * fid, unsigned int channels)
+void write_scan_header(OutStream * stream, unsigned int channels)
 {
     unsigned char data[5];
     unsigned short len = 6 + 2 * channels;
@@ -207,7 +238,7 @@ void write_scan_header(FILE * fid, unsigned int channels)
     
     // Number of Compoents in Scan
     data[4] = channels;
-    fwrite(data, 1, 5, fid);
+    stream_write(stream, data, 5);
 
     for (unsigned int i = 0; i < channels; i++)
     {
@@ -220,7 +251,7 @@ void write_scan_header(FILE * fid, unsigned int channels)
         else
             data[1] = 0x11;
 
-        fwrite(data, 1, 2, fid);
+        stream_write(stream, data, 2);
     }
 
     // Start of Spectral Selection
@@ -231,7 +262,81 @@ void write_scan_header(FILE * fid, unsigned int channels)
     
     // Approximation Bit Positions
     data[2] = 0;
-    fwrite(data, 1, 3, fid);
+    stream_write(stream, data, 3);
+}
+
+//================================================================================
+// This function will check that the image fits in a single JPEG.
+//
+// Parameters:
+//  width       - The width of the image
+//  height      - The height of the image
+//
+// Return:
+//  0 if the image fits, -1 if it is too large
+//================================================================================
+int check_size(unsigned int width, unsigned int height)
+{
+    // The Frame Header Stores the Size in 16 Bits
+    if ((width > 65535) || (height > 65535))
+    {
+        printf("Image Too Large For a Single JPEG: %dx%d (use -t to tile it)\n", width, height);
+        return -1;
+    }
+
+    return 0;
+}
+
+//================================================================================
+// This function will fill in the proper JPEG header information.
+//
+// Parameters:
+//  stream      - The output stream
+//  width       - The width of the input & output images
+//  height      - The height of the input & output images
+//  info        - The individual color  channel information
+//  channels    - The number of color channels in the image
+//================================================================================
+void write_header(OutStream * stream, unsigned int width, unsigned int height, ChannelInfo * info, unsigned int channels)
+{
+    unsigned char data[2];
+
+    // Write Start Of Image Marker
+    data[0] = 0xFF;
+    data[1] = 0xD8;
+    stream_write(stream, data, 2);
+    
+    // Write Quantization Tables
+    write_quantization(stream, channels);
+
+    // Write Start Of Frame
+    write_start_of_frame(stream, width, height, info, channels);
+
+    if (get_entropy_coder() == ENTROPY_ARITHMETIC)
+    {
+        // Write Conditioning Tables & Start a New Scan
+        write_arith_conditioning(stream, channels);
+
+        if (stream->arith == NULL)
+            stream->arith = arith_open(channels);
+        else
+            arith_reset(stream->arith, channels);
+    }
+    else
+    {
+        // Write Huffman Tables
+        write_huffman(stream, 0x00, get_code_count(1), get_code_lens(1, 0), get_code_values(1, 0));
+        write_huffman(stream, 0x10, get_code_count(0), get_code_lens(0, 0), get_code_values(0, 0));
+
+        if (channels > 1)
+        {
+            write_huffman(stream, 0x01, get_code_count(1), get_code_lens(1, 1), get_code_values(1, 1));
+            write_huffman(stream, 0x11, get_code_count(0), get_code_lens(0, 1), get_code_values(0, 1));
+        }
+    }
+
+    // Write Scan Header
+    write_scan_header(stream, channels);
 }
 
 //================================================================================
@@ -240,88 +345,211 @@ void write_scan_header(FILE * fid, unsigned int channels)
 //
 // Parameters:
 //  file_name   - Output File Name
+//  flags       - Any of the WRITER_* flags
 //  width       - The width of the input & output images
 //  height      - The height of the input & output images
 //  info        - The individual color  channel information
 //  channels    - The number of color channels in the image
 //
 // Return:
-//  It will return the file id of the opened output file
+//  It will return the output stream of the opened output file
 //================================================================================
-FILE * open_stream(const char * file_name, unsigned int width, unsigned int height, ChannelInfo * info, unsigned int channels)
+OutStream * open_stream(const char * file_name, unsigned int flags, unsigned int width, unsigned int height, ChannelInfo * info, unsigned int channels)
 {
-    FILE * fid;
-    unsigned char data[2];
+    OutStream * stream;
+
+    if (check_size(width, height) != 0)
+    {
+        return NULL;
+    }
 
     // Open File
-    fid = fopen(file_name, "wb");
-    if (fid == NULL)
+    stream = stream_open(file_name, flags);
+    if (stream == NULL)
     {
         printf("Failed To Open File");
         return NULL;
     }
 
-    // Write Start Of Image Marker
-    data[0] = 0xFF;
-    data[1] = 0xD8;
-    fwrite(&data, 1, 2, fid);
-    
-    // Write Quantization Tables
-    write_quantization(fid, channels);
+    write_header(stream, width, height, info, channels);
 
-    // Write Start Of Frame
-    write_start_of_frame(fid, width, height, info, channels);
+    // Return Output Stream
+    return stream;
+}
 
-    // Write Huffman Tables
-    write_huffman(fid, 0x00, get_code_count(1), get_code_lens(1, 0), get_code_values(1, 0));
-    write_huffman(fid, 0x10, get_code_count(0), get_code_lens(0, 0), get_code_values(0, 0));
+//================================================================================
+// This function will open a memory stream and fill in the proper JPEG header
+// information.
+//
+// Parameters:
+//  width       - The width of the input & output images
+//  height      - The height of the input & output images
+//  info        - The individual color  channel information
+//  channels    - The number of color channels in the image
+//
+// Return:
+//  It will return the output stream or NULL if the image is too large
+//================================================================================
+OutStream * open_memory_stream(unsigned int width, unsigned int height, ChannelInfo * info, unsigned int channels)
+{
+    OutStream * stream;
 
-    if (channels > 1)
+    if (check_size(width, height) != 0)
     {
-        write_huffman(fid, 0x01, get_code_count(1), get_code_lens(1, 1), get_code_values(1, 1));
-        write_huffman(fid, 0x11, get_code_count(0), get_code_lens(0, 1), get_code_values(0, 1));
+        return NULL;
     }
 
-    // Write Scan Header
-    write_scan_header(fid, channels);
+    stream = stream_open_memory();
+    write_header(stream, width, height, info, channels);
 
-    // Return File Pointer
-    return fid;
+    return stream;
 }
 
 //================================================================================
-// This function will close the JPEG file and write out the end of image marker.
+// This function will write out any remaining bits and the end of image marker.
 //
 // Parameters:
-//  fid - Output File ID
+//  stream - The output stream
 //================================================================================
-void close_stream(FILE * fid)
+void write_trailer(OutStream * stream)
 {
     unsigned char data[2];
 
-    // Check for Data in Buffer
-    if (current_bit_cnt > 0)
+    if (stream->arith != NULL)
+    {
+        // Flush the Arithmetic Coder
+        arith_finish(stream->arith, stream);
+    }
+    else if (stream->current_bit_cnt > 0)
     {
-        fwrite(&current_byte, 1, 1, fid);
+        // Check for Data in Buffer
+        stream_put(stream, stream->current_byte);
     }
 
     // Write End Of Image
     data[0] = 0xFF;
     data[1] = 0xD9;
-    fwrite(data, 1, 2, fid);
+    stream_write(stream, data, 2);
+}
+
+//================================================================================
+// This function will close the JPEG file and write out the end of image marker.
+//
+// Parameters:
+//  stream - The output stream
+//
+// Return:
+//  0 on success, -1 if writing the file failed
+//================================================================================
+int close_stream(OutStream * stream)
+{
+    write_trailer(stream);
 
     // Close File
-    fclose(fid);
+    return stream_close(stream);
+}
+
+//================================================================================
+// This function will close a memory stream and write out the end of image
+// marker.
+//
+// Parameters:
+//  stream - The output stream
+//  size   - A pointer to store the size of the JPEG in
+//
+// Return:
+//  The JPEG data, it must be released with free
+//================================================================================
+unsigned char * close_memory_stream(OutStream * stream, size_t * size)
+{
+    write_trailer(stream);
+
+    return stream_close_memory(stream, size);
+}
+
+//================================================================================
+// This function will empty a memory stream and fill in the JPEG header for the
+// next image, so one stream can be used for a series of images.
+//
+// Parameters:
+//  stream      - The memory stream from open_memory_stream
+//  width       - The width of the input & output images
+//  height      - The height of the input & output images
+//  info        - The individual color  channel information
+//  channels    - The number of color channels in the image
+//================================================================================
+void restart_memory_stream(OutStream * stream, unsigned int width, unsigned int height, ChannelInfo * info, unsigned int channels)
+{
+    stream_reset_memory(stream);
+    write_header(stream, width, height, info, channels);
+}
+
+//================================================================================
+// This function will write out the end of image marker to a memory stream but
+// leave it open so it can be restarted.
+//
+// Parameters:
+//  stream - The memory stream
+//  size   - A pointer to store the size of the JPEG in
+//
+// Return:
+//  The JPEG data, it is only valid until the stream is restarted or closed
+//================================================================================
+const unsigned char * finish_memory_stream(OutStream * stream, size_t * size)
+{
+    write_trailer(stream);
+
+    *size = stream->memory_size + stream->length;
+    return stream->memory;
+}
+
+//================================================================================
+// This function will work out the exact size of the JPEG file for an image
+// without encoding it to a stream. The headers are the same for every image of
+// the same size so they are measured, and the scan is counted by count_img. The
+// quantization tables must already be initialized by init_qtable.
+//
+// Parameters:
+//  width       - The width of the input & output images
+//  height      - The height of the input & output images
+//  info        - The individual color  channel information
+//  channels    - The number of color channels in the image
+//  arena       - The arena to allocate the scratch memory from
+//  row_bytes   - If not NULL an array with one entry per MCU row to store the
+//                number of scan bytes each row adds (see count_img)
+//
+// Return:
+//  The size of the JPEG file in bytes or 0 if the image is too large
+//================================================================================
+size_t predict_jpeg_size(unsigned int width, unsigned int height, ChannelInfo * info, unsigned int channels,
+                         Arena * arena, size_t * row_bytes)
+{
+    OutStream * stream;
+    unsigned char * data;
+    size_t size;
+
+    // Headers & End of Image Marker
+    stream = open_memory_stream(width, height, info, channels);
+    if (stream == NULL)
+    {
+        return 0;
+    }
+
+    data = close_memory_stream(stream, &size);
+    free(data);
+
+    // Entropy Coded Scan
+    return size + count_img(channels, info, arena, row_bytes);
 }
 
 //================================================================================
 // This function write the encoded information to the file.
 //
 // Parameters:
-//  fid     - Output File ID
+//  stream  - The output stream
 //  item    - The encoded item to be outputed to file
 //================================================================================
-void write_stream(FILE * fid, const EncodeInfo * item)
+void write_stream(OutStream * stream, const EncodeInfo * item)
 {
     // Get Information from the info
     unsigned int code_length = item->length + item->add_length;
@@ -332,7 +560,7 @@ void write_stream(FILE * fid, const EncodeInfo * item)
     while (code_length > 0)
     {
         // Get the Remaning bits left in the current byte
-        unsigned int rem_len = 8 - current_bit_cnt;
+        unsigned int rem_len = 8 - stream->current_bit_cnt;
 
         // Store Code into current byte
         if (code_length > rem_len)
@@ -344,8 +572,8 @@ void write_stream(FILE * fid, const EncodeInfo * item)
             unsigned short len_diff = code_length - rem_len;
             unsigned short value = (code >> len_diff) & mask;
             code &= (1 << len_diff) - 1;
-            current_byte += (unsigned char)value;
-            current_bit_cnt = 8;
+            stream->current_byte += (unsigned char)value;
+            stream->current_bit_cnt = 8;
             code_length -= rem_len;
         }
         else
@@ -355,18 +583,18 @@ void write_stream(FILE * fid, const EncodeInfo * item)
             // and move to the next code
             unsigned short mask = ((1 << code_length) - 1);
             unsigned short value = (code & mask) << (rem_len - code_length);
-            current_byte += (unsigned char)value;
-            current_bit_cnt += code_length;
+            stream->current_byte += (unsigned char)value;
+            stream->current_bit_cnt += code_length;
             code_length = 0;
         }
 
         // If we have a bytes worth of data in 
         // the current byte then we need to write
         // the byte out to file.
-        if (current_bit_cnt == 8)
+        if (stream->current_bit_cnt == 8)
         {
             // Write Byte to File
-            fwrite(&current_byte, 1, 1, fid);
+            stream_put(stream, stream->current_byte);
             
             // Check if the byte we currently
             // outputed was 0xFF and since 
@@ -375,15 +603,15 @@ void write_stream(FILE * fid, const EncodeInfo * item)
             // decoder know that it was data not
             // control, see Annex F - Section F.1.2.3
             // of ISO DIS 10918-1
-            if (current_byte == 0xFF)
+            if (stream->current_byte == 0xFF)
             {
-                current_byte = 0;
-                fwrite(&current_byte, 1, 1, fid);
+                stream->current_byte = 0;
+                stream_put(stream, stream->current_byte);
             }
             
             // Reset Counters
-            current_byte = 0;
-            current_bit_cnt = 0;
+            stream->current_byte = 0;
+            stream->current_bit_cnt = 0;
         }
     }    
 }
@@ -391,10 +619,10 @@ void write_stream(FILE * fid, const EncodeInfo * item)
 //================================================================================
 // This function reads file with the specified parameters and stores it in the
 // following format. This file will also convert a RGB image to YCrCb 4:2:0
-// format. This function assumes that the input file is a raw binary format
-// that is either 8-bit grayscale or 24-bit (stored in a 32-bit) RGB format.
-// For the RGB images this code assumes that the data is stored in local byte
-// order and that it looks like the following.
+// format. The input file can be any of the FORMAT_* formats in reader.h, the
+// original raw binary format is either 8-bit grayscale or 24-bit (stored in a
+// 32-bit) RGB format. For the raw RGB images this code assumes that the data
+// is stored in local byte order and that it looks like the following.
 //
 //  RGB Pixel Format:
 //  ====================================================
@@ -416,170 +644,39 @@ void write_stream(FILE * fid, const EncodeInfo * item)
 //
 // Parameters:
 //      file_name   - The file to open and read the image from
-//      image       - The a pointer to the loaded image
-//      width       - The original input width, will return a size that is
-//                    divisable by 8.
-//      height      - The original input height, will return a size that is
-//                    divisable by 8.
-//      channels    - The number of channels in the image, the two valid values
-//                    are either 1 for grayscale or 3 for 24-bit RGB.
+//      format      - The input file format (FORMAT_*)
+//      width       - A pointer to the input width, for PNM files it is
+//                    read from the header.
+//      height      - A pointer to the input height, for PNM files it is
+//                    read from the header.
+//      channels    - A pointer to the number of channels in the image, the
+//                    two valid values are either 1 for grayscale or 3 for
+//                    24-bit RGB. For PNM files it is read from the header.
+//      info        - An array of structures to store the channel information in
+//      arena       - The arena to allocate the planes from
 //================================================================================
-void file_read(const char * file_name, unsigned int width, unsigned int height,
-               unsigned int channels, ChannelInfo * info)
+void file_read(const char * file_name, unsigned int format, unsigned int * width,
+               unsigned int * height, unsigned int * channels, ChannelInfo * info, Arena * arena)
 {
-    FILE * fid = NULL;
-    unsigned int img_size = width * height;
-
-    // Check for Valid # of Channels
-    if ((channels != 1) && (channels != 3))
-    {
-        printf("Invalid # of Channels: %d (1,3 are the only valid options)\n", channels);
-        exit(-1);
-    }
-
-    // Calculate Bounds
-    unsigned int aWidth = 0;
-    unsigned int aHeight = 0;
-    for (unsigned int i = 0; i < channels; i++)
-    {
-        unsigned int w_div= 8;
-        unsigned int h_div = 8;
-
-        if (i != 0)
-        {
-            w_div *= 2;
-            h_div *= 2;
-        }
-
-        aWidth = max(aWidth, ((width + w_div - 1) / w_div) * w_div);
-        aHeight = max(aHeight, ((height + h_div - 1) / h_div) * h_div);
-    }
-
-    // Allocate Memory
-    for (unsigned int i = 0; i < channels; i++)
-    {
-        info[i].width = aWidth;
-        info[i].height = aHeight;
-
-        if (i != 0)
-        {
-            info[i].width /= 2;
-            info[i].height /= 2;
-        }
-
-        info[i].data = (unsigned char *)malloc(info[i].width * info[i].height);
-    }
+    ImageReader reader;
 
     // Open File
-    fid = fopen(file_name, "rb");
-    if (fid == NULL)
+    if (reader_open(&reader, file_name, format, *width, *height, *channels) != 0)
     {
-        printf("Failed to Open File: %s\n", file_name);
-        for (unsigned int i = 0; i < channels; i++)
-        {
-            free(info[i].data);
-        }
         exit(-1);
     }
 
-    // Read File
-    unsigned int row = 0;
-    unsigned int xblock = 0;
-    unsigned int yblock = 0;
-    unsigned int rowCnt;
+    *width = reader.width;
+    *height = reader.height;
+    *channels = reader.channels;
 
-    while (img_size > 0)
+    // Read File
+    if (reader_read_planes(&reader, info, arena) != 0)
     {
-        // Read 1 Row of data from a file and store it an array that is orginized by block
-        rowCnt = width;
-        while (rowCnt > 0)
-        {
-            unsigned int offset = (yblock * info[0].width * 8) + (xblock * 8 * 8) + (row * 8);
-            unsigned int size = min(8, rowCnt);
-
-            if (channels == 1)
-            {
-                // Handle 8-bit Grayscale Image
-                if (fread(&info[0].data[offset], 1, size, fid) != size)
-                {
-                    printf("Error Reading File\n");
-                    for (unsigned int i = 0; i < channels; i++)
-                    {
-                        free(info[i].data);
-                    }
-                    exit(-1);
-                }
-            }
-            else
-            {
-                // Handle 24-bit RGB Image
-                unsigned int buffer[8];
-                unsigned int elements = 0;
-                if ((elements = fread(buffer, 4, size, fid)) != size)
-                {
-                    printf("Error Reading File: %d != %d\n", size, elements);
-                    for (unsigned int i = 0; i < channels; i++)
-                    {
-                        free(info[i].data);
-                    }
-                    exit(-1);
-                }
-
-                // Convert to YCrCb
-                for (unsigned int i = 0; i < size; i++)
-                {
-                    // Break RGB into individual colors
-                    // Assumes that values are stored in local
-                    // byte-order.
-                    unsigned int r = (buffer[i] >> 16) & 0xFF;
-                    unsigned int g = (buffer[i] >> 8) & 0xFF;
-                    unsigned int b = buffer[i] & 0xFF;
-
-                    // Handle Y Channel
-                    float y = 0.299f * r + 0.587f * g + 0.114f * b;
-                    info[0].data[offset + i] = (unsigned char)y;
-
-                    // Handle Cb/Cr Channels
-                    if ((row % 2) == 0)
-                    {
-                        unsigned int alt = (row % 4) / 2;
-                        unsigned int clrOffset = ((yblock / 2) * info[1].width * 8) + (yblock % 2) * 8 * 4 + (xblock / 2) * 8 * 8 + (xblock % 2) * 4 + row * 4 + i / 2;
-                        if (((i + alt) % 2) == 0)
-                        {
-                            
-                            float cb = roundf(128.0f - 0.168736f * r - 0.331264f * g + 0.5f * b);
-                            info[1].data[clrOffset] = (unsigned char)cb;
-                        }
-
-                        if (((i + alt + 1) % 2) == 0)
-                        {
-                            float cr = roundf(128.0f + 0.5f * r - 0.418688f * g - 0.081312f * b);
-                            info[2].data[clrOffset] = (unsigned char)cr;
-                        }
-                    }
-                }
-            }
-
-            rowCnt -= size;
-            xblock++;
-        }
-
-        // Subtract Row for Size
-        img_size -= width;
-
-        // Reset X Block Idx
-        xblock = 0;
-
-        // Increment Row
-        row++;
-            
-        if (row == 8)
-        {
-            yblock++;
-            row = 0;
-        }
+        printf("Error Reading File\n");
+        exit(-1);
     }
 
     // Close File
-    fclose(fid);
+    reader_close(&reader);
 }
@@ -11,6 +11,24 @@
 
 #include <stdio.h>
 #include "encoder.h"
+#include "writer.h"
+
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+//================================================================================
+// This function will check that the image fits in a single JPEG.
+//
+// Parameters:
+//  width       - The width of the image
+//  height      - The height of the image
+//
+// Return:
+//  0 if the image fits, -1 if it is too large
+//================================================================================
+int check_size(unsigned int width, unsigned int height);
 
 //================================================================================
 // This function will open the output file and fill in the proper JPEG header
@@ -18,38 +36,116 @@
 //
 // Parameters:
 //  file_name   - Output File Name
+//  flags       - Any of the WRITER_* flags
 //  width       - The width of the input & output images
 //  height      - The height of the input & output images
 //  info        - The individual color  channel information
 //  channels    - The number of color channels in the image
 //
 // Return:
-//  It will return the file id of the opened output file
+//  It will return the output stream of the opened output file
 //================================================================================
-FILE * open_stream(const char * file_name, unsigned int width, unsigned int height, ChannelInfo * info, unsigned int channels);
+OutStream * open_stream(const char * file_name, unsigned int flags, unsigned int width, unsigned int height, ChannelInfo * info, unsigned int channels);
 
 //================================================================================
 // This function will close the JPEG file and write out the end of image marker.
 //
 // Parameters:
-//  fid - Output File ID
+//  stream - The output stream
+//
+// Return:
+//  0 on success, -1 if writing the file failed
+//================================================================================
+int close_stream(OutStream * stream);
+
+//================================================================================
+// This function will open a memory stream and fill in the proper JPEG header
+// information.
+//
+// Parameters:
+//  width       - The width of the input & output images
+//  height      - The height of the input & output images
+//  info        - The individual color  channel information
+//  channels    - The number of color channels in the image
+//
+// Return:
+//  It will return the output stream or NULL if the image is too large
+//================================================================================
+OutStream * open_memory_stream(unsigned int width, unsigned int height, ChannelInfo * info, unsigned int channels);
+
+//================================================================================
+// This function will close a memory stream and write out the end of image
+// marker.
+//
+// Parameters:
+//  stream - The output stream
+//  size   - A pointer to store the size of the JPEG in
+//
+// Return:
+//  The JPEG data, it must be released with free
+//================================================================================
+unsigned char * close_memory_stream(OutStream * stream, size_t * size);
+
+//================================================================================
+// This function will empty a memory stream and fill in the JPEG header for the
+// next image, so one stream can be used for a series of images.
+//
+// Parameters:
+//  stream      - The memory stream from open_memory_stream
+//  width       - The width of the input & output images
+//  height      - The height of the input & output images
+//  info        - The individual color  channel information
+//  channels    - The number of color channels in the image
 //================================================================================
-void close_stream(FILE * fid);
+void restart_memory_stream(OutStream * stream, unsigned int width, unsigned int height, ChannelInfo * info, unsigned int channels);
+
+//================================================================================
+// This function will write out the end of image marker to a memory stream but
+// leave it open so it can be restarted.
+//
+// Parameters:
+//  stream - The memory stream
+//  size   - A pointer to store the size of the JPEG in
+//
+// Return:
+//  The JPEG data, it is only valid until the stream is restarted or closed
+//================================================================================
+const unsigned char * finish_memory_stream(OutStream * stream, size_t * size);
+
+//================================================================================
+// This function will work out the exact size of the JPEG file for an image
+// without encoding it to a stream. The headers are the same for every image of
+// the same size so they are measured, and the scan is counted by count_img. The
+// quantization tables must already be initialized by init_qtable.
+//
+// Parameters:
+//  width       - The width of the input & output images
+//  height      - The height of the input & output images
+//  info        - The individual color  channel information
+//  channels    - The number of color channels in the image
+//  arena       - The arena to allocate the scratch memory from
+//  row_bytes   - If not NULL an array with one entry per MCU row to store the
+//                number of scan bytes each row adds (see count_img)
+//
+// Return:
+//  The size of the JPEG file in bytes or 0 if the image is too large
+//================================================================================
+size_t predict_jpeg_size(unsigned int width, unsigned int height, ChannelInfo * info, unsigned int channels,
+                         Arena * arena, size_t * row_bytes);
 
 //================================================================================
 // This function write the encoded information to the file.
 //
 // Parameters:
-//  fid     - Output File ID
+//  stream  - The output stream
 //  item    - The encoded item to be outputed to file
 //================================================================================
-void write_stream(FILE * fid, const EncodeInfo * item);
+void write_stream(OutStream * stream, const EncodeInfo * item);
 
 //================================================================================
 // This function reads file with the specified parameters and stores it in the
-// following format. This file will also convert a RGB image to YCrCb 4:2:2
-// format. This function assumes that the input file is a raw binary format
-// that is either 8-bit grayscale or 24-bit (stored in a 32-bit) RGB format.
+// following format. This file will also convert a RGB image to YCrCb 4:2:0
+// format. The input file can be any of the FORMAT_* formats in reader.h.
 //
 //  Input Image                         Output Array
 //  11111111222222223333333344444440    1111111111111111111111111111111111111111111111111111111111111111
@@ -63,15 +159,24 @@ void write_stream(FILE * fid, const EncodeInfo * item);
 //
 // Parameters:
 //      file_name    - The file to open and read the image from
-//      width        - The input width
-//      height       - The input height
-//      channels     - The number of channels in the image, the two valid values
-//                     are either 1 for grayscale or 3 for 24-bit RGB.
+//      format       - The input file format (FORMAT_*)
+//      width        - A pointer to the input width, for PNM files it is read
+//                     from the header
+//      height       - A pointer to the input height, for PNM files it is read
+//                     from the header
+//      channels     - A pointer to the number of channels in the image, the two
+//                     valid values are either 1 for grayscale or 3 for 24-bit
+//                     RGB. For PNM files it is read from the header.
 //      channel_info - An array of structures to store the channel information
 //                     in. This array needs to be at least as large as the number
 //                     of channels.
+//      arena        - The arena to allocate the planes from
 //================================================================================
-void file_read(const char * file_name, unsigned int width, unsigned int height,
-               unsigned int channels, ChannelInfo * info);
+void file_read(const char * file_name, unsigned int format, unsigned int * width,
+               unsigned int * height, unsigned int * channels, ChannelInfo * info, Arena * arena);
+
+#ifdef __cplusplus
+}
+#endif
 
 #endif /* JPEG_FILE_H */
\ No newline at end of file
@@ -0,0 +1,310 @@
+//==========================================================================
+// This file contains the Python bindings for the JPEG encoder. The images
+// are passed in as NumPy arrays and read in place, and the GIL is released
+// while they are compressed so other Python threads can keep running.
+//
+//  import jpeg_py
+//  data = jpeg_py.encode(image)                  # HxW or HxWx3 uint8
+//  datas = jpeg_py.encode_batch([a, b, c], 4)    # on 4 native threads
+//==========================================================================
+#if defined(_WIN32)
+#define BOOST_PYTHON_STATIC_LIB
+#endif
+#include <boost/python/numpy.hpp>
+
+#include <atomic>
+#include <mutex>
+#include <shared_mutex>
+#include <thread>
+#include <vector>
+
+#include "encoder.h"
+#include "jpeg_file.h"
+#include "reader.h"
+
+namespace p = boost::python;
+namespace np = boost::python::numpy;
+
+//==========================================================================
+// Size of each chunk of memory in the thread arenas
+//==========================================================================
+#define PY_ARENA_SIZE (4 * 1024 * 1024)
+
+//==========================================================================
+// The quantization tables are shared by every encode, so they are only
+// changed while no encodes are running.
+//==========================================================================
+static std::shared_timed_mutex table_lock;
+
+//==========================================================================
+// Structure to hold an image that is read in place from a NumPy array.
+// The strides are in bytes.
+//==========================================================================
+struct ImageView
+{
+    const unsigned char * data;
+    ptrdiff_t strides[3];
+    unsigned int width;
+    unsigned int height;
+    unsigned int channels;
+};
+
+//==========================================================================
+// Structure to hold a compressed image
+//==========================================================================
+struct EncodedImage
+{
+    unsigned char * data;
+    size_t size;
+};
+
+//==========================================================================
+// Each thread keeps its own arena so the planes and scratch memory are
+// reused from one encode to the next.
+//==========================================================================
+struct ThreadArena
+{
+    Arena arena;
+
+    ThreadArena() { arena_init(&arena, PY_ARENA_SIZE, 0); }
+    ~ThreadArena() { arena_free(&arena); }
+};
+
+static thread_local ThreadArena thread_arena;
+
+//==========================================================================
+// Releases the GIL for the lifetime of the object.
+//==========================================================================
+class ReleaseGIL
+{
+public:
+    ReleaseGIL() : state(PyEval_SaveThread()) {}
+    ~ReleaseGIL() { PyEval_RestoreThread(state); }
+
+private:
+    PyThreadState * state;
+};
+
+//==========================================================================
+// Helper function that will raise a Python ValueError.
+//
+// Parameters:
+//  message - The error message
+//==========================================================================
+static void raise_value_error(const char * message)
+{
+    PyErr_SetString(PyExc_ValueError, message);
+    p::throw_error_already_set();
+}
+
+//==========================================================================
+// Helper function that will describe a NumPy array. The GIL must be held.
+//
+// Parameters:
+//  image - A HxW or HxWx3 uint8 array, any strides are allowed
+//
+// Return:
+//  The image view
+//==========================================================================
+static ImageView get_view(const np::ndarray & image)
+{
+    ImageView view;
+    int nd = image.get_nd();
+    const Py_intptr_t * strides = image.get_strides();
+
+    if (!np::equivalent(image.get_dtype(), np::dtype::get_builtin<unsigned char>()))
+    {
+        raise_value_error("image must be a uint8 array");
+    }
+
+    if ((nd == 2) || ((nd == 3) && (image.shape(2) == 1)))
+    {
+        view.channels = 1;
+    }
+    else if ((nd == 3) && (image.shape(2) == 3))
+    {
+        view.channels = 3;
+    }
+    else
+    {
+        raise_value_error("image must be HxW or HxWx3");
+    }
+
+    if ((image.shape(0) < 1) || (image.shape(1) < 1) ||
+        (image.shape(0) > 65535) || (image.shape(1) > 65535))
+    {
+        raise_value_error("image must be between 1x1 and 65535x65535");
+    }
+
+    view.data = reinterpret_cast<const unsigned char *>(image.get_data());
+    view.height = (unsigned int)image.shape(0);
+    view.width = (unsigned int)image.shape(1);
+    view.strides[0] = strides[0];
+    view.strides[1] = strides[1];
+    view.strides[2] = (nd == 3) ? strides[2] : 1;
+
+    return view;
+}
+
+//==========================================================================
+// Helper function that will compress an image. The GIL does not need to
+// be held.
+//
+// Parameters:
+//  view - The image to compress
+//
+// Return:
+//  The compressed image, the data must be released with free
+//==========================================================================
+static EncodedImage encode_view(const ImageView & view)
+{
+    ChannelInfo info[3];
+    EncodedImage result;
+    Arena * arena = &thread_arena.arena;
+
+    // Convert Straight From the Array
+    arena_reset(arena);
+    store_image(view.data, view.strides[0], view.strides[1], view.strides[2],
+                view.width, view.height, view.channels, info, arena);
+
+    // Compress Into Memory
+    OutStream * stream = open_memory_stream(view.width, view.height, info, view.channels);
+    compress_img(view.channels, info, arena, stream);
+    result.data = close_memory_stream(stream, &result.size);
+
+    return result;
+}
+
+//==========================================================================
+// Helper function that will turn a compressed image into Python bytes.
+// The GIL must be held.
+//
+// Parameters:
+//  image - The compressed image, its data is released
+//
+// Return:
+//  The bytes object
+//==========================================================================
+static p::object to_bytes(EncodedImage & image)
+{
+    PyObject * bytes = PyBytes_FromStringAndSize(reinterpret_cast<const char *>(image.data), image.size);
+    free(image.data);
+    image.data = NULL;
+
+    return p::object(p::handle<>(bytes));
+}
+
+//==========================================================================
+// Compress a single image.
+//
+// Parameters:
+//  image - A HxW or HxWx3 uint8 array
+//
+// Return:
+//  The JPEG file as bytes
+//==========================================================================
+p::object py_encode(np::ndarray image)
+{
+    ImageView view = get_view(image);
+    EncodedImage result;
+
+    {
+        ReleaseGIL release;
+        std::shared_lock<std::shared_timed_mutex> lock(table_lock);
+        result = encode_view(view);
+    }
+
+    return to_bytes(result);
+}
+
+//==========================================================================
+// Compress a list of images on native threads.
+//
+// Parameters:
+//  images  - A list of HxW or HxWx3 uint8 arrays
+//  threads - The number of threads, 0 for one per CPU
+//
+// Return:
+//  A list of the JPEG files as bytes
+//==========================================================================
+p::list py_encode_batch(p::list images, unsigned int threads)
+{
+    size_t count = (size_t)p::len(images);
+    std::vector<np::ndarray> arrays;
+    std::vector<ImageView> views;
+    std::vector<EncodedImage> results(count);
+    std::atomic<size_t> next(0);
+
+    // Keep a Reference to Every Array While the GIL is Released
+    for (size_t i = 0; i < count; i++)
+    {
+        arrays.push_back(p::extract<np::ndarray>(images[i]));
+        views.push_back(get_view(arrays.back()));
+    }
+
+    if (threads == 0)
+    {
+        threads = std::thread::hardware_concurrency();
+    }
+    if (threads > count)
+    {
+        threads = (unsigned int)count;
+    }
+
+    {
+        ReleaseGIL release;
+        std::shared_lock<std::shared_timed_mutex> lock(table_lock);
+        std::vector<std::thread> pool;
+
+        auto worker = [&]()
+        {
+            for (size_t i = next++; i < count; i = next++)
+            {
+                results[i] = encode_view(views[i]);
+            }
+        };
+
+        for (unsigned int i = 1; i < threads; i++)
+        {
+            pool.emplace_back(worker);
+        }
+        worker();
+
+        for (auto & thread : pool)
+        {
+            thread.join();
+        }
+    }
+
+    p::list output;
+    for (size_t i = 0; i < count; i++)
+    {
+        output.append(to_bytes(results[i]));
+    }
+
+    return output;
+}
+
+//==========================================================================
+// Set the quality of the quantization tables used by every encode. This
+// waits for any running encodes to finish.
+//
+// Parameters:
+//  quality - An integer from 1 to 100, 50 is normal quality
+//==========================================================================
+void py_set_quality(unsigned int quality)
+{
+    ReleaseGIL release;
+    std::unique_lock<std::shared_timed_mutex> lock(table_lock);
+    init_qtable(quality);
+}
+
+BOOST_PYTHON_MODULE(jpeg_py)
+{
+    np::initialize();
+    init_qtable(50);
+
+    p::def("encode", py_encode, (p::arg("image")));
+    p::def("encode_batch", py_encode_batch, (p::arg("images"), p::arg("threads") = 0));
+    p::def("set_quality", py_set_quality, (p::arg("quality")));
+}
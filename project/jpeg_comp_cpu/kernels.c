@@ -0,0 +1,600 @@
+//==========================================================================
+// This file picks the kernel variant to use. The CPU features are read
+// with cpuid and the best variant the CPU supports is used unless the
+// JPEG_KERNELS environment variable names another one. Before a variant
+// is used it is checked against the scalar reference.
+//==========================================================================
+
+#include "kernels.h"
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+#include "reader.h"
+
+#if defined(KERNELS_X86) && defined(_MSC_VER)
+#include <intrin.h>
+#elif defined(KERNELS_X86)
+#include <cpuid.h>
+#endif
+
+//==========================================================================
+// Number of test blocks used to check a variant before it is used
+//==========================================================================
+#define CHECK_BLOCKS 512
+
+//==========================================================================
+// The scalar reference kernels
+//==========================================================================
+const Kernels scalar_kernels =
+{
+    "scalar",
+    fdct,
+    quant_zigzag,
+    zero_rle,
+    encode,
+    store_rgb_row,
+    store_rgb_mcu
+};
+
+//==========================================================================
+// Local Variables to hold the variant names and the kernels in use
+//==========================================================================
+static const char * variant_names[KERNELS_COUNT] = { "scalar", "sse41", "avx2", "avx512" };
+static const Kernels * selected_kernels = NULL;
+static int preferred_variant = -1;
+
+#ifdef KERNELS_X86
+//==========================================================================
+// Helper function that will run the cpuid instruction.
+//
+// Parameters:
+//  leaf - The cpuid leaf (EAX)
+//  sub  - The cpuid sub-leaf (ECX)
+//  regs - An array to store EAX, EBX, ECX & EDX in
+//==========================================================================
+void read_cpuid(unsigned int leaf, unsigned int sub, unsigned int * regs)
+{
+#if defined(_MSC_VER)
+    __cpuidex((int *)regs, (int)leaf, (int)sub);
+#else
+    __cpuid_count(leaf, sub, regs[0], regs[1], regs[2], regs[3]);
+#endif
+}
+
+//==========================================================================
+// Helper function that will read the register state the OS saves (XCR0).
+//
+// Return:
+//  The value of XCR0
+//==========================================================================
+unsigned long long read_xcr0()
+{
+#if defined(_MSC_VER)
+    return _xgetbv(0);
+#else
+    unsigned int eax;
+    unsigned int edx;
+    __asm__ volatile ("xgetbv" : "=a"(eax), "=d"(edx) : "c"(0));
+    return ((unsigned long long)edx << 32) | eax;
+#endif
+}
+#endif
+
+//==========================================================================
+// Helper function that will find the best variant the CPU supports. Each
+// variant needs all of the features of the ones before it.
+//
+// Return:
+//  One of the KERNELS_* values
+//==========================================================================
+unsigned int cpu_variant()
+{
+#ifdef KERNELS_X86
+    unsigned int regs[4];
+    unsigned long long xcr0 = 0;
+
+    read_cpuid(0, 0, regs);
+    unsigned int max_leaf = regs[0];
+
+    read_cpuid(1, 0, regs);
+    unsigned int sse41 = (regs[2] >> 19) & 1;
+    unsigned int osxsave = (regs[2] >> 27) & 1;
+    unsigned int avx = (regs[2] >> 28) & 1;
+    if (osxsave)
+    {
+        xcr0 = read_xcr0();
+    }
+
+    unsigned int leaf7 = 0;
+    if (max_leaf >= 7)
+    {
+        read_cpuid(7, 0, regs);
+        leaf7 = regs[1];
+    }
+
+    read_cpuid(0x80000000, 0, regs);
+    unsigned int lzcnt = 0;
+    if (regs[0] >= 0x80000001)
+    {
+        read_cpuid(0x80000001, 0, regs);
+        lzcnt = (regs[2] >> 5) & 1;
+    }
+
+    // SSE4.1
+    if (!sse41)
+        return KERNELS_SCALAR;
+
+    // AVX2, BMI1, BMI2 & LZCNT With the YMM State Saved by the OS
+    if (!avx || !((leaf7 >> 5) & 1) || !((leaf7 >> 3) & 1) || !((leaf7 >> 8) & 1) || !lzcnt ||
+        ((xcr0 & 0x6) != 0x6))
+        return KERNELS_SSE41;
+
+    // AVX-512 F, BW & VL With the ZMM State Saved by the OS
+    if (!((leaf7 >> 16) & 1) || !((leaf7 >> 30) & 1) || !((leaf7 >> 31) & 1) || ((xcr0 & 0xE6) != 0xE6))
+        return KERNELS_AVX2;
+
+    return KERNELS_AVX512;
+#else
+    return KERNELS_SCALAR;
+#endif
+}
+
+//==========================================================================
+// Get the name of the CPU, used to check that a tuning profile was made on
+// the same kind of CPU.
+//
+// Parameters:
+//  name - The buffer to store the name in
+//  size - The size of the buffer
+//==========================================================================
+void cpu_name(char * name, size_t size)
+{
+    snprintf(name, size, "unknown");
+
+#ifdef KERNELS_X86
+    unsigned int regs[13];
+
+    read_cpuid(0x80000000, 0, regs);
+    if (regs[0] >= 0x80000004)
+    {
+        // Brand String, Without the Leading & Repeated Spaces
+        for (unsigned int i = 0; i < 3; i++)
+        {
+            read_cpuid(0x80000002 + i, 0, &regs[i * 4]);
+        }
+        regs[12] = 0;
+
+        const char * brand = (const char *)regs;
+        size_t length = 0;
+        for (unsigned int i = 0; (brand[i] != '\0') && (length + 1 < size); i++)
+        {
+            if ((brand[i] != ' ') || ((length > 0) && (name[length - 1] != ' ')))
+            {
+                name[length++] = brand[i];
+            }
+        }
+        while ((length > 0) && (name[length - 1] == ' '))
+        {
+            length--;
+        }
+        name[length] = '\0';
+    }
+#endif
+}
+
+//==========================================================================
+// Look up a kernel variant by name.
+//
+// Parameters:
+//  name - The name of the variant, such as "avx2"
+//
+// Return:
+//  One of the KERNELS_* values or -1 if there is no variant with the name
+//==========================================================================
+int kernel_variant_id(const char * name)
+{
+    for (unsigned int variant = 0; variant < KERNELS_COUNT; variant++)
+    {
+        if (strcmp(name, variant_names[variant]) == 0)
+        {
+            return (int)variant;
+        }
+    }
+
+    return -1;
+}
+
+//==========================================================================
+// Set the variant get_kernels picks instead of the best one the CPU
+// supports, such as the fastest one found by calibrate. It must be called
+// before the kernels are picked. JPEG_KERNELS still overrides it, and a
+// variant the CPU does not support is ignored.
+//
+// Parameters:
+//  variant - One of the KERNELS_* values
+//==========================================================================
+void set_kernel_preference(unsigned int variant)
+{
+    preferred_variant = (int)variant;
+}
+
+//==========================================================================
+// Get one of the kernel variants.
+//
+// Parameters:
+//  variant - One of the KERNELS_* values
+//
+// Return:
+//  The kernel function table or NULL if the variant was not built or is
+//  not supported by the CPU
+//==========================================================================
+const Kernels * get_kernel_variant(unsigned int variant)
+{
+    if (variant > cpu_variant())
+    {
+        return NULL;
+    }
+
+    switch (variant)
+    {
+#ifdef KERNELS_X86
+    case KERNELS_SSE41:
+        return &sse41_kernels;
+    case KERNELS_AVX2:
+        return &avx2_kernels;
+    case KERNELS_AVX512:
+        return &avx512_kernels;
+#endif
+    case KERNELS_SCALAR:
+        return &scalar_kernels;
+    }
+
+    return NULL;
+}
+
+//==========================================================================
+// Get the kernels to use. The first call picks the kernels, so it must be
+// made before any encoding threads are started (init_qtable does this).
+//
+// Return:
+//  The kernel function table
+//==========================================================================
+const Kernels * get_kernels()
+{
+    if (selected_kernels != NULL)
+    {
+        return selected_kernels;
+    }
+
+    const Kernels * kernels = get_kernel_variant(cpu_variant());
+    const char * name = getenv("JPEG_KERNELS");
+
+    // Tuned Variant
+    if ((preferred_variant >= 0) && (get_kernel_variant(preferred_variant) != NULL))
+    {
+        kernels = get_kernel_variant(preferred_variant);
+    }
+
+    // Forced Variant
+    if ((name != NULL) && (name[0] != '\0'))
+    {
+        int variant = kernel_variant_id(name);
+
+        if (variant < 0)
+        {
+            printf("Unknown JPEG_KERNELS Variant: %s\n", name);
+        }
+        else if (get_kernel_variant(variant) == NULL)
+        {
+            printf("JPEG_KERNELS Variant Not Supported By This CPU: %s\n", name);
+        }
+        else
+        {
+            kernels = get_kernel_variant(variant);
+        }
+    }
+
+    // Never Use a Variant That Does Not Match the Reference
+    if ((kernels != &scalar_kernels) && (check_kernels(kernels, CHECK_BLOCKS) != 0))
+    {
+        printf("The %s Kernels Do Not Match the Scalar Kernels, Using Scalar\n", kernels->name);
+        kernels = &scalar_kernels;
+    }
+
+    selected_kernels = kernels;
+    return selected_kernels;
+}
+
+//==========================================================================
+// Helper function that will generate the next pseudo random number. A
+// fixed generator is used so every run checks the same blocks.
+//
+// Parameters:
+//  seed - A pointer to the generator state
+//
+// Return:
+//  A random number from 0 to 32767
+//==========================================================================
+unsigned int check_rand(unsigned int * seed)
+{
+    *seed = *seed * 1103515245 + 12345;
+    return (*seed >> 16) & 0x7FFF;
+}
+
+//==========================================================================
+// Helper function that will fill a block with one of several patterns:
+// noise, a gradient, black & white, or flat with a single outlier.
+//
+// Parameters:
+//  block - A pointer to a 8x8 block
+//  n     - The test number, it picks the pattern
+//  seed  - A pointer to the generator state
+//==========================================================================
+void check_block(unsigned char * block, unsigned int n, unsigned int * seed)
+{
+    unsigned int base = check_rand(seed) & 0xFF;
+
+    for (unsigned int i = 0; i < 8 * 8; i++)
+    {
+        switch (n % 4)
+        {
+        case 0:
+            block[i] = (unsigned char)check_rand(seed);
+            break;
+        case 1:
+            block[i] = (unsigned char)min(255, base / 2 + (i % 8) * 8 + (i / 8) * 4 + (check_rand(seed) & 7));
+            break;
+        case 2:
+            block[i] = (check_rand(seed) & 1) ? 255 : 0;
+            break;
+        default:
+            block[i] = (unsigned char)base;
+            break;
+        }
+    }
+
+    if ((n % 4) == 3)
+    {
+        block[check_rand(seed) % 64] = (unsigned char)check_rand(seed);
+    }
+}
+
+//==========================================================================
+// Helper function that will check the color conversion kernel. Rows of
+// random pixels, including pure blue which wraps the Cb sample, are stored
+// in a 48x16 image.
+//
+// Parameters:
+//  kernels - The kernel function table to check
+//  count   - The number of test rows
+//
+// Return:
+//  0 if the kernel matches, otherwise -1
+//==========================================================================
+int check_rgb_row(const Kernels * kernels, unsigned int count)
+{
+    static const unsigned int widths[5] = { 48, 47, 33, 9, 1 };
+    unsigned char planes[2][48 * 16 + 2 * 24 * 8];
+    unsigned char rgb[48 * 3];
+    ChannelInfo info[2][3];
+    unsigned int seed = 7;
+    int result = 0;
+
+    memset(planes, 0x5A, sizeof(planes));
+    for (unsigned int k = 0; k < 2; k++)
+    {
+        info[k][0].data = planes[k];
+        info[k][0].width = 48;
+        info[k][0].height = 16;
+        info[k][1].data = &planes[k][48 * 16];
+        info[k][2].data = &planes[k][48 * 16 + 24 * 8];
+        for (unsigned int c = 1; c < 3; c++)
+        {
+            info[k][c].width = 24;
+            info[k][c].height = 8;
+        }
+    }
+
+    for (unsigned int n = 0; n < count; n++)
+    {
+        unsigned int width = widths[n % 5];
+        unsigned int y = n % 16;
+
+        for (unsigned int i = 0; i < 48 * 3; i++)
+        {
+            rgb[i] = (unsigned char)check_rand(&seed);
+            if ((n % 3) == 0)
+            {
+                rgb[i] = ((i % 3) == 2) ? 255 : 0;
+            }
+        }
+
+        scalar_kernels.rgb_row(info[0], y, rgb, width);
+        kernels->rgb_row(info[1], y, rgb, width);
+
+        // Compare Every Row, Later Rows Overwrite the Chroma Samples
+        if (memcmp(planes[0], planes[1], sizeof(planes[0])) != 0)
+        {
+            printf("%s rgb_row Does Not Match\n", kernels->name);
+            result = -1;
+            break;
+        }
+    }
+
+    return result;
+}
+
+//==========================================================================
+// Helper function that will check the MCU color conversion kernel. Random
+// tiles, including pure blue which wraps the Cb sample, are read from a
+// strip with a stride that is not a multiple of the vector size.
+//
+// Parameters:
+//  kernels - The kernel function table to check
+//  count   - The number of test tiles
+//
+// Return:
+//  0 if the kernel matches, otherwise -1
+//==========================================================================
+int check_rgb_mcu(const Kernels * kernels, unsigned int count)
+{
+    const size_t stride = 17 * 3;
+    unsigned char rgb[16 * 17 * 3];
+    unsigned char blocks[2][6 * 64];
+    unsigned int seed = 11;
+
+    for (unsigned int n = 0; n < count; n++)
+    {
+        for (unsigned int i = 0; i < sizeof(rgb); i++)
+        {
+            rgb[i] = (unsigned char)check_rand(&seed);
+            if (((n % 3) == 0) && (((i / 3) % 5) == 0))
+            {
+                rgb[i] = ((i % 3) == 2) ? 255 : 0;
+            }
+        }
+
+        scalar_kernels.rgb_mcu(&rgb[n % 2 * 3], stride, blocks[0]);
+        kernels->rgb_mcu(&rgb[n % 2 * 3], stride, blocks[1]);
+        if (memcmp(blocks[0], blocks[1], sizeof(blocks[0])) != 0)
+        {
+            printf("%s rgb_mcu Does Not Match\n", kernels->name);
+            return -1;
+        }
+    }
+
+    return 0;
+}
+
+//==========================================================================
+// Check that a kernel table gives exactly the same output as the scalar
+// reference.
+//
+// Parameters:
+//  kernels - The kernel function table to check
+//  count   - The number of test blocks to run through each kernel
+//
+// Return:
+//  0 if every kernel matches, otherwise -1
+//==========================================================================
+int check_kernels(const Kernels * kernels, unsigned int count)
+{
+    unsigned char block[8 * 8];
+    unsigned char qTable[8 * 8];
+    float dct[2][8 * 8];
+    short zz[2][8 * 8];
+    RLEInfo rle[2][256];
+    unsigned int rle_length[2];
+    short prev_dc[2] = { 0, 0 };
+    unsigned char * data[2];
+    size_t size[2];
+    unsigned int seed = 1;
+    int result = 0;
+    OutStream * stream[2] = { stream_open_memory(), stream_open_memory() };
+
+    for (unsigned int n = 0; (n < count) && (result == 0); n++)
+    {
+        check_block(block, n, &seed);
+        for (unsigned int i = 0; i < 8 * 8; i++)
+        {
+            qTable[i] = (unsigned char)(1 + check_rand(&seed) % (((n % 2) == 0) ? 16 : 255));
+        }
+
+        // DCT
+        scalar_kernels.fdct(block, dct[0]);
+        kernels->fdct(block, dct[1]);
+        if (memcmp(dct[0], dct[1], sizeof(dct[0])) != 0)
+        {
+            printf("%s fdct Does Not Match\n", kernels->name);
+            result = -1;
+        }
+
+        // Quantization
+        scalar_kernels.quantize(dct[0], qTable, zz[0]);
+        kernels->quantize(dct[0], qTable, zz[1]);
+        if (memcmp(zz[0], zz[1], sizeof(zz[0])) != 0)
+        {
+            printf("%s quantize Does Not Match\n", kernels->name);
+            result = -1;
+        }
+
+        // Sparse Blocks With Long Zero Runs
+        if ((n % 5) == 4)
+        {
+            memset(zz[0], 0, sizeof(zz[0]));
+            for (unsigned int i = 0; i < 3; i++)
+            {
+                zz[0][check_rand(&seed) % 64] = (short)(check_rand(&seed) % 2047) - 1023;
+            }
+        }
+
+        // Run Length Encoding
+        scalar_kernels.rle(zz[0], rle[0], &rle_length[0], &prev_dc[0]);
+        kernels->rle(zz[0], rle[1], &rle_length[1], &prev_dc[1]);
+        if ((rle_length[0] != rle_length[1]) || (prev_dc[0] != prev_dc[1]) ||
+            (memcmp(rle[0], rle[1], rle_length[0] * sizeof(RLEInfo)) != 0))
+        {
+            printf("%s rle Does Not Match\n", kernels->name);
+            result = -1;
+        }
+
+        // Huffman Encoding
+        scalar_kernels.encode(rle[0], 1, get_huffman_table(1, n % 2), stream[0]);
+        scalar_kernels.encode(&rle[0][1], rle_length[0] - 1, get_huffman_table(0, n % 2), stream[0]);
+        kernels->encode(rle[0], 1, get_huffman_table(1, n % 2), stream[1]);
+        kernels->encode(&rle[0][1], rle_length[0] - 1, get_huffman_table(0, n % 2), stream[1]);
+        if ((stream[0]->current_byte != stream[1]->current_byte) ||
+            (stream[0]->current_bit_cnt != stream[1]->current_bit_cnt))
+        {
+            printf("%s encode Does Not Match\n", kernels->name);
+            result = -1;
+        }
+    }
+
+    data[0] = stream_close_memory(stream[0], &size[0]);
+    data[1] = stream_close_memory(stream[1], &size[1]);
+    if ((result == 0) && ((size[0] != size[1]) || (memcmp(data[0], data[1], size[0]) != 0)))
+    {
+        printf("%s encode Does Not Match\n", kernels->name);
+        result = -1;
+    }
+    free(data[0]);
+    free(data[1]);
+
+    // Color Conversion
+    if (result == 0)
+    {
+        result = check_rgb_row(kernels, count);
+    }
+
+    if (result == 0)
+    {
+        result = check_rgb_mcu(kernels, count);
+    }
+
+    return result;
+}
+
+//==========================================================================
+// Print the kernel variants, whether they are supported and checked, and
+// which one is in use.
+//==========================================================================
+void print_kernels()
+{
+    const Kernels * kernels = get_kernels();
+
+    for (unsigned int i = 0; i < KERNELS_COUNT; i++)
+    {
+        const Kernels * variant = get_kernel_variant(i);
+        const char * status = "not supported";
+
+        if (variant != NULL)
+        {
+            status = (check_kernels(variant, 16 * CHECK_BLOCKS) == 0) ? "matches scalar" : "DOES NOT MATCH";
+        }
+
+        printf("%c %-8s %s\n", (variant == kernels) ? '*' : ' ', variant_names[i], status);
+    }
+}
@@ -0,0 +1,164 @@
+//==========================================================================
+// This file contains the table of hot kernels used by the encoder. The
+// kernels are built for several instruction sets and the best one the CPU
+// supports is picked once at start up.
+//==========================================================================
+
+#ifndef KERNELS_H
+#define KERNELS_H
+
+#include "encoder.h"
+#include "writer.h"
+#include "tables.h"
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+//==========================================================================
+// The instruction set specific kernels are only built for x86
+//==========================================================================
+#if defined(__x86_64__) || defined(__i386__) || defined(_M_X64) || defined(_M_IX86)
+#define KERNELS_X86
+#endif
+
+//==========================================================================
+// Kernel Variants, the environment variable JPEG_KERNELS can be set to the
+// name of a variant to force it to be used.
+//==========================================================================
+#define KERNELS_SCALAR 0
+#define KERNELS_SSE41  1
+#define KERNELS_AVX2   2
+#define KERNELS_AVX512 3
+#define KERNELS_COUNT  4
+
+//==========================================================================
+// Structure to hold the kernel function table
+//
+//  fdct     - Zero shift and 2D-DCT an 8x8 block (see dct2d)
+//  quantize - Quantize and zig-zag order the DCT (see quant_zigzag)
+//  rle      - Zero run length encode the block (see zero_rle)
+//  encode   - Huffman encode and pack the bits (see encode)
+//  rgb_row  - Convert a row of RGB to YCbCr planes (see store_rgb_row)
+//  rgb_mcu  - Convert a 16x16 RGB tile to the blocks of an MCU (see
+//             store_rgb_mcu)
+//==========================================================================
+typedef struct
+{
+    const char * name;
+    void (*fdct)(const unsigned char * block, float * output);
+    void (*quantize)(const float * input, const unsigned char * qTable, short * output);
+    void (*rle)(const short * input, RLEInfo * output, unsigned int * length, short * prev_dc);
+    void (*encode)(const RLEInfo * rle, unsigned int rle_length, const HuffTable * table, OutStream * stream);
+    void (*rgb_row)(ChannelInfo * info, unsigned int y, const unsigned char * rgb, unsigned int count);
+    void (*rgb_mcu)(const unsigned char * rgb, size_t stride, unsigned char * blocks);
+} Kernels;
+
+//==========================================================================
+// The kernel tables, the scalar table is the reference the other tables
+// are checked against.
+//==========================================================================
+extern const Kernels scalar_kernels;
+#ifdef KERNELS_X86
+extern const Kernels sse41_kernels;
+extern const Kernels avx2_kernels;
+extern const Kernels avx512_kernels;
+#endif
+
+//==========================================================================
+// Get the name of the CPU, used to check that a tuning profile was made on
+// the same kind of CPU.
+//
+// Parameters:
+//  name - The buffer to store the name in
+//  size - The size of the buffer
+//==========================================================================
+void cpu_name(char * name, size_t size);
+
+//==========================================================================
+// Look up a kernel variant by name.
+//
+// Parameters:
+//  name - The name of the variant, such as "avx2"
+//
+// Return:
+//  One of the KERNELS_* values or -1 if there is no variant with the name
+//==========================================================================
+int kernel_variant_id(const char * name);
+
+//==========================================================================
+// Set the variant get_kernels picks instead of the best one the CPU
+// supports, such as the fastest one found by calibrate. It must be called
+// before the kernels are picked. JPEG_KERNELS still overrides it, and a
+// variant the CPU does not support is ignored.
+//
+// Parameters:
+//  variant - One of the KERNELS_* values
+//==========================================================================
+void set_kernel_preference(unsigned int variant);
+
+//==========================================================================
+// Get the kernels to use. The first call picks the kernels, so it must be
+// made before any encoding threads are started (init_qtable does this).
+//
+// Return:
+//  The kernel function table
+//==========================================================================
+const Kernels * get_kernels();
+
+//==========================================================================
+// Get one of the kernel variants.
+//
+// Parameters:
+//  variant - One of the KERNELS_* values
+//
+// Return:
+//  The kernel function table or NULL if the variant was not built or is
+//  not supported by the CPU
+//==========================================================================
+const Kernels * get_kernel_variant(unsigned int variant);
+
+//==========================================================================
+// Check that a kernel table gives exactly the same output as the scalar
+// reference.
+//
+// Parameters:
+//  kernels - The kernel function table to check
+//  count   - The number of test blocks to run through each kernel
+//
+// Return:
+//  0 if every kernel matches, otherwise -1
+//==========================================================================
+int check_kernels(const Kernels * kernels, unsigned int count);
+
+//==========================================================================
+// Print the kernel variants, whether they are supported and checked, and
+// which one is in use.
+//==========================================================================
+void print_kernels();
+
+//==========================================================================
+// Scalar reference kernels, these are implemented in encoder.c & reader.c
+//==========================================================================
+void fdct(const unsigned char * block, float * output);
+void quant_zigzag(const float * input, const unsigned char * qTable, short * output);
+void zero_rle(const short * input, RLEInfo * output, unsigned int * length, short * prev_dc);
+void encode(const RLEInfo * rle, unsigned int rle_length, const HuffTable * table, OutStream * stream);
+
+//==========================================================================
+// Helper function for fetching the Huffman code tables
+//
+// Parameters:
+//  isDC    - Flag for we are requesting the DC codes
+//  channel - The codes for this specified channel
+//
+// Return:
+//  Huffman code table
+//==========================================================================
+const HuffTable * get_huffman_table(unsigned char isDC, unsigned int channel);
+
+#ifdef __cplusplus
+}
+#endif
+
+#endif /* KERNELS_H */
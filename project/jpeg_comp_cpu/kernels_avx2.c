@@ -0,0 +1,16 @@
+//==========================================================================
+// This file builds the AVX2 kernels. It needs to be compiled with the
+// AVX2 instruction set enabled, see the Makefile.
+//==========================================================================
+
+#include "kernels.h"
+
+#ifdef KERNELS_X86
+
+#define KERNEL_NAME(name) name##_avx2
+#define KERNEL_TABLE      avx2_kernels
+#define KERNEL_ISA        "avx2"
+
+#include "kernels_impl.h"
+
+#endif
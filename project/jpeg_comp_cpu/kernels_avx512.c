@@ -0,0 +1,16 @@
+//==========================================================================
+// This file builds the AVX-512 kernels. It needs to be compiled with the
+// AVX-512 instruction set enabled, see the Makefile.
+//==========================================================================
+
+#include "kernels.h"
+
+#ifdef KERNELS_X86
+
+#define KERNEL_NAME(name) name##_avx512
+#define KERNEL_TABLE      avx512_kernels
+#define KERNEL_ISA        "avx512"
+
+#include "kernels_impl.h"
+
+#endif
@@ -0,0 +1,497 @@
+//==========================================================================
+// This file contains the portable versions of the hot kernels. It is
+// included by each of the kernels_<isa>.c files, which are compiled with
+// that instruction set enabled so the loops below are vectorized for it.
+// KERNEL_NAME(name) adds the instruction set to each function name and
+// KERNEL_TABLE is the name of the kernel function table.
+//
+// The kernels have to match the scalar reference bit for bit, so every
+// floating point operation is done in the same order as the reference and
+// the files are built with -ffp-contract=off (no fused multiply-add).
+//==========================================================================
+
+#include <stdlib.h>
+#include <string.h>
+#include <math.h>
+
+#include "kernels.h"
+
+#if defined(_MSC_VER)
+#include <intrin.h>
+#endif
+
+//==========================================================================
+// Helper function that will count the leading zeros of a non zero value.
+//
+// Parameters:
+//  value - The value, it must not be zero
+//
+// Return:
+//  The number of leading zero bits
+//==========================================================================
+static inline unsigned int KERNEL_NAME(clz)(unsigned int value)
+{
+#if defined(_MSC_VER)
+    unsigned long index;
+    _BitScanReverse(&index, value);
+    return 31 - index;
+#else
+    return __builtin_clz(value);
+#endif
+}
+
+//==========================================================================
+// Helper function that will count the trailing zeros of a non zero value.
+//
+// Parameters:
+//  value - The value, it must not be zero
+//
+// Return:
+//  The number of trailing zero bits
+//==========================================================================
+static inline unsigned int KERNEL_NAME(ctz64)(unsigned long long value)
+{
+#if defined(_MSC_VER) && defined(_M_X64)
+    unsigned long index;
+    _BitScanForward64(&index, value);
+    return index;
+#elif defined(_MSC_VER)
+    unsigned long index;
+    if (_BitScanForward(&index, (unsigned long)value))
+        return index;
+    _BitScanForward(&index, (unsigned long)(value >> 32));
+    return index + 32;
+#else
+    return __builtin_ctzll(value);
+#endif
+}
+
+//==========================================================================
+// Same as num_bits, the number of bits needed to store the absolute value.
+//
+// Parameter:
+//  value - The number to find the minimum number of bits to store
+//
+// Return:
+//  The minimum number of bits to store the specified value
+//==========================================================================
+static inline int KERNEL_NAME(num_bits)(int value)
+{
+    if (value == 0)
+        return 0;
+
+    int bits = 32 - KERNEL_NAME(clz)((unsigned int)abs(value));
+    return (bits > 15) ? 15 : bits;
+}
+
+//==========================================================================
+// Same as roundf, halfway cases are rounded away from zero. The fraction
+// is exact, so this only needs a truncate which every SIMD instruction set
+// from SSE4.1 on has.
+//
+// Parameter:
+//  value - The value to round
+//
+// Return:
+//  The rounded value
+//==========================================================================
+static inline float KERNEL_NAME(round)(float value)
+{
+    float whole = truncf(value);
+    float fraction = value - whole;
+
+    whole += (fraction >= 0.5f) ? 1.0f : 0.0f;
+    whole -= (fraction <= -0.5f) ? 1.0f : 0.0f;
+    return whole;
+}
+
+//==========================================================================
+// Same as cdct1d, the 8 columns are independent so they are done as one
+// vector per term.
+//
+// Parameters:
+//  block - A pointer to a 8x8 block
+//==========================================================================
+static inline void KERNEL_NAME(dct_columns)(float * block)
+{
+    for (unsigned int i = 0; i < 8; i++)
+    {
+        // Sum Terms
+        float s07 = block[i] + block[56 + i];
+        float s12 = block[8 + i] + block[16 + i];
+        float s34 = block[24 + i] + block[32 + i];
+        float s56 = block[40 + i] + block[48 + i];
+
+        // Difference Terms
+        float d07 = block[0 + i] - block[56 + i];
+        float d12 = block[8 + i] - block[16 + i];
+        float d34 = block[24 + i] - block[32 + i];
+        float d56 = block[40 + i] - block[48 + i];
+
+        // Combined Terms
+        float ss07s34 = s07 + s34;
+        float ss12s56 = s12 + s56;
+        float sd12d56 = d12 + d56;
+        float dd12d56 = d12 - d56;
+        float ds07s34 = s07 - s34;
+        float ds12s56 = s12 - s56;
+
+        // Combine More Terms w/ Multiply
+        float C4mds12s56 = C(4) * ds12s56;
+        float C4msd12d56 = C(4) * sd12d56;
+
+        block[i] = (C(4) * (ss07s34 + ss12s56));
+        block[8 + i] = (C(1) * (d07 + C4mds12s56) - S(1) * (-d34 - C4msd12d56));
+        block[16 + i] = (C(6) * dd12d56 + S(6) * ds07s34);
+        block[24 + i] = (C(3) * (d07 - C4mds12s56) - S(3) * (d34 - C4msd12d56));
+        block[32 + i] = (C(4) * (ss07s34 - ss12s56));
+        block[40 + i] = (S(3) * (d07 - C4mds12s56) + C(3) * (d34 - C4msd12d56));
+        block[48 + i] = (-S(6) * dd12d56 + C(6) * ds07s34);
+        block[56 + i] = (S(1) * (d07 + C4mds12s56) + C(1) * (-d34 - C4msd12d56));
+    }
+}
+
+//==========================================================================
+// Zero shift and 2D-DCT an 8x8 block. The block is transposed so the row
+// DCT can be done with the same column kernel, then transposed back for
+// the column DCT.
+//
+// Parameters:
+//  block  - A pointer to a 8x8 pixels
+//  output - A pointer to store the 8x8 DCT in
+//==========================================================================
+static void KERNEL_NAME(fdct)(const unsigned char * block, float * output)
+{
+    float temp[8 * 8];
+
+    // Zero Shift & Transpose
+    for (unsigned int r = 0; r < 8; r++)
+    {
+        for (unsigned int c = 0; c < 8; c++)
+        {
+            temp[c * 8 + r] = (float)block[r * 8 + c] - 128.0f;
+        }
+    }
+
+    // Row 1D-DCT
+    KERNEL_NAME(dct_columns)(temp);
+
+    // Transpose Back
+    for (unsigned int r = 0; r < 8; r++)
+    {
+        for (unsigned int c = 0; c < 8; c++)
+        {
+            output[c * 8 + r] = temp[r * 8 + c];
+        }
+    }
+
+    // Column 1D-DCT
+    KERNEL_NAME(dct_columns)(output);
+}
+
+//==========================================================================
+// Quantize the DCT and store it in zig-zag order.
+//
+// Parameters:
+//  input  - A pointer to a 8x8 DCT
+//  qTable - A pointer to a 8x8 table of quaniztation values
+//  output - A pointer to store the zig-zag ordered values in
+//==========================================================================
+static void KERNEL_NAME(quantize)(const float * input, const unsigned char * qTable, short * output)
+{
+    short values[8 * 8];
+
+    for (unsigned int i = 0; i < 8 * 8; i++)
+    {
+        float value = KERNEL_NAME(round)(input[i] / (float)qTable[i]);
+        values[i] = (short)((int)value / 4);
+    }
+
+    for (unsigned int i = 0; i < 8 * 8; i++)
+    {
+        output[output_pattern[i]] = values[i];
+    }
+}
+
+//==========================================================================
+// Zero run length encode a zig-zag ordered block. The non zero AC terms
+// are found with a bit mask instead of testing every term in the loop.
+//
+// Parameters:
+//  input   - a pointer to the input 8x8 block (output of quantization)
+//  output  - a pointer to the output buffer
+//  length  - a pointer to the length of the output RLE
+//  prev_dc - a pointer to the previous DC component value
+//==========================================================================
+static void KERNEL_NAME(rle)(const short * input, RLEInfo * output, unsigned int * length, short * prev_dc)
+{
+    unsigned long long mask = 0;
+    int diff = input[0] - *prev_dc;
+    int idx = 0;
+    unsigned int last = 0;
+
+    // DPCM DC
+    *prev_dc = input[0];
+    output[0].zero_cnt = 0;
+    output[0].num_bits = KERNEL_NAME(num_bits)(diff);
+    output[0].value = diff;
+
+    // Mask of the Non Zero AC Terms
+    for (unsigned int i = 1; i < 8 * 8; i++)
+    {
+        mask |= (unsigned long long)(input[i] != 0) << i;
+    }
+
+    while (mask != 0)
+    {
+        unsigned int i = KERNEL_NAME(ctz64)(mask);
+        unsigned int zero_cnt = i - last - 1;
+        mask &= mask - 1;
+        last = i;
+        idx++;
+
+        while (zero_cnt > 15)
+        {
+            output[idx].zero_cnt = 15;
+            output[idx].num_bits = 0;
+            output[idx].value = 0;
+            idx++;
+            zero_cnt -= 16;
+        }
+
+        output[idx].zero_cnt = zero_cnt;
+        output[idx].num_bits = KERNEL_NAME(num_bits)(input[i]);
+        output[idx].value = input[i];
+    }
+
+    // Add EOB, Unless the Last Term is Non Zero
+    if (input[63] == 0)
+    {
+        idx++;
+        output[idx].zero_cnt = 0;
+        output[idx].num_bits = 0;
+        output[idx].value = 0;
+    }
+
+    *length = idx + 1;
+}
+
+//==========================================================================
+// Huffman encode the run length encoding and write it to the stream. The
+// codes are collected in a 64-bit word and written out a byte at a time,
+// instead of a bit field at a time like write_stream.
+//
+// Parameters:
+//  rle        - a pointer to the input buffer of run-length ecoded data
+//  rle_length - the size of the rle data
+//  table      - Huffman Code Table
+//  stream     - The output stream
+//==========================================================================
+static void KERNEL_NAME(encode)(const RLEInfo * rle, unsigned int rle_length, const HuffTable * table, OutStream * stream)
+{
+    unsigned int bit_cnt = stream->current_bit_cnt;
+    unsigned long long bits = stream->current_byte >> (8 - bit_cnt);
+
+    for (unsigned int i = 0; i < rle_length; i++)
+    {
+        unsigned int num_bits = rle[i].num_bits;
+        int additional = rle[i].value;
+        if (additional < 0)
+        {
+            additional += (1 << num_bits) - 1;
+        }
+
+        // Code Followed by the Additional Bits
+        const HuffInfo * info = &table->code[(rle[i].zero_cnt << 4) + num_bits];
+        unsigned int length = info->length;
+        unsigned int code = ((info->value & ((1u << length) - 1)) << num_bits) |
+                            ((unsigned int)additional & ((1u << num_bits) - 1));
+
+        bits = (bits << (length + num_bits)) | code;
+        bit_cnt += length + num_bits;
+
+        // Write the Full Bytes, 0xFF is Followed by a Stuffed 0x00
+        while (bit_cnt >= 8)
+        {
+            bit_cnt -= 8;
+            unsigned char value = (unsigned char)(bits >> bit_cnt);
+            stream_put(stream, value);
+            if (value == 0xFF)
+            {
+                stream_put(stream, 0);
+            }
+        }
+        bits &= (1ull << bit_cnt) - 1;
+    }
+
+    stream->current_byte = (unsigned char)(bits << (8 - bit_cnt));
+    stream->current_bit_cnt = (unsigned char)bit_cnt;
+}
+
+//==========================================================================
+// Helper function that will convert one pixel to Cb, same as store_rgb_row.
+//
+// Parameters:
+//  rgb - The packed 24-bit RGB pixel
+//
+// Return:
+//  The Cb sample
+//==========================================================================
+static inline unsigned char KERNEL_NAME(cb)(const unsigned char * rgb)
+{
+    float r = rgb[0];
+    float g = rgb[1];
+    float b = rgb[2];
+    return (unsigned char)(int)KERNEL_NAME(round)(128.0f - 0.168736f * r - 0.331264f * g + 0.5f * b);
+}
+
+//==========================================================================
+// Helper function that will convert one pixel to Cr, same as store_rgb_row.
+//
+// Parameters:
+//  rgb - The packed 24-bit RGB pixel
+//
+// Return:
+//  The Cr sample
+//==========================================================================
+static inline unsigned char KERNEL_NAME(cr)(const unsigned char * rgb)
+{
+    float r = rgb[0];
+    float g = rgb[1];
+    float b = rgb[2];
+    return (unsigned char)(int)KERNEL_NAME(round)(128.0f + 0.5f * r - 0.418688f * g - 0.081312f * b);
+}
+
+//==========================================================================
+// Convert one row of RGB pixels to YCbCr and store it in the block
+// ordered planes. The Y samples of each block row and the Cb & Cr samples
+// of each chroma block row are contiguous, so they are done 8 at a time.
+//
+// Parameters:
+//  info  - The channel information
+//  y     - The row number
+//  rgb   - The packed 24-bit RGB pixels
+//  count - The number of pixels in the row
+//==========================================================================
+static void KERNEL_NAME(rgb_row)(ChannelInfo * info, unsigned int y, const unsigned char * rgb, unsigned int count)
+{
+    unsigned int row = y % 8;
+    unsigned int yblock = y / 8;
+    unsigned int alt = (row % 4) / 2;
+    unsigned char * lum = &info[0].data[(yblock * info[0].width * 8) + (row * 8)];
+
+    // Y Channel
+    for (unsigned int x = 0; x < count; x += 8)
+    {
+        const unsigned char * src = &rgb[x * 3];
+        unsigned char * dst = &lum[x * 8];
+        unsigned int n = (count - x < 8) ? count - x : 8;
+
+        for (unsigned int i = 0; i < n; i++)
+        {
+            float r = src[i * 3];
+            float g = src[i * 3 + 1];
+            float b = src[i * 3 + 2];
+            dst[i] = (unsigned char)(0.299f * r + 0.587f * g + 0.114f * b);
+        }
+    }
+
+    // Cb/Cr Channels, Sample j Comes From Pixel 2j + alt (Cb) and
+    // Pixel 2j + 1 - alt (Cr)
+    if ((row % 2) == 0)
+    {
+        unsigned int offset = ((yblock / 2) * info[1].width * 8) + (yblock % 2) * 8 * 4 + row * 4;
+        unsigned char * cb = &info[1].data[offset];
+        unsigned char * cr = &info[2].data[offset];
+        unsigned int samples = (count + 1) / 2;
+        unsigned int j = 0;
+
+        // Whole Chroma Blocks
+        for (; j + 8 <= count / 2; j += 8)
+        {
+            const unsigned char * src = &rgb[j * 2 * 3];
+            unsigned char * cb_dst = &cb[j * 8];
+            unsigned char * cr_dst = &cr[j * 8];
+
+            for (unsigned int i = 0; i < 8; i++)
+            {
+                cb_dst[i] = KERNEL_NAME(cb)(&src[(2 * i + alt) * 3]);
+                cr_dst[i] = KERNEL_NAME(cr)(&src[(2 * i + 1 - alt) * 3]);
+            }
+        }
+
+        // Partial Block at the End of the Row
+        for (; j < samples; j++)
+        {
+            unsigned int idx = (j / 8) * 8 * 8 + (j % 8);
+
+            if (2 * j + alt < count)
+                cb[idx] = KERNEL_NAME(cb)(&rgb[(2 * j + alt) * 3]);
+
+            if (2 * j + 1 - alt < count)
+                cr[idx] = KERNEL_NAME(cr)(&rgb[(2 * j + 1 - alt) * 3]);
+        }
+    }
+}
+
+//==========================================================================
+// Convert a 16x16 tile of RGB pixels to the blocks of one MCU. Each row of
+// the tile is two rows of luminance blocks and every other row is a row
+// of the Cb & Cr blocks, so they are done 8 samples at a time.
+//
+// Parameters:
+//  rgb    - The top left pixel of the tile, packed 24-bit RGB
+//  stride - The distance between the rows of the tile in bytes
+//  blocks - The 6 8x8 blocks to store the MCU in
+//==========================================================================
+static void KERNEL_NAME(rgb_mcu)(const unsigned char * rgb, size_t stride, unsigned char * blocks)
+{
+    for (unsigned int y = 0; y < 16; y++)
+    {
+        const unsigned char * row = &rgb[y * stride];
+
+        // Y Channel, the Left Block Then the Right Block
+        for (unsigned int h = 0; h < 2; h++)
+        {
+            const unsigned char * src = &row[h * 8 * 3];
+            unsigned char * dst = &blocks[((y / 8) * 2 + h) * 64 + (y % 8) * 8];
+
+            for (unsigned int i = 0; i < 8; i++)
+            {
+                float r = src[i * 3];
+                float g = src[i * 3 + 1];
+                float b = src[i * 3 + 2];
+                dst[i] = (unsigned char)(0.299f * r + 0.587f * g + 0.114f * b);
+            }
+        }
+
+        // Cb/Cr Channels, Sample j Comes From Pixel 2j + alt (Cb) and
+        // Pixel 2j + 1 - alt (Cr)
+        if ((y % 2) == 0)
+        {
+            unsigned int alt = (y % 4) / 2;
+            unsigned char * cb = &blocks[4 * 64 + (y / 2) * 8];
+            unsigned char * cr = &blocks[5 * 64 + (y / 2) * 8];
+
+            for (unsigned int i = 0; i < 8; i++)
+            {
+                cb[i] = KERNEL_NAME(cb)(&row[(2 * i + alt) * 3]);
+                cr[i] = KERNEL_NAME(cr)(&row[(2 * i + 1 - alt) * 3]);
+            }
+        }
+    }
+}
+
+//==========================================================================
+// The kernel function table
+//==========================================================================
+const Kernels KERNEL_TABLE =
+{
+    KERNEL_ISA,
+    KERNEL_NAME(fdct),
+    KERNEL_NAME(quantize),
+    KERNEL_NAME(rle),
+    KERNEL_NAME(encode),
+    KERNEL_NAME(rgb_row),
+    KERNEL_NAME(rgb_mcu)
+};
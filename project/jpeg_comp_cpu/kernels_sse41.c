@@ -0,0 +1,16 @@
+//==========================================================================
+// This file builds the SSE4.1 kernels. It needs to be compiled with the
+// SSE4.1 instruction set enabled, see the Makefile.
+//==========================================================================
+
+#include "kernels.h"
+
+#ifdef KERNELS_X86
+
+#define KERNEL_NAME(name) name##_sse41
+#define KERNEL_TABLE      sse41_kernels
+#define KERNEL_ISA        "sse41"
+
+#include "kernels_impl.h"
+
+#endif
@@ -4,68 +4,696 @@
 
 #include "jpeg_file.h"
 #include "encoder.h"
+#include "reader.h"
+#include "tiler.h"
+#include "kernels.h"
+#include "mjpeg.h"
+#include "transcode.h"
+#include "qtune.h"
+#include "sweep.h"
+#include "server.h"
+#include "wisdom.h"
+
+//==========================================================================
+// Maximum number of scaled outputs (1/2, 1/4 & 1/8)
+//==========================================================================
+#define MAX_SCALED 3
+
+//==========================================================================
+// Minimum size of each chunk of memory in the image arena
+//==========================================================================
+#define ARENA_CHUNK_SIZE (4 * 1024 * 1024)
+
+//==========================================================================
+// Helper function that will build the output file name for a scaled
+// output. The scale factor is inserted before the file extension, so
+// "output.jpg" with a factor of 4 becomes "output_s4.jpg".
+//
+// Parameters:
+//  file_name - The full size output file name
+//  factor    - The reduction factor
+//  output    - The buffer to store the scaled output file name in
+//  size      - The size of the output buffer
+//==========================================================================
+void scaled_file_name(const char * file_name, unsigned int factor, char * output, size_t size)
+{
+    const char * ext = strrchr(file_name, '.');
+    int base_len = (ext != NULL) ? (int)(ext - file_name) : (int)strlen(file_name);
+
+    snprintf(output, size, "%.*s_s%u%s", base_len, file_name, factor, (ext != NULL) ? ext : "");
+}
+
+//==========================================================================
+// Helper function that will check if an option is on the command line.
+//
+// Parameters:
+//  argc   - The number of arguments
+//  argv   - The arguments
+//  option - The option to look for
+//
+// Return:
+//  Not 0 if the option is there
+//==========================================================================
+int has_option(int argc, char * argv[], const char * option)
+{
+    for (int i = 1; i < argc; i++)
+    {
+        if (strcmp(argv[i], option) == 0)
+        {
+            return 1;
+        }
+    }
+
+    return 0;
+}
 
 //==========================================================================
 // This is the main entry point to the JPEG encoder application. The
 // application will take the specified raw input file and and convert it
 // to a JPEG image.
 //
-// Usage: jpeg_comp_cpu.exe [raw input file] [width] [height] [channels] [output file]
+// Usage: jpeg_comp_cpu.exe [raw input file] [width] [height] [channels] [output file] [options]
+//        jpeg_comp_cpu.exe [pgm/ppm input file] [output file] [options]
+//        jpeg_comp_cpu.exe [jpeg input file] [output file] -transcode [options]
+//        jpeg_comp_cpu.exe [image directory] [output .csv/.json] -sweep q,q,... [options]
+//        jpeg_comp_cpu.exe [socket path] -serve [options]
+//        jpeg_comp_cpu.exe -tune [wisdom file]
 // Required:
 //    raw input file    - Input Image File
 //    width             - Input Image Width (Integer)
 //    height            - Input Image Height (Integer)
 //    channels          - Input Image Channel Count (Integer)
 //    output file       - Output JPEG File
+// Options:
+//    -q quality        - Quality from 1 to 100 (default 50)
+//    -psnr dB          - Tune the quantization tables to the image for the
+//                        fewest bits at this PSNR (replaces -q)
+//    -perceptual       - Weight the -psnr error by the Annex K table shape
+//    -transcode        - Requantize a baseline JPEG to the quality without
+//                        decoding it to pixels
+//    -f format         - Input format: raw (default with a size), pnm
+//                        (default without a size), rgb24, bgr24 or yuv420
+//    -s factor         - Also write a 1/factor scaled JPEG (2, 4 or 8),
+//                        may be repeated
+//    -crop x,y,w,h     - Only encode the w x h region at x,y, just that region
+//                        is read from the file
+//    -orient name      - Rotate or flip the output: fliph, flipv, rot90, rot180,
+//                        rot270, transpose or transverse (a flipped edge is
+//                        trimmed to whole MCUs)
+//    -t size           - Write a pyramid of size x size tiles instead of a
+//                        single JPEG, the output file is the tile prefix
+//    -j workers        - Number of tile, sweep or server worker threads
+//                        (default one per CPU or the tuned number)
+//    -m container      - Encode a stream of frames until the end of the input
+//                        as length prefixed JPEGs (length) or a multipart
+//                        MJPEG stream (multipart), "-" is stdin / stdout
+//    -arith            - Use arithmetic coding (SOF9) instead of Huffman coding,
+//                        the files are smaller but need a decoder that
+//                        supports it
+//    -cache            - With -m, reuse the codes of the blocks that have not
+//                        changed since the last frame
+//    -dryrun           - Print the size the JPEG would be without writing it
+//    -rows             - With -dryrun, also print the bytes each MCU row adds
+//                        to the scan
+//    -sweep q,q,...    - Encode every image in the input directory at each
+//                        quality and write the size, bits per pixel, PSNR and
+//                        time of each, and the RD curve of all of them
+//    -serve            - Encode the images that local clients send to the
+//                        socket until stopped (see jpeg_client)
+//    -measure          - Print the PSNR of the coded YCbCr samples, measured
+//                        while encoding
+//    -ssim             - Print the mean SSIM of the 8x8 blocks as well
+//    -huge             - Back the image memory with transparent huge pages
+//    -sync             - Write the output on the encoding thread
+//    -direct           - Write the output with O_DIRECT
+//    -fsync            - Sync the output to disk before closing it
+//    -kernels          - List the kernel variants and the one in use (the
+//                        JPEG_KERNELS environment variable forces one)
+//    -wisdom file      - Use the kernels and number of workers tuned for this
+//                        CPU by -tune (default the JPEG_WISDOM environment
+//                        variable)
+//    -tune file        - Time the kernel variants and number of workers on
+//                        this CPU and write the fastest to the wisdom file
 //==========================================================================1
 int main(int argc, char * argv[])
 {
-    unsigned int width;
-    unsigned int height;
-    unsigned int channels;
+    unsigned int width = 0;
+    unsigned int height = 0;
+    unsigned int channels = 0;
+    const char * args[5];
+    int arg_cnt = 0;
+    int format = -1;
     ChannelInfo info[3];
-    FILE * fid;
+    OutStream * stream;
     unsigned int quality_factor = 50;
+    ScaledImage scaled[MAX_SCALED];
+    unsigned int scaled_cnt = 0;
+    unsigned int arena_flags = 0;
+    unsigned int writer_flags = 0;
+    unsigned int tile_size = 0;
+    unsigned int workers = 0;
+    int container = -1;
+    int transcode = 0;
+    unsigned int crop[4];
+    int cropped = 0;
+    int dry_run = 0;
+    int dry_rows = 0;
+    int arith = 0;
+    int cache_blocks = 0;
+    float target_psnr = 0.0f;
+    int perceptual = 0;
+    int orientation = ORIENT_NONE;
+    int measure = 0;
+    int ssim = 0;
+    int server = 0;
+    unsigned int sweep[SWEEP_MAX_QUALITIES];
+    unsigned int sweep_cnt = 0;
+    Arena arena;
+    int bad_args = 0;
+
+    // Tuned Defaults, Before Anything Picks the Kernels
+    const char * wisdom = getenv("JPEG_WISDOM");
+    if ((wisdom != NULL) && (wisdom[0] != '\0') && !has_option(argc, argv, "-wisdom"))
+    {
+        load_wisdom(wisdom);
+    }
+
+    // Process Command Line Options
+    for (int i = 1; (i < argc) && !bad_args; i++)
+    {
+        if ((argv[i][0] != '-') || (argv[i][1] == '\0'))
+        {
+            if (arg_cnt < 5)
+                args[arg_cnt++] = argv[i];
+            else
+                bad_args = 1;
+        }
+        else if ((strcmp(argv[i], "-q") == 0) && (i + 1 < argc))
+        {
+            quality_factor = atoi(argv[++i]);
+            bad_args = (quality_factor < 1) || (quality_factor > 100);
+        }
+        else if ((strcmp(argv[i], "-psnr") == 0) && (i + 1 < argc))
+        {
+            target_psnr = (float)atof(argv[++i]);
+            bad_args = (target_psnr <= 0.0f);
+        }
+        else if (strcmp(argv[i], "-perceptual") == 0)
+        {
+            perceptual = 1;
+        }
+        else if (strcmp(argv[i], "-transcode") == 0)
+        {
+            transcode = 1;
+        }
+        else if ((strcmp(argv[i], "-f") == 0) && (i + 1 < argc))
+        {
+            format = reader_format(argv[++i]);
+            bad_args = (format < 0);
+        }
+        else if ((strcmp(argv[i], "-s") == 0) && (i + 1 < argc) && (scaled_cnt < MAX_SCALED))
+        {
+            scaled[scaled_cnt++].factor = atoi(argv[++i]);
+        }
+        else if ((strcmp(argv[i], "-crop") == 0) && (i + 1 < argc))
+        {
+            cropped = 1;
+            bad_args = (sscanf(argv[++i], "%u,%u,%u,%u", &crop[0], &crop[1], &crop[2], &crop[3]) != 4);
+        }
+        else if ((strcmp(argv[i], "-orient") == 0) && (i + 1 < argc))
+        {
+            orientation = orientation_id(argv[++i]);
+            bad_args = (orientation < 0);
+        }
+        else if ((strcmp(argv[i], "-t") == 0) && (i + 1 < argc))
+        {
+            tile_size = atoi(argv[++i]);
+        }
+        else if ((strcmp(argv[i], "-j") == 0) && (i + 1 < argc))
+        {
+            workers = atoi(argv[++i]);
+        }
+        else if ((strcmp(argv[i], "-m") == 0) && (i + 1 < argc))
+        {
+            container = mjpeg_container(argv[++i]);
+            bad_args = (container < 0);
+        }
+        else if (strcmp(argv[i], "-arith") == 0)
+        {
+            arith = 1;
+        }
+        else if (strcmp(argv[i], "-cache") == 0)
+        {
+            cache_blocks = 1;
+        }
+        else if (strcmp(argv[i], "-dryrun") == 0)
+        {
+            dry_run = 1;
+        }
+        else if (strcmp(argv[i], "-rows") == 0)
+        {
+            dry_rows = 1;
+        }
+        else if ((strcmp(argv[i], "-sweep") == 0) && (i + 1 < argc))
+        {
+            sweep_cnt = sweep_qualities(argv[++i], sweep, SWEEP_MAX_QUALITIES);
+            bad_args = (sweep_cnt == 0);
+        }
+        else if (strcmp(argv[i], "-serve") == 0)
+        {
+            server = 1;
+        }
+        else if (strcmp(argv[i], "-measure") == 0)
+        {
+            measure = 1;
+        }
+        else if (strcmp(argv[i], "-ssim") == 0)
+        {
+            measure = 1;
+            ssim = 1;
+        }
+        else if (strcmp(argv[i], "-huge") == 0)
+        {
+            arena_flags |= ARENA_HUGE_PAGES;
+        }
+        else if (strcmp(argv[i], "-sync") == 0)
+        {
+            writer_flags |= WRITER_SYNC;
+        }
+        else if (strcmp(argv[i], "-direct") == 0)
+        {
+            writer_flags |= WRITER_DIRECT;
+        }
+        else if (strcmp(argv[i], "-fsync") == 0)
+        {
+            writer_flags |= WRITER_FSYNC;
+        }
+        else if (strcmp(argv[i], "-kernels") == 0)
+        {
+            print_kernels();
+            exit(0);
+        }
+        else if ((strcmp(argv[i], "-wisdom") == 0) && (i + 1 < argc))
+        {
+            load_wisdom(argv[++i]);
+        }
+        else if ((strcmp(argv[i], "-tune") == 0) && (i + 1 < argc))
+        {
+            init_qtable(quality_factor);
+            exit((calibrate(argv[++i]) == 0) ? 0 : -1);
+        }
+        else
+        {
+            bad_args = 1;
+        }
+    }
 
     // Process Command Line Arguments
-    if (argc != 6)
+    if (server)
+    {
+        // The Only Argument is the Socket & Each Request Has the Image Size
+        bad_args |= (arg_cnt != 1) || (format >= 0) || transcode || (tile_size > 0) || (scaled_cnt > 0) ||
+                    (container >= 0) || cropped || dry_run || (sweep_cnt > 0) || measure ||
+                    (target_psnr > 0.0f) || (orientation != ORIENT_NONE) || cache_blocks;
+    }
+    else if (transcode)
+    {
+        // The Input is a JPEG With a Single Output
+        bad_args |= (arg_cnt != 2) || (format >= 0) || (tile_size > 0) || (scaled_cnt > 0) || (container >= 0) || cropped;
+    }
+    else if (arg_cnt == 2)
+    {
+        // Size Comes From the File Header
+        if (format < 0)
+            format = FORMAT_PNM;
+        bad_args |= (format != FORMAT_PNM);
+    }
+    else if (arg_cnt == 5)
+    {
+        width = atoi(args[1]);
+        height = atoi(args[2]);
+        channels = atoi(args[3]);
+        if (format < 0)
+            format = FORMAT_RAW;
+    }
+    else
+    {
+        bad_args = 1;
+    }
+
+    // Scaled Outputs are Replaced by the Pyramid Levels
+    if ((tile_size > 0) && (scaled_cnt > 0))
+    {
+        bad_args = 1;
+    }
+
+    // Tuning Needs the Whole Image Before Encoding
+    if ((target_psnr > 0.0f) && (transcode || (tile_size > 0) || (container >= 0)))
+    {
+        bad_args = 1;
+    }
+
+    // Blocks are Only Reordered for the Main Image of a Single Image or a Stream
+    if ((orientation != ORIENT_NONE) && (transcode || (tile_size > 0) || (scaled_cnt > 0)))
+    {
+        bad_args = 1;
+    }
+
+    // PSNR & SSIM are Only Measured for a Single Image Encoded From Pixels
+    if (measure && (transcode || (tile_size > 0) || (container >= 0)))
+    {
+        bad_args = 1;
+    }
+
+    // Dry Runs Only Size a Single Image
+    if (dry_run && (measure || transcode || (tile_size > 0) || (scaled_cnt > 0) || (container >= 0)))
+    {
+        bad_args = 1;
+    }
+
+    // Row Sizes Come From a Dry Run
+    if (dry_rows && !dry_run)
+    {
+        bad_args = 1;
+    }
+
+    // Streams Only Have a Single Output & Crops Need to Seek in the Input
+    if ((container >= 0) && ((tile_size > 0) || (scaled_cnt > 0) || cropped))
+    {
+        bad_args = 1;
+    }
+
+    // Sweeps Encode Each Image in the Directory at the Listed Qualities Only
+    if ((sweep_cnt > 0) && (transcode || (tile_size > 0) || (scaled_cnt > 0) || (container >= 0) || cropped ||
+                            dry_run || measure || (target_psnr > 0.0f) || (orientation != ORIENT_NONE)))
+    {
+        bad_args = 1;
+    }
+
+    // Transcodes, Dry Runs & Sweeps Only Count or Write Huffman Codes
+    if (arith && (transcode || dry_run || (sweep_cnt > 0)))
+    {
+        bad_args = 1;
+    }
+
+    // Only Frame Streams Have a Last Frame & Arithmetic Codes Adapt to What is Before Them
+    if (cache_blocks && ((container < 0) || arith))
+    {
+        bad_args = 1;
+    }
+
+    if (bad_args)
     {
-        printf("Usage: %s [raw input file] [width] [height] [channels] [output file]\n", argv[0]);
+        printf("Usage: %s [raw input file] [width] [height] [channels] [output file] [options]\n", argv[0]);
+        printf("       %s [pgm/ppm input file] [output file] [options]\n", argv[0]);
+        printf("       %s [jpeg input file] [output file] -transcode [options]\n", argv[0]);
+        printf("       %s [image directory] [output .csv/.json] -sweep q,q,... [options]\n", argv[0]);
+        printf("       %s [socket path] -serve [options]\n", argv[0]);
+        printf("       %s -tune [wisdom file]\n", argv[0]);
         printf("Required:\n");
         printf("   raw input file    - Input Image File\n");
         printf("   width             - Input Image Width (Integer)\n");
         printf("   height            - Input Image Height (Integer)\n");
         printf("   channels          - Input Image Channel Count (Integer)\n");
-        printf("   output file       - Output JPEG File\n\n");
+        printf("   output file       - Output JPEG File\n");
+        printf("Options:\n");
+        printf("   -q quality        - Quality from 1 to 100 (default 50)\n");
+        printf("   -psnr dB          - Tune the quantization tables to the image for the\n");
+        printf("                       fewest bits at this PSNR (replaces -q)\n");
+        printf("   -perceptual       - Weight the -psnr error by the Annex K table shape\n");
+        printf("   -transcode        - Requantize a baseline JPEG to the quality without\n");
+        printf("                       decoding it to pixels\n");
+        printf("   -f format         - Input format: raw (default with a size), pnm\n");
+        printf("                       (default without a size), rgb24, bgr24 or yuv420\n");
+        printf("   -s factor         - Also write a 1/factor scaled JPEG (2, 4 or 8),\n");
+        printf("                       may be repeated\n");
+        printf("   -crop x,y,w,h     - Only encode the w x h region at x,y, just that region\n");
+        printf("                       is read from the file\n");
+        printf("   -orient name      - Rotate or flip the output: fliph, flipv, rot90, rot180,\n");
+        printf("                       rot270, transpose or transverse (a flipped edge is\n");
+        printf("                       trimmed to whole MCUs)\n");
+        printf("   -t size           - Write a pyramid of size x size tiles instead of a\n");
+        printf("                       single JPEG, the output file is the tile prefix\n");
+        printf("   -j workers        - Number of tile, sweep or server worker threads\n");
+        printf("                       (default one per CPU or the tuned number)\n");
+        printf("   -m container      - Encode a stream of frames until the end of the input\n");
+        printf("                       as length prefixed JPEGs (length) or a multipart\n");
+        printf("                       MJPEG stream (multipart), \"-\" is stdin / stdout\n");
+        printf("   -arith            - Use arithmetic coding (SOF9) instead of Huffman coding,\n");
+        printf("                       the files are smaller but need a decoder that\n");
+        printf("                       supports it\n");
+        printf("   -cache            - With -m, reuse the codes of the blocks that have not\n");
+        printf("                       changed since the last frame\n");
+        printf("   -dryrun           - Print the size the JPEG would be without writing it\n");
+        printf("   -rows             - With -dryrun, also print the bytes each MCU row adds\n");
+        printf("                       to the scan\n");
+        printf("   -sweep q,q,...    - Encode every image in the input directory at each\n");
+        printf("                       quality and write the size, bits per pixel, PSNR and\n");
+        printf("                       time of each, and the RD curve of all of them\n");
+        printf("   -serve            - Encode the images that local clients send to the\n");
+        printf("                       socket until stopped (see jpeg_client)\n");
+        printf("   -measure          - Print the PSNR of the coded YCbCr samples, measured\n");
+        printf("                       while encoding\n");
+        printf("   -ssim             - Print the mean SSIM of the 8x8 blocks as well\n");
+        printf("   -huge             - Back the image memory with transparent huge pages\n");
+        printf("   -sync             - Write the output on the encoding thread\n");
+        printf("   -direct           - Write the output with O_DIRECT\n");
+        printf("   -fsync            - Sync the output to disk before closing it\n");
+        printf("   -kernels          - List the kernel variants and the one in use (the\n");
+        printf("                       JPEG_KERNELS environment variable forces one)\n");
+        printf("   -wisdom file      - Use the kernels and number of workers tuned for this\n");
+        printf("                       CPU by -tune (default the JPEG_WISDOM environment\n");
+        printf("                       variable)\n");
+        printf("   -tune file        - Time the kernel variants and number of workers on\n");
+        printf("                       this CPU and write the fastest to the wisdom file\n\n");
+        exit(-1);
+    }
+    const char * input_name = args[0];
+    const char * output_name = args[arg_cnt - 1];
+
+    // Entropy Coder of Every Output Stream
+    set_entropy_coder(arith ? ENTROPY_ARITHMETIC : ENTROPY_HUFFMAN);
+
+    // Encode the Images From Clients Until Stopped
+    if (server)
+    {
+        init_qtable(quality_factor);
+        return (serve(input_name, workers, arena_flags) == 0) ? 0 : -1;
+    }
+
+    // Sweep a Directory of Images Over the Qualities
+    if (sweep_cnt > 0)
+    {
+        init_qtable(quality_factor);
+        return (sweep_dir(input_name, format, width, height, channels, sweep, sweep_cnt, workers,
+                          output_name, arena_flags) == 0) ? 0 : -1;
+    }
+
+    // Stream the Image Into a Tile Pyramid
+    if (tile_size > 0)
+    {
+        ImageReader reader;
+        int result;
+
+        if (reader_open(&reader, input_name, format, width, height, channels) != 0)
+        {
+            exit(-1);
+        }
+
+        if (cropped && (reader_set_crop(&reader, crop[0], crop[1], crop[2], crop[3]) != 0))
+        {
+            reader_close(&reader);
+            exit(-1);
+        }
+
+        init_qtable(quality_factor);
+        result = tile_image(&reader, output_name, tile_size, workers, writer_flags, arena_flags);
+        reader_close(&reader);
+
+        return (result == 0) ? 0 : -1;
+    }
+
+    // Requantize a JPEG
+    if (transcode)
+    {
+        init_qtable(quality_factor);
+        return (transcode_jpeg(input_name, output_name, writer_flags) == 0) ? 0 : -1;
+    }
+
+    // Encode a Stream of Frames
+    if (container >= 0)
+    {
+        ImageReader reader;
+        int result;
+
+        if (reader_open(&reader, input_name, format, width, height, channels) != 0)
+        {
+            exit(-1);
+        }
+
+        init_qtable(quality_factor);
+        set_orientation(orientation);
+        result = encode_mjpeg(&reader, output_name, container, writer_flags, arena_flags, cache_blocks);
+        reader_close(&reader);
+
+        return (result == 0) ? 0 : -1;
+    }
+
+    // Create the Image Arena
+    arena_init(&arena, ARENA_CHUNK_SIZE, arena_flags);
+
+    // Open File
+    ImageReader reader;
+    if (reader_open(&reader, input_name, format, width, height, channels) != 0)
+    {
+        exit(-1);
+    }
+
+    // Only the Rows & Columns of the Crop are Read
+    if (cropped && (reader_set_crop(&reader, crop[0], crop[1], crop[2], crop[3]) != 0))
+    {
+        reader_close(&reader);
         exit(-1);
     }
-    width = atoi(argv[2]);
-    height = atoi(argv[3]);
-    channels = atoi(argv[4]);
+
+    width = reader.width;
+    height = reader.height;
+    channels = reader.channels;
+
+    // A Color Image That is Only Written Goes Straight From the Rows to
+    // the Output, One MCU at a Time
+    if ((channels == 3) && (reader.format != FORMAT_YUV420) && (scaled_cnt == 0) && !dry_run && !measure &&
+        (target_psnr <= 0.0f) && (orientation == ORIENT_NONE))
+    {
+        int result = -1;
+
+        init_qtable(quality_factor);
+        stream = open_stream(output_name, writer_flags, width, height, info, channels);
+        if (stream != NULL)
+        {
+            result = compress_rgb_rows(&reader, &arena, stream);
+            close_stream(stream);
+        }
+
+        reader_close(&reader);
+        arena_free(&arena);
+        return (result == 0) ? 0 : -1;
+    }
 
     // Read File
-    file_read(argv[1], width, height, channels, info);
+    if (reader_read_planes(&reader, info, &arena) != 0)
+    {
+        printf("Error Reading File\n");
+        reader_close(&reader);
+        arena_free(&arena);
+        return -1;
+    }
+    reader_close(&reader);
     
     // Init Q Table
     init_qtable(quality_factor);
+    if (target_psnr > 0.0f)
+    {
+        float psnr = tune_qtable(channels, info, width, height, target_psnr, perceptual);
+        printf("Tuned Tables for %.2f dB (%s %.2f dB)\n", target_psnr, perceptual ? "Expected" : "Measured", psnr);
+    }
+
+    // Measure Against the Source Before it is Oriented
+    QualityStats quality;
+    init_quality_stats(&quality, width, height, channels, ssim);
+
+    // Rotate / Flip the Output
+    set_orientation(orientation);
+    if (orient_image(&width, &height, channels) != 0)
+    {
+        arena_free(&arena);
+        exit(-1);
+    }
+
+    // Size the JPEG Without Writing It
+    if (dry_run)
+    {
+        unsigned int mcu = (channels == 1) ? 8 : 16;
+        unsigned int rows = (height + mcu - 1) / mcu;
+        size_t * row_bytes = dry_rows ? (size_t *)arena_alloc(&arena, rows * sizeof(size_t)) : NULL;
+
+        size_t size = predict_jpeg_size(width, height, info, channels, &arena, row_bytes);
+        if (size > 0)
+        {
+            printf("Predicted Size: %lu bytes\n", (unsigned long)size);
+        }
+
+        // Bytes Each MCU Row Adds to the Scan
+        for (unsigned int i = 0; (i < rows) && (row_bytes != NULL) && (size > 0); i++)
+        {
+            printf("Row %u: %lu bytes\n", i, (unsigned long)row_bytes[i]);
+        }
+
+        arena_free(&arena);
+        return (size > 0) ? 0 : -1;
+    }
+
+    // Init Scaled Outputs
+    for (unsigned int i = 0; i < scaled_cnt; i++)
+    {
+        init_scaled_img(scaled[i].factor, channels, info, &scaled[i], &arena);
+    }
 
     // Write Out JPEG
-    fid = open_stream(argv[5], width, height, info, channels);
-    if (fid != NULL)
+    stream = open_stream(output_name, writer_flags, width, height, info, channels);
+    if (stream == NULL)
     {
-        // Flush Header to Disk
-        fflush(fid);
+        arena_free(&arena);
+        return -1;
+    }
+
+    // Compress
+    compress_img_scaled(channels, info, &arena, stream, scaled, scaled_cnt, measure ? &quality : NULL);
 
-        // Compress
-        compress_img(channels, info, fid);
+    // Close File
+    close_stream(stream);
 
-        // Close File
-        close_stream(fid);
+    // Print the Reconstruction Quality
+    if (measure)
+    {
+        if (channels == 1)
+            printf("PSNR: %.2f dB\n", quality_psnr(&quality, 0));
+        else
+            printf("PSNR: %.2f dB (Y %.2f, Cb %.2f, Cr %.2f)\n", quality_psnr(&quality, -1),
+                   quality_psnr(&quality, 0), quality_psnr(&quality, 1), quality_psnr(&quality, 2));
+
+        if (ssim && (channels == 1))
+            printf("SSIM: %.4f\n", quality_ssim(&quality, 0));
+        else if (ssim)
+            printf("SSIM: %.4f (Y %.4f, Cb %.4f, Cr %.4f)\n", quality_ssim(&quality, -1),
+                   quality_ssim(&quality, 0), quality_ssim(&quality, 1), quality_ssim(&quality, 2));
     }
 
-    // Clean Up
-    for (unsigned int i = 0; i < channels; i++)
+    // Write Out Scaled JPEGs
+    int result = 0;
+    for (unsigned int i = 0; i < scaled_cnt; i++)
     {
-        free(info[i].data);
+        ChannelInfo sinfo[3];
+        char file_name[1024];
+        unsigned int factor = scaled[i].factor;
+        unsigned int swidth = (width + factor - 1) / factor;
+        unsigned int sheight = (height + factor - 1) / factor;
+
+        scaled_to_blocks(&scaled[i], channels, swidth, sheight, sinfo, &arena);
+        scaled_file_name(output_name, factor, file_name, sizeof(file_name));
+
+        OutStream * sstream = open_stream(file_name, writer_flags, swidth, sheight, sinfo, channels);
+        if (sstream == NULL)
+        {
+            result = -1;
+            continue;
+        }
+
+        compress_img(channels, sinfo, &arena, sstream);
+        close_stream(sstream);
     }
+
+    // Clean Up
+    arena_free(&arena);
+    return result;
 }
@@ -0,0 +1,336 @@
+//==========================================================================
+// This file implements the Motion-JPEG streaming mode. Each frame is
+// compressed into a memory stream, so its length is known before it is
+// written, and then handed to the output writer straight away so the next
+// frame is compressed while the last one is written.
+//==========================================================================
+
+#include "mjpeg.h"
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+
+#include "jpeg_file.h"
+
+#if defined(_WIN32)
+#include <windows.h>
+#include <io.h>
+#else
+#include <unistd.h>
+#endif
+
+//==========================================================================
+// Helper function that will convert a container name to a container id.
+//
+// Parameters:
+//  name - The container name (length or multipart)
+//
+// Return:
+//  The container id or -1 if the name is not known
+//==========================================================================
+int mjpeg_container(const char * name)
+{
+    if ((strcmp(name, "length") == 0) || (strcmp(name, "len") == 0))
+        return MJPEG_LENGTH;
+    if ((strcmp(name, "multipart") == 0) || (strcmp(name, "mjpeg") == 0))
+        return MJPEG_MULTIPART;
+
+    return -1;
+}
+
+//==========================================================================
+// Read a monotonic clock.
+//
+// Return:
+//  The time in seconds
+//==========================================================================
+double mjpeg_clock()
+{
+#if defined(_WIN32)
+    LARGE_INTEGER count;
+    LARGE_INTEGER freq;
+
+    QueryPerformanceCounter(&count);
+    QueryPerformanceFrequency(&freq);
+    return (double)count.QuadPart / (double)freq.QuadPart;
+#else
+    struct timespec now;
+
+    clock_gettime(CLOCK_MONOTONIC, &now);
+    return (double)now.tv_sec + (double)now.tv_nsec * 1e-9;
+#endif
+}
+
+//==========================================================================
+// Helper function that will open the output. When the output is stdout
+// the stream gets its own copy of it and stdout is pointed at stderr, so
+// messages can not end up in the middle of the frames.
+//
+// Parameters:
+//  file_name    - The output file name, "-" for stdout
+//  writer_flags - Any of the WRITER_* flags
+//
+// Return:
+//  The output stream or NULL if it could not be opened
+//==========================================================================
+OutStream * open_output(const char * file_name, unsigned int writer_flags)
+{
+    if (strcmp(file_name, "-") != 0)
+    {
+        return stream_open(file_name, writer_flags);
+    }
+
+    fflush(stdout);
+#if defined(_WIN32)
+    int fd = _dup(1);
+    _dup2(2, 1);
+#else
+    int fd = dup(1);
+    dup2(2, 1);
+#endif
+    if (fd < 0)
+    {
+        return NULL;
+    }
+
+    return stream_open_fd(fd, writer_flags);
+}
+
+//==========================================================================
+// Helper function that will write one JPEG to the output in the container
+// format.
+//
+// Parameters:
+//  stream    - The output stream
+//  container - One of the MJPEG_* values
+//  data      - The JPEG data
+//  size      - The size of the JPEG
+//==========================================================================
+void write_frame(OutStream * stream, unsigned int container, const unsigned char * data, size_t size)
+{
+    if (container == MJPEG_MULTIPART)
+    {
+        char header[128];
+        int length = snprintf(header, sizeof(header),
+                              "--" MJPEG_BOUNDARY "\r\nContent-Type: image/jpeg\r\nContent-Length: %lu\r\n\r\n",
+                              (unsigned long)size);
+
+        stream_write(stream, header, length);
+        stream_write(stream, data, size);
+        stream_write(stream, "\r\n", 2);
+    }
+    else
+    {
+        unsigned char length[4];
+
+        length[0] = (unsigned char)(size >> 24);
+        length[1] = (unsigned char)(size >> 16);
+        length[2] = (unsigned char)(size >> 8);
+        length[3] = (unsigned char)size;
+
+        stream_write(stream, length, 4);
+        stream_write(stream, data, size);
+    }
+}
+
+//==========================================================================
+// Helper function that will add a sample to the latency log.
+//
+// Parameters:
+//  log     - The latency log
+//  latency - The latency in seconds
+//==========================================================================
+void log_latency(LatencyLog * log, double latency)
+{
+    if (log->count == log->size)
+    {
+        log->size = (log->size == 0) ? 1024 : log->size * 2;
+        log->samples = (double *)realloc(log->samples, log->size * sizeof(double));
+        if (log->samples == NULL)
+        {
+            printf("Out of Memory\n");
+            exit(-1);
+        }
+    }
+
+    log->samples[log->count++] = latency;
+}
+
+//==========================================================================
+// Helper function for sorting the latency samples with qsort
+//==========================================================================
+int compare_latency(const void * a, const void * b)
+{
+    double x = *(const double *)a;
+    double y = *(const double *)b;
+
+    return (x > y) - (x < y);
+}
+
+//==========================================================================
+// Helper function that will get a percentile of the sorted samples using
+// the nearest rank.
+//
+// Parameters:
+//  log     - The latency log, the samples must be sorted
+//  percent - The percentile from 0 to 100
+//
+// Return:
+//  The latency in milliseconds
+//==========================================================================
+double latency_percentile(const LatencyLog * log, double percent)
+{
+    unsigned long rank = (unsigned long)(percent / 100.0 * log->count + 0.999999);
+
+    if (rank < 1)
+        rank = 1;
+    if (rank > log->count)
+        rank = log->count;
+
+    return log->samples[rank - 1] * 1000.0;
+}
+
+//==========================================================================
+// Helper function that will print the rate and latency percentiles.
+//
+// Parameters:
+//  log     - The latency log, the samples are sorted by this call
+//  label   - What the samples are, such as "Frames"
+//  elapsed - The total time in seconds
+//==========================================================================
+void print_latency(LatencyLog * log, const char * label, double elapsed)
+{
+    printf("%s: %lu in %.3f s (%.1f per second)\n", label, log->count, elapsed,
+           (elapsed > 0.0) ? log->count / elapsed : 0.0);
+
+    if (log->count == 0)
+    {
+        return;
+    }
+
+    qsort(log->samples, log->count, sizeof(double), compare_latency);
+    printf("Latency (ms): min %.3f  p50 %.3f  p90 %.3f  p99 %.3f  p99.9 %.3f  max %.3f\n",
+           latency_percentile(log, 0.0), latency_percentile(log, 50.0), latency_percentile(log, 90.0),
+           latency_percentile(log, 99.0), latency_percentile(log, 99.9), latency_percentile(log, 100.0));
+}
+
+//==========================================================================
+// Compress every frame from a reader until the end of the stream. The
+// latency of each frame is measured from when its first byte is read to
+// when its JPEG is handed to the writer, and the percentiles are printed
+// at the end. The quantization and Huffman tables must already be
+// initialized by init_qtable, and the frames are oriented by the
+// set_orientation setting.
+//
+// Parameters:
+//  reader       - The opened input stream
+//  file_name    - The output file name, "-" for stdout
+//  container    - One of the MJPEG_* values
+//  writer_flags - Any of the WRITER_* flags for the output
+//  arena_flags  - Any of the ARENA_* flags for the frame arena
+//  cache_blocks - If not 0 the blocks that have not changed since the last
+//                 frame reuse their AC codes (see compress_img_cached)
+//
+// Return:
+//  0 on success, -1 on failure
+//==========================================================================
+int encode_mjpeg(ImageReader * reader, const char * file_name, unsigned int container,
+                 unsigned int writer_flags, unsigned int arena_flags, int cache_blocks)
+{
+    ChannelInfo info[3];
+    Arena arena;
+    OutStream * output;
+    OutStream * frame = NULL;
+    LatencyLog log = { NULL, 0, 0 };
+    BlockCache cache = { NULL, 0, 0, 0 };
+    double start_time = mjpeg_clock();
+    unsigned int width = reader->width;
+    unsigned int height = reader->height;
+    int result;
+
+    // Every Frame is the Same Size
+    if (orient_image(&width, &height, reader->channels) != 0)
+    {
+        return -1;
+    }
+
+    output = open_output(file_name, writer_flags);
+    if (output == NULL)
+    {
+        printf("Failed to Open File: %s\n", file_name);
+        return -1;
+    }
+
+    arena_init(&arena, MJPEG_ARENA_SIZE, arena_flags);
+
+    while ((result = reader_next_frame(reader)) > 0)
+    {
+        double frame_start = mjpeg_clock();
+        size_t size;
+
+        // Reuse the Planes & Scratch Memory of the Last Frame, a Frame
+        // Cut Short Ends the Stream
+        arena_reset(&arena);
+        if (reader_read_planes(reader, info, &arena) != 0)
+        {
+            printf("Frame %lu is Incomplete, Ending the Stream\n", reader->frames);
+            result = 0;
+            break;
+        }
+
+        // Reuse the Memory Stream of the Last Frame
+        if (frame == NULL)
+        {
+            frame = open_memory_stream(width, height, info, reader->channels);
+            if (frame == NULL)
+            {
+                result = -1;
+                break;
+            }
+        }
+        else
+        {
+            restart_memory_stream(frame, width, height, info, reader->channels);
+        }
+
+        if (cache_blocks)
+            compress_img_cached(reader->channels, info, &arena, &cache, frame);
+        else
+            compress_img(reader->channels, info, &arena, frame);
+        const unsigned char * data = finish_memory_stream(frame, &size);
+
+        // Hand the Frame to the Writer Without Waiting for the Buffer to Fill
+        write_frame(output, container, data, size);
+        stream_submit(output);
+
+        log_latency(&log, mjpeg_clock() - frame_start);
+    }
+
+    // Clean Up
+    if (frame != NULL)
+    {
+        size_t size;
+        free(stream_close_memory(frame, &size));
+    }
+
+    if (stream_close(output) != 0)
+    {
+        result = -1;
+    }
+    arena_free(&arena);
+
+    print_latency(&log, "Frames", mjpeg_clock() - start_time);
+    free(log.samples);
+
+    if (cache_blocks)
+    {
+        unsigned long blocks = cache.hits + cache.misses;
+        printf("Unchanged Blocks: %lu of %lu (%.1f%%)\n", cache.hits, blocks,
+               (blocks > 0) ? 100.0 * cache.hits / blocks : 0.0);
+        free_block_cache(&cache);
+    }
+
+    return (result == 0) ? 0 : -1;
+}
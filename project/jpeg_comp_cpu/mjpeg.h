@@ -0,0 +1,114 @@
+//==========================================================================
+// This file contains the Motion-JPEG streaming mode. Frames are read one
+// after another from a file or pipe and each one is written out as a
+// JPEG, either with its length in front of it or as part of a multipart
+// stream. The buffers and tables are set up once and reused for every
+// frame.
+//==========================================================================
+
+#ifndef MJPEG_H
+#define MJPEG_H
+
+#include "reader.h"
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+//==========================================================================
+// Output Containers
+//
+//  MJPEG_LENGTH    - Each JPEG is preceded by its length as a 4 byte big
+//                    endian number
+//  MJPEG_MULTIPART - A multipart/x-mixed-replace body, each JPEG is a part
+//                    with a Content-Length header, as served by IP cameras
+//==========================================================================
+#define MJPEG_LENGTH    0
+#define MJPEG_MULTIPART 1
+
+//==========================================================================
+// The boundary between the parts of a multipart stream
+//==========================================================================
+#define MJPEG_BOUNDARY "jpegframe"
+
+//==========================================================================
+// Size of each chunk of memory in the frame arena
+//==========================================================================
+#define MJPEG_ARENA_SIZE (4 * 1024 * 1024)
+
+//==========================================================================
+// Structure to hold the latency of every frame, start with all of the
+// fields set to 0
+//==========================================================================
+typedef struct
+{
+    double * samples;
+    unsigned long count;
+    unsigned long size;
+} LatencyLog;
+
+//==========================================================================
+// Read a monotonic clock.
+//
+// Return:
+//  The time in seconds
+//==========================================================================
+double mjpeg_clock();
+
+//==========================================================================
+// Helper function that will convert a container name to a container id.
+//
+// Parameters:
+//  name - The container name (length or multipart)
+//
+// Return:
+//  The container id or -1 if the name is not known
+//==========================================================================
+int mjpeg_container(const char * name);
+
+//==========================================================================
+// Helper function that will add a sample to the latency log.
+//
+// Parameters:
+//  log     - The latency log
+//  latency - The latency in seconds
+//==========================================================================
+void log_latency(LatencyLog * log, double latency);
+
+//==========================================================================
+// Helper function that will print the rate and latency percentiles.
+//
+// Parameters:
+//  log     - The latency log, the samples are sorted by this call
+//  label   - What the samples are, such as "Frames"
+//  elapsed - The total time in seconds
+//==========================================================================
+void print_latency(LatencyLog * log, const char * label, double elapsed);
+
+//==========================================================================
+// Compress every frame from a reader until the end of the stream. The
+// latency of each frame is measured from when its first byte is read to
+// when its JPEG is handed to the writer, and the percentiles are printed
+// at the end. The quantization and Huffman tables must already be
+// initialized by init_qtable.
+//
+// Parameters:
+//  reader       - The opened input stream
+//  file_name    - The output file name, "-" for stdout
+//  container    - One of the MJPEG_* values
+//  writer_flags - Any of the WRITER_* flags for the output
+//  arena_flags  - Any of the ARENA_* flags for the frame arena
+//  cache_blocks - If not 0 the blocks that have not changed since the last
+//                 frame reuse their AC codes (see compress_img_cached)
+//
+// Return:
+//  0 on success, -1 on failure
+//==========================================================================
+int encode_mjpeg(ImageReader * reader, const char * file_name, unsigned int container,
+                 unsigned int writer_flags, unsigned int arena_flags, int cache_blocks);
+
+#ifdef __cplusplus
+}
+#endif
+
+#endif /* MJPEG_H */
@@ -0,0 +1,541 @@
+//==========================================================================
+// This file implements the quantization table tuner. The tuner works in
+// two passes, the first builds a magnitude histogram of every coefficient
+// and the second works out the distortion and the entropy each table
+// entry would give from the histograms, so the search over lambda never
+// touches the image again. The picked tables are then checked by
+// rebuilding the image the way a decoder would.
+//==========================================================================
+
+#include "qtune.h"
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <math.h>
+
+#include "tables.h"
+#include "kernels.h"
+
+//==========================================================================
+// Largest quantized magnitude, quant_zigzag divides by 4 after rounding
+//==========================================================================
+#define QTUNE_LEVELS (QTUNE_BINS / 4 + 1)
+
+//==========================================================================
+// Number of steps in the lambda search
+//==========================================================================
+#define QTUNE_STEPS 64
+
+//==========================================================================
+// Largest number of times the tables are rebuilt and searched again to
+// meet the target
+//==========================================================================
+#define QTUNE_PASSES 8
+
+//==========================================================================
+// Local Variable to hold the 8-point IDCT basis, indexed by [frequency]
+// [position]
+//==========================================================================
+static float qtune_cos[8][8];
+
+//==========================================================================
+// Helper function that will add the coefficients of one block to the
+// histograms.
+//
+// Parameters:
+//  stats   - The coefficient statistics
+//  cls     - The table class of the block (QTUNE_LUMA or QTUNE_CHROMA)
+//  coeffs  - The DCT of the block (see dct2d)
+//  prev_dc - A pointer to the DC term of the previous block
+//==========================================================================
+void add_block_stats(QTuneStats * stats, unsigned int cls, const float * coeffs, float * prev_dc)
+{
+    unsigned int * hist = stats->hist[cls];
+    unsigned int * max_bin = stats->max_bin[cls];
+
+    for (unsigned int k = 0; k < 64; k++)
+    {
+        unsigned int bin = (unsigned int)min(QTUNE_BINS - 1, fabsf(coeffs[k]) + 0.5f);
+        hist[k * QTUNE_BINS + bin]++;
+        max_bin[k] = max(max_bin[k], bin);
+    }
+
+    unsigned int diff = (unsigned int)min(QTUNE_BINS - 1, fabsf(coeffs[0] - *prev_dc) + 0.5f);
+    stats->dc_diff[cls][diff]++;
+    max_bin[64] = max(max_bin[64], diff);
+    *prev_dc = coeffs[0];
+
+    stats->blocks[cls]++;
+}
+
+//==========================================================================
+// Measure the DCT coefficients of every block of an image.
+//
+// Parameters:
+//  stats    - The statistics to fill in, release with free_coeff_stats
+//  channels - The number of channels in the image
+//  info     - A pointer to an array that stores the channel information
+//==========================================================================
+void measure_coeffs(QTuneStats * stats, unsigned int channels, ChannelInfo * info)
+{
+    const Kernels * kernels = get_kernels();
+    float coeffs[8 * 8];
+
+    memset(stats, 0, sizeof(QTuneStats));
+    for (unsigned int cls = 0; cls < 2; cls++)
+    {
+        stats->hist[cls] = (unsigned int *)calloc(64 * QTUNE_BINS, sizeof(unsigned int));
+        stats->dc_diff[cls] = (unsigned int *)calloc(QTUNE_BINS, sizeof(unsigned int));
+    }
+
+    for (unsigned int c = 0; c < channels; c++)
+    {
+        unsigned int cls = (c == 0) ? QTUNE_LUMA : QTUNE_CHROMA;
+        unsigned int block_cnt = (info[c].width / 8) * (info[c].height / 8);
+        float prev_dc = 0.0f;
+
+        for (unsigned int i = 0; i < block_cnt; i++)
+        {
+            kernels->fdct(&info[c].data[i * 64], coeffs);
+            add_block_stats(stats, cls, coeffs, &prev_dc);
+        }
+    }
+}
+
+//==========================================================================
+// Release the memory held by the coefficient statistics.
+//
+// Parameters:
+//  stats - The statistics from measure_coeffs
+//==========================================================================
+void free_coeff_stats(QTuneStats * stats)
+{
+    for (unsigned int cls = 0; cls < 2; cls++)
+    {
+        free(stats->hist[cls]);
+        free(stats->dc_diff[cls]);
+        stats->hist[cls] = NULL;
+        stats->dc_diff[cls] = NULL;
+    }
+}
+
+//==========================================================================
+// Helper function that will quantize a magnitude the same way as
+// quant_zigzag.
+//
+// Parameters:
+//  bin - The magnitude as output by dct2d
+//  q   - The quantization table entry
+//
+// Return:
+//  The quantized magnitude
+//==========================================================================
+unsigned int quantize_bin(unsigned int bin, unsigned int q)
+{
+    return ((unsigned int)roundf((float)bin / (float)q)) / 4;
+}
+
+//==========================================================================
+// Helper function that will calculate the squared error and the entropy
+// of quantizing a histogram with a table entry. The error is in the units
+// of the JPEG coefficients, so it is the same as the squared error of the
+// pixels, and every non zero value costs a sign bit on top of the entropy.
+//
+// Parameters:
+//  bins   - The non-empty bins of the magnitude histogram
+//  counts - The number of values in each of the bins
+//  length - The number of non-empty bins
+//  q      - The quantization table entry
+//  count  - The number of values in the histogram
+//  error  - A pointer to store the sum of the squared error in
+//  bits   - A pointer to store the number of bits needed to code the values
+//==========================================================================
+void quant_cost(const unsigned int * bins, const unsigned int * counts, unsigned int length, unsigned int q,
+                unsigned long count, double * error, double * bits)
+{
+    unsigned int levels[QTUNE_LEVELS];
+    unsigned int top = (length > 0) ? quantize_bin(bins[length - 1], q) : 0;
+    double sum = 0.0;
+    double entropy = 0.0;
+
+    memset(levels, 0, (top + 1) * sizeof(unsigned int));
+    for (unsigned int i = 0; i < length; i++)
+    {
+        unsigned int level = quantize_bin(bins[i], q);
+        double diff = (double)bins[i] - 4.0 * q * level;
+        sum += counts[i] * diff * diff;
+        levels[level] += counts[i];
+    }
+
+    for (unsigned int m = 0; m <= top; m++)
+    {
+        if (levels[m] != 0)
+        {
+            entropy -= levels[m] * log2((double)levels[m] / (double)count);
+        }
+    }
+
+    *error = sum / 16.0;
+    *bits = entropy + (double)(count - levels[0]);
+}
+
+//==========================================================================
+// Helper function that will list the non-empty bins of a histogram.
+//
+// Parameters:
+//  hist    - The magnitude histogram
+//  max_bin - The largest non-empty bin of the histogram
+//  bins    - An array to store the bins in
+//  counts  - An array to store the number of values in each bin in
+//
+// Return:
+//  The number of non-empty bins
+//==========================================================================
+unsigned int list_bins(const unsigned int * hist, unsigned int max_bin, unsigned int * bins, unsigned int * counts)
+{
+    unsigned int length = 0;
+
+    for (unsigned int bin = 0; bin <= max_bin; bin++)
+    {
+        if (hist[bin] != 0)
+        {
+            bins[length] = bin;
+            counts[length] = hist[bin];
+            length++;
+        }
+    }
+
+    return length;
+}
+
+//==========================================================================
+// Helper function that will pick the table entries for a lambda.
+//
+// Parameters:
+//  error  - The weighted error of every entry and table value
+//  bits   - The bits of every entry and table value
+//  lambda - The cost of a bit
+//  tables - The tables to store the picked values in
+//
+// Return:
+//  The total weighted error of the tables
+//==========================================================================
+double pick_tables(const double (*error)[64][256], const double (*bits)[64][256], double lambda, unsigned char (*tables)[64])
+{
+    double total = 0.0;
+
+    for (unsigned int cls = 0; cls < 2; cls++)
+    {
+        for (unsigned int k = 0; k < 64; k++)
+        {
+            unsigned int best = 1;
+            double best_cost = error[cls][k][1] + lambda * bits[cls][k][1];
+
+            for (unsigned int q = 2; q < 256; q++)
+            {
+                double cost = error[cls][k][q] + lambda * bits[cls][k][q];
+                if (cost < best_cost)
+                {
+                    best = q;
+                    best_cost = cost;
+                }
+            }
+
+            tables[cls][k] = (unsigned char)best;
+            total += error[cls][k][best];
+        }
+    }
+
+    return total;
+}
+
+//==========================================================================
+// Helper function that will search for the largest lambda (fewest bits)
+// whose tables have no more than the target error.
+//
+// Parameters:
+//  error  - The weighted error of every entry and table value
+//  bits   - The bits of every entry and table value
+//  target - The largest total error
+//  tables - The tables to store the picked values in
+//
+// Return:
+//  The total weighted error of the tables
+//==========================================================================
+double search_lambda(const double (*error)[64][256], const double (*bits)[64][256], double target, unsigned char (*tables)[64])
+{
+    double lo = log(1e-6);
+    double hi = log(1e9);
+    double total = pick_tables(error, bits, exp(lo), tables);
+
+    if (total <= target)
+    {
+        for (unsigned int step = 0; step < QTUNE_STEPS; step++)
+        {
+            double mid = 0.5 * (lo + hi);
+            if (pick_tables(error, bits, exp(mid), tables) <= target)
+                lo = mid;
+            else
+                hi = mid;
+        }
+
+        total = pick_tables(error, bits, exp(lo), tables);
+    }
+
+    return total;
+}
+
+//==========================================================================
+// Helper function that will encode and decode every block of an image
+// with a pair of tables and return the squared error of the samples inside
+// the image. The blocks go through the same DCT and quantizer kernels as
+// the encoder, and the decoder side rounds and clamps to 8 bits.
+//
+// Parameters:
+//  channels - The number of channels in the image
+//  info     - A pointer to an array that stores the channel information
+//  width    - The width of the image
+//  height   - The height of the image
+//  tables   - The luminance and chrominance tables
+//  samples  - A pointer to store the number of samples measured in
+//
+// Return:
+//  The sum of the squared error
+//==========================================================================
+double rebuild_error(unsigned int channels, ChannelInfo * info, unsigned int width, unsigned int height,
+                     unsigned char (*tables)[64], double * samples)
+{
+    const Kernels * kernels = get_kernels();
+    float coeffs[8 * 8];
+    float tmp[8 * 8];
+    short zz[8 * 8];
+    double sse = 0.0;
+
+    // Populate the IDCT Basis
+    for (unsigned int u = 0; u < 8; u++)
+    {
+        float cu = (u == 0) ? 0.70710678f : 1.0f;
+        for (unsigned int x = 0; x < 8; x++)
+        {
+            qtune_cos[u][x] = 0.5f * cu * cosf((2 * x + 1) * u * 3.14159265f / 16.0f);
+        }
+    }
+
+    *samples = 0.0;
+    for (unsigned int c = 0; c < channels; c++)
+    {
+        const unsigned char * qTable = tables[(c == 0) ? QTUNE_LUMA : QTUNE_CHROMA];
+        unsigned int xblocks = info[c].width / 8;
+        unsigned int block_cnt = xblocks * (info[c].height / 8);
+        unsigned int plane_width = (c == 0) ? width : (width + 1) / 2;
+        unsigned int plane_height = (c == 0) ? height : (height + 1) / 2;
+
+        for (unsigned int i = 0; i < block_cnt; i++)
+        {
+            const unsigned char * block = &info[c].data[i * 64];
+            unsigned int x0 = (i % xblocks) * 8;
+            unsigned int y0 = (i / xblocks) * 8;
+
+            // Padding Blocks are Not Part of the Image
+            if ((x0 >= plane_width) || (y0 >= plane_height))
+            {
+                continue;
+            }
+
+            unsigned int cols = min(8, plane_width - x0);
+            unsigned int rows = min(8, plane_height - y0);
+
+            // Encode & Dequantize
+            kernels->fdct(block, coeffs);
+            kernels->quantize(coeffs, qTable, zz);
+            for (unsigned int k = 0; k < 8 * 8; k++)
+            {
+                coeffs[k] = (float)(zz[output_pattern[k]] * qTable[k]);
+            }
+
+            // Row IDCT, Most Coefficients are Zero so Only the Non Zero
+            // Coefficients and Rows are Added In
+            unsigned int used[8];
+            unsigned int used_cnt = 0;
+            for (unsigned int v = 0; v < 8; v++)
+            {
+                int nonzero = 0;
+                memset(&tmp[v * 8], 0, 8 * sizeof(float));
+                for (unsigned int u = 0; u < 8; u++)
+                {
+                    float value = coeffs[v * 8 + u];
+                    if (value != 0.0f)
+                    {
+                        for (unsigned int x = 0; x < 8; x++)
+                        {
+                            tmp[v * 8 + x] += value * qtune_cos[u][x];
+                        }
+                        nonzero = 1;
+                    }
+                }
+
+                if (nonzero)
+                {
+                    used[used_cnt++] = v;
+                }
+            }
+
+            // Column IDCT & Level Shift a Whole Row of 8 at a Time, Clamped
+            // Then Rounded Half Away From Zero the Same as roundf
+            unsigned int block_sse = 0;
+            for (unsigned int y = 0; y < rows; y++)
+            {
+                float pixel[8];
+                int diff[8];
+                for (unsigned int x = 0; x < 8; x++)
+                {
+                    pixel[x] = 128.0f;
+                }
+
+                for (unsigned int j = 0; j < used_cnt; j++)
+                {
+                    float basis = qtune_cos[used[j]][y];
+                    for (unsigned int x = 0; x < 8; x++)
+                    {
+                        pixel[x] += basis * tmp[used[j] * 8 + x];
+                    }
+                }
+
+                for (unsigned int x = 0; x < 8; x++)
+                {
+                    float value = max(0.0f, min(255.0f, pixel[x]));
+                    int rounded = (int)value;
+                    rounded += (value - (float)rounded >= 0.5f) ? 1 : 0;
+                    diff[x] = (int)block[y * 8 + x] - rounded;
+                }
+
+                for (unsigned int x = 0; x < cols; x++)
+                {
+                    block_sse += diff[x] * diff[x];
+                }
+            }
+
+            sse += block_sse;
+            *samples += cols * rows;
+        }
+    }
+
+    return sse;
+}
+
+//==========================================================================
+// Pick the quantization tables that use the fewest bits for a target
+// PSNR and make them the current tables (see set_qtable).
+//
+// Parameters:
+//  channels   - The number of channels in the image
+//  info       - A pointer to an array that stores the channel information
+//  width      - The width of the image
+//  height     - The height of the image
+//  psnr       - The target PSNR in dB
+//  perceptual - If not 0 the error in each coefficient is weighted by the
+//               shape of the Annex K tables
+//
+// Return:
+//  The measured PSNR of the tables, or the expected weighted PSNR when
+//  perceptual is set
+//==========================================================================
+float tune_qtable(unsigned int channels, ChannelInfo * info, unsigned int width, unsigned int height, float psnr,
+                  int perceptual)
+{
+    QTuneStats stats;
+    double (*error)[64][256] = (double (*)[64][256])calloc(2, sizeof(*error));
+    double (*bits)[64][256] = (double (*)[64][256])calloc(2, sizeof(*bits));
+    unsigned char tables[2][64];
+    unsigned int * bins = (unsigned int *)malloc(4 * QTUNE_BINS * sizeof(unsigned int));
+    unsigned int * counts = &bins[QTUNE_BINS];
+    unsigned int * dc_bins = &bins[2 * QTUNE_BINS];
+    unsigned int * dc_counts = &bins[3 * QTUNE_BINS];
+
+    measure_coeffs(&stats, channels, info);
+
+    // Distortion & Rate Curves of Every Table Entry
+    for (unsigned int cls = 0; cls < 2; cls++)
+    {
+        const unsigned char * shape = (cls == QTUNE_LUMA) ? y_qTable : cr_qTable;
+        unsigned int * hist = stats.hist[cls];
+        unsigned int * max_bin = stats.max_bin[cls];
+        unsigned long count = stats.blocks[cls];
+
+        if (count == 0)
+        {
+            continue;
+        }
+
+        for (unsigned int k = 0; k < 64; k++)
+        {
+            unsigned int length = list_bins(&hist[k * QTUNE_BINS], max_bin[k], bins, counts);
+            unsigned int dc_length = 0;
+            double unused;
+
+            // DC Terms are Coded as the Difference to the Last Block
+            if (k == 0)
+            {
+                dc_length = list_bins(stats.dc_diff[cls], max_bin[64], dc_bins, dc_counts);
+            }
+
+            // Weight by the Annex K Step Size Relative to the DC Step
+            double weight = 1.0;
+            if (perceptual)
+            {
+                weight = (double)shape[0] / (double)shape[k];
+                weight *= weight;
+            }
+
+            for (unsigned int q = 1; q < 256; q++)
+            {
+                quant_cost(bins, counts, length, q, count, &error[cls][k][q], &bits[cls][k][q]);
+                error[cls][k][q] *= weight;
+
+                if (k == 0)
+                {
+                    quant_cost(dc_bins, dc_counts, dc_length, q, count, &unused, &bits[cls][k][q]);
+                }
+            }
+        }
+    }
+
+    // Largest Error That Meets the Target, Rounding the Output to 8 Bits
+    // Adds a Uniform Error of 1 / 12 to Every Sample on Top of the Tables
+    double samples = 64.0 * (stats.blocks[QTUNE_LUMA] + stats.blocks[QTUNE_CHROMA]);
+    double mse = 255.0 * 255.0 / pow(10.0, psnr / 10.0);
+    double rounding = samples / 12.0;
+    double target = samples * mse - rounding;
+    double total = search_lambda(error, bits, target, tables);
+    float result = (float)(10.0 * log10(samples * 255.0 * 255.0 / (total + rounding)));
+
+    // The Model Leaves Out the Error of the DCT Kernels and of Clamping, so
+    // the Image is Rebuilt With the Tables and the Target is Lowered by the
+    // Error Over Until the Measured PSNR Meets It. Weighted PSNR Can Only
+    // Come From the Model.
+    for (unsigned int pass = 0; (pass < QTUNE_PASSES) && !perceptual; pass++)
+    {
+        double count;
+        double sse = rebuild_error(channels, info, width, height, tables, &count);
+        double goal = count * mse;
+
+        result = (sse > 0.0) ? (float)(10.0 * log10(count * 255.0 * 255.0 / sse)) : 99.0f;
+        if ((sse <= goal) || (total <= 0.0))
+        {
+            break;
+        }
+
+        target = total - (sse - goal) * samples / count;
+        total = search_lambda(error, bits, target, tables);
+    }
+
+    set_qtable(tables[QTUNE_LUMA], tables[QTUNE_CHROMA]);
+
+    free_coeff_stats(&stats);
+    free(error);
+    free(bits);
+    free(bins);
+
+    return result;
+}
@@ -0,0 +1,97 @@
+//==========================================================================
+// This file contains the image adaptive quantization table tuner. The DCT
+// coefficients of the image are measured and a pair of tables is picked
+// that uses the fewest bits for a target PSNR, instead of scaling the
+// Annex K tables by a quality factor.
+//==========================================================================
+
+#ifndef QTUNE_H
+#define QTUNE_H
+
+#include "encoder.h"
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+//==========================================================================
+// Number of histogram bins per coefficient. The coefficients are binned
+// by their magnitude as output by dct2d (4x the JPEG coefficients), which
+// is always below 8192 for 8-bit samples.
+//==========================================================================
+#define QTUNE_BINS 8192
+
+//==========================================================================
+// Table classes, one for luminance and one for both chrominance channels
+//==========================================================================
+#define QTUNE_LUMA   0
+#define QTUNE_CHROMA 1
+
+//==========================================================================
+// Structure to hold the coefficient statistics of an image
+//
+//  hist    - Magnitude histograms of each coefficient (raster order)
+//  dc_diff - Magnitude histogram of the difference between the DC terms
+//            of neighbouring blocks, which is what the DC codes cost
+//  max_bin - The largest non-empty bin of each histogram (64 is dc_diff)
+//  blocks  - The number of blocks measured
+//==========================================================================
+typedef struct
+{
+    unsigned int * hist[2];
+    unsigned int * dc_diff[2];
+    unsigned int max_bin[2][65];
+    unsigned long blocks[2];
+} QTuneStats;
+
+//==========================================================================
+// Measure the DCT coefficients of every block of an image.
+//
+// Parameters:
+//  stats    - The statistics to fill in, release with free_coeff_stats
+//  channels - The number of channels in the image
+//  info     - A pointer to an array that stores the channel information
+//==========================================================================
+void measure_coeffs(QTuneStats * stats, unsigned int channels, ChannelInfo * info);
+
+//==========================================================================
+// Release the memory held by the coefficient statistics.
+//
+// Parameters:
+//  stats - The statistics from measure_coeffs
+//==========================================================================
+void free_coeff_stats(QTuneStats * stats);
+
+//==========================================================================
+// Pick the quantization tables that use the fewest bits for a target
+// PSNR and make them the current tables (see set_qtable). Each table
+// entry is picked to minimize distortion + lambda * bits, with the
+// distortion of the quantizer and the entropy of its output measured on
+// the coefficient histograms, and lambda is searched for to hit the
+// target. The PSNR is over the YCbCr samples that are coded. The tables
+// are then checked by encoding and decoding the image, and lambda is
+// lowered until the measured PSNR meets the target.
+//
+// Parameters:
+//  channels   - The number of channels in the image
+//  info       - A pointer to an array that stores the channel information
+//  width      - The width of the image
+//  height     - The height of the image
+//  psnr       - The target PSNR in dB
+//  perceptual - If not 0 the error in each coefficient is weighted by the
+//               shape of the Annex K tables, so the target is a weighted
+//               PSNR that tolerates more error at high frequencies and is
+//               not checked against the image
+//
+// Return:
+//  The measured PSNR of the tables, or the expected weighted PSNR when
+//  perceptual is set
+//==========================================================================
+float tune_qtable(unsigned int channels, ChannelInfo * info, unsigned int width, unsigned int height, float psnr,
+                  int perceptual);
+
+#ifdef __cplusplus
+}
+#endif
+
+#endif /* QTUNE_H */
@@ -0,0 +1,1003 @@
+//==========================================================================
+// This file implements the input image reader. The image is read one row
+// at a time, converted to YCbCr when needed, and stored in the block
+// ordered planes used by the encoder.
+//==========================================================================
+
+#include "reader.h"
+#include "kernels.h"
+
+#include <stdlib.h>
+#include <string.h>
+#include <ctype.h>
+#include <math.h>
+
+#if defined(_WIN32)
+#include <io.h>
+#include <fcntl.h>
+#else
+#include <unistd.h>
+#endif
+
+#if defined(__SSE2__) || defined(_M_X64)
+#include <emmintrin.h>
+#endif
+
+//==========================================================================
+// Distance ahead of the current column that each row of a strip is
+// prefetched, in bytes
+//==========================================================================
+#define STRIP_PREFETCH 512
+
+//==========================================================================
+// Helper function that will convert a format name to a format id.
+//
+// Parameters:
+//  name - The format name (raw, pnm, rgb24, bgr24 or yuv420)
+//
+// Return:
+//  The format id or -1 if the name is not known
+//==========================================================================
+int reader_format(const char * name)
+{
+    if (strcmp(name, "raw") == 0)
+        return FORMAT_RAW;
+    if ((strcmp(name, "pnm") == 0) || (strcmp(name, "pgm") == 0) || (strcmp(name, "ppm") == 0))
+        return FORMAT_PNM;
+    if (strcmp(name, "rgb24") == 0)
+        return FORMAT_RGB24;
+    if (strcmp(name, "bgr24") == 0)
+        return FORMAT_BGR24;
+    if (strcmp(name, "yuv420") == 0)
+        return FORMAT_YUV420;
+
+    return -1;
+}
+
+//==========================================================================
+// Helper function that will read the next number from a PNM header. White
+// space and comments are skipped.
+//
+// Parameters:
+//  fid   - The input file id
+//  value - A pointer to store the number in
+//
+// Return:
+//  0 on success, -1 if a number could not be read
+//==========================================================================
+int read_pnm_value(FILE * fid, unsigned int * value)
+{
+    int c = fgetc(fid);
+
+    // Skip White Space & Comments
+    while ((c == '#') || isspace(c))
+    {
+        if (c == '#')
+        {
+            while ((c != '\n') && (c != EOF))
+            {
+                c = fgetc(fid);
+            }
+        }
+        c = fgetc(fid);
+    }
+
+    if (!isdigit(c))
+    {
+        return -1;
+    }
+
+    *value = 0;
+    while (isdigit(c))
+    {
+        *value = *value * 10 + (c - '0');
+        c = fgetc(fid);
+    }
+
+    // The Single White Space After the Value is Consumed
+    return 0;
+}
+
+//==========================================================================
+// Helper function that will parse a binary PGM (P5) or PPM (P6) header.
+// After it returns the file is positioned at the start of the pixel data.
+//
+// Parameters:
+//  reader - The input image reader
+//
+// Return:
+//  0 on success, -1 if the header is not valid
+//==========================================================================
+int read_pnm_header(ImageReader * reader)
+{
+    char magic[2];
+    unsigned int maxval;
+
+    if (fread(magic, 1, 2, reader->fid) != 2)
+    {
+        return -1;
+    }
+
+    if ((magic[0] != 'P') || ((magic[1] != '5') && (magic[1] != '6')))
+    {
+        printf("Only Binary PGM (P5) & PPM (P6) Files are Supported\n");
+        return -1;
+    }
+    reader->channels = (magic[1] == '5') ? 1 : 3;
+
+    if ((read_pnm_value(reader->fid, &reader->width) != 0) ||
+        (read_pnm_value(reader->fid, &reader->height) != 0) ||
+        (read_pnm_value(reader->fid, &maxval) != 0))
+    {
+        printf("Invalid PNM Header\n");
+        return -1;
+    }
+
+    if (maxval != 255)
+    {
+        printf("Only 8-bit PNM Files are Supported (maxval %d)\n", maxval);
+        return -1;
+    }
+
+    return 0;
+}
+
+//==========================================================================
+// Open an input image. For FORMAT_PNM the width, height and channels are
+// read from the header, for all of the other formats they need to be
+// provided.
+//
+// Parameters:
+//  reader    - The reader to initialize
+//  file_name - The file to open and read the image from, "-" for stdin
+//  format    - One of the FORMAT_* values
+//  width     - The input width
+//  height    - The input height
+//  channels  - The number of channels, 1 for grayscale or 3 for color
+//
+// Return:
+//  0 on success, -1 if the file could not be opened or is not valid
+//==========================================================================
+int reader_open(ImageReader * reader, const char * file_name, unsigned int format,
+                unsigned int width, unsigned int height, unsigned int channels)
+{
+    memset(reader, 0, sizeof(ImageReader));
+    reader->format = format;
+    reader->width = width;
+    reader->height = height;
+    reader->channels = channels;
+
+    // Open File
+    if (strcmp(file_name, "-") == 0)
+    {
+#if defined(_WIN32)
+        _setmode(_fileno(stdin), _O_BINARY);
+#endif
+        reader->fid = stdin;
+    }
+    else
+    {
+        reader->fid = fopen(file_name, "rb");
+    }
+
+    if (reader->fid == NULL)
+    {
+        printf("Failed to Open File: %s\n", file_name);
+        return -1;
+    }
+
+    // Read Header
+    if ((format == FORMAT_PNM) && (read_pnm_header(reader) != 0))
+    {
+        reader_close(reader);
+        return -1;
+    }
+
+    // Packed RGB & Planar YUV are Always Color
+    if ((format == FORMAT_RGB24) || (format == FORMAT_BGR24) || (format == FORMAT_YUV420))
+    {
+        reader->channels = 3;
+    }
+
+    // Check for Valid # of Channels
+    if ((reader->channels != 1) && (reader->channels != 3))
+    {
+        printf("Invalid # of Channels: %d (1,3 are the only valid options)\n", reader->channels);
+        reader_close(reader);
+        return -1;
+    }
+
+    if ((reader->width == 0) || (reader->height == 0))
+    {
+        printf("Invalid Image Size: %dx%d\n", reader->width, reader->height);
+        reader_close(reader);
+        return -1;
+    }
+
+    // Bytes Per Pixel in the File
+    if ((reader->channels == 1) || (format == FORMAT_YUV420))
+        reader->pixel_size = 1;
+    else if (format == FORMAT_RAW)
+        reader->pixel_size = 4;
+    else
+        reader->pixel_size = 3;
+
+    reader->row = (unsigned char *)malloc(reader->width * reader->pixel_size);
+    reader->rgb = (unsigned char *)malloc(reader->width * 3);
+
+    return 0;
+}
+
+//==========================================================================
+// Only read a window of the image. After this call the reader acts as if
+// the image was just the window, and each row of the window is read
+// straight from its offset in the file, so the rest of the image is never
+// read. This must be called before any rows are read and the file has to
+// be seekable.
+//
+// Parameters:
+//  reader - The opened input image reader
+//  x      - The left edge of the window
+//  y      - The top edge of the window
+//  width  - The width of the window
+//  height - The height of the window
+//
+// Return:
+//  0 on success, -1 if the window is not valid for the image
+//==========================================================================
+int reader_set_crop(ImageReader * reader, unsigned int x, unsigned int y, unsigned int width, unsigned int height)
+{
+    if ((width == 0) || (height == 0) || (x >= reader->width) || (y >= reader->height) ||
+        (width > reader->width - x) || (height > reader->height - y))
+    {
+        printf("Crop %dx%d+%d+%d is Outside the %dx%d Image\n", width, height, x, y, reader->width, reader->height);
+        return -1;
+    }
+
+    // The Chroma Planes are Half Size
+    if ((reader->format == FORMAT_YUV420) && (((x % 2) != 0) || ((y % 2) != 0)))
+    {
+        printf("YUV420 Crops Must Start on an Even Row & Column\n");
+        return -1;
+    }
+
+    // Pixel Data Starts After the Header
+    if (reader->fid == stdin)
+    {
+        printf("Crops Can Not be Read From stdin\n");
+        return -1;
+    }
+
+#if defined(_WIN32)
+    reader->data_offset = _ftelli64(reader->fid);
+#else
+    reader->data_offset = ftello(reader->fid);
+#endif
+    if (reader->data_offset < 0)
+    {
+        printf("Crops Can Not be Read From a File That Can't Seek\n");
+        return -1;
+    }
+
+    reader->cropped = 1;
+    reader->crop_x = x;
+    reader->crop_y = y;
+    reader->src_width = reader->width;
+    reader->src_height = reader->height;
+    reader->row_idx = 0;
+    reader->width = width;
+    reader->height = height;
+
+    return 0;
+}
+
+//==========================================================================
+// Read a span of bytes from an absolute offset in the input file.
+//
+// Parameters:
+//  reader - The input image reader
+//  data   - Buffer to read the bytes into
+//  count  - The number of bytes to read
+//  offset - The offset of the first byte in the file
+//
+// Return:
+//  0 on success, -1 if the bytes could not be read
+//==========================================================================
+int read_span(ImageReader * reader, unsigned char * data, size_t count, long long offset)
+{
+#if defined(_WIN32)
+    if (_fseeki64(reader->fid, offset, SEEK_SET) != 0)
+    {
+        return -1;
+    }
+
+    return (fread(data, 1, count, reader->fid) == count) ? 0 : -1;
+#else
+    // pread Leaves the FILE Position Alone, so Nothing is Buffered
+    int fd = fileno(reader->fid);
+    while (count > 0)
+    {
+        ssize_t read_cnt = pread(fd, data, count, (off_t)offset);
+        if (read_cnt <= 0)
+        {
+            return -1;
+        }
+
+        data += read_cnt;
+        count -= (size_t)read_cnt;
+        offset += read_cnt;
+    }
+
+    return 0;
+#endif
+}
+
+//==========================================================================
+// Start the next frame of a stream of images, such as raw video frames
+// or PNM images written one after another to a pipe. Every frame has to
+// be the same size as the first one. Call this before reading each frame,
+// including the first.
+//
+// Parameters:
+//  reader - The input image reader
+//
+// Return:
+//  1 if there is another frame, 0 at the end of the stream or -1 if the
+//  frame header is not valid
+//==========================================================================
+int reader_next_frame(ImageReader * reader)
+{
+    unsigned int width = reader->width;
+    unsigned int height = reader->height;
+    unsigned int channels = reader->channels;
+
+    // Wait for the First Byte of the Frame
+    int c = fgetc(reader->fid);
+    if (c == EOF)
+    {
+        return 0;
+    }
+    ungetc(c, reader->fid);
+
+    // The Header of the First PNM Frame was Read by reader_open
+    if ((reader->format == FORMAT_PNM) && (reader->frames > 0))
+    {
+        if (read_pnm_header(reader) != 0)
+        {
+            return -1;
+        }
+
+        if ((reader->width != width) || (reader->height != height) || (reader->channels != channels))
+        {
+            printf("Frame %lu Size Changed: %dx%dx%d\n", reader->frames, reader->width, reader->height, reader->channels);
+            return -1;
+        }
+    }
+
+    reader->frames++;
+    return 1;
+}
+
+//==========================================================================
+// Read the next row of the image. The row is returned as 8-bit grayscale
+// or as packed 24-bit RGB. This is not valid for FORMAT_YUV420.
+//
+// Parameters:
+//  reader - The input image reader
+//
+// Return:
+//  A pointer to the row or NULL if the row could not be read
+//==========================================================================
+const unsigned char * reader_read_row(ImageReader * reader)
+{
+    unsigned int width = reader->width;
+
+    if (reader->cropped)
+    {
+        long long offset = reader->data_offset +
+            ((long long)(reader->crop_y + reader->row_idx) * reader->src_width + reader->crop_x) * reader->pixel_size;
+
+        if ((reader->row_idx >= reader->height) || (read_span(reader, reader->row, (size_t)width * reader->pixel_size, offset) != 0))
+        {
+            return NULL;
+        }
+
+        reader->row_idx++;
+    }
+    else if (fread(reader->row, reader->pixel_size, width, reader->fid) != width)
+    {
+        return NULL;
+    }
+
+    // Grayscale, PPM and RGB24 are Already in the Right Format
+    if ((reader->channels == 1) || (reader->format == FORMAT_PNM) || (reader->format == FORMAT_RGB24))
+    {
+        return reader->row;
+    }
+
+    if (reader->format == FORMAT_BGR24)
+    {
+        for (unsigned int i = 0; i < width; i++)
+        {
+            reader->rgb[i * 3] = reader->row[i * 3 + 2];
+            reader->rgb[i * 3 + 1] = reader->row[i * 3 + 1];
+            reader->rgb[i * 3 + 2] = reader->row[i * 3];
+        }
+    }
+    else
+    {
+        // Raw 32-bit Pixels are Stored in Local Byte Order
+        //  |    BITS ||31 ... 24|23 ... 16|15 ...  8| 7 ...  0|
+        //  |   COLOR ||  UNUSED |     RED |   GREEN |    BLUE |
+        for (unsigned int i = 0; i < width; i++)
+        {
+            unsigned int pixel;
+            memcpy(&pixel, &reader->row[i * 4], 4);
+            reader->rgb[i * 3] = (pixel >> 16) & 0xFF;
+            reader->rgb[i * 3 + 1] = (pixel >> 8) & 0xFF;
+            reader->rgb[i * 3 + 2] = pixel & 0xFF;
+        }
+    }
+
+    return reader->rgb;
+}
+
+//==========================================================================
+// Allocate the block ordered planes for an image. The planes are padded
+// out to a multiple of the MCU size.
+//
+// Parameters:
+//  width    - The image width
+//  height   - The image height
+//  channels - The number of channels, 1 for grayscale or 3 for color
+//  info     - An array of structures to store the channel information in
+//  arena    - The arena to allocate the planes from
+//==========================================================================
+void alloc_planes(unsigned int width, unsigned int height, unsigned int channels, ChannelInfo * info, Arena * arena)
+{
+    // Calculate Bounds
+    unsigned int aWidth = 0;
+    unsigned int aHeight = 0;
+    for (unsigned int i = 0; i < channels; i++)
+    {
+        unsigned int w_div = 8;
+        unsigned int h_div = 8;
+
+        if (i != 0)
+        {
+            w_div *= 2;
+            h_div *= 2;
+        }
+
+        aWidth = max(aWidth, ((width + w_div - 1) / w_div) * w_div);
+        aHeight = max(aHeight, ((height + h_div - 1) / h_div) * h_div);
+    }
+
+    // Allocate Memory
+    for (unsigned int i = 0; i < channels; i++)
+    {
+        info[i].width = aWidth;
+        info[i].height = aHeight;
+
+        if (i != 0)
+        {
+            info[i].width /= 2;
+            info[i].height /= 2;
+        }
+
+        info[i].data = (unsigned char *)arena_alloc(arena, info[i].width * info[i].height);
+    }
+}
+
+//==========================================================================
+// Fill the padding of a block ordered plane by repeating the last column
+// and row of the samples.
+//
+// Parameters:
+//  plane  - The plane to pad
+//  width  - The number of samples in each row
+//  height - The number of rows
+//==========================================================================
+void pad_plane(ChannelInfo * plane, unsigned int width, unsigned int height)
+{
+    unsigned int pwidth = plane->width;
+    unsigned int pheight = plane->height;
+
+    for (unsigned int y = 0; y < pheight; y++)
+    {
+        unsigned char * dst = &plane->data[(y / 8) * pwidth * 8 + (y % 8) * 8];
+
+        if (y >= height)
+        {
+            // Copy the Whole Last Row, Block by Block
+            const unsigned char * src = &plane->data[((height - 1) / 8) * pwidth * 8 + ((height - 1) % 8) * 8];
+            for (unsigned int x = 0; x < pwidth; x += 8)
+            {
+                memcpy(&dst[x * 8], &src[x * 8], 8);
+            }
+        }
+        else
+        {
+            unsigned char last = dst[((width - 1) / 8) * 64 + (width - 1) % 8];
+            for (unsigned int x = width; x < pwidth; x++)
+            {
+                dst[(x / 8) * 64 + x % 8] = last;
+            }
+        }
+    }
+}
+
+//==========================================================================
+// Store one row of 8-bit samples in a block ordered plane.
+//
+// Parameters:
+//  plane - The plane to store the row in
+//  y     - The row number
+//  row   - The samples
+//  count - The number of samples in the row
+//==========================================================================
+void store_plane_row(ChannelInfo * plane, unsigned int y, const unsigned char * row, unsigned int count)
+{
+    unsigned char * dst = &plane->data[(y / 8) * plane->width * 8 + (y % 8) * 8];
+
+    for (unsigned int x = 0; x < count; x += 8)
+    {
+        memcpy(&dst[x * 8], &row[x], min(8, count - x));
+    }
+}
+
+//==========================================================================
+// Store a strip of 8 rows of 8-bit samples in a block ordered plane. Each
+// block is written whole, two at a time with SSE2 from 16 samples of each
+// row, and the samples past the end of the rows are filled with the last
+// sample of each row.
+//
+// Parameters:
+//  plane - The plane to store the strip in
+//  y     - The first row number, a multiple of 8
+//  rows  - The 8 rows, repeat a row to pad the bottom of the plane
+//  count - The number of samples in each row, at most the plane width
+//==========================================================================
+void store_plane_strip(ChannelInfo * plane, unsigned int y, const unsigned char * const * rows, unsigned int count)
+{
+    unsigned char * dst = &plane->data[(y / 8) * plane->width * 8];
+    unsigned int x = 0;
+
+#if defined(__SSE2__) || defined(_M_X64)
+    // Two Blocks at a Time, the Low & High Halves of Each Pair of Rows
+    for (; x + 16 <= count; x += 16)
+    {
+        __m128i r[8];
+
+        for (unsigned int i = 0; i < 8; i++)
+        {
+            // Each Row is its Own Stream, so Fetch Ahead in Every Row
+            if ((x % 64) == 0)
+            {
+                _mm_prefetch((const char *)&rows[i][x] + STRIP_PREFETCH, _MM_HINT_T0);
+            }
+            r[i] = _mm_loadu_si128((const __m128i *)&rows[i][x]);
+        }
+
+        for (unsigned int i = 0; i < 8; i += 2)
+        {
+            _mm_storeu_si128((__m128i *)&dst[x * 8 + i * 8], _mm_unpacklo_epi64(r[i], r[i + 1]));
+            _mm_storeu_si128((__m128i *)&dst[x * 8 + 64 + i * 8], _mm_unpackhi_epi64(r[i], r[i + 1]));
+        }
+    }
+#endif
+
+    // One Block at a Time, One 64-bit Move per Row
+    for (; x + 8 <= count; x += 8)
+    {
+        for (unsigned int i = 0; i < 8; i++)
+        {
+            memcpy(&dst[x * 8 + i * 8], &rows[i][x], 8);
+        }
+    }
+
+    // Partial Last Block & the Padding Blocks
+    for (; x < plane->width; x += 8)
+    {
+        unsigned int n = (x < count) ? count - x : 0;
+
+        for (unsigned int i = 0; i < 8; i++)
+        {
+            memcpy(&dst[x * 8 + i * 8], &rows[i][x], n);
+            memset(&dst[x * 8 + i * 8 + n], rows[i][count - 1], 8 - n);
+        }
+    }
+}
+
+//==========================================================================
+// Convert one row of RGB pixels to YCbCr and store it in the block
+// ordered planes. The Cb & Cr samples are taken from alternating pixels
+// of the even rows.
+//
+// Parameters:
+//  info  - The channel information
+//  y     - The row number
+//  rgb   - The packed 24-bit RGB pixels
+//  count - The number of pixels in the row
+//==========================================================================
+void store_rgb_row(ChannelInfo * info, unsigned int y, const unsigned char * rgb, unsigned int count)
+{
+    unsigned int row = y % 8;
+    unsigned int yblock = y / 8;
+    unsigned int alt = (row % 4) / 2;
+
+    for (unsigned int x = 0; x < count; x++)
+    {
+        unsigned int xblock = x / 8;
+        unsigned int i = x % 8;
+        unsigned int offset = (yblock * info[0].width * 8) + (xblock * 8 * 8) + (row * 8);
+        unsigned int r = rgb[x * 3];
+        unsigned int g = rgb[x * 3 + 1];
+        unsigned int b = rgb[x * 3 + 2];
+
+        // Handle Y Channel
+        float lum = 0.299f * r + 0.587f * g + 0.114f * b;
+        info[0].data[offset + i] = (unsigned char)lum;
+
+        // Handle Cb/Cr Channels
+        if ((row % 2) == 0)
+        {
+            unsigned int clrOffset = ((yblock / 2) * info[1].width * 8) + (yblock % 2) * 8 * 4 + (xblock / 2) * 8 * 8 + (xblock % 2) * 4 + row * 4 + i / 2;
+            if (((i + alt) % 2) == 0)
+            {
+                float cb = roundf(128.0f - 0.168736f * r - 0.331264f * g + 0.5f * b);
+                info[1].data[clrOffset] = (unsigned char)cb;
+            }
+
+            if (((i + alt + 1) % 2) == 0)
+            {
+                float cr = roundf(128.0f + 0.5f * r - 0.418688f * g - 0.081312f * b);
+                info[2].data[clrOffset] = (unsigned char)cr;
+            }
+        }
+    }
+}
+
+//==========================================================================
+// Convert a 16x16 tile of RGB pixels to the blocks of one MCU, the four
+// luminance blocks followed by the Cb and Cr blocks. The blocks are the
+// same as store_rgb_row would store for the tile.
+//
+// Parameters:
+//  rgb    - The top left pixel of the tile, packed 24-bit RGB
+//  stride - The distance between the rows of the tile in bytes
+//  blocks - The 6 8x8 blocks to store the MCU in
+//==========================================================================
+void store_rgb_mcu(const unsigned char * rgb, size_t stride, unsigned char * blocks)
+{
+    for (unsigned int y = 0; y < 16; y++)
+    {
+        const unsigned char * src = &rgb[y * stride];
+        unsigned int row = y % 8;
+        unsigned int alt = (row % 4) / 2;
+
+        for (unsigned int x = 0; x < 16; x++)
+        {
+            unsigned int i = x % 8;
+            unsigned int r = src[x * 3];
+            unsigned int g = src[x * 3 + 1];
+            unsigned int b = src[x * 3 + 2];
+
+            // Handle Y Channel
+            float lum = 0.299f * r + 0.587f * g + 0.114f * b;
+            blocks[((y / 8) * 2 + x / 8) * 64 + row * 8 + i] = (unsigned char)lum;
+
+            // Handle Cb/Cr Channels
+            if ((row % 2) == 0)
+            {
+                unsigned int clrOffset = (y / 2) * 8 + x / 2;
+                if (((i + alt) % 2) == 0)
+                {
+                    float cb = roundf(128.0f - 0.168736f * r - 0.331264f * g + 0.5f * b);
+                    blocks[4 * 64 + clrOffset] = (unsigned char)cb;
+                }
+
+                if (((i + alt + 1) % 2) == 0)
+                {
+                    float cr = roundf(128.0f + 0.5f * r - 0.418688f * g - 0.081312f * b);
+                    blocks[5 * 64 + clrOffset] = (unsigned char)cr;
+                }
+            }
+        }
+    }
+}
+
+//==========================================================================
+// Store an image that is already in memory in block ordered planes. The
+// planes are padded out to a whole number of MCUs by repeating the last
+// row and column of the image. The strides are in bytes and may be
+// negative, so a view into a larger image is read in place.
+//
+// Parameters:
+//  pixels         - The first sample of the image
+//  row_stride     - The distance between the rows
+//  pixel_stride   - The distance between the pixels of a row
+//  channel_stride - The distance between the samples of a pixel
+//  width          - The image width
+//  height         - The image height
+//  channels       - The number of channels, 1 for grayscale or 3 for RGB
+//  info           - An array of structures to store the channel information in
+//  arena          - The arena to allocate the planes from
+//==========================================================================
+void store_image(const unsigned char * pixels, ptrdiff_t row_stride, ptrdiff_t pixel_stride, ptrdiff_t channel_stride,
+                 unsigned int width, unsigned int height, unsigned int channels, ChannelInfo * info, Arena * arena)
+{
+    unsigned int mcu = (channels == 1) ? 8 : 16;
+    unsigned int pad_width = ((width + mcu - 1) / mcu) * mcu;
+    unsigned int pad_height = ((height + mcu - 1) / mcu) * mcu;
+    int packed = (pixel_stride == (ptrdiff_t)channels) && ((channels == 1) || (channel_stride == 1));
+    const Kernels * kernels = get_kernels();
+
+    alloc_planes(width, height, channels, info, arena);
+
+    // Grayscale is Stored a Strip of 8 Rows at a Time, in Place if Packed
+    if (channels == 1)
+    {
+        unsigned char * strip = (unsigned char *)arena_alloc(arena, (size_t)width * 8);
+        const unsigned char * rows[8];
+
+        for (unsigned int y = 0; y < pad_height; y += 8)
+        {
+            for (unsigned int i = 0; i < 8; i++)
+            {
+                const unsigned char * src = pixels + (ptrdiff_t)min(y + i, height - 1) * row_stride;
+
+                rows[i] = src;
+                if (!packed)
+                {
+                    for (unsigned int x = 0; x < width; x++)
+                    {
+                        strip[i * width + x] = src[x * pixel_stride];
+                    }
+                    rows[i] = &strip[i * width];
+                }
+            }
+
+            store_plane_strip(&info[0], y, rows, width);
+        }
+        return;
+    }
+
+    unsigned char * row = (unsigned char *)arena_alloc(arena, pad_width * channels);
+
+    for (unsigned int y = 0; y < pad_height; y++)
+    {
+        const unsigned char * src = pixels + (ptrdiff_t)min(y, height - 1) * row_stride;
+
+        // Gather the Row
+        if (packed)
+        {
+            memcpy(row, src, width * channels);
+        }
+        else
+        {
+            for (unsigned int x = 0; x < width; x++)
+            {
+                for (unsigned int c = 0; c < channels; c++)
+                {
+                    row[x * channels + c] = src[x * pixel_stride + c * channel_stride];
+                }
+            }
+        }
+
+        // Repeat the Last Column
+        for (unsigned int x = width; x < pad_width; x++)
+        {
+            memcpy(&row[x * channels], &row[(width - 1) * channels], channels);
+        }
+
+        kernels->rgb_row(info, y, row, pad_width);
+    }
+}
+
+//==========================================================================
+// Helper function that will read the next strip of rows of a grayscale
+// image. An image that is not cropped is read with a single fread.
+//
+// Parameters:
+//  reader - The input image reader
+//  strip  - The buffer to store the rows in, one after another
+//  count  - The number of rows to read, at most 8
+//
+// Return:
+//  0 on success, -1 if the rows could not be read
+//==========================================================================
+int read_gray_strip(ImageReader * reader, unsigned char * strip, unsigned int count)
+{
+    size_t width = reader->width;
+
+    if (!reader->cropped)
+    {
+        return (fread(strip, 1, width * count, reader->fid) == width * count) ? 0 : -1;
+    }
+
+    for (unsigned int i = 0; i < count; i++)
+    {
+        const unsigned char * row = reader_read_row(reader);
+        if (row == NULL)
+        {
+            return -1;
+        }
+        memcpy(&strip[i * width], row, width);
+    }
+
+    return 0;
+}
+
+//==========================================================================
+// Helper function that will read a planar YCbCr 4:2:0 image straight into
+// the block ordered planes, no color conversion is needed.
+//
+// Parameters:
+//  reader - The input image reader
+//  info   - The channel information
+//
+// Return:
+//  0 on success, -1 if the planes could not be read
+//==========================================================================
+int read_yuv420(ImageReader * reader, ChannelInfo * info)
+{
+    unsigned int cwidth = (reader->width + 1) / 2;
+    unsigned int cheight = (reader->height + 1) / 2;
+
+    // Layout of the Planes in the File When Cropping
+    long long src_cwidth = (reader->src_width + 1) / 2;
+    long long src_cheight = (reader->src_height + 1) / 2;
+    long long offset = reader->data_offset;
+
+    for (unsigned int i = 0; i < reader->channels; i++)
+    {
+        unsigned int width = (i == 0) ? reader->width : cwidth;
+        unsigned int height = (i == 0) ? reader->height : cheight;
+        long long stride = (i == 0) ? reader->src_width : src_cwidth;
+        unsigned int x0 = (i == 0) ? reader->crop_x : reader->crop_x / 2;
+        unsigned int y0 = (i == 0) ? reader->crop_y : reader->crop_y / 2;
+
+        for (unsigned int y = 0; y < height; y++)
+        {
+            int status;
+            if (reader->cropped)
+                status = read_span(reader, reader->row, width, offset + (y0 + y) * stride + x0);
+            else
+                status = (fread(reader->row, 1, width, reader->fid) == width) ? 0 : -1;
+
+            if (status != 0)
+            {
+                return -1;
+            }
+
+            store_plane_row(&info[i], y, reader->row, width);
+        }
+
+        offset += (i == 0) ? (long long)reader->src_width * reader->src_height : src_cwidth * src_cheight;
+    }
+
+    return 0;
+}
+
+//==========================================================================
+// Read the rest of the image and store it in block ordered planes. Color
+// images are converted to YCbCr 4:2:0. The planes are padded out to a
+// whole number of MCUs by repeating the last row and column of the image,
+// the same as store_image.
+//
+// Parameters:
+//  reader - The input image reader
+//  info   - An array of structures to store the channel information in
+//  arena  - The arena to allocate the planes from
+//
+// Return:
+//  0 on success, -1 if the image ended early or could not be read
+//==========================================================================
+int reader_read_planes(ImageReader * reader, ChannelInfo * info, Arena * arena)
+{
+    const Kernels * kernels = get_kernels();
+    unsigned int channels = reader->channels;
+
+    alloc_planes(reader->width, reader->height, channels, info, arena);
+
+    // The Planes are Read Whole, so Only the Planes Can be Padded
+    if (reader->format == FORMAT_YUV420)
+    {
+        unsigned int cwidth = (reader->width + 1) / 2;
+        unsigned int cheight = (reader->height + 1) / 2;
+
+        if (read_yuv420(reader, info) != 0)
+        {
+            return -1;
+        }
+
+        pad_plane(&info[0], reader->width, reader->height);
+        if (channels == 3)
+        {
+            pad_plane(&info[1], cwidth, cheight);
+            pad_plane(&info[2], cwidth, cheight);
+        }
+        return 0;
+    }
+
+    unsigned int pad_width = info[0].width;
+    unsigned int pad_height = info[0].height;
+
+    // Grayscale is Read & Stored a Strip of 8 Rows at a Time
+    if (channels == 1)
+    {
+        unsigned char * strip = (unsigned char *)arena_alloc(arena, (size_t)reader->width * 8);
+        const unsigned char * rows[8];
+
+        for (unsigned int y = 0; y < pad_height; y += 8)
+        {
+            unsigned int count = min(8, reader->height - y);
+
+            if (read_gray_strip(reader, strip, count) != 0)
+            {
+                return -1;
+            }
+
+            // Rows Past the Bottom Repeat the Last Row
+            for (unsigned int i = 0; i < 8; i++)
+            {
+                rows[i] = &strip[min(i, count - 1) * reader->width];
+            }
+
+            store_plane_strip(&info[0], y, rows, reader->width);
+        }
+        return 0;
+    }
+
+    unsigned char * padded = (unsigned char *)arena_alloc(arena, pad_width * channels);
+    const unsigned char * row = NULL;
+
+    for (unsigned int y = 0; y < pad_height; y++)
+    {
+        // Rows Past the Bottom Repeat the Last Row
+        if (y < reader->height)
+        {
+            row = reader_read_row(reader);
+            if (row == NULL)
+            {
+                return -1;
+            }
+
+            // Repeat the Last Column
+            if (reader->width < pad_width)
+            {
+                memcpy(padded, row, reader->width * channels);
+                for (unsigned int x = reader->width; x < pad_width; x++)
+                {
+                    memcpy(&padded[x * channels], &padded[(reader->width - 1) * channels], channels);
+                }
+                row = padded;
+            }
+        }
+
+        kernels->rgb_row(info, y, row, pad_width);
+    }
+
+    return 0;
+}
+
+//==========================================================================
+// Close the input image.
+//
+// Parameters:
+//  reader - The input image reader
+//==========================================================================
+void reader_close(ImageReader * reader)
+{
+    if (reader->fid != NULL)
+    {
+        fclose(reader->fid);
+        reader->fid = NULL;
+    }
+
+    free(reader->row);
+    free(reader->rgb);
+    reader->row = NULL;
+    reader->rgb = NULL;
+}
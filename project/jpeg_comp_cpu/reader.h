@@ -0,0 +1,257 @@
+//==========================================================================
+// This file contains the functions needed to read the input image. The
+// image is read one row at a time and stored in the block ordered planes
+// used by the encoder.
+//==========================================================================
+
+#ifndef READER_H
+#define READER_H
+
+#include <stdio.h>
+#include <stddef.h>
+#include "encoder.h"
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+//==========================================================================
+// Supported Input Formats
+//
+//  FORMAT_RAW    - Headerless 8-bit grayscale or 24-bit RGB stored in a
+//                  32-bit word in local byte order
+//  FORMAT_PNM    - Binary PGM (P5) or PPM (P6) with an 8-bit maxval, the
+//                  size and channel count are read from the header
+//  FORMAT_RGB24  - Headerless packed 24-bit RGB
+//  FORMAT_BGR24  - Headerless packed 24-bit BGR
+//  FORMAT_YUV420 - Headerless planar YCbCr 4:2:0 (I420), the Y plane is
+//                  followed by the Cb plane and then the Cr plane
+//==========================================================================
+#define FORMAT_RAW    0
+#define FORMAT_PNM    1
+#define FORMAT_RGB24  2
+#define FORMAT_BGR24  3
+#define FORMAT_YUV420 4
+
+//==========================================================================
+// Structure to hold the input image reader information
+//==========================================================================
+typedef struct ImageReader
+{
+    FILE * fid;
+    unsigned int format;
+    unsigned int width;
+    unsigned int height;
+    unsigned int channels;
+    unsigned int pixel_size;
+    unsigned long frames;
+    unsigned char * row;
+    unsigned char * rgb;
+
+    // Crop Window (see reader_set_crop)
+    int cropped;
+    unsigned int crop_x;
+    unsigned int crop_y;
+    unsigned int src_width;
+    unsigned int src_height;
+    unsigned int row_idx;
+    long long data_offset;
+} ImageReader;
+
+//==========================================================================
+// Helper function that will convert a format name to a format id.
+//
+// Parameters:
+//  name - The format name (raw, pnm, rgb24, bgr24 or yuv420)
+//
+// Return:
+//  The format id or -1 if the name is not known
+//==========================================================================
+int reader_format(const char * name);
+
+//==========================================================================
+// Open an input image. For FORMAT_PNM the width, height and channels are
+// read from the header, for all of the other formats they need to be
+// provided.
+//
+// Parameters:
+//  reader    - The reader to initialize
+//  file_name - The file to open and read the image from, "-" for stdin
+//  format    - One of the FORMAT_* values
+//  width     - The input width
+//  height    - The input height
+//  channels  - The number of channels, 1 for grayscale or 3 for color
+//
+// Return:
+//  0 on success, -1 if the file could not be opened or is not valid
+//==========================================================================
+int reader_open(ImageReader * reader, const char * file_name, unsigned int format,
+                unsigned int width, unsigned int height, unsigned int channels);
+
+//==========================================================================
+// Only read a window of the image. After this call the reader acts as if
+// the image was just the window, and each row of the window is read
+// straight from its offset in the file, so the rest of the image is never
+// read. This must be called before any rows are read and the file has to
+// be seekable.
+//
+// Parameters:
+//  reader - The opened input image reader
+//  x      - The left edge of the window
+//  y      - The top edge of the window
+//  width  - The width of the window
+//  height - The height of the window
+//
+// Return:
+//  0 on success, -1 if the window is not valid for the image
+//==========================================================================
+int reader_set_crop(ImageReader * reader, unsigned int x, unsigned int y, unsigned int width, unsigned int height);
+
+//==========================================================================
+// Start the next frame of a stream of images, such as raw video frames
+// or PNM images written one after another to a pipe. Every frame has to
+// be the same size as the first one. Call this before reading each frame,
+// including the first.
+//
+// Parameters:
+//  reader - The input image reader
+//
+// Return:
+//  1 if there is another frame, 0 at the end of the stream or -1 if the
+//  frame header is not valid
+//==========================================================================
+int reader_next_frame(ImageReader * reader);
+
+//==========================================================================
+// Read the next row of the image. The row is returned as 8-bit grayscale
+// or as packed 24-bit RGB. This is not valid for FORMAT_YUV420.
+//
+// Parameters:
+//  reader - The input image reader
+//
+// Return:
+//  A pointer to the row or NULL if the row could not be read
+//==========================================================================
+const unsigned char * reader_read_row(ImageReader * reader);
+
+//==========================================================================
+// Read the rest of the image and store it in block ordered planes. Color
+// images are converted to YCbCr 4:2:0. The planes are padded out to a
+// whole number of MCUs by repeating the last row and column of the image.
+//
+// Parameters:
+//  reader - The input image reader
+//  info   - An array of structures to store the channel information in
+//  arena  - The arena to allocate the planes from
+//
+// Return:
+//  0 on success, -1 if the image ended early or could not be read
+//==========================================================================
+int reader_read_planes(ImageReader * reader, ChannelInfo * info, Arena * arena);
+
+//==========================================================================
+// Allocate the block ordered planes for an image. The planes are padded
+// out to a multiple of the MCU size.
+//
+// Parameters:
+//  width    - The image width
+//  height   - The image height
+//  channels - The number of channels, 1 for grayscale or 3 for color
+//  info     - An array of structures to store the channel information in
+//  arena    - The arena to allocate the planes from
+//==========================================================================
+void alloc_planes(unsigned int width, unsigned int height, unsigned int channels, ChannelInfo * info, Arena * arena);
+
+//==========================================================================
+// Fill the padding of a block ordered plane by repeating the last column
+// and row of the samples.
+//
+// Parameters:
+//  plane  - The plane to pad
+//  width  - The number of samples in each row
+//  height - The number of rows
+//==========================================================================
+void pad_plane(ChannelInfo * plane, unsigned int width, unsigned int height);
+
+//==========================================================================
+// Store one row of 8-bit samples in a block ordered plane.
+//
+// Parameters:
+//  plane - The plane to store the row in
+//  y     - The row number
+//  row   - The samples
+//  count - The number of samples in the row
+//==========================================================================
+void store_plane_row(ChannelInfo * plane, unsigned int y, const unsigned char * row, unsigned int count);
+
+//==========================================================================
+// Store a strip of 8 rows of 8-bit samples in a block ordered plane. The
+// samples past the end of the rows are filled with the last sample of
+// each row.
+//
+// Parameters:
+//  plane - The plane to store the strip in
+//  y     - The first row number, a multiple of 8
+//  rows  - The 8 rows, repeat a row to pad the bottom of the plane
+//  count - The number of samples in each row, at most the plane width
+//==========================================================================
+void store_plane_strip(ChannelInfo * plane, unsigned int y, const unsigned char * const * rows, unsigned int count);
+
+//==========================================================================
+// Convert one row of RGB pixels to YCbCr and store it in the block
+// ordered planes. The Cb & Cr samples are taken from alternating pixels
+// of the even rows.
+//
+// Parameters:
+//  info  - The channel information
+//  y     - The row number
+//  rgb   - The packed 24-bit RGB pixels
+//  count - The number of pixels in the row
+//==========================================================================
+void store_rgb_row(ChannelInfo * info, unsigned int y, const unsigned char * rgb, unsigned int count);
+
+//==========================================================================
+// Convert a 16x16 tile of RGB pixels to the blocks of one MCU, the four
+// luminance blocks followed by the Cb and Cr blocks. The blocks are the
+// same as store_rgb_row would store for the tile.
+//
+// Parameters:
+//  rgb    - The top left pixel of the tile, packed 24-bit RGB
+//  stride - The distance between the rows of the tile in bytes
+//  blocks - The 6 8x8 blocks to store the MCU in
+//==========================================================================
+void store_rgb_mcu(const unsigned char * rgb, size_t stride, unsigned char * blocks);
+
+//==========================================================================
+// Store an image that is already in memory in block ordered planes. The
+// planes are padded out to a whole number of MCUs by repeating the last
+// row and column of the image. The strides are in bytes and may be
+// negative, so a view into a larger image is read in place.
+//
+// Parameters:
+//  pixels         - The first sample of the image
+//  row_stride     - The distance between the rows
+//  pixel_stride   - The distance between the pixels of a row
+//  channel_stride - The distance between the samples of a pixel
+//  width          - The image width
+//  height         - The image height
+//  channels       - The number of channels, 1 for grayscale or 3 for RGB
+//  info           - An array of structures to store the channel information in
+//  arena          - The arena to allocate the planes from
+//==========================================================================
+void store_image(const unsigned char * pixels, ptrdiff_t row_stride, ptrdiff_t pixel_stride, ptrdiff_t channel_stride,
+                 unsigned int width, unsigned int height, unsigned int channels, ChannelInfo * info, Arena * arena);
+
+//==========================================================================
+// Close the input image.
+//
+// Parameters:
+//  reader - The input image reader
+//==========================================================================
+void reader_close(ImageReader * reader);
+
+#ifdef __cplusplus
+}
+#endif
+
+#endif /* READER_H */
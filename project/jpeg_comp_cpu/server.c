@@ -0,0 +1,699 @@
+//==========================================================================
+// This file implements the encoder server. The main thread accepts the
+// connections and polls the idle ones, and queues each connection with a
+// request for the worker pool. A worker reads the one request, compresses
+// the image straight out of the client's shared memory segment, writes
+// the JPEG back into it and hands the connection back to the main thread.
+//==========================================================================
+
+#if defined(__linux__) && !defined(_GNU_SOURCE)
+#define _GNU_SOURCE
+#endif
+
+#include "server.h"
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+#include "jpeg_file.h"
+#include "reader.h"
+#include "wisdom.h"
+
+#ifdef SERVER_SUPPORTED
+#include <errno.h>
+#include <fcntl.h>
+#include <poll.h>
+#include <signal.h>
+#include <time.h>
+#include <unistd.h>
+#include <sys/mman.h>
+#include <sys/socket.h>
+#include <sys/stat.h>
+#include <sys/time.h>
+#include <sys/un.h>
+
+//==========================================================================
+// Local Variables set by the signal handler to stop the server, and the
+// write end of the pipe it wakes the accept loop with
+//==========================================================================
+static volatile sig_atomic_t server_stop = 0;
+static volatile sig_atomic_t server_wake_fd = -1;
+
+//==========================================================================
+// Helper function that will stop the server on SIGINT or SIGTERM.
+//
+// Parameters:
+//  sig - The signal number
+//==========================================================================
+void server_signal(int sig)
+{
+    int saved_errno = errno;
+
+    (void)sig;
+    server_stop = 1;
+    if (server_wake_fd >= 0)
+    {
+        ssize_t written = write(server_wake_fd, "", 1);
+        (void)written;
+    }
+    errno = saved_errno;
+}
+
+//==========================================================================
+// Helper function that will wake the accept loop. The pipe does not block,
+// if it is full the loop is already going to wake up.
+//
+// Parameters:
+//  server - The server
+//==========================================================================
+static inline void wake_server(Server * server)
+{
+    ssize_t written = write(server->wake_fd[1], "", 1);
+    (void)written;
+}
+
+//==========================================================================
+// Helper function that will get the time for the idle timeout.
+//
+// Return:
+//  The time in seconds
+//==========================================================================
+static inline double server_now(void)
+{
+    struct timespec now;
+
+    clock_gettime(CLOCK_MONOTONIC, &now);
+    return (double)now.tv_sec + (double)now.tv_nsec * 1e-9;
+}
+
+//==========================================================================
+// Helper function that will read the next request of a connection along
+// with the segment file descriptor, if the client sent one.
+//
+// Parameters:
+//  fd      - The connection
+//  request - The request to fill in
+//  shm_fd  - A pointer to store the segment file descriptor in, -1 if
+//            there is none
+//
+// Return:
+//  The size of the request, 0 if the connection was closed or -1 if it
+//  failed
+//==========================================================================
+ssize_t receive_request(int fd, ServerRequest * request, int * shm_fd)
+{
+    union
+    {
+        struct cmsghdr header;
+        char data[CMSG_SPACE(sizeof(int))];
+    } control;
+    struct iovec iov;
+    struct msghdr msg;
+    ssize_t length;
+
+    memset(&msg, 0, sizeof(msg));
+    iov.iov_base = request;
+    iov.iov_len = sizeof(ServerRequest);
+    msg.msg_iov = &iov;
+    msg.msg_iovlen = 1;
+    msg.msg_control = control.data;
+    msg.msg_controllen = sizeof(control.data);
+
+    *shm_fd = -1;
+    do
+    {
+        length = recvmsg(fd, &msg, 0);
+    } while ((length < 0) && (errno == EINTR));
+
+    for (struct cmsghdr * cmsg = CMSG_FIRSTHDR(&msg); cmsg != NULL; cmsg = CMSG_NXTHDR(&msg, cmsg))
+    {
+        if ((cmsg->cmsg_level == SOL_SOCKET) && (cmsg->cmsg_type == SCM_RIGHTS))
+        {
+            memcpy(shm_fd, CMSG_DATA(cmsg), sizeof(int));
+        }
+    }
+
+    return length;
+}
+
+//==========================================================================
+// Helper function that will check that a region fits in the segment.
+//
+// Parameters:
+//  offset       - The offset of the region
+//  size         - The size of the region
+//  segment_size - The size of the segment
+//
+// Return:
+//  Not 0 if the region is inside the segment
+//==========================================================================
+static inline int region_fits(unsigned long long offset, unsigned long long size, size_t segment_size)
+{
+    return (offset <= segment_size) && (size <= segment_size - offset);
+}
+
+//==========================================================================
+// Helper function that will compress the image of a request.
+//
+// Parameters:
+//  worker       - The worker serving the request
+//  request      - The request
+//  segment      - The client's shared memory segment, NULL if there is none
+//  segment_size - The size of the segment
+//  size         - A pointer to store the size of the JPEG in
+//
+// Return:
+//  One of the SERVER_* status values
+//==========================================================================
+unsigned int encode_request(ServerWorker * worker, const ServerRequest * request, unsigned char * segment,
+                            size_t segment_size, unsigned long long * size)
+{
+    ChannelInfo info[3];
+    unsigned int width = request->width;
+    unsigned int height = request->height;
+    unsigned int channels = request->channels;
+
+    *size = 0;
+    if ((request->magic != SERVER_MAGIC) || (width == 0) || (height == 0) || ((channels != 1) && (channels != 3)) ||
+        (check_size(width, height) != 0))
+    {
+        return SERVER_BAD_REQUEST;
+    }
+
+    unsigned long long input_size = (unsigned long long)width * height * channels;
+    if ((segment == NULL) || !region_fits(request->input_offset, input_size, segment_size) ||
+        !region_fits(request->output_offset, request->output_size, segment_size))
+    {
+        return SERVER_BAD_SEGMENT;
+    }
+
+    // Convert the Pixels to Block Ordered Planes
+    arena_reset(&worker->arena);
+    store_image(segment + request->input_offset, (ptrdiff_t)width * channels, channels, 1, width, height, channels,
+                info, &worker->arena);
+
+    // Reuse the Memory Stream of the Last Request
+    if (worker->stream == NULL)
+    {
+        worker->stream = open_memory_stream(width, height, info, channels);
+    }
+    else
+    {
+        restart_memory_stream(worker->stream, width, height, info, channels);
+    }
+
+    compress_img(channels, info, &worker->arena, worker->stream);
+
+    size_t length;
+    const unsigned char * data = finish_memory_stream(worker->stream, &length);
+    *size = length;
+
+    if (length > request->output_size)
+    {
+        return SERVER_TOO_SMALL;
+    }
+
+    memcpy(segment + request->output_offset, data, length);
+    return SERVER_OK;
+}
+
+//==========================================================================
+// Helper function that will serve the next request of a connection. The
+// request has already arrived when the connection is queued, the receive
+// timeout only stops a client that misbehaves from holding the worker.
+//
+// Parameters:
+//  worker - The worker serving the request
+//  conn   - The connection
+//
+// Return:
+//  Not 0 if the reply was sent and the connection stays open
+//==========================================================================
+int serve_request(ServerWorker * worker, ServerConn * conn)
+{
+    ServerRequest request;
+    ServerReply reply;
+    int shm_fd;
+
+    ssize_t length = receive_request(conn->fd, &request, &shm_fd);
+    if (length <= 0)
+    {
+        return 0;
+    }
+
+    // Map the New Segment
+    if (shm_fd >= 0)
+    {
+        struct stat st;
+
+        if (conn->segment != NULL)
+        {
+            munmap(conn->segment, conn->segment_size);
+            conn->segment = NULL;
+            conn->segment_size = 0;
+        }
+
+        int usable = (fstat(shm_fd, &st) == 0) && (st.st_size > 0);
+#ifdef F_SEAL_SHRINK
+        // An Unsealed Segment Could be Shrunk While it is Being Read
+        int seals = fcntl(shm_fd, F_GET_SEALS);
+        usable = usable && (seals >= 0) && (seals & F_SEAL_SHRINK);
+#endif
+
+        if (usable)
+        {
+            void * memory = mmap(NULL, (size_t)st.st_size, PROT_READ | PROT_WRITE, MAP_SHARED, shm_fd, 0);
+            if (memory != MAP_FAILED)
+            {
+                conn->segment = (unsigned char *)memory;
+                conn->segment_size = (size_t)st.st_size;
+            }
+        }
+        close(shm_fd);
+    }
+
+    memset(&reply, 0, sizeof(reply));
+    if (length != sizeof(ServerRequest))
+        reply.status = SERVER_BAD_REQUEST;
+    else
+        reply.status = encode_request(worker, &request, conn->segment, conn->segment_size, &reply.size);
+
+    return send(conn->fd, &reply, sizeof(reply), 0) == sizeof(reply);
+}
+
+//==========================================================================
+// The worker thread. It serves one request of each queued connection and
+// hands the connection back, until the server is stopped.
+//
+// Parameters:
+//  arg - The worker information
+//==========================================================================
+void * server_worker(void * arg)
+{
+    ServerWorker * worker = (ServerWorker *)arg;
+    Server * server = worker->server;
+
+    pthread_mutex_lock(&server->lock);
+    for (;;)
+    {
+        // Wait for a Request
+        while ((server->queued == 0) && (server->stop == 0))
+        {
+            pthread_cond_wait(&server->cond, &server->lock);
+        }
+
+        if (server->stop)
+        {
+            break;
+        }
+
+        // Take the Connection From the Queue
+        ServerConn * conn = server->queue[server->head];
+        server->head = (server->head + 1) % SERVER_MAX_CONNS;
+        server->queued--;
+        conn->state = SERVER_CONN_BUSY;
+        worker->conn = conn;
+
+        // Serve it Without Holding the Lock
+        pthread_mutex_unlock(&server->lock);
+        int open = serve_request(worker, conn);
+        pthread_mutex_lock(&server->lock);
+
+        // Hand the Connection Back to the Accept Loop
+        worker->conn = NULL;
+        conn->state = open ? SERVER_CONN_IDLE : SERVER_CONN_CLOSED;
+        conn->last_active = server_now();
+        if (open)
+        {
+            server->requests++;
+        }
+        wake_server(server);
+    }
+    pthread_mutex_unlock(&server->lock);
+
+    return NULL;
+}
+
+//==========================================================================
+// Helper function that will accept a connection into a free slot. The
+// accept loop only polls the listening socket while there is one.
+//
+// Parameters:
+//  server - The server
+//
+// Return:
+//  0 on success or if the client went away, -1 if accept failed
+//==========================================================================
+int accept_connection(Server * server)
+{
+    struct timeval timeout;
+
+    int fd = accept(server->listen_fd, NULL, NULL);
+    if (fd < 0)
+    {
+        return ((errno == EINTR) || (errno == ECONNABORTED)) ? 0 : -1;
+    }
+
+    // Workers Give Up on a Client That Stops in the Middle of a Request
+    timeout.tv_sec = SERVER_RECV_TIMEOUT;
+    timeout.tv_usec = 0;
+    setsockopt(fd, SOL_SOCKET, SO_RCVTIMEO, &timeout, sizeof(timeout));
+    setsockopt(fd, SOL_SOCKET, SO_SNDTIMEO, &timeout, sizeof(timeout));
+
+    pthread_mutex_lock(&server->lock);
+    for (unsigned int i = 0; i < SERVER_MAX_CONNS; i++)
+    {
+        ServerConn * conn = &server->conns[i];
+        if (conn->state == SERVER_CONN_FREE)
+        {
+            memset(conn, 0, sizeof(ServerConn));
+            conn->fd = fd;
+            conn->state = SERVER_CONN_IDLE;
+            conn->last_active = server_now();
+            server->conn_cnt++;
+            break;
+        }
+    }
+    pthread_mutex_unlock(&server->lock);
+
+    return 0;
+}
+
+//==========================================================================
+// Helper function that will close a connection and free its slot. Only
+// the accept loop closes connections, so a polled descriptor is never
+// reused underneath it.
+//
+// Parameters:
+//  server - The server
+//  conn   - The connection
+//==========================================================================
+void release_connection(Server * server, ServerConn * conn)
+{
+    if (conn->segment != NULL)
+    {
+        munmap(conn->segment, conn->segment_size);
+    }
+    close(conn->fd);
+
+    memset(conn, 0, sizeof(ServerConn));
+    conn->state = SERVER_CONN_FREE;
+    server->conn_cnt--;
+}
+
+//==========================================================================
+// Helper function that will create the pipe the accept loop is woken
+// with. Neither end blocks, so the signal handler and the workers never
+// wait on it.
+//
+// Parameters:
+//  wake_fd - The read and write ends of the pipe
+//
+// Return:
+//  0 on success, -1 if the pipe could not be created
+//==========================================================================
+int open_wake_pipe(int wake_fd[2])
+{
+    if (pipe(wake_fd) != 0)
+    {
+        printf("Failed to Create the Wake Up Pipe\n");
+        return -1;
+    }
+
+    for (unsigned int i = 0; i < 2; i++)
+    {
+        fcntl(wake_fd[i], F_SETFL, fcntl(wake_fd[i], F_GETFL) | O_NONBLOCK);
+        fcntl(wake_fd[i], F_SETFD, FD_CLOEXEC);
+    }
+
+    return 0;
+}
+
+//==========================================================================
+// Helper function that will open the listening socket.
+//
+// Parameters:
+//  socket_path - The path of the socket
+//
+// Return:
+//  The socket or -1 if it could not be opened
+//==========================================================================
+int open_listener(const char * socket_path)
+{
+    struct sockaddr_un addr;
+
+    if (strlen(socket_path) >= sizeof(addr.sun_path))
+    {
+        printf("Socket Path Too Long: %s\n", socket_path);
+        return -1;
+    }
+
+    memset(&addr, 0, sizeof(addr));
+    addr.sun_family = AF_UNIX;
+    strcpy(addr.sun_path, socket_path);
+
+    // Each Message is One Request or Reply
+    int fd = socket(AF_UNIX, SOCK_SEQPACKET, 0);
+    if (fd < 0)
+    {
+        printf("Failed to Create Socket\n");
+        return -1;
+    }
+
+    unlink(socket_path);
+    if ((bind(fd, (struct sockaddr *)&addr, sizeof(addr)) != 0) || (listen(fd, SERVER_BACKLOG) != 0))
+    {
+        printf("Failed to Listen on %s\n", socket_path);
+        close(fd);
+        return -1;
+    }
+
+    return fd;
+}
+#endif
+
+//==========================================================================
+// Run the encoder server until it gets SIGINT or SIGTERM. init_qtable
+// must be called first, every image is encoded with the same tables.
+//
+// Parameters:
+//  socket_path - The path of the Unix domain socket, it is replaced if it
+//                already exists and removed when the server stops
+//  workers     - The number of worker threads, 0 for the default (see
+//                default_workers)
+//  arena_flags - Any of the ARENA_* flags for the worker arenas
+//
+// Return:
+//  0 on success, -1 if the server could not be started
+//==========================================================================
+int serve(const char * socket_path, unsigned int workers, unsigned int arena_flags)
+{
+#ifdef SERVER_SUPPORTED
+    Server * server = (Server *)calloc(1, sizeof(Server));
+    struct sigaction action;
+    sigset_t signals;
+    sigset_t old_signals;
+
+    if (server == NULL)
+    {
+        printf("Out of Memory\n");
+        exit(-1);
+    }
+
+    server->listen_fd = open_listener(socket_path);
+    if (server->listen_fd < 0)
+    {
+        free(server);
+        return -1;
+    }
+
+    if (open_wake_pipe(server->wake_fd) != 0)
+    {
+        close(server->listen_fd);
+        unlink(socket_path);
+        free(server);
+        return -1;
+    }
+
+    if (workers == 0)
+    {
+        workers = default_workers();
+    }
+    workers = min(workers, SERVER_MAX_WORKERS);
+
+    pthread_mutex_init(&server->lock, NULL);
+    pthread_cond_init(&server->cond, NULL);
+
+    // The Signals are Only Handled by the Accept Loop, the Handler Writes
+    // to the Wake Up Pipe so They Interrupt poll
+    server_wake_fd = server->wake_fd[1];
+    memset(&action, 0, sizeof(action));
+    action.sa_handler = server_signal;
+    sigemptyset(&action.sa_mask);
+    sigaction(SIGINT, &action, NULL);
+    sigaction(SIGTERM, &action, NULL);
+    signal(SIGPIPE, SIG_IGN);
+
+    sigemptyset(&signals);
+    sigaddset(&signals, SIGINT);
+    sigaddset(&signals, SIGTERM);
+    pthread_sigmask(SIG_BLOCK, &signals, &old_signals);
+
+    // Start the Worker Pool
+    for (unsigned int i = 0; i < workers; i++)
+    {
+        ServerWorker * worker = &server->workers[i];
+
+        worker->server = server;
+        worker->conn = NULL;
+        arena_init(&worker->arena, SERVER_CHUNK_SIZE, arena_flags);
+        if (pthread_create(&worker->thread, NULL, server_worker, worker) != 0)
+        {
+            arena_free(&worker->arena);
+            break;
+        }
+        server->worker_cnt++;
+    }
+    pthread_sigmask(SIG_SETMASK, &old_signals, NULL);
+
+    printf("Listening on %s with %u Workers\n", socket_path, server->worker_cnt);
+    fflush(stdout);
+
+    // Accept Connections & Queue Their Requests Until Stopped
+    while (!server_stop && (server->worker_cnt > 0))
+    {
+        struct pollfd fds[SERVER_MAX_CONNS + 2];
+        ServerConn * polled[SERVER_MAX_CONNS + 2];
+        unsigned int nfds = 0;
+        int listening = 0;
+        double now = server_now();
+
+        fds[nfds].fd = server->wake_fd[0];
+        fds[nfds].events = POLLIN;
+        polled[nfds++] = NULL;
+
+        if (server->conn_cnt < SERVER_MAX_CONNS)
+        {
+            fds[nfds].fd = server->listen_fd;
+            fds[nfds].events = POLLIN;
+            polled[nfds++] = NULL;
+            listening = 1;
+        }
+
+        // Release the Closed & Timed Out Connections and Poll the Idle Ones
+        pthread_mutex_lock(&server->lock);
+        for (unsigned int i = 0; i < SERVER_MAX_CONNS; i++)
+        {
+            ServerConn * conn = &server->conns[i];
+
+            if ((conn->state == SERVER_CONN_CLOSED) ||
+                ((conn->state == SERVER_CONN_IDLE) && (now - conn->last_active >= SERVER_IDLE_TIMEOUT)))
+            {
+                release_connection(server, conn);
+            }
+            else if (conn->state == SERVER_CONN_IDLE)
+            {
+                fds[nfds].fd = conn->fd;
+                fds[nfds].events = POLLIN;
+                polled[nfds++] = conn;
+            }
+        }
+        pthread_mutex_unlock(&server->lock);
+
+        // Wake Up Once a Second to Close the Idle Connections
+        if (poll(fds, nfds, 1000) < 0)
+        {
+            if (errno == EINTR)
+                continue;
+
+            printf("Failed to Poll the Connections\n");
+            break;
+        }
+
+        if (fds[0].revents & POLLIN)
+        {
+            char drain[64];
+            while (read(server->wake_fd[0], drain, sizeof(drain)) > 0)
+            {
+            }
+        }
+
+        if (listening && (fds[1].revents & POLLIN) && (accept_connection(server) != 0))
+        {
+            printf("Failed to Accept a Connection\n");
+            break;
+        }
+
+        // Queue the Connections With a Request, or That the Client Closed
+        pthread_mutex_lock(&server->lock);
+        for (unsigned int i = 1 + listening; i < nfds; i++)
+        {
+            if (fds[i].revents != 0)
+            {
+                polled[i]->state = SERVER_CONN_QUEUED;
+                server->queue[(server->head + server->queued) % SERVER_MAX_CONNS] = polled[i];
+                server->queued++;
+            }
+        }
+        pthread_cond_broadcast(&server->cond);
+        pthread_mutex_unlock(&server->lock);
+    }
+
+    // Stop the Workers, the Connections Being Served are Shut Down so They
+    // Return and the Queued Ones are Released With the Rest
+    pthread_mutex_lock(&server->lock);
+    server->stop = 1;
+    for (unsigned int i = 0; i < server->worker_cnt; i++)
+    {
+        if (server->workers[i].conn != NULL)
+        {
+            shutdown(server->workers[i].conn->fd, SHUT_RDWR);
+        }
+    }
+    server->queued = 0;
+    pthread_cond_broadcast(&server->cond);
+    pthread_mutex_unlock(&server->lock);
+
+    for (unsigned int i = 0; i < server->worker_cnt; i++)
+    {
+        ServerWorker * worker = &server->workers[i];
+
+        pthread_join(worker->thread, NULL);
+        if (worker->stream != NULL)
+        {
+            size_t size;
+            free(stream_close_memory(worker->stream, &size));
+        }
+        arena_free(&worker->arena);
+    }
+
+    for (unsigned int i = 0; i < SERVER_MAX_CONNS; i++)
+    {
+        if (server->conns[i].state != SERVER_CONN_FREE)
+        {
+            release_connection(server, &server->conns[i]);
+        }
+    }
+
+    printf("Served %lu Requests\n", server->requests);
+
+    server_wake_fd = -1;
+    close(server->wake_fd[0]);
+    close(server->wake_fd[1]);
+    close(server->listen_fd);
+    unlink(socket_path);
+    pthread_cond_destroy(&server->cond);
+    pthread_mutex_destroy(&server->lock);
+    free(server);
+
+    return 0;
+#else
+    (void)socket_path;
+    (void)workers;
+    (void)arena_flags;
+
+    printf("The Server is Not Supported on This Platform\n");
+    return -1;
+#endif
+}
@@ -0,0 +1,208 @@
+//==========================================================================
+// This file contains the encoder server. It listens on a Unix domain
+// socket and compresses the images that local clients hand it through a
+// shared memory segment, so the process start up and table set up are
+// only paid once and the pixels and JPEGs never go through a file. Each
+// worker thread keeps its own arena and output stream. The requests are
+// handed to whichever worker is free, so a client that keeps its
+// connection open between images does not hold a worker.
+//
+// The protocol is one ServerRequest message for each image, with the
+// segment passed as a file descriptor (SCM_RIGHTS) on the first request
+// of the connection and whenever the client replaces it, and one
+// ServerReply message back once the JPEG is in the segment. On Linux the
+// segment has to be a memfd sealed with F_SEAL_SHRINK, so the client can
+// not shrink it while the server is reading it.
+//==========================================================================
+
+#ifndef SERVER_H
+#define SERVER_H
+
+#include "encoder.h"
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+//==========================================================================
+// The server is only available on POSIX platforms
+//==========================================================================
+#if !defined(_WIN32)
+#define SERVER_SUPPORTED
+#include <pthread.h>
+#endif
+
+//==========================================================================
+// Limits for the server. Once SERVER_MAX_CONNS connections are open no
+// more are accepted, so the clients wait in connect instead of the server
+// holding an unbounded number of them. A connection with no request for
+// SERVER_IDLE_TIMEOUT seconds is closed, and a worker gives up on a
+// client that has not sent or taken a message after SERVER_RECV_TIMEOUT
+// seconds.
+//==========================================================================
+#define SERVER_MAX_WORKERS  64
+#define SERVER_MAX_CONNS    256
+#define SERVER_BACKLOG      16
+#define SERVER_IDLE_TIMEOUT 60
+#define SERVER_RECV_TIMEOUT 5
+
+//==========================================================================
+// Size of each chunk of memory in the worker arenas
+//==========================================================================
+#define SERVER_CHUNK_SIZE (4 * 1024 * 1024)
+
+//==========================================================================
+// The first field of every request, "JPEG"
+//==========================================================================
+#define SERVER_MAGIC 0x4A504547
+
+//==========================================================================
+// Reply Status
+//
+//  SERVER_OK          - The JPEG is in the output region
+//  SERVER_BAD_REQUEST - The request or the image size is not valid
+//  SERVER_BAD_SEGMENT - There is no segment or the regions are outside it
+//  SERVER_TOO_SMALL   - The output region is too small, the reply size is
+//                       the size it needs to be
+//==========================================================================
+#define SERVER_OK          0
+#define SERVER_BAD_REQUEST 1
+#define SERVER_BAD_SEGMENT 2
+#define SERVER_TOO_SMALL   3
+
+//==========================================================================
+// Structure to hold a request. The pixels are 8-bit grayscale or packed
+// 24-bit RGB rows with no padding between them.
+//
+//  magic         - SERVER_MAGIC
+//  input_offset  - The offset of the pixels in the segment
+//  output_offset - The offset of the region to store the JPEG in
+//  output_size   - The size of the output region
+//==========================================================================
+typedef struct
+{
+    unsigned int magic;
+    unsigned int width;
+    unsigned int height;
+    unsigned int channels;
+    unsigned long long input_offset;
+    unsigned long long output_offset;
+    unsigned long long output_size;
+} ServerRequest;
+
+//==========================================================================
+// Structure to hold a reply
+//
+//  status - One of the SERVER_* status values
+//  size   - The size of the JPEG
+//==========================================================================
+typedef struct
+{
+    unsigned int status;
+    unsigned int reserved;
+    unsigned long long size;
+} ServerReply;
+
+#ifdef SERVER_SUPPORTED
+struct Server;
+
+//==========================================================================
+// Connection States
+//
+//  SERVER_CONN_FREE   - The slot is not in use
+//  SERVER_CONN_IDLE   - Waiting for the client's next request
+//  SERVER_CONN_QUEUED - A request has arrived, waiting for a worker
+//  SERVER_CONN_BUSY   - A worker is serving the request
+//  SERVER_CONN_CLOSED - Closed by the client or failed, waiting to be
+//                       released by the accept loop
+//==========================================================================
+#define SERVER_CONN_FREE   0
+#define SERVER_CONN_IDLE   1
+#define SERVER_CONN_QUEUED 2
+#define SERVER_CONN_BUSY   3
+#define SERVER_CONN_CLOSED 4
+
+//==========================================================================
+// Structure to hold a connection. The segment stays mapped from one
+// request to the next, the client only sends it when it changes.
+//
+//  state       - One of the SERVER_CONN_* states
+//  last_active - When the last request was served, for the idle timeout
+//==========================================================================
+typedef struct
+{
+    int fd;
+    int state;
+    unsigned char * segment;
+    size_t segment_size;
+    double last_active;
+} ServerConn;
+
+//==========================================================================
+// Structure to hold the worker information. The arena and stream are kept
+// from one request to the next, so a worker stops allocating once it has
+// seen the largest image.
+//
+//  conn - The connection being served, NULL if there is none
+//==========================================================================
+typedef struct
+{
+    struct Server * server;
+    Arena arena;
+    OutStream * stream;
+    ServerConn * conn;
+    pthread_t thread;
+} ServerWorker;
+
+//==========================================================================
+// Structure to hold the server information
+//
+//  wake_fd - A pipe that wakes the accept loop when a worker hands a
+//            connection back or the server is stopped
+//==========================================================================
+typedef struct Server
+{
+    int listen_fd;
+    int wake_fd[2];
+    unsigned long requests;
+
+    // Worker Pool
+    unsigned int worker_cnt;
+    ServerWorker workers[SERVER_MAX_WORKERS];
+
+    // Open Connections
+    unsigned int conn_cnt;
+    ServerConn conns[SERVER_MAX_CONNS];
+
+    // Connections With a Request Waiting for a Worker, Each Connection is
+    // Queued at Most Once so the Queue Can Not Fill Up
+    ServerConn * queue[SERVER_MAX_CONNS];
+    unsigned int head;
+    unsigned int queued;
+    int stop;
+    pthread_mutex_t lock;
+    pthread_cond_t cond;
+} Server;
+#endif
+
+//==========================================================================
+// Run the encoder server until it gets SIGINT or SIGTERM. init_qtable
+// must be called first, every image is encoded with the same tables.
+//
+// Parameters:
+//  socket_path - The path of the Unix domain socket, it is replaced if it
+//                already exists and removed when the server stops
+//  workers     - The number of worker threads, 0 for the default (see
+//                default_workers)
+//  arena_flags - Any of the ARENA_* flags for the worker arenas
+//
+// Return:
+//  0 on success, -1 if the server could not be started
+//==========================================================================
+int serve(const char * socket_path, unsigned int workers, unsigned int arena_flags);
+
+#ifdef __cplusplus
+}
+#endif
+
+#endif /* SERVER_H */
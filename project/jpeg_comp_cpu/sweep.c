@@ -0,0 +1,577 @@
+//==========================================================================
+// This file implements the rate-distortion sweep. The workers take whole
+// images from the list, so each image is read and transformed on one
+// thread and its planes and coefficients stay in that worker's arena
+// while it is counted at every quality.
+//==========================================================================
+
+#include "sweep.h"
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <ctype.h>
+
+#include "jpeg_file.h"
+#include "reader.h"
+#include "mjpeg.h"
+#include "wisdom.h"
+
+#if defined(_WIN32)
+#include <windows.h>
+#else
+#include <dirent.h>
+#endif
+
+//==========================================================================
+// Helper function that will parse a comma separated list of qualities.
+//
+// Parameters:
+//  list      - The list, such as "10,30,50,70,90"
+//  qualities - The array to store the qualities in
+//  max_cnt   - The size of the array
+//
+// Return:
+//  The number of qualities or 0 if the list is not valid
+//==========================================================================
+unsigned int sweep_qualities(const char * list, unsigned int * qualities, unsigned int max_cnt)
+{
+    unsigned int count = 0;
+
+    while (*list != '\0')
+    {
+        char * end;
+        long quality = strtol(list, &end, 10);
+
+        if ((end == list) || (quality < 1) || (quality > 100) || (count == max_cnt))
+        {
+            return 0;
+        }
+        qualities[count++] = (unsigned int)quality;
+
+        if (*end == ',')
+            end++;
+        else if (*end != '\0')
+            return 0;
+
+        list = end;
+    }
+
+    return count;
+}
+
+//==========================================================================
+// Helper function that will check if a file in the directory should be
+// swept. Hidden files are skipped, and with FORMAT_PNM so is any file
+// without a .pgm, .ppm or .pnm extension.
+//
+// Parameters:
+//  name   - The file name
+//  format - One of the FORMAT_* values
+//
+// Return:
+//  Not 0 if the file should be swept
+//==========================================================================
+int sweep_file_type(const char * name, unsigned int format)
+{
+    const char * ext = strrchr(name, '.');
+    char lower[5];
+
+    if (name[0] == '.')
+    {
+        return 0;
+    }
+
+    if (format != FORMAT_PNM)
+    {
+        return 1;
+    }
+
+    if ((ext == NULL) || (strlen(ext) != 4))
+    {
+        return 0;
+    }
+
+    for (unsigned int i = 0; i < 5; i++)
+    {
+        lower[i] = (char)tolower((unsigned char)ext[i]);
+    }
+
+    return (strcmp(lower, ".pgm") == 0) || (strcmp(lower, ".ppm") == 0) || (strcmp(lower, ".pnm") == 0);
+}
+
+//==========================================================================
+// Helper function that will add a file to the list of images.
+//
+// Parameters:
+//  sweep    - The sweep
+//  dir_name - The directory of images
+//  name     - The file name
+//  capacity - A pointer to the number of images the list has room for
+//==========================================================================
+void add_sweep_image(Sweep * sweep, const char * dir_name, const char * name, unsigned int * capacity)
+{
+    if (sweep->image_cnt == *capacity)
+    {
+        *capacity = max(16, *capacity * 2);
+        sweep->images = (SweepImage *)realloc(sweep->images, *capacity * sizeof(SweepImage));
+        if (sweep->images == NULL)
+        {
+            printf("Out of Memory\n");
+            exit(-1);
+        }
+    }
+
+    SweepImage * image = &sweep->images[sweep->image_cnt++];
+    size_t length = strlen(dir_name) + strlen(name) + 2;
+
+    memset(image, 0, sizeof(SweepImage));
+    image->file_name = (char *)malloc(length);
+    image->points = (SweepPoint *)calloc(sweep->quality_cnt, sizeof(SweepPoint));
+    if ((image->file_name == NULL) || (image->points == NULL))
+    {
+        printf("Out of Memory\n");
+        exit(-1);
+    }
+
+    snprintf(image->file_name, length, "%s/%s", dir_name, name);
+}
+
+//==========================================================================
+// Helper function that will compare two images by file name for qsort.
+//==========================================================================
+int compare_sweep_images(const void * a, const void * b)
+{
+    return strcmp(((const SweepImage *)a)->file_name, ((const SweepImage *)b)->file_name);
+}
+
+//==========================================================================
+// Helper function that will list the images in a directory. The images
+// are sorted by name so the output does not depend on the file system.
+//
+// Parameters:
+//  sweep    - The sweep
+//  dir_name - The directory of images
+//
+// Return:
+//  0 on success, -1 if the directory could not be read
+//==========================================================================
+int list_sweep_images(Sweep * sweep, const char * dir_name)
+{
+    unsigned int capacity = 0;
+
+#if defined(_WIN32)
+    WIN32_FIND_DATAA entry;
+    char pattern[1024];
+
+    snprintf(pattern, sizeof(pattern), "%s\\*", dir_name);
+    HANDLE find = FindFirstFileA(pattern, &entry);
+    if (find == INVALID_HANDLE_VALUE)
+    {
+        printf("Error Reading Directory %s\n", dir_name);
+        return -1;
+    }
+
+    do
+    {
+        if (((entry.dwFileAttributes & FILE_ATTRIBUTE_DIRECTORY) == 0) && sweep_file_type(entry.cFileName, sweep->format))
+        {
+            add_sweep_image(sweep, dir_name, entry.cFileName, &capacity);
+        }
+    } while (FindNextFileA(find, &entry));
+
+    FindClose(find);
+#else
+    DIR * dir = opendir(dir_name);
+    struct dirent * entry;
+
+    if (dir == NULL)
+    {
+        printf("Error Reading Directory %s\n", dir_name);
+        return -1;
+    }
+
+    while ((entry = readdir(dir)) != NULL)
+    {
+        if (sweep_file_type(entry->d_name, sweep->format))
+        {
+            add_sweep_image(sweep, dir_name, entry->d_name, &capacity);
+        }
+    }
+
+    closedir(dir);
+#endif
+
+    if (sweep->image_cnt > 0)
+    {
+        qsort(sweep->images, sweep->image_cnt, sizeof(SweepImage), compare_sweep_images);
+    }
+
+    return 0;
+}
+
+//==========================================================================
+// Helper function that will encode an image at every quality. The image
+// is read and transformed once.
+//
+// Parameters:
+//  sweep - The sweep
+//  image - The image to encode
+//  arena - The arena of the worker
+//==========================================================================
+void sweep_image(Sweep * sweep, SweepImage * image, Arena * arena)
+{
+    ImageReader reader;
+    ChannelInfo info[3];
+    double start = mjpeg_clock();
+
+    // Read the Planes
+    if (reader_open(&reader, image->file_name, sweep->format, sweep->width, sweep->height, sweep->channels) != 0)
+    {
+        image->error = 1;
+        return;
+    }
+
+    image->width = reader.width;
+    image->height = reader.height;
+    image->channels = reader.channels;
+    if (reader_read_planes(&reader, info, arena) != 0)
+    {
+        printf("Error Reading File: %s\n", image->file_name);
+        reader_close(&reader);
+        image->error = 1;
+        return;
+    }
+    reader_close(&reader);
+
+    // The Headers are the Same Size for Every Quality
+    size_t header_size;
+    OutStream * stream = open_memory_stream(image->width, image->height, info, image->channels);
+    if (stream == NULL)
+    {
+        image->error = 1;
+        return;
+    }
+    free(close_memory_stream(stream, &header_size));
+
+    // Transform Once
+    float * coeffs = dct_img(image->channels, info, arena);
+    image->prep_ms = (mjpeg_clock() - start) * 1000.0;
+
+    for (unsigned int i = 0; i < sweep->quality_cnt; i++)
+    {
+        unsigned char yq[8 * 8];
+        unsigned char cq[8 * 8];
+        QualityStats quality;
+
+        scale_qtables(sweep->qualities[i], yq, cq);
+
+        // Time the Coding Without the Measurement
+        start = mjpeg_clock();
+        size_t scan_size = count_img_coeffs(image->channels, info, coeffs, yq, cq, arena, NULL);
+        image->points[i].encode_ms = (mjpeg_clock() - start) * 1000.0;
+        image->points[i].bytes = header_size + scan_size;
+
+        init_quality_stats(&quality, image->width, image->height, image->channels, 0);
+        count_img_coeffs(image->channels, info, coeffs, yq, cq, arena, &quality);
+        image->points[i].psnr = quality_psnr(&quality, -1);
+    }
+}
+
+//==========================================================================
+// Helper function for the worker threads. Each worker takes the next
+// image from the list until there are none left.
+//
+// Parameters:
+//  arg - The sweep
+//
+// Return:
+//  NULL
+//==========================================================================
+void * sweep_worker(void * arg)
+{
+    Sweep * sweep = (Sweep *)arg;
+    Arena arena;
+
+    arena_init(&arena, SWEEP_CHUNK_SIZE, sweep->arena_flags);
+
+    for (;;)
+    {
+#ifdef SWEEP_THREADS
+        pthread_mutex_lock(&sweep->lock);
+#endif
+        unsigned int index = sweep->next;
+        if (index < sweep->image_cnt)
+        {
+            sweep->next++;
+        }
+#ifdef SWEEP_THREADS
+        pthread_mutex_unlock(&sweep->lock);
+#endif
+
+        if (index >= sweep->image_cnt)
+        {
+            break;
+        }
+
+        sweep_image(sweep, &sweep->images[index], &arena);
+        arena_reset(&arena);
+    }
+
+    arena_free(&arena);
+    return NULL;
+}
+
+//==========================================================================
+// Helper function that will write a string as a JSON string.
+//
+// Parameters:
+//  fid  - The output file
+//  text - The string
+//==========================================================================
+void write_json_string(FILE * fid, const char * text)
+{
+    fputc('"', fid);
+    for (; *text != '\0'; text++)
+    {
+        unsigned char c = (unsigned char)*text;
+
+        if ((c == '"') || (c == '\\'))
+            fprintf(fid, "\\%c", c);
+        else if (c < 0x20)
+            fprintf(fid, "\\u%04x", c);
+        else
+            fputc(c, fid);
+    }
+    fputc('"', fid);
+}
+
+//==========================================================================
+// Helper function that will write the results of the sweep. The curve is
+// the total bits over the total pixels against the mean PSNR of the
+// images at each quality.
+//
+// Parameters:
+//  sweep  - The sweep
+//  output - The output file name, ending in ".json" for JSON
+//
+// Return:
+//  0 on success, -1 if the file could not be written
+//==========================================================================
+int write_sweep(const Sweep * sweep, const char * output)
+{
+    const char * ext = strrchr(output, '.');
+    int json = (ext != NULL) && (strcmp(ext, ".json") == 0);
+    unsigned int image_cnt = 0;
+    double pixels = 0.0;
+
+    FILE * fid = fopen(output, "w");
+    if (fid == NULL)
+    {
+        printf("Error Opening File %s\n", output);
+        return -1;
+    }
+
+    for (unsigned int i = 0; i < sweep->image_cnt; i++)
+    {
+        if (!sweep->images[i].error)
+        {
+            image_cnt++;
+            pixels += (double)sweep->images[i].width * sweep->images[i].height;
+        }
+    }
+
+    // Results of Each Image
+    if (json)
+        fprintf(fid, "{\n  \"images\": [");
+    else
+        fprintf(fid, "image,width,height,channels,quality,bytes,bpp,psnr,encode_ms,prep_ms\n");
+
+    int first = 1;
+    for (unsigned int i = 0; i < sweep->image_cnt; i++)
+    {
+        const SweepImage * image = &sweep->images[i];
+        double image_pixels = (double)image->width * image->height;
+
+        if (image->error)
+        {
+            continue;
+        }
+
+        if (json)
+        {
+            fprintf(fid, "%s\n    { \"image\": ", first ? "" : ",");
+            write_json_string(fid, image->file_name);
+            fprintf(fid, ", \"width\": %u, \"height\": %u, \"channels\": %u, \"prep_ms\": %.3f, \"points\": [",
+                    image->width, image->height, image->channels, image->prep_ms);
+        }
+        first = 0;
+
+        for (unsigned int q = 0; q < sweep->quality_cnt; q++)
+        {
+            const SweepPoint * point = &image->points[q];
+            double bpp = 8.0 * point->bytes / image_pixels;
+
+            if (json)
+                fprintf(fid, "%s\n      { \"quality\": %u, \"bytes\": %lu, \"bpp\": %.4f, \"psnr\": %.3f, \"encode_ms\": %.3f }",
+                        (q == 0) ? "" : ",", sweep->qualities[q], (unsigned long)point->bytes, bpp, point->psnr, point->encode_ms);
+            else
+                fprintf(fid, "%s,%u,%u,%u,%u,%lu,%.4f,%.3f,%.3f,%.3f\n", image->file_name, image->width, image->height,
+                        image->channels, sweep->qualities[q], (unsigned long)point->bytes, bpp, point->psnr,
+                        point->encode_ms, image->prep_ms);
+        }
+
+        if (json)
+            fprintf(fid, "\n    ] }");
+    }
+
+    // RD Curve of All of the Images
+    if (json)
+        fprintf(fid, "\n  ],\n  \"curve\": [");
+
+    for (unsigned int q = 0; (q < sweep->quality_cnt) && (image_cnt > 0); q++)
+    {
+        double bytes = 0.0;
+        double psnr = 0.0;
+        double encode_ms = 0.0;
+        double prep_ms = 0.0;
+
+        for (unsigned int i = 0; i < sweep->image_cnt; i++)
+        {
+            const SweepImage * image = &sweep->images[i];
+            if (!image->error)
+            {
+                bytes += (double)image->points[q].bytes;
+                psnr += image->points[q].psnr;
+                encode_ms += image->points[q].encode_ms;
+                prep_ms += image->prep_ms;
+            }
+        }
+
+        if (json)
+            fprintf(fid, "%s\n    { \"quality\": %u, \"images\": %u, \"bytes\": %.0f, \"bpp\": %.4f, \"psnr\": %.3f, \"encode_ms\": %.3f }",
+                    (q == 0) ? "" : ",", sweep->qualities[q], image_cnt, bytes, 8.0 * bytes / pixels,
+                    psnr / image_cnt, encode_ms);
+        else
+            fprintf(fid, "ALL,,,,%u,%.0f,%.4f,%.3f,%.3f,%.3f\n", sweep->qualities[q], bytes,
+                    8.0 * bytes / pixels, psnr / image_cnt, encode_ms, prep_ms);
+    }
+
+    if (json)
+        fprintf(fid, "\n  ]\n}\n");
+
+    if (fclose(fid) != 0)
+    {
+        printf("Error Writing File %s\n", output);
+        return -1;
+    }
+
+    return 0;
+}
+
+//==========================================================================
+// Encode every image in a directory at every quality and write the
+// results to a CSV or JSON file.
+//
+// Parameters:
+//  dir_name    - The directory of images
+//  format      - One of the FORMAT_* values
+//  width       - The image width, if not FORMAT_PNM
+//  height      - The image height, if not FORMAT_PNM
+//  channels    - The number of channels, if not FORMAT_PNM
+//  qualities   - The qualities to encode at, from 1 to 100
+//  quality_cnt - The number of qualities
+//  workers     - The number of worker threads, 0 for the default (see
+//                default_workers)
+//  output      - The output file name
+//  arena_flags - Any of the ARENA_* flags for the worker arenas
+//
+// Return:
+//  0 on success, -1 on failure
+//==========================================================================
+int sweep_dir(const char * dir_name, unsigned int format, unsigned int width, unsigned int height,
+              unsigned int channels, const unsigned int * qualities, unsigned int quality_cnt,
+              unsigned int workers, const char * output, unsigned int arena_flags)
+{
+    Sweep sweep;
+    int result;
+
+    memset(&sweep, 0, sizeof(Sweep));
+    sweep.format = format;
+    sweep.width = width;
+    sweep.height = height;
+    sweep.channels = channels;
+    sweep.arena_flags = arena_flags;
+    sweep.quality_cnt = min(quality_cnt, SWEEP_MAX_QUALITIES);
+    memcpy(sweep.qualities, qualities, sweep.quality_cnt * sizeof(unsigned int));
+
+    if (list_sweep_images(&sweep, dir_name) != 0)
+    {
+        return -1;
+    }
+
+    if (sweep.image_cnt == 0)
+    {
+        printf("No Images in %s\n", dir_name);
+        return -1;
+    }
+
+#ifdef SWEEP_THREADS
+    pthread_t threads[SWEEP_MAX_WORKERS];
+    unsigned int thread_cnt = 0;
+
+    if (workers == 0)
+    {
+        workers = default_workers();
+    }
+    workers = min(min(workers, SWEEP_MAX_WORKERS), sweep.image_cnt);
+
+    pthread_mutex_init(&sweep.lock, NULL);
+    for (unsigned int i = 0; i < workers; i++)
+    {
+        if (pthread_create(&threads[thread_cnt], NULL, sweep_worker, &sweep) != 0)
+        {
+            break;
+        }
+        thread_cnt++;
+    }
+
+    // Sweep on This Thread if No Workers Could be Started
+    if (thread_cnt == 0)
+    {
+        sweep_worker(&sweep);
+    }
+
+    for (unsigned int i = 0; i < thread_cnt; i++)
+    {
+        pthread_join(threads[i], NULL);
+    }
+    pthread_mutex_destroy(&sweep.lock);
+#else
+    sweep_worker(&sweep);
+#endif
+
+    // Images That Could not be Read are Left Out
+    unsigned int errors = 0;
+    for (unsigned int i = 0; i < sweep.image_cnt; i++)
+    {
+        errors += sweep.images[i].error ? 1 : 0;
+    }
+    printf("Swept %u Images at %u Qualities", sweep.image_cnt - errors, sweep.quality_cnt);
+    if (errors > 0)
+    {
+        printf(" (%u Could not be Read)", errors);
+    }
+    printf("\n");
+
+    result = (errors < sweep.image_cnt) ? write_sweep(&sweep, output) : -1;
+
+    for (unsigned int i = 0; i < sweep.image_cnt; i++)
+    {
+        free(sweep.images[i].file_name);
+        free(sweep.images[i].points);
+    }
+    free(sweep.images);
+
+    return result;
+}
@@ -0,0 +1,141 @@
+//==========================================================================
+// This file contains the rate-distortion sweep. Every image in a
+// directory is encoded at a list of qualities on a pool of worker threads
+// and the size, bits per pixel, PSNR and encode time of each pair are
+// written out along with the RD curve of the whole set of images. Each
+// image is read, color converted and transformed once and only the
+// quantization and entropy coding are repeated for each quality.
+//==========================================================================
+
+#ifndef SWEEP_H
+#define SWEEP_H
+
+#include <stddef.h>
+
+#include "encoder.h"
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+//==========================================================================
+// The worker pool is only available on POSIX platforms, on other
+// platforms the images are swept one after another.
+//==========================================================================
+#if !defined(_WIN32)
+#define SWEEP_THREADS
+#include <pthread.h>
+#endif
+
+//==========================================================================
+// Limits for the sweep
+//==========================================================================
+#define SWEEP_MAX_QUALITIES 100
+#define SWEEP_MAX_WORKERS   64
+
+//==========================================================================
+// Size of each chunk of memory in the worker arenas
+//==========================================================================
+#define SWEEP_CHUNK_SIZE (4 * 1024 * 1024)
+
+//==========================================================================
+// Structure to hold the result of encoding an image at one quality
+//
+//  bytes     - The size of the JPEG file
+//  psnr      - The PSNR of the coded YCbCr samples
+//  encode_ms - The time to quantize and entropy code the image
+//==========================================================================
+typedef struct
+{
+    size_t bytes;
+    double psnr;
+    double encode_ms;
+} SweepPoint;
+
+//==========================================================================
+// Structure to hold an image of the sweep
+//
+//  file_name - The path of the image
+//  prep_ms   - The time to read, color convert and transform the image,
+//              which is shared by all of the qualities
+//  error     - Not 0 if the image could not be read
+//  points    - The results, one per quality
+//==========================================================================
+typedef struct
+{
+    char * file_name;
+    unsigned int width;
+    unsigned int height;
+    unsigned int channels;
+    double prep_ms;
+    int error;
+    SweepPoint * points;
+} SweepImage;
+
+//==========================================================================
+// Structure to hold the sweep information
+//==========================================================================
+typedef struct
+{
+    unsigned int format;
+    unsigned int width;
+    unsigned int height;
+    unsigned int channels;
+    unsigned int arena_flags;
+    unsigned int qualities[SWEEP_MAX_QUALITIES];
+    unsigned int quality_cnt;
+    SweepImage * images;
+    unsigned int image_cnt;
+
+    // Work Queue, the Index of the Next Image to Sweep
+    unsigned int next;
+#ifdef SWEEP_THREADS
+    pthread_mutex_t lock;
+#endif
+} Sweep;
+
+//==========================================================================
+// Helper function that will parse a comma separated list of qualities.
+//
+// Parameters:
+//  list      - The list, such as "10,30,50,70,90"
+//  qualities - The array to store the qualities in
+//  max_cnt   - The size of the array
+//
+// Return:
+//  The number of qualities or 0 if the list is not valid
+//==========================================================================
+unsigned int sweep_qualities(const char * list, unsigned int * qualities, unsigned int max_cnt);
+
+//==========================================================================
+// Encode every image in a directory at every quality and write the
+// results to a CSV file, or a JSON file if the output name ends in
+// ".json". The JPEG sizes are counted exactly without writing the files.
+// init_qtable must be called first.
+//
+// Parameters:
+//  dir_name    - The directory of images, with FORMAT_PNM only the .pgm,
+//                .ppm and .pnm files are used
+//  format      - One of the FORMAT_* values
+//  width       - The image width, if not FORMAT_PNM
+//  height      - The image height, if not FORMAT_PNM
+//  channels    - The number of channels, if not FORMAT_PNM
+//  qualities   - The qualities to encode at, from 1 to 100
+//  quality_cnt - The number of qualities
+//  workers     - The number of worker threads, 0 for the default (see
+//                default_workers)
+//  output      - The output file name
+//  arena_flags - Any of the ARENA_* flags for the worker arenas
+//
+// Return:
+//  0 on success, -1 on failure
+//==========================================================================
+int sweep_dir(const char * dir_name, unsigned int format, unsigned int width, unsigned int height,
+              unsigned int channels, const unsigned int * qualities, unsigned int quality_cnt,
+              unsigned int workers, const char * output, unsigned int arena_flags);
+
+#ifdef __cplusplus
+}
+#endif
+
+#endif /* SWEEP_H */
@@ -1,6 +1,7 @@
 //==========================================================================
 // This file contains useful constant tables used in the encorder portion
-// of the software.
+// of the software. The tables are static so the header can be included
+// by the encoder and by each of the kernel files.
 //
 // Author: George Rosier (gmrosier@email.arizona.edu)
 // Date: 4/02/2017
@@ -12,7 +13,7 @@
 // Standard Luminance Quantization Table
 // Specified in Annex K - Table K.1
 // ISO DIS 10918-1
-const unsigned char y_qTable[8 * 8] =
+static const unsigned char y_qTable[8 * 8] =
 {
     16, 11, 10, 16,  24,  40,  51,  61,
     12, 12, 14, 19,  26,  58,  60,  55,
@@ -27,7 +28,7 @@ const unsigned char y_qTable[8 * 8] =
 // Standard Chrominance Quantization Table
 // Specified in Annex K - Table K.2
 // ISO DIS 10918-1
-const unsigned char cr_qTable[8 * 8] = 
+static const unsigned char cr_qTable[8 * 8] = 
 {
     17, 18, 24, 47, 99, 99, 99, 99,
     18, 21, 26, 66, 99, 99, 99, 99,
@@ -43,7 +44,7 @@ const unsigned char cr_qTable[8 * 8] =
 // JPEG Still Image Data Compression Standard
 // William B. Pennebaker, Joal L. Mitchell
 // Section 4.3.1
-const float angle[7] = {
+static const float angle[7] = {
     0.9808f,
     0.9239f,
     0.8315f,
@@ -61,7 +62,7 @@ const float angle[7] = {
 // Based on Figure A.6
 // Specified in Annex A - Section A.3.6
 // ISO DIS 10918-1
-const unsigned char output_pattern[8 * 8] =
+static const unsigned char output_pattern[8 * 8] =
 {
     0,   1,  5,  6, 14, 15, 27, 28,
     2,   4,  7, 13, 16, 26, 29, 42,
@@ -88,19 +89,55 @@ typedef struct
     unsigned char length;
 } HuffInfo;
 
+// Huffman Code Table
+// Indexed by the symbol (Zero Run Upper Nibble, Num Bits Lower Nibble)
+typedef struct
+{
+    HuffInfo code[256];
+} HuffTable;
+
+// When built as C++14 (or newer) the Huffman code tables are generated
+// at compile time, otherwise they are generated once at run time.
+#if defined(__cplusplus) && ((__cplusplus >= 201402L) || (defined(_MSVC_LANG) && (_MSVC_LANG >= 201402L)))
+#define CONSTEXPR_TABLES
+
+// Generate the Huffman codes from the number of codes per length and the
+// symbol values, see Annex C of ISO DIS 10918-1
+constexpr HuffTable make_huffman_table(const unsigned char * codes_per_len, const unsigned char * values)
+{
+    HuffTable table = {};
+    unsigned short code = 0;
+    unsigned int pos = 0;
+
+    for (int i = 0; i < 16; i++)
+    {
+        for (int j = 0; j < codes_per_len[i]; j++)
+        {
+            table.code[values[pos]].length = (unsigned char)(i + 1);
+            table.code[values[pos]].value = code;
+            pos++;
+            code++;
+        }
+        code <<= 1;
+    }
+
+    return table;
+}
+#endif
+
 // Standard Luminance DC Entropy Codes
 // Based on Table K.3
 // Specified in Annex K - Section K.3.3.1
 // ISO DIS 10918-1
-const unsigned char y_dc_codes_per_len[16] = { 0,1,5,1,1,1,1,1,1,0,0,0,0,0,0,0 };
-const unsigned char y_dc_values[12] = { 0,1,2,3,4,5,6,7,8,9,10,11 };
+static const unsigned char y_dc_codes_per_len[16] = { 0,1,5,1,1,1,1,1,1,0,0,0,0,0,0,0 };
+static const unsigned char y_dc_values[12] = { 0,1,2,3,4,5,6,7,8,9,10,11 };
 
 // Standard Luminance AC Entropy Codes
 // Based on Table K.5
 // Specified in Annex K - Section K.3.3.2
 // ISO DIS 10918-1
-const unsigned char y_ac_codes_per_len[16] = { 0,2,1,3,3,2,4,3,5,5,4,4,0,0,1,0x7D };
-const unsigned char y_ac_values[162] = {
+static const unsigned char y_ac_codes_per_len[16] = { 0,2,1,3,3,2,4,3,5,5,4,4,0,0,1,0x7D };
+static const unsigned char y_ac_values[162] = {
     0x01,0x02,0x03,0x00,0x04,0x11,0x05,0x12,0x21,0x31,0x41,0x06,0x13,0x51,0x61,0x07,0x22,0x71,0x14,0x32,0x81,0x91,0xa1,0x08,
     0x23,0x42,0xb1,0xc1,0x15,0x52,0xd1,0xf0,0x24,0x33,0x62,0x72,0x82,0x09,0x0a,0x16,0x17,0x18,0x19,0x1a,0x25,0x26,0x27,0x28,
     0x29,0x2a,0x34,0x35,0x36,0x37,0x38,0x39,0x3a,0x43,0x44,0x45,0x46,0x47,0x48,0x49,0x4a,0x53,0x54,0x55,0x56,0x57,0x58,0x59,
@@ -114,15 +151,15 @@ const unsigned char y_ac_values[162] = {
 // Based on Table K.4
 // Specified in Annex K - Section K.3.3.1
 // ISO DIS 10918-1
-const unsigned char c_dc_codes_per_len[16] = { 0, 3, 1, 1, 1, 1, 1, 1, 1, 1, 1, 0, 0, 0, 0, 0 };
-const unsigned char c_dc_values[12] = { 0, 1, 2, 3, 4, 5, 6, 7, 8, 9, 10, 11 };
+static const unsigned char c_dc_codes_per_len[16] = { 0, 3, 1, 1, 1, 1, 1, 1, 1, 1, 1, 0, 0, 0, 0, 0 };
+static const unsigned char c_dc_values[12] = { 0, 1, 2, 3, 4, 5, 6, 7, 8, 9, 10, 11 };
 
 // Standard Chrominance AC Entropy Codes
 // Based on Table K.6
 // Specified in Annex K - Section K.3.3.2
 // ISO DIS 10918-1
-const unsigned char c_ac_codes_per_len[16] = { 0, 2, 1, 2, 4, 4, 3, 4, 7, 5, 4, 4, 0, 1, 2, 0x77 };
-const unsigned char c_ac_values[258] = 
+static const unsigned char c_ac_codes_per_len[16] = { 0, 2, 1, 2, 4, 4, 3, 4, 7, 5, 4, 4, 0, 1, 2, 0x77 };
+static const unsigned char c_ac_values[258] = 
 {
     0x00, 0x01, 0x02, 0x03, 0x11, 0x04, 0x05, 0x21,
     0x31, 0x06, 0x12, 0x41, 0x51, 0x07, 0x61, 0x71,
@@ -0,0 +1,551 @@
+//==========================================================================
+// This file implements the tile pyramid. Each level keeps one band of
+// tile rows; when a band is full it is cut into tiles which are handed to
+// the worker pool, and every pair of rows is averaged down into the next
+// level as it arrives.
+//==========================================================================
+
+#include "tiler.h"
+
+#include <stdlib.h>
+#include <string.h>
+
+#include "jpeg_file.h"
+#include "wisdom.h"
+
+//==========================================================================
+// Helper function that will allocate memory or exit if there is none.
+//
+// Parameters:
+//  size - The number of bytes to allocate
+//
+// Return:
+//  The allocated memory
+//==========================================================================
+void * tiler_malloc(size_t size)
+{
+    void * data = malloc(size);
+    if (data == NULL)
+    {
+        printf("Out of Memory\n");
+        exit(-1);
+    }
+
+    return data;
+}
+
+//==========================================================================
+// Helper function that will compress a single tile.
+//
+// Parameters:
+//  tiler  - The tile pyramid
+//  worker - The worker compressing the tile
+//  job    - The tile to compress
+//
+// Return:
+//  0 on success, -1 if the tile could not be written
+//==========================================================================
+int encode_tile(Tiler * tiler, TileWorker * worker, TileJob * job)
+{
+    ChannelInfo info[3];
+    char file_name[1024];
+    unsigned int channels = tiler->channels;
+    Arena * arena = &worker->arena;
+
+    // Convert the Tile to Block Ordered Planes
+    arena_reset(arena);
+    store_image(job->pixels, job->width * channels, channels, 1, job->width, job->height, channels, info, arena);
+
+    // Compress the Tile, the Pool Already Keeps Every Core Busy so the
+    // Tile is Written on the Worker Thread
+    snprintf(file_name, sizeof(file_name), "%s_%u_%u_%u.jpg", tiler->prefix, job->level, job->col, job->row);
+    OutStream * stream = open_stream(file_name, tiler->writer_flags | WRITER_SYNC, job->width, job->height, info, channels);
+    if (stream == NULL)
+    {
+        return -1;
+    }
+
+    compress_img(channels, info, arena, stream);
+    return close_stream(stream);
+}
+
+#ifdef TILER_THREADS
+//==========================================================================
+// The worker thread. It compresses the queued tiles until the pyramid is
+// closed.
+//
+// Parameters:
+//  arg - The worker information
+//==========================================================================
+void * tile_worker(void * arg)
+{
+    TileWorker * worker = (TileWorker *)arg;
+    Tiler * tiler = worker->tiler;
+
+    pthread_mutex_lock(&tiler->lock);
+    for (;;)
+    {
+        // Wait for a Tile
+        while ((tiler->head == NULL) && (tiler->stop == 0))
+        {
+            pthread_cond_wait(&tiler->cond, &tiler->lock);
+        }
+
+        if (tiler->head == NULL)
+        {
+            break;
+        }
+
+        // Take the Tile From the Queue
+        TileJob * job = tiler->head;
+        tiler->head = job->next;
+        if (tiler->head == NULL)
+        {
+            tiler->tail = NULL;
+        }
+        tiler->queued--;
+        pthread_cond_broadcast(&tiler->cond);
+
+        // Compress the Tile Without Holding the Lock
+        pthread_mutex_unlock(&tiler->lock);
+        int result = encode_tile(tiler, worker, job);
+        free(job);
+        pthread_mutex_lock(&tiler->lock);
+
+        if (result != 0)
+        {
+            tiler->error = -1;
+        }
+    }
+    pthread_mutex_unlock(&tiler->lock);
+
+    return NULL;
+}
+#endif
+
+//==========================================================================
+// Helper function that will hand a tile to the worker pool. This will
+// block while the queue is full, which keeps the number of bands in
+// memory bounded. Without a pool the tile is compressed right away.
+//
+// Parameters:
+//  tiler - The tile pyramid
+//  job   - The tile to compress
+//==========================================================================
+void queue_tile(Tiler * tiler, TileJob * job)
+{
+    tiler->tile_cnt++;
+
+#ifdef TILER_THREADS
+    if (tiler->worker_cnt > 0)
+    {
+        pthread_mutex_lock(&tiler->lock);
+        while (tiler->queued >= 2 * tiler->worker_cnt)
+        {
+            pthread_cond_wait(&tiler->cond, &tiler->lock);
+        }
+
+        job->next = NULL;
+        if (tiler->tail != NULL)
+        {
+            tiler->tail->next = job;
+        }
+        else
+        {
+            tiler->head = job;
+        }
+        tiler->tail = job;
+        tiler->queued++;
+
+        pthread_cond_broadcast(&tiler->cond);
+        pthread_mutex_unlock(&tiler->lock);
+        return;
+    }
+#endif
+
+    if (encode_tile(tiler, &tiler->workers[0], job) != 0)
+    {
+        tiler->error = -1;
+    }
+    free(job);
+}
+
+//==========================================================================
+// Helper function that will cut the band of a level into tiles and hand
+// them to the worker pool.
+//
+// Parameters:
+//  tiler - The tile pyramid
+//  l     - The level
+//==========================================================================
+void flush_band(Tiler * tiler, unsigned int l)
+{
+    TileLevel * level = &tiler->level[l];
+    unsigned int channels = tiler->channels;
+    unsigned int tile_size = tiler->tile_size;
+    unsigned int stride = level->width * channels;
+    unsigned int cols = (level->width + tile_size - 1) / tile_size;
+
+    for (unsigned int col = 0; col < cols; col++)
+    {
+        unsigned int width = min(tile_size, level->width - col * tile_size);
+        unsigned int length = width * channels;
+        TileJob * job = (TileJob *)tiler_malloc(sizeof(TileJob) + length * level->rows);
+
+        job->next = NULL;
+        job->level = l;
+        job->col = col;
+        job->row = level->band;
+        job->width = width;
+        job->height = level->rows;
+        job->pixels = (unsigned char *)(job + 1);
+
+        for (unsigned int y = 0; y < level->rows; y++)
+        {
+            memcpy(&job->pixels[y * length], &level->data[y * stride + col * tile_size * channels], length);
+        }
+
+        queue_tile(tiler, job);
+    }
+
+    level->rows = 0;
+    level->band++;
+}
+
+//==========================================================================
+// Helper function that will average two rows down into one row of half
+// the width. An odd last column is averaged with itself.
+//
+// Parameters:
+//  top      - The first row
+//  bottom   - The second row
+//  width    - The width of the rows
+//  channels - The number of channels
+//  output   - The half width row
+//==========================================================================
+void downsample_rows(const unsigned char * top, const unsigned char * bottom, unsigned int width,
+                     unsigned int channels, unsigned char * output)
+{
+    unsigned int out_width = (width + 1) / 2;
+
+    for (unsigned int x = 0; x < out_width; x++)
+    {
+        unsigned int x0 = (2 * x) * channels;
+        unsigned int x1 = min(2 * x + 1, width - 1) * channels;
+
+        for (unsigned int c = 0; c < channels; c++)
+        {
+            unsigned int sum = top[x0 + c] + top[x1 + c] + bottom[x0 + c] + bottom[x1 + c];
+            output[x * channels + c] = (unsigned char)((sum + 2) / 4);
+        }
+    }
+}
+
+//==========================================================================
+// Helper function that will add a row to a level. Every second row the
+// last two rows are averaged and passed on to the next level.
+//
+// Parameters:
+//  tiler - The tile pyramid
+//  l     - The level
+//  row   - The row as 8-bit grayscale or packed 24-bit RGB
+//==========================================================================
+void add_level_row(Tiler * tiler, unsigned int l, const unsigned char * row)
+{
+    TileLevel * level = &tiler->level[l];
+    unsigned int stride = level->width * tiler->channels;
+
+    memcpy(&level->data[level->rows * stride], row, stride);
+    level->rows++;
+
+    // Pass a Row On to the Next Level
+    if (((level->rows % 2) == 0) && (l + 1 < tiler->levels))
+    {
+        downsample_rows(&level->data[(level->rows - 2) * stride], &level->data[(level->rows - 1) * stride],
+                        level->width, tiler->channels, level->down);
+        add_level_row(tiler, l + 1, level->down);
+    }
+
+    // Cut the Band into Tiles Once it is Full
+    if (level->rows == tiler->tile_size)
+    {
+        flush_band(tiler, l);
+    }
+}
+
+//==========================================================================
+// Helper function that will write the manifest of the pyramid.
+//
+// Parameters:
+//  tiler - The tile pyramid
+//
+// Return:
+//  0 on success, -1 if the manifest could not be written
+//==========================================================================
+int write_manifest(Tiler * tiler)
+{
+    char file_name[1024];
+    const char * name = tiler->prefix;
+    const char * sep = strrchr(name, '/');
+
+#if defined(_WIN32)
+    if (strrchr(name, '\\') > sep)
+        sep = strrchr(name, '\\');
+#endif
+
+    // Tile Names are Relative to the Manifest
+    if (sep != NULL)
+        name = sep + 1;
+
+    snprintf(file_name, sizeof(file_name), "%s.txt", tiler->prefix);
+    FILE * fid = fopen(file_name, "w");
+    if (fid == NULL)
+    {
+        printf("Failed to Open File: %s\n", file_name);
+        return -1;
+    }
+
+    fprintf(fid, "# JPEG tile pyramid, level 0 is full size and each level is half\n");
+    fprintf(fid, "# the size of the one before it\n");
+    fprintf(fid, "# level <level> <width> <height> <columns> <rows>\n");
+    fprintf(fid, "tiles %s_<level>_<column>_<row>.jpg\n", name);
+    fprintf(fid, "size %u %u\n", tiler->level[0].width, tiler->level[0].height);
+    fprintf(fid, "channels %u\n", tiler->channels);
+    fprintf(fid, "tile_size %u\n", tiler->tile_size);
+    fprintf(fid, "levels %u\n", tiler->levels);
+    fprintf(fid, "count %lu\n", tiler->tile_cnt);
+
+    for (unsigned int l = 0; l < tiler->levels; l++)
+    {
+        TileLevel * level = &tiler->level[l];
+        fprintf(fid, "level %u %u %u %u %u\n", l, level->width, level->height,
+                (level->width + tiler->tile_size - 1) / tiler->tile_size,
+                (level->height + tiler->tile_size - 1) / tiler->tile_size);
+    }
+
+    return (fclose(fid) == 0) ? 0 : -1;
+}
+
+//==========================================================================
+// Start a tile pyramid. Level 0 is the full size image and each level
+// after it is half the size of the one before it, down to the first level
+// that fits in a single tile. The tiles are written to
+// "<prefix>_<level>_<col>_<row>.jpg" and the quantization and Huffman
+// tables must already be initialized by init_qtable.
+//
+// Parameters:
+//  tiler        - The tiler to initialize
+//  prefix       - The prefix of the output file names
+//  tile_size    - The width & height of the tiles, a multiple of 16
+//  width        - The image width
+//  height       - The image height
+//  channels     - The number of channels, 1 for grayscale or 3 for color
+//  workers      - The number of worker threads, 0 for the default (see
+//                 default_workers)
+//  writer_flags - Any of the WRITER_* flags for the tile files
+//  arena_flags  - Any of the ARENA_* flags for the worker arenas
+//
+// Return:
+//  0 on success, -1 if the pyramid could not be started
+//==========================================================================
+int tiler_open(Tiler * tiler, const char * prefix, unsigned int tile_size, unsigned int width,
+               unsigned int height, unsigned int channels, unsigned int workers,
+               unsigned int writer_flags, unsigned int arena_flags)
+{
+    memset(tiler, 0, sizeof(Tiler));
+
+    if ((tile_size < 16) || ((tile_size % 16) != 0) || (tile_size > 65535))
+    {
+        printf("Invalid Tile Size: %d (must be a multiple of 16)\n", tile_size);
+        return -1;
+    }
+
+    tiler->prefix = prefix;
+    tiler->tile_size = tile_size;
+    tiler->channels = channels;
+    tiler->writer_flags = writer_flags;
+
+    // Size the Levels
+    for (;;)
+    {
+        TileLevel * level = &tiler->level[tiler->levels++];
+
+        level->width = width;
+        level->height = height;
+        level->data = (unsigned char *)tiler_malloc((size_t)tile_size * width * channels);
+        level->down = (unsigned char *)tiler_malloc((size_t)((width + 1) / 2) * channels);
+
+        if (((width <= tile_size) && (height <= tile_size)) || (tiler->levels == TILER_MAX_LEVELS))
+        {
+            break;
+        }
+
+        width = (width + 1) / 2;
+        height = (height + 1) / 2;
+    }
+
+    // Start the Worker Pool
+#ifdef TILER_THREADS
+    if (workers == 0)
+    {
+        workers = default_workers();
+    }
+    workers = min(workers, TILER_MAX_WORKERS);
+
+    pthread_mutex_init(&tiler->lock, NULL);
+    pthread_cond_init(&tiler->cond, NULL);
+#endif
+
+    for (unsigned int i = 0; i < max(workers, 1); i++)
+    {
+        tiler->workers[i].tiler = tiler;
+        arena_init(&tiler->workers[i].arena, TILER_CHUNK_SIZE, arena_flags);
+    }
+
+#ifdef TILER_THREADS
+    for (unsigned int i = 0; i < workers; i++)
+    {
+        if (pthread_create(&tiler->workers[i].thread, NULL, tile_worker, &tiler->workers[i]) != 0)
+        {
+            break;
+        }
+        tiler->worker_cnt++;
+    }
+#endif
+
+    return 0;
+}
+
+//==========================================================================
+// Add the next row of the full size image to the pyramid.
+//
+// Parameters:
+//  tiler - The tile pyramid
+//  row   - The row as 8-bit grayscale or packed 24-bit RGB
+//==========================================================================
+void tiler_add_row(Tiler * tiler, const unsigned char * row)
+{
+    add_level_row(tiler, 0, row);
+}
+
+//==========================================================================
+// Flush the last partial tiles, wait for the workers and write the
+// manifest to "<prefix>.txt".
+//
+// Parameters:
+//  tiler - The tile pyramid
+//
+// Return:
+//  0 on success, -1 if any of the tiles could not be written
+//==========================================================================
+int tiler_close(Tiler * tiler)
+{
+    // Flush the Levels in Order, Each One Adds Rows to the Next
+    for (unsigned int l = 0; l < tiler->levels; l++)
+    {
+        TileLevel * level = &tiler->level[l];
+        unsigned int stride = level->width * tiler->channels;
+
+        // An Odd Last Row is Averaged With Itself
+        if (((level->rows % 2) == 1) && (l + 1 < tiler->levels))
+        {
+            const unsigned char * last = &level->data[(level->rows - 1) * stride];
+            downsample_rows(last, last, level->width, tiler->channels, level->down);
+            add_level_row(tiler, l + 1, level->down);
+        }
+
+        if (level->rows > 0)
+        {
+            flush_band(tiler, l);
+        }
+    }
+
+    // Wait for the Workers
+#ifdef TILER_THREADS
+    pthread_mutex_lock(&tiler->lock);
+    tiler->stop = 1;
+    pthread_cond_broadcast(&tiler->cond);
+    pthread_mutex_unlock(&tiler->lock);
+
+    for (unsigned int i = 0; i < tiler->worker_cnt; i++)
+    {
+        pthread_join(tiler->workers[i].thread, NULL);
+    }
+
+    pthread_mutex_destroy(&tiler->lock);
+    pthread_cond_destroy(&tiler->cond);
+#endif
+
+    if (write_manifest(tiler) != 0)
+    {
+        tiler->error = -1;
+    }
+
+    // Clean Up
+    for (unsigned int i = 0; i < max(tiler->worker_cnt, 1); i++)
+    {
+        arena_free(&tiler->workers[i].arena);
+    }
+
+    for (unsigned int l = 0; l < tiler->levels; l++)
+    {
+        free(tiler->level[l].data);
+        free(tiler->level[l].down);
+    }
+
+    return tiler->error;
+}
+
+//==========================================================================
+// Stream an image from a reader into a tile pyramid.
+//
+// Parameters:
+//  reader       - The opened input image, FORMAT_YUV420 is not supported
+//  prefix       - The prefix of the output file names
+//  tile_size    - The width & height of the tiles, a multiple of 16
+//  workers      - The number of worker threads, 0 for the default (see
+//                 default_workers)
+//  writer_flags - Any of the WRITER_* flags for the tile files
+//  arena_flags  - Any of the ARENA_* flags for the worker arenas
+//
+// Return:
+//  0 on success, -1 on failure
+//==========================================================================
+int tile_image(ImageReader * reader, const char * prefix, unsigned int tile_size,
+               unsigned int workers, unsigned int writer_flags, unsigned int arena_flags)
+{
+    Tiler tiler;
+    int result = 0;
+
+    if (reader->format == FORMAT_YUV420)
+    {
+        printf("YUV420 Input Can Not be Tiled\n");
+        return -1;
+    }
+
+    if (tiler_open(&tiler, prefix, tile_size, reader->width, reader->height, reader->channels,
+                   workers, writer_flags, arena_flags) != 0)
+    {
+        return -1;
+    }
+
+    for (unsigned int y = 0; y < reader->height; y++)
+    {
+        const unsigned char * row = reader_read_row(reader);
+        if (row == NULL)
+        {
+            printf("Error Reading File\n");
+            result = -1;
+            break;
+        }
+
+        tiler_add_row(&tiler, row);
+    }
+
+    if (tiler_close(&tiler) != 0)
+    {
+        result = -1;
+    }
+
+    return result;
+}
@@ -0,0 +1,181 @@
+//==========================================================================
+// This file contains the functions needed to cut a large image into a
+// pyramid of JPEG tiles. The image is streamed in one row at a time, so
+// only one band of tile rows per level is ever held in memory, and the
+// tiles are compressed on a pool of worker threads.
+//==========================================================================
+
+#ifndef TILER_H
+#define TILER_H
+
+#include <stdio.h>
+
+#include "encoder.h"
+#include "reader.h"
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+//==========================================================================
+// The worker pool is only available on POSIX platforms, on other
+// platforms the tiles are compressed as soon as their band is complete.
+//==========================================================================
+#if !defined(_WIN32)
+#define TILER_THREADS
+#include <pthread.h>
+#endif
+
+//==========================================================================
+// Limits for the pyramid. 32 levels covers any image whose size fits in
+// an unsigned int.
+//==========================================================================
+#define TILER_MAX_LEVELS  32
+#define TILER_MAX_WORKERS 64
+
+//==========================================================================
+// Size of each chunk of memory in the worker arenas
+//==========================================================================
+#define TILER_CHUNK_SIZE (1024 * 1024)
+
+//==========================================================================
+// Structure to hold a tile that is waiting to be compressed. The pixels
+// are stored in raster order as 8-bit grayscale or packed 24-bit RGB.
+//==========================================================================
+typedef struct TileJob
+{
+    struct TileJob * next;
+    unsigned int level;
+    unsigned int col;
+    unsigned int row;
+    unsigned int width;
+    unsigned int height;
+    unsigned char * pixels;
+} TileJob;
+
+//==========================================================================
+// Structure to hold one level of the pyramid. The band holds the rows of
+// the current row of tiles and down holds the row that is passed on to
+// the next level.
+//==========================================================================
+typedef struct
+{
+    unsigned int width;
+    unsigned int height;
+    unsigned int rows;
+    unsigned int band;
+    unsigned char * data;
+    unsigned char * down;
+} TileLevel;
+
+struct Tiler;
+
+//==========================================================================
+// Structure to hold the worker information
+//==========================================================================
+typedef struct
+{
+    struct Tiler * tiler;
+    Arena arena;
+#ifdef TILER_THREADS
+    pthread_t thread;
+#endif
+} TileWorker;
+
+//==========================================================================
+// Structure to hold the tile pyramid information
+//==========================================================================
+typedef struct Tiler
+{
+    const char * prefix;
+    unsigned int tile_size;
+    unsigned int channels;
+    unsigned int levels;
+    unsigned int writer_flags;
+    unsigned long tile_cnt;
+    int error;
+    TileLevel level[TILER_MAX_LEVELS];
+
+    // Worker Pool
+    unsigned int worker_cnt;
+    TileWorker workers[TILER_MAX_WORKERS];
+#ifdef TILER_THREADS
+    TileJob * head;
+    TileJob * tail;
+    unsigned int queued;
+    int stop;
+    pthread_mutex_t lock;
+    pthread_cond_t cond;
+#endif
+} Tiler;
+
+//==========================================================================
+// Start a tile pyramid. Level 0 is the full size image and each level
+// after it is half the size of the one before it, down to the first level
+// that fits in a single tile. The tiles are written to
+// "<prefix>_<level>_<col>_<row>.jpg" and the quantization and Huffman
+// tables must already be initialized by init_qtable.
+//
+// Parameters:
+//  tiler        - The tiler to initialize
+//  prefix       - The prefix of the output file names
+//  tile_size    - The width & height of the tiles, a multiple of 16
+//  width        - The image width
+//  height       - The image height
+//  channels     - The number of channels, 1 for grayscale or 3 for color
+//  workers      - The number of worker threads, 0 for the default (see
+//                 default_workers)
+//  writer_flags - Any of the WRITER_* flags for the tile files
+//  arena_flags  - Any of the ARENA_* flags for the worker arenas
+//
+// Return:
+//  0 on success, -1 if the pyramid could not be started
+//==========================================================================
+int tiler_open(Tiler * tiler, const char * prefix, unsigned int tile_size, unsigned int width,
+               unsigned int height, unsigned int channels, unsigned int workers,
+               unsigned int writer_flags, unsigned int arena_flags);
+
+//==========================================================================
+// Add the next row of the full size image to the pyramid.
+//
+// Parameters:
+//  tiler - The tile pyramid
+//  row   - The row as 8-bit grayscale or packed 24-bit RGB
+//==========================================================================
+void tiler_add_row(Tiler * tiler, const unsigned char * row);
+
+//==========================================================================
+// Flush the last partial tiles, wait for the workers and write the
+// manifest to "<prefix>.txt".
+//
+// Parameters:
+//  tiler - The tile pyramid
+//
+// Return:
+//  0 on success, -1 if any of the tiles could not be written
+//==========================================================================
+int tiler_close(Tiler * tiler);
+
+//==========================================================================
+// Stream an image from a reader into a tile pyramid.
+//
+// Parameters:
+//  reader       - The opened input image, FORMAT_YUV420 is not supported
+//  prefix       - The prefix of the output file names
+//  tile_size    - The width & height of the tiles, a multiple of 16
+//  workers      - The number of worker threads, 0 for the default (see
+//                 default_workers)
+//  writer_flags - Any of the WRITER_* flags for the tile files
+//  arena_flags  - Any of the ARENA_* flags for the worker arenas
+//
+// Return:
+//  0 on success, -1 on failure
+//==========================================================================
+int tile_image(ImageReader * reader, const char * prefix, unsigned int tile_size,
+               unsigned int workers, unsigned int writer_flags, unsigned int arena_flags);
+
+#ifdef __cplusplus
+}
+#endif
+
+#endif /* TILER_H */
@@ -0,0 +1,762 @@
+//==========================================================================
+// This file implements the JPEG requantizer. The input scan is decoded
+// one MCU at a time and each block is requantized and encoded again with
+// the same kernels used by compress_img, so there is no pixel domain work
+// and no IDCT/DCT round off.
+//==========================================================================
+
+#include "transcode.h"
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+#include "jpeg_file.h"
+#include "kernels.h"
+
+//==========================================================================
+// Largest quantized coefficients the Huffman tables can code, the DC
+// differences have to fit in 11 bits and the AC values in 10 bits.
+//==========================================================================
+#define MAX_DC_VALUE 1023
+#define MIN_DC_VALUE -1024
+#define MAX_AC_VALUE 1023
+
+//==========================================================================
+// Helper function that will read a whole file into memory.
+//
+// Parameters:
+//  file_name - The file to read
+//  size      - A pointer to store the size of the file in
+//
+// Return:
+//  The file data or NULL if it could not be read, it must be released
+//  with free
+//==========================================================================
+unsigned char * read_whole_file(const char * file_name, size_t * size)
+{
+    FILE * fid = fopen(file_name, "rb");
+    unsigned char * data = NULL;
+    long length;
+
+    if (fid == NULL)
+    {
+        printf("Failed to Open File: %s\n", file_name);
+        return NULL;
+    }
+
+    if ((fseek(fid, 0, SEEK_END) == 0) && ((length = ftell(fid)) > 0) && (fseek(fid, 0, SEEK_SET) == 0))
+    {
+        data = (unsigned char *)malloc(length);
+        if ((data != NULL) && (fread(data, 1, length, fid) != (size_t)length))
+        {
+            free(data);
+            data = NULL;
+        }
+        *size = (size_t)length;
+    }
+    fclose(fid);
+
+    if (data == NULL)
+    {
+        printf("Error Reading File: %s\n", file_name);
+    }
+
+    return data;
+}
+
+//==========================================================================
+// Helper function that will build a Huffman decoding table from the code
+// counts and values of a DHT segment.
+//
+// Parameters:
+//  counts - The number of codes of each length from 1 to 16
+//  values - The symbols in order of their codes
+//  total  - The number of symbols
+//  table  - The table to build
+//==========================================================================
+void build_decode_table(const unsigned char * counts, const unsigned char * values, unsigned int total, HuffDecodeTable * table)
+{
+    int code = 0;
+    int idx = 0;
+
+    for (int len = 1; len <= 16; len++)
+    {
+        table->val_ptr[len] = idx;
+        table->min_code[len] = code;
+        code += counts[len - 1];
+        idx += counts[len - 1];
+        table->max_code[len] = (counts[len - 1] > 0) ? code - 1 : -1;
+        code <<= 1;
+    }
+
+    memcpy(table->values, values, total);
+
+    // Every Index That Starts With a Short Code
+    memset(table->lookup_len, 0, sizeof(table->lookup_len));
+    for (int len = 1; len <= HUFF_LOOKUP_BITS; len++)
+    {
+        for (int i = 0; i < counts[len - 1]; i++)
+        {
+            int first = (table->min_code[len] + i) << (HUFF_LOOKUP_BITS - len);
+            if (first >= (1 << HUFF_LOOKUP_BITS))
+            {
+                break;
+            }
+
+            for (int j = 0; j < (1 << (HUFF_LOOKUP_BITS - len)); j++)
+            {
+                table->lookup_len[first + j] = (unsigned char)len;
+                table->lookup_val[first + j] = table->values[table->val_ptr[len] + i];
+            }
+        }
+    }
+
+    table->loaded = 1;
+}
+
+//==========================================================================
+// Helper function that will parse a DQT segment.
+//
+// Parameters:
+//  data   - The segment data after the length
+//  length - The length of the segment data
+//  frame  - The frame information
+//
+// Return:
+//  0 on success, -1 if the segment is not valid
+//==========================================================================
+int parse_quantization(const unsigned char * data, size_t length, JpegFrame * frame)
+{
+    while (length > 0)
+    {
+        unsigned int precision = data[0] >> 4;
+        unsigned int id = data[0] & 0xF;
+        size_t size = 1 + ((precision == 0) ? 64 : 128);
+
+        if ((id > 3) || (precision > 1) || (length < size))
+        {
+            return -1;
+        }
+
+        // Stored in Zig-Zag Order Like the Coefficients
+        for (unsigned int i = 0; i < 64; i++)
+        {
+            if (precision == 0)
+                frame->qtables[id][i] = data[1 + i];
+            else
+                frame->qtables[id][i] = (unsigned short)((data[1 + 2 * i] << 8) | data[2 + 2 * i]);
+        }
+
+        data += size;
+        length -= size;
+    }
+
+    return 0;
+}
+
+//==========================================================================
+// Helper function that will parse a DHT segment.
+//
+// Parameters:
+//  data   - The segment data after the length
+//  length - The length of the segment data
+//  frame  - The frame information
+//
+// Return:
+//  0 on success, -1 if the segment is not valid
+//==========================================================================
+int parse_huffman(const unsigned char * data, size_t length, JpegFrame * frame)
+{
+    while (length > 0)
+    {
+        unsigned int table_class = data[0] >> 4;
+        unsigned int id = data[0] & 0xF;
+        unsigned int total = 0;
+
+        if ((length < 17) || (table_class > 1) || (id > 3))
+        {
+            return -1;
+        }
+
+        for (unsigned int i = 0; i < 16; i++)
+        {
+            total += data[1 + i];
+        }
+
+        if ((total > 256) || (length < 17 + total))
+        {
+            return -1;
+        }
+
+        build_decode_table(&data[1], &data[17], total,
+                           (table_class == 0) ? &frame->dc_tables[id] : &frame->ac_tables[id]);
+
+        data += 17 + total;
+        length -= 17 + total;
+    }
+
+    return 0;
+}
+
+//==========================================================================
+// Helper function that will parse a SOF0 or SOF1 segment.
+//
+// Parameters:
+//  data   - The segment data after the length
+//  length - The length of the segment data
+//  frame  - The frame information
+//
+// Return:
+//  0 on success, -1 if the frame is not valid or not supported
+//==========================================================================
+int parse_frame(const unsigned char * data, size_t length, JpegFrame * frame)
+{
+    if ((length < 6) || (data[0] != 8))
+    {
+        printf("Only 8-bit JPEGs Can be Transcoded\n");
+        return -1;
+    }
+
+    frame->height = (data[1] << 8) | data[2];
+    frame->width = (data[3] << 8) | data[4];
+    frame->channels = data[5];
+
+    if ((frame->channels != 1) && (frame->channels != 3))
+    {
+        printf("Invalid # of Channels: %d (1,3 are the only valid options)\n", frame->channels);
+        return -1;
+    }
+
+    if ((length < 6 + 3 * frame->channels) || (frame->width == 0) || (frame->height == 0))
+    {
+        return -1;
+    }
+
+    for (unsigned int i = 0; i < frame->channels; i++)
+    {
+        frame->id[i] = data[6 + 3 * i];
+        frame->sampling[i] = data[7 + 3 * i];
+        frame->qtable_id[i] = data[8 + 3 * i] & 0x3;
+    }
+
+    // The Encoder Only Writes Grayscale or 4:2:0
+    if ((frame->channels == 3) &&
+        ((frame->sampling[0] != 0x22) || (frame->sampling[1] != 0x11) || (frame->sampling[2] != 0x11)))
+    {
+        printf("Only 4:2:0 Color JPEGs Can be Transcoded\n");
+        return -1;
+    }
+
+    return 0;
+}
+
+//==========================================================================
+// Helper function that will parse a SOS segment.
+//
+// Parameters:
+//  data   - The segment data after the length
+//  length - The length of the segment data
+//  frame  - The frame information
+//
+// Return:
+//  0 on success, -1 if the scan is not valid or not supported
+//==========================================================================
+int parse_scan(const unsigned char * data, size_t length, JpegFrame * frame)
+{
+    unsigned int count = data[0];
+
+    if ((frame->channels == 0) || (length < 4 + 2 * count))
+    {
+        return -1;
+    }
+
+    // One Interleaved Scan With Every Component in Frame Order
+    if (count != frame->channels)
+    {
+        printf("Only Single Scan JPEGs Can be Transcoded\n");
+        return -1;
+    }
+
+    for (unsigned int i = 0; i < count; i++)
+    {
+        if (data[1 + 2 * i] != frame->id[i])
+        {
+            printf("Only Single Scan JPEGs Can be Transcoded\n");
+            return -1;
+        }
+
+        frame->dc_id[i] = (data[2 + 2 * i] >> 4) & 0x3;
+        frame->ac_id[i] = data[2 + 2 * i] & 0x3;
+
+        if (!frame->dc_tables[frame->dc_id[i]].loaded || !frame->ac_tables[frame->ac_id[i]].loaded)
+        {
+            printf("Missing Huffman Table\n");
+            return -1;
+        }
+    }
+
+    return 0;
+}
+
+//==========================================================================
+// Parse the headers of a baseline JPEG up to the start of the scan. Only
+// grayscale and YCbCr 4:2:0 images can be parsed, since those are the
+// layouts the encoder writes.
+//
+// Parameters:
+//  data  - The JPEG file
+//  size  - The size of the JPEG file
+//  frame - A pointer to store the frame information in
+//
+// Return:
+//  0 on success, -1 if the JPEG is not valid or not supported
+//==========================================================================
+int parse_jpeg(const unsigned char * data, size_t size, JpegFrame * frame)
+{
+    size_t pos = 2;
+
+    memset(frame, 0, sizeof(JpegFrame));
+
+    if ((size < 4) || (data[0] != 0xFF) || (data[1] != 0xD8))
+    {
+        printf("Not a JPEG File\n");
+        return -1;
+    }
+
+    for (;;)
+    {
+        // Skip Fill Bytes Before the Marker
+        if ((pos >= size) || (data[pos] != 0xFF))
+        {
+            printf("Invalid JPEG Marker\n");
+            return -1;
+        }
+        while ((pos < size) && (data[pos] == 0xFF))
+        {
+            pos++;
+        }
+
+        if (pos + 3 > size)
+        {
+            printf("Unexpected End of JPEG\n");
+            return -1;
+        }
+
+        unsigned char marker = data[pos];
+        size_t length = (data[pos + 1] << 8) | data[pos + 2];
+        const unsigned char * segment = &data[pos + 3];
+        int result = 0;
+
+        if ((length < 2) || (pos + 1 + length > size))
+        {
+            printf("Unexpected End of JPEG\n");
+            return -1;
+        }
+        length -= 2;
+
+        switch (marker)
+        {
+        case 0xC0:
+        case 0xC1:
+            result = parse_frame(segment, length, frame);
+            break;
+
+        case 0xC4:
+            result = parse_huffman(segment, length, frame);
+            break;
+
+        case 0xDB:
+            result = parse_quantization(segment, length, frame);
+            break;
+
+        case 0xDD:
+            result = (length >= 2) ? 0 : -1;
+            frame->restart_interval = (segment[0] << 8) | segment[1];
+            break;
+
+        case 0xDA:
+            if (parse_scan(segment, length, frame) != 0)
+            {
+                return -1;
+            }
+            frame->scan_start = pos + 3 + length;
+            return 0;
+
+        case 0xD9:
+            printf("JPEG Has No Scan\n");
+            return -1;
+
+        default:
+            // Progressive, Lossless & Arithmetic Coded Frames
+            if ((marker >= 0xC2) && (marker <= 0xCF) && (marker != 0xC4) && (marker != 0xC8) && (marker != 0xCC))
+            {
+                printf("Only Baseline Huffman JPEGs Can be Transcoded\n");
+                return -1;
+            }
+            break;
+        }
+
+        if (result != 0)
+        {
+            printf("Invalid JPEG Segment: FF%02X\n", marker);
+            return -1;
+        }
+
+        pos += 1 + 2 + length;
+    }
+}
+
+//==========================================================================
+// Helper function that will make sure there are enough bits buffered.
+// Stuffed zero bytes are removed, and once a marker is found only zero
+// bits are returned until the marker is consumed.
+//
+// Parameters:
+//  reader - The bit reader
+//  count  - The number of bits needed, from 0 to 16
+//==========================================================================
+static inline void fill_bits(BitReader * reader, unsigned int count)
+{
+    while (reader->bit_cnt < count)
+    {
+        unsigned int byte = 0;
+
+        if (!reader->marker && (reader->pos < reader->size))
+        {
+            byte = reader->data[reader->pos];
+            if (byte != 0xFF)
+            {
+                reader->pos++;
+            }
+            else if ((reader->pos + 1 < reader->size) && (reader->data[reader->pos + 1] == 0x00))
+            {
+                reader->pos += 2;
+            }
+            else
+            {
+                reader->marker = 1;
+                byte = 0;
+            }
+        }
+
+        reader->bits = (reader->bits << 8) | byte;
+        reader->bit_cnt += 8;
+    }
+}
+
+//==========================================================================
+// Helper function that will read bits from the entropy coded data.
+//
+// Parameters:
+//  reader - The bit reader
+//  count  - The number of bits to read, from 0 to 16
+//
+// Return:
+//  The bits
+//==========================================================================
+static inline unsigned int read_bits(BitReader * reader, unsigned int count)
+{
+    fill_bits(reader, count);
+
+    reader->bit_cnt -= count;
+    return (reader->bits >> reader->bit_cnt) & ((1u << count) - 1);
+}
+
+//==========================================================================
+// Helper function that will decode one Huffman symbol.
+//
+// Parameters:
+//  reader - The bit reader
+//  table  - The Huffman decoding table
+//
+// Return:
+//  The symbol or -1 if the code is not valid
+//==========================================================================
+static inline int decode_symbol(BitReader * reader, const HuffDecodeTable * table)
+{
+    // Short Codes
+    fill_bits(reader, HUFF_LOOKUP_BITS);
+    int code = (reader->bits >> (reader->bit_cnt - HUFF_LOOKUP_BITS)) & ((1 << HUFF_LOOKUP_BITS) - 1);
+    int len = table->lookup_len[code];
+    if (len > 0)
+    {
+        reader->bit_cnt -= len;
+        return table->lookup_val[code];
+    }
+
+    // Long Codes
+    reader->bit_cnt -= HUFF_LOOKUP_BITS;
+    for (len = HUFF_LOOKUP_BITS + 1; len <= 16; len++)
+    {
+        code = (code << 1) | (int)read_bits(reader, 1);
+        if (code <= table->max_code[len])
+        {
+            return table->values[table->val_ptr[len] + code - table->min_code[len]];
+        }
+    }
+
+    return -1;
+}
+
+//==========================================================================
+// Helper function that will read the additional bits of a coefficient and
+// convert them to a signed value (see Annex F.2.2.1).
+//
+// Parameters:
+//  reader - The bit reader
+//  size   - The number of additional bits
+//
+// Return:
+//  The coefficient value
+//==========================================================================
+static inline int receive_extend(BitReader * reader, unsigned int size)
+{
+    int value = (int)read_bits(reader, size);
+
+    if (value < (1 << (size - 1)))
+    {
+        value -= (1 << size) - 1;
+    }
+
+    return value;
+}
+
+//==========================================================================
+// Helper function that will decode the quantized coefficients of a block.
+// Coefficients that a bad run length places past the end of the block
+// are dropped.
+//
+// Parameters:
+//  reader  - The bit reader
+//  dc      - The DC Huffman decoding table
+//  ac      - The AC Huffman decoding table
+//  pred    - A pointer to the DC prediction of the component
+//  output  - A pointer to the 8x8 coefficients in zig-zag order
+//
+// Return:
+//  0 on success, -1 if the data is not valid
+//==========================================================================
+int decode_block(BitReader * reader, const HuffDecodeTable * dc, const HuffDecodeTable * ac, int * pred, int * output)
+{
+    int size = decode_symbol(reader, dc);
+
+    memset(output, 0, 64 * sizeof(int));
+
+    if ((size < 0) || (size > 11))
+    {
+        return -1;
+    }
+
+    *pred += (size > 0) ? receive_extend(reader, size) : 0;
+    output[0] = *pred;
+
+    for (int k = 1; k < 64; k++)
+    {
+        int symbol = decode_symbol(reader, ac);
+        if (symbol < 0)
+        {
+            return -1;
+        }
+
+        int run = symbol >> 4;
+        size = symbol & 0xF;
+
+        if (size > 0)
+        {
+            k += run;
+            int value = receive_extend(reader, size);
+            if (k < 64)
+            {
+                output[k] = value;
+            }
+        }
+        else if (run == 15)
+        {
+            k += 15;
+        }
+        else
+        {
+            break;
+        }
+    }
+
+    return 0;
+}
+
+//==========================================================================
+// Helper function that will skip to the next restart marker.
+//
+// Parameters:
+//  reader - The bit reader
+//
+// Return:
+//  0 on success, -1 if there is no restart marker
+//==========================================================================
+int read_restart(BitReader * reader)
+{
+    // The Rest of the Byte is Padding
+    reader->bit_cnt = 0;
+
+    while ((reader->pos < reader->size) && (reader->data[reader->pos] == 0xFF))
+    {
+        reader->pos++;
+    }
+
+    if ((reader->pos >= reader->size) || ((reader->data[reader->pos] & 0xF8) != 0xD0))
+    {
+        return -1;
+    }
+
+    reader->pos++;
+    reader->marker = 0;
+    return 0;
+}
+
+//==========================================================================
+// Helper function that will requantize a block. The old value of each
+// coefficient is divided by the new quantization value and rounded.
+//
+// Parameters:
+//  input  - The decoded coefficients in zig-zag order
+//  old_q  - The quantization table of the input in zig-zag order
+//  new_q  - The quantization table of the output in zig-zag order
+//  output - A pointer to the 8x8 requantized coefficients
+//==========================================================================
+void requantize_block(const int * input, const unsigned short * old_q, const unsigned char * new_q, short * output)
+{
+    for (unsigned int k = 0; k < 64; k++)
+    {
+        int value = input[k] * old_q[k];
+        int q = new_q[k];
+        int level = (abs(value) + q / 2) / q;
+
+        if (value < 0)
+        {
+            level = -level;
+        }
+
+        if (k == 0)
+        {
+            level = max(MIN_DC_VALUE, min(MAX_DC_VALUE, level));
+        }
+        else
+        {
+            level = max(-MAX_AC_VALUE, min(MAX_AC_VALUE, level));
+        }
+
+        output[k] = (short)level;
+    }
+}
+
+//==========================================================================
+// Requantize a JPEG to the tables set by init_qtable. Each coefficient is
+// multiplied by its old quantization value and divided by the new one
+// with rounding, so the only loss is from the coarser new tables.
+//
+// Parameters:
+//  input_name   - The input JPEG file
+//  output_name  - The output JPEG file
+//  writer_flags - Any of the WRITER_* flags for the output
+//
+// Return:
+//  0 on success, -1 on failure
+//==========================================================================
+int transcode_jpeg(const char * input_name, const char * output_name, unsigned int writer_flags)
+{
+    const Kernels * kernels = get_kernels();
+    const unsigned char * read_ptrn = get_read_pattern();
+    unsigned char new_q[2][64];
+    JpegFrame frame;
+    BitReader reader;
+    int coeffs[64];
+    short zz[64];
+    RLEInfo rle[256];
+    unsigned int rle_length;
+    int pred[3] = { 0, 0, 0 };
+    short prev_dc[3] = { 0, 0, 0 };
+    size_t size;
+    int result = 0;
+
+    unsigned char * data = read_whole_file(input_name, &size);
+    if (data == NULL)
+    {
+        return -1;
+    }
+
+    if (parse_jpeg(data, size, &frame) != 0)
+    {
+        free(data);
+        return -1;
+    }
+
+    // New Tables in Zig-Zag Order (see write_quantization)
+    for (unsigned int i = 0; i < 64; i++)
+    {
+        new_q[0][read_ptrn[i]] = get_yqtable()[i];
+        new_q[1][read_ptrn[i]] = get_cqtable()[i];
+    }
+
+    OutStream * stream = open_stream(output_name, writer_flags, frame.width, frame.height, NULL, frame.channels);
+    if (stream == NULL)
+    {
+        free(data);
+        return -1;
+    }
+
+    // MCUs are 8x8 for Grayscale and 16x16 for 4:2:0
+    unsigned int mcu_size = (frame.channels == 1) ? 8 : 16;
+    unsigned int mcu_cnt = ((frame.width + mcu_size - 1) / mcu_size) * ((frame.height + mcu_size - 1) / mcu_size);
+
+    memset(&reader, 0, sizeof(BitReader));
+    reader.data = data;
+    reader.size = size;
+    reader.pos = frame.scan_start;
+
+    for (unsigned int mcu = 0; (mcu < mcu_cnt) && (result == 0); mcu++)
+    {
+        // Restart Intervals Reset the DC Predictions
+        if ((frame.restart_interval > 0) && (mcu > 0) && ((mcu % frame.restart_interval) == 0))
+        {
+            if (read_restart(&reader) != 0)
+            {
+                printf("Missing Restart Marker\n");
+                result = -1;
+                break;
+            }
+            memset(pred, 0, sizeof(pred));
+        }
+
+        for (unsigned int c = 0; (c < frame.channels) && (result == 0); c++)
+        {
+            unsigned int blocks = (frame.channels == 1) ? 1 : ((frame.sampling[c] >> 4) * (frame.sampling[c] & 0xF));
+            unsigned int table = (c == 0) ? 0 : 1;
+
+            for (unsigned int b = 0; b < blocks; b++)
+            {
+                if (decode_block(&reader, &frame.dc_tables[frame.dc_id[c]], &frame.ac_tables[frame.ac_id[c]],
+                                 &pred[c], coeffs) != 0)
+                {
+                    printf("Invalid JPEG Scan Data\n");
+                    result = -1;
+                    break;
+                }
+
+                requantize_block(coeffs, frame.qtables[frame.qtable_id[c]], new_q[table], zz);
+
+                // Same Entropy Path as compress_8x8
+                kernels->rle(zz, rle, &rle_length, &prev_dc[c]);
+                kernels->encode(rle, 1, get_huffman_table(1, table), stream);
+                kernels->encode(&rle[1], rle_length - 1, get_huffman_table(0, table), stream);
+            }
+        }
+    }
+
+    if (close_stream(stream) != 0)
+    {
+        result = -1;
+    }
+    free(data);
+
+    return result;
+}
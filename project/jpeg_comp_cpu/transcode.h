@@ -0,0 +1,107 @@
+//==========================================================================
+// This file contains the JPEG requantizer. A baseline JPEG is Huffman
+// decoded to its quantized coefficients, which are scaled to the current
+// quantization tables and encoded again, so a JPEG can be recompressed to
+// a lower quality without an IDCT and DCT.
+//==========================================================================
+
+#ifndef TRANSCODE_H
+#define TRANSCODE_H
+
+#include "encoder.h"
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+//==========================================================================
+// Number of bits looked up at once when decoding a Huffman code, longer
+// codes fall back to searching by length.
+//==========================================================================
+#define HUFF_LOOKUP_BITS 9
+
+//==========================================================================
+// Structure to hold a Huffman decoding table. The codes of each length
+// are consecutive, so a code is found by its length (see Annex F.2.2.3).
+// The short codes are also in a table indexed by the next bits of data.
+//==========================================================================
+typedef struct
+{
+    int max_code[17];
+    int val_ptr[17];
+    int min_code[17];
+    unsigned char values[256];
+    unsigned char lookup_len[1 << HUFF_LOOKUP_BITS];
+    unsigned char lookup_val[1 << HUFF_LOOKUP_BITS];
+    int loaded;
+} HuffDecodeTable;
+
+//==========================================================================
+// Structure to hold the state of the entropy coded data reader. When a
+// marker is found the reader stops and returns zero bits.
+//==========================================================================
+typedef struct
+{
+    const unsigned char * data;
+    size_t size;
+    size_t pos;
+    unsigned int bits;
+    unsigned int bit_cnt;
+    int marker;
+} BitReader;
+
+//==========================================================================
+// Structure to hold the frame information of the input JPEG
+//==========================================================================
+typedef struct
+{
+    unsigned int width;
+    unsigned int height;
+    unsigned int channels;
+    unsigned int restart_interval;
+    unsigned char id[3];
+    unsigned char sampling[3];
+    unsigned char qtable_id[3];
+    unsigned char dc_id[3];
+    unsigned char ac_id[3];
+    unsigned short qtables[4][64];
+    HuffDecodeTable dc_tables[4];
+    HuffDecodeTable ac_tables[4];
+    size_t scan_start;
+} JpegFrame;
+
+//==========================================================================
+// Parse the headers of a baseline JPEG up to the start of the scan. Only
+// grayscale and YCbCr 4:2:0 images can be parsed, since those are the
+// layouts the encoder writes.
+//
+// Parameters:
+//  data  - The JPEG file
+//  size  - The size of the JPEG file
+//  frame - A pointer to store the frame information in
+//
+// Return:
+//  0 on success, -1 if the JPEG is not valid or not supported
+//==========================================================================
+int parse_jpeg(const unsigned char * data, size_t size, JpegFrame * frame);
+
+//==========================================================================
+// Requantize a JPEG to the tables set by init_qtable. Each coefficient is
+// multiplied by its old quantization value and divided by the new one
+// with rounding, so the only loss is from the coarser new tables.
+//
+// Parameters:
+//  input_name   - The input JPEG file
+//  output_name  - The output JPEG file
+//  writer_flags - Any of the WRITER_* flags for the output
+//
+// Return:
+//  0 on success, -1 on failure
+//==========================================================================
+int transcode_jpeg(const char * input_name, const char * output_name, unsigned int writer_flags);
+
+#ifdef __cplusplus
+}
+#endif
+
+#endif /* TRANSCODE_H */
@@ -0,0 +1,383 @@
+//==========================================================================
+// This file implements the start up tuning. The kernels are timed the way
+// the encoder runs them, one MCU at a time from RGB to Huffman codes, on a
+// synthetic strip of MCUs, first on one thread for each kernel variant and
+// then on more and more threads with the fastest variant.
+//==========================================================================
+
+#include "wisdom.h"
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+#include "kernels.h"
+#include "mjpeg.h"
+
+#if defined(_WIN32)
+#include <windows.h>
+#else
+#include <unistd.h>
+#endif
+
+//==========================================================================
+// Structure to hold one timed run of the kernels
+//
+//  kernels - The kernel variant to time
+//  rgb     - The synthetic strip of WISDOM_MCUS MCUs
+//  mcus    - The number of MCUs that were encoded
+//  elapsed - The time it took in seconds
+//==========================================================================
+typedef struct
+{
+    const Kernels * kernels;
+    const unsigned char * rgb;
+    unsigned long mcus;
+    double elapsed;
+#ifdef WISDOM_THREADS
+    pthread_t thread;
+#endif
+} WisdomRun;
+
+//==========================================================================
+// Local Variable to hold the loaded profile
+//==========================================================================
+static Wisdom loaded_wisdom = { "", 0, -1, 0 };
+
+//==========================================================================
+// Helper function that will get the number of CPUs.
+//
+// Return:
+//  The number of CPUs that are online
+//==========================================================================
+unsigned int online_cpus()
+{
+#if defined(_WIN32)
+    SYSTEM_INFO info;
+
+    GetSystemInfo(&info);
+    return max((unsigned int)info.dwNumberOfProcessors, 1);
+#else
+    long cpus = sysconf(_SC_NPROCESSORS_ONLN);
+    return (cpus > 0) ? (unsigned int)cpus : 1;
+#endif
+}
+
+//==========================================================================
+// Helper function that will fill the synthetic strip of MCUs. It is a
+// gradient with fine texture, so the blocks have the mix of zero runs and
+// coefficients of a photo rather than being flat or noise.
+//
+// Parameters:
+//  rgb - The strip of 16 rows of WISDOM_MCUS * 16 packed RGB pixels
+//==========================================================================
+void fill_wisdom_strip(unsigned char * rgb)
+{
+    for (unsigned int y = 0; y < 16; y++)
+    {
+        for (unsigned int x = 0; x < WISDOM_MCUS * 16; x++)
+        {
+            unsigned int texture = ((x * 7919 + y * 104729) >> 3) & 31;
+
+            for (unsigned int c = 0; c < 3; c++)
+            {
+                rgb[(y * WISDOM_MCUS * 16 + x) * 3 + c] = (unsigned char)((x * (c + 1) + y * 3 + texture) & 0xFF);
+            }
+        }
+    }
+}
+
+//==========================================================================
+// The timing thread. It encodes the strip over and over for
+// WISDOM_SECONDS, with the color conversion, DCT, quantization, run length
+// and Huffman kernels of each MCU.
+//
+// Parameters:
+//  arg - The run information
+//==========================================================================
+void * run_kernels(void * arg)
+{
+    WisdomRun * run = (WisdomRun *)arg;
+    const Kernels * kernels = run->kernels;
+    const size_t stride = WISDOM_MCUS * 16 * 3;
+    unsigned char blocks[6 * 64];
+    float dct[8 * 8];
+    short zz[8 * 8];
+    RLEInfo rle[256];
+    unsigned int rle_length;
+    short prev_dc[3] = { 0, 0, 0 };
+    OutStream * stream = stream_open_memory();
+
+    run->mcus = 0;
+    double start = mjpeg_clock();
+    do
+    {
+        for (unsigned int m = 0; m < WISDOM_MCUS; m++)
+        {
+            kernels->rgb_mcu(&run->rgb[m * 16 * 3], stride, blocks);
+
+            // 4 Luminance Blocks Then Cb & Cr
+            for (unsigned int i = 0; i < 6; i++)
+            {
+                unsigned int c = (i < 4) ? 0 : i - 3;
+
+                kernels->fdct(&blocks[i * 64], dct);
+                kernels->quantize(dct, (c == 0) ? get_yqtable() : get_cqtable(), zz);
+                kernels->rle(zz, rle, &rle_length, &prev_dc[c]);
+                kernels->encode(rle, 1, get_huffman_table(1, c), stream);
+                kernels->encode(&rle[1], rle_length - 1, get_huffman_table(0, c), stream);
+            }
+        }
+
+        stream_reset_memory(stream);
+        run->mcus += WISDOM_MCUS;
+        run->elapsed = mjpeg_clock() - start;
+    } while (run->elapsed < WISDOM_SECONDS);
+
+    size_t size;
+    free(stream_close_memory(stream, &size));
+
+    return NULL;
+}
+
+//==========================================================================
+// Helper function that will time the kernels on a number of threads at
+// the same time.
+//
+// Parameters:
+//  kernels - The kernel variant to time
+//  rgb     - The synthetic strip of MCUs
+//  workers - The number of threads
+//
+// Return:
+//  The number of MCUs encoded per second by all of the threads
+//==========================================================================
+double time_kernels(const Kernels * kernels, const unsigned char * rgb, unsigned int workers)
+{
+    WisdomRun runs[WISDOM_MAX_WORKERS];
+    unsigned long mcus = 0;
+    double elapsed = 0.0;
+
+    for (unsigned int i = 0; i < workers; i++)
+    {
+        runs[i].kernels = kernels;
+        runs[i].rgb = rgb;
+    }
+
+#ifdef WISDOM_THREADS
+    unsigned int started = 0;
+    for (unsigned int i = 1; i < workers; i++)
+    {
+        if (pthread_create(&runs[i].thread, NULL, run_kernels, &runs[i]) != 0)
+        {
+            break;
+        }
+        started++;
+    }
+    run_kernels(&runs[0]);
+    for (unsigned int i = 1; i <= started; i++)
+    {
+        pthread_join(runs[i].thread, NULL);
+    }
+    workers = started + 1;
+#else
+    workers = 1;
+    run_kernels(&runs[0]);
+#endif
+
+    for (unsigned int i = 0; i < workers; i++)
+    {
+        mcus += runs[i].mcus;
+        elapsed = max(elapsed, runs[i].elapsed);
+    }
+
+    return (elapsed > 0.0) ? mcus / elapsed : 0.0;
+}
+
+//==========================================================================
+// Time the kernel variants and worker counts on this CPU and write the
+// fastest ones to a profile. init_qtable must be called first.
+//
+// Parameters:
+//  file_name - The profile to write
+//
+// Return:
+//  0 on success, -1 if the profile could not be written
+//==========================================================================
+int calibrate(const char * file_name)
+{
+    Wisdom wisdom;
+    unsigned char * rgb = (unsigned char *)malloc(WISDOM_MCUS * 16 * 16 * 3);
+    const Kernels * best = get_kernels();
+    double best_rate = 0.0;
+
+    if (rgb == NULL)
+    {
+        printf("Out of Memory\n");
+        exit(-1);
+    }
+    fill_wisdom_strip(rgb);
+
+    cpu_name(wisdom.cpu, sizeof(wisdom.cpu));
+    wisdom.cpus = online_cpus();
+    printf("CPU: %s (%u CPUs)\n", wisdom.cpu, wisdom.cpus);
+
+    // Fastest Kernel Variant on One Thread, Only Variants That Match the Reference
+    printf("Kernels:\n");
+    for (unsigned int i = 0; i < KERNELS_COUNT; i++)
+    {
+        const Kernels * kernels = get_kernel_variant(i);
+
+        if ((kernels == NULL) || ((kernels != &scalar_kernels) && (check_kernels(kernels, 512) != 0)))
+        {
+            continue;
+        }
+
+        double rate = time_kernels(kernels, rgb, 1);
+        printf("   %-8s %10.0f MCUs/s\n", kernels->name, rate);
+        if (rate > best_rate)
+        {
+            best = kernels;
+            best_rate = rate;
+        }
+    }
+    wisdom.kernels = kernel_variant_id(best->name);
+
+    // Fewest Workers That are Not Much Slower Than More Workers
+    double workers_rate = 0.0;
+    wisdom.workers = 1;
+#ifdef WISDOM_THREADS
+    unsigned int max_workers = min(wisdom.cpus, WISDOM_MAX_WORKERS);
+
+    printf("Workers (%s):\n", best->name);
+    for (unsigned int workers = 1; ; workers = min(workers * 2, max_workers))
+    {
+        double rate = time_kernels(best, rgb, workers);
+        printf("   %-8u %10.0f MCUs/s\n", workers, rate);
+        if (rate > workers_rate * (1.0 + WISDOM_MARGIN))
+        {
+            wisdom.workers = workers;
+            workers_rate = rate;
+        }
+
+        if (workers == max_workers)
+        {
+            break;
+        }
+    }
+#endif
+    free(rgb);
+
+    // Write the Profile
+    FILE * file = fopen(file_name, "w");
+    if (file == NULL)
+    {
+        printf("Failed to Write %s\n", file_name);
+        return -1;
+    }
+
+    fprintf(file, "# JPEG encoder wisdom, written by -tune\n");
+    fprintf(file, "cpu %s\n", wisdom.cpu);
+    fprintf(file, "cpus %u\n", wisdom.cpus);
+    fprintf(file, "kernels %s\n", best->name);
+    fprintf(file, "workers %u\n", wisdom.workers);
+    int result = (ferror(file) == 0) ? 0 : -1;
+    if (fclose(file) != 0)
+    {
+        result = -1;
+    }
+
+    if (result != 0)
+    {
+        printf("Failed to Write %s\n", file_name);
+        return -1;
+    }
+
+    printf("Wrote %s: %s kernels, %u workers\n", file_name, best->name, wisdom.workers);
+    return 0;
+}
+
+//==========================================================================
+// Load a profile written by calibrate. It must be called before
+// init_qtable, which picks the kernels. A profile made on a different CPU
+// is ignored.
+//
+// Parameters:
+//  file_name - The profile to load
+//
+// Return:
+//  0 if the profile was loaded, -1 if it could not be read or is for a
+//  different CPU
+//==========================================================================
+int load_wisdom(const char * file_name)
+{
+    Wisdom wisdom = { "", 0, -1, 0 };
+    char line[256];
+    char cpu[64];
+
+    FILE * file = fopen(file_name, "r");
+    if (file == NULL)
+    {
+        printf("Error Opening Wisdom %s\n", file_name);
+        return -1;
+    }
+
+    while (fgets(line, sizeof(line), file) != NULL)
+    {
+        line[strcspn(line, "\r\n")] = '\0';
+
+        // Comments & Lines Without a Value
+        char * value = strchr(line, ' ');
+        if ((line[0] == '#') || (value == NULL))
+        {
+            continue;
+        }
+        *value++ = '\0';
+
+        if (strcmp(line, "cpu") == 0)
+        {
+            snprintf(wisdom.cpu, sizeof(wisdom.cpu), "%s", value);
+        }
+        else if (strcmp(line, "cpus") == 0)
+        {
+            wisdom.cpus = atoi(value);
+        }
+        else if (strcmp(line, "kernels") == 0)
+        {
+            wisdom.kernels = kernel_variant_id(value);
+        }
+        else if (strcmp(line, "workers") == 0)
+        {
+            wisdom.workers = min((unsigned int)atoi(value), WISDOM_MAX_WORKERS);
+        }
+    }
+    fclose(file);
+
+    // The Timings Only Hold for the CPU They Were Made On
+    cpu_name(cpu, sizeof(cpu));
+    if ((strcmp(wisdom.cpu, cpu) != 0) || (wisdom.cpus != online_cpus()))
+    {
+        printf("%s Was Tuned on a Different CPU, Using the Defaults\n", file_name);
+        return -1;
+    }
+
+    if (wisdom.kernels >= 0)
+    {
+        set_kernel_preference(wisdom.kernels);
+    }
+    loaded_wisdom = wisdom;
+
+    return 0;
+}
+
+//==========================================================================
+// Get the number of worker threads to use when none is given, the tuned
+// number if a profile was loaded and otherwise one per CPU.
+//
+// Return:
+//  The number of worker threads
+//==========================================================================
+unsigned int default_workers()
+{
+    return (loaded_wisdom.workers > 0) ? loaded_wisdom.workers : online_cpus();
+}
@@ -0,0 +1,97 @@
+//==========================================================================
+// This file contains the start up tuning of the encoder. calibrate times
+// each kernel variant and each number of worker threads on synthetic
+// blocks and saves the fastest ones to a small profile, the "wisdom" file,
+// which later runs load instead of using the fixed defaults.
+//
+// The profile is a text file of "name value" lines:
+//
+//  cpu     - The CPU name, the profile is ignored on a different CPU
+//  cpus    - The number of CPUs, the profile is ignored if it changed
+//  kernels - The fastest kernel variant
+//  workers - The fastest number of worker threads
+//==========================================================================
+
+#ifndef WISDOM_H
+#define WISDOM_H
+
+#include "encoder.h"
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+//==========================================================================
+// The worker threads are only timed on POSIX platforms
+//==========================================================================
+#if !defined(_WIN32)
+#define WISDOM_THREADS
+#include <pthread.h>
+#endif
+
+//==========================================================================
+// Limits for the calibration. Each kernel variant and worker count is run
+// for WISDOM_SECONDS, and a larger worker count has to be more than
+// WISDOM_MARGIN faster to be picked over a smaller one.
+//==========================================================================
+#define WISDOM_MAX_WORKERS 64
+#define WISDOM_MCUS        64
+#define WISDOM_SECONDS     0.25
+#define WISDOM_MARGIN      0.03
+
+//==========================================================================
+// Structure to hold the tuned settings
+//
+//  cpu     - The CPU name (see cpu_name)
+//  cpus    - The number of CPUs
+//  kernels - One of the KERNELS_* values, -1 if it is not tuned
+//  workers - The number of worker threads, 0 if it is not tuned
+//==========================================================================
+typedef struct
+{
+    char cpu[64];
+    unsigned int cpus;
+    int kernels;
+    unsigned int workers;
+} Wisdom;
+
+//==========================================================================
+// Time the kernel variants and worker counts on this CPU and write the
+// fastest ones to a profile. init_qtable must be called first.
+//
+// Parameters:
+//  file_name - The profile to write
+//
+// Return:
+//  0 on success, -1 if the profile could not be written
+//==========================================================================
+int calibrate(const char * file_name);
+
+//==========================================================================
+// Load a profile written by calibrate. It must be called before
+// init_qtable, which picks the kernels. A profile made on a different CPU
+// is ignored.
+//
+// Parameters:
+//  file_name - The profile to load
+//
+// Return:
+//  0 if the profile was loaded, -1 if it could not be read or is for a
+//  different CPU
+//==========================================================================
+int load_wisdom(const char * file_name);
+
+//==========================================================================
+// Get the number of worker threads to use when none is given, the tuned
+// number if a profile was loaded and otherwise one per CPU.
+//
+// Return:
+//  The number of worker threads
+//==========================================================================
+unsigned int default_workers();
+
+#ifdef __cplusplus
+}
+#endif
+
+#endif /* WISDOM_H */
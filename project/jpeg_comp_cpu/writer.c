@@ -0,0 +1,459 @@
+//==========================================================================
+// This file implements the buffered output stream. When the background
+// writer is used the encoder fills one buffer while the writer thread
+// flushes the previously filled ones, so slow writes do not stall the
+// encoder until all of the buffers are full.
+//==========================================================================
+
+#if defined(__linux__) && !defined(_GNU_SOURCE)
+#define _GNU_SOURCE
+#endif
+
+#include "writer.h"
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <fcntl.h>
+
+#if defined(_WIN32)
+#include <io.h>
+#include <malloc.h>
+#else
+#include <unistd.h>
+#endif
+
+//==========================================================================
+// Helper function that will write a buffer out to the file.
+//
+// Parameters:
+//  stream - The output stream
+//  data   - The data to write
+//  length - The number of bytes to write
+//==========================================================================
+void write_buffer(OutStream * stream, const unsigned char * data, size_t length)
+{
+#if defined(__linux__) && defined(O_DIRECT)
+    // O_DIRECT needs whole blocks, so the final partial buffer is
+    // written through the page cache.
+    if (stream->direct && ((length % WRITER_ALIGN) != 0))
+    {
+        fcntl(stream->fd, F_SETFL, fcntl(stream->fd, F_GETFL) & ~O_DIRECT);
+        stream->direct = 0;
+    }
+#endif
+
+    while ((length > 0) && (stream->error == 0))
+    {
+#if defined(_WIN32)
+        int written = _write(stream->fd, data, (unsigned int)length);
+#else
+        ssize_t written = write(stream->fd, data, length);
+#endif
+        if (written <= 0)
+        {
+            printf("Error Writing File\n");
+            stream->error = -1;
+            break;
+        }
+
+        data += written;
+        length -= written;
+    }
+}
+
+#ifdef WRITER_THREADS
+//==========================================================================
+// The background writer thread. It writes the submitted buffers out in
+// order until the stream is closed.
+//
+// Parameters:
+//  arg - The output stream
+//==========================================================================
+void * writer_thread(void * arg)
+{
+    OutStream * stream = (OutStream *)arg;
+
+    pthread_mutex_lock(&stream->lock);
+    for (;;)
+    {
+        // Wait for a Buffer
+        while ((stream->pending == 0) && (stream->stop == 0))
+        {
+            pthread_cond_wait(&stream->cond, &stream->lock);
+        }
+
+        if (stream->pending == 0)
+        {
+            break;
+        }
+
+        // Write the Buffer Without Holding the Lock
+        unsigned int idx = stream->write_idx;
+        pthread_mutex_unlock(&stream->lock);
+        write_buffer(stream, stream->buffers[idx], stream->lengths[idx]);
+        pthread_mutex_lock(&stream->lock);
+
+        // Release the Buffer
+        stream->write_idx = (idx + 1) % WRITER_BUFFERS;
+        stream->pending--;
+        pthread_cond_broadcast(&stream->cond);
+    }
+    pthread_mutex_unlock(&stream->lock);
+
+    return NULL;
+}
+#endif
+
+//==========================================================================
+// Helper function that will allocate the buffers and start the background
+// writer for a stream whose file is open.
+//
+// Parameters:
+//  stream - The output stream
+//  flags  - Any of the WRITER_* flags
+//
+// Return:
+//  The stream
+//==========================================================================
+OutStream * start_stream(OutStream * stream, unsigned int flags)
+{
+    stream->flags = flags;
+
+    // Allocate the Buffers, Aligned for O_DIRECT
+    for (unsigned int i = 0; i < WRITER_BUFFERS; i++)
+    {
+#if defined(_WIN32)
+        stream->buffers[i] = (unsigned char *)_aligned_malloc(WRITER_BUFFER_SIZE, WRITER_ALIGN);
+#else
+        void * data = NULL;
+        if (posix_memalign(&data, WRITER_ALIGN, WRITER_BUFFER_SIZE) == 0)
+        {
+            stream->buffers[i] = (unsigned char *)data;
+        }
+#endif
+        if (stream->buffers[i] == NULL)
+        {
+            printf("Out of Memory\n");
+            exit(-1);
+        }
+    }
+    stream->fill_idx = 0;
+    stream->data = stream->buffers[0];
+    stream->length = 0;
+
+#ifdef WRITER_THREADS
+    // Start the Background Writer
+    if ((flags & WRITER_SYNC) == 0)
+    {
+        pthread_mutex_init(&stream->lock, NULL);
+        pthread_cond_init(&stream->cond, NULL);
+        if (pthread_create(&stream->thread, NULL, writer_thread, stream) != 0)
+        {
+            pthread_mutex_destroy(&stream->lock);
+            pthread_cond_destroy(&stream->cond);
+            stream->flags |= WRITER_SYNC;
+        }
+    }
+#endif
+
+    return stream;
+}
+
+//==========================================================================
+// Open an output stream.
+//
+// Parameters:
+//  file_name - Output File Name
+//  flags     - Any of the WRITER_* flags
+//
+// Return:
+//  The opened stream or NULL if the file could not be opened
+//==========================================================================
+OutStream * stream_open(const char * file_name, unsigned int flags)
+{
+    OutStream * stream = (OutStream *)calloc(1, sizeof(OutStream));
+    if (stream == NULL)
+    {
+        return NULL;
+    }
+
+#if defined(_WIN32)
+    stream->fd = _open(file_name, _O_WRONLY | _O_CREAT | _O_TRUNC | _O_BINARY, 0644);
+    flags |= WRITER_SYNC;
+#else
+    int oflags = O_WRONLY | O_CREAT | O_TRUNC;
+#if defined(__linux__) && defined(O_DIRECT)
+    if (flags & WRITER_DIRECT)
+    {
+        oflags |= O_DIRECT;
+    }
+#endif
+    stream->fd = open(file_name, oflags, 0644);
+    stream->direct = (oflags & ~(O_WRONLY | O_CREAT | O_TRUNC)) != 0;
+#endif
+    if (stream->fd < 0)
+    {
+        free(stream);
+        return NULL;
+    }
+
+    return start_stream(stream, flags);
+}
+
+//==========================================================================
+// Open an output stream on a file that is already open, such as a pipe.
+// The file is closed when the stream is closed.
+//
+// Parameters:
+//  fd    - The open file descriptor
+//  flags - Any of the WRITER_* flags, WRITER_DIRECT is ignored
+//
+// Return:
+//  The opened stream
+//==========================================================================
+OutStream * stream_open_fd(int fd, unsigned int flags)
+{
+    OutStream * stream = (OutStream *)calloc(1, sizeof(OutStream));
+    if (stream == NULL)
+    {
+        printf("Out of Memory\n");
+        exit(-1);
+    }
+
+#if defined(_WIN32)
+    _setmode(fd, _O_BINARY);
+    flags |= WRITER_SYNC;
+#endif
+    stream->fd = fd;
+
+    return start_stream(stream, flags & ~WRITER_DIRECT);
+}
+
+//==========================================================================
+// Helper function that will make room for another buffer at the end of a
+// memory stream.
+//
+// Parameters:
+//  stream - The output stream
+//==========================================================================
+void grow_memory(OutStream * stream)
+{
+    if (stream->memory_size + WRITER_BUFFER_SIZE > stream->memory_capacity)
+    {
+        unsigned char * memory = (unsigned char *)realloc(stream->memory, stream->memory_size + WRITER_BUFFER_SIZE);
+        if (memory == NULL)
+        {
+            printf("Out of Memory\n");
+            exit(-1);
+        }
+
+        stream->memory = memory;
+        stream->memory_capacity = stream->memory_size + WRITER_BUFFER_SIZE;
+    }
+
+    stream->data = &stream->memory[stream->memory_size];
+    stream->length = 0;
+}
+
+//==========================================================================
+// Open a stream that is kept in memory. The encoder writes straight into
+// the memory, which grows as it is filled.
+//
+// Return:
+//  The opened stream
+//==========================================================================
+OutStream * stream_open_memory()
+{
+    OutStream * stream = (OutStream *)calloc(1, sizeof(OutStream));
+    if (stream == NULL)
+    {
+        printf("Out of Memory\n");
+        exit(-1);
+    }
+
+    stream->fd = -1;
+    stream->flags = WRITER_MEMORY | WRITER_SYNC;
+    grow_memory(stream);
+
+    return stream;
+}
+
+//==========================================================================
+// Empty a memory stream so it can be used again. The memory is kept, so a
+// stream that is reused for a series of images stops allocating once it
+// has grown to fit the largest one.
+//
+// Parameters:
+//  stream - The memory stream
+//==========================================================================
+void stream_reset_memory(OutStream * stream)
+{
+    stream->memory_size = 0;
+    stream->current_byte = 0;
+    stream->current_bit_cnt = 0;
+    grow_memory(stream);
+}
+
+//==========================================================================
+// Hand the buffer that is being filled to the writer and switch to the
+// next free buffer. This will block if all of the buffers are waiting to
+// be written.
+//
+// Parameters:
+//  stream - The output stream
+//==========================================================================
+void stream_submit(OutStream * stream)
+{
+    if (stream->length == 0)
+    {
+        return;
+    }
+
+    // Memory Streams Keep the Buffer and Grow
+    if (stream->flags & WRITER_MEMORY)
+    {
+        stream->memory_size += stream->length;
+        grow_memory(stream);
+        return;
+    }
+
+#ifdef WRITER_THREADS
+    if ((stream->flags & WRITER_SYNC) == 0)
+    {
+        pthread_mutex_lock(&stream->lock);
+
+        // Queue the Current Buffer
+        stream->lengths[stream->fill_idx] = stream->length;
+        stream->pending++;
+        pthread_cond_broadcast(&stream->cond);
+
+        // Wait for the Next Buffer to be Written
+        while (stream->pending == WRITER_BUFFERS)
+        {
+            pthread_cond_wait(&stream->cond, &stream->lock);
+        }
+
+        pthread_mutex_unlock(&stream->lock);
+
+        stream->fill_idx = (stream->fill_idx + 1) % WRITER_BUFFERS;
+        stream->data = stream->buffers[stream->fill_idx];
+        stream->length = 0;
+        return;
+    }
+#endif
+
+    write_buffer(stream, stream->data, stream->length);
+    stream->length = 0;
+}
+
+//==========================================================================
+// Write a block of data to the stream.
+//
+// Parameters:
+//  stream - The output stream
+//  data   - The data to write
+//  length - The number of bytes to write
+//==========================================================================
+void stream_write(OutStream * stream, const void * data, size_t length)
+{
+    const unsigned char * src = (const unsigned char *)data;
+
+    while (length > 0)
+    {
+        if (stream->length == WRITER_BUFFER_SIZE)
+        {
+            stream_submit(stream);
+        }
+
+        size_t size = WRITER_BUFFER_SIZE - stream->length;
+        if (size > length)
+        {
+            size = length;
+        }
+
+        memcpy(&stream->data[stream->length], src, size);
+        stream->length += size;
+        src += size;
+        length -= size;
+    }
+}
+
+//==========================================================================
+// Write out everything in the stream and close the file.
+//
+// Parameters:
+//  stream - The output stream, it is freed by this call
+//
+// Return:
+//  0 on success, -1 if any of the writes failed
+//==========================================================================
+int stream_close(OutStream * stream)
+{
+    int error;
+
+    // Write Out the Last Buffer
+    stream_submit(stream);
+
+#ifdef WRITER_THREADS
+    // Wait for the Background Writer to Finish
+    if ((stream->flags & WRITER_SYNC) == 0)
+    {
+        pthread_mutex_lock(&stream->lock);
+        stream->stop = 1;
+        pthread_cond_broadcast(&stream->cond);
+        pthread_mutex_unlock(&stream->lock);
+
+        pthread_join(stream->thread, NULL);
+        pthread_mutex_destroy(&stream->lock);
+        pthread_cond_destroy(&stream->cond);
+    }
+#endif
+
+#if defined(_WIN32)
+    _close(stream->fd);
+#else
+    // Make Sure the Data is on Disk
+    if ((stream->flags & WRITER_FSYNC) && (fsync(stream->fd) != 0))
+    {
+        printf("Error Syncing File\n");
+        stream->error = -1;
+    }
+    close(stream->fd);
+#endif
+
+    for (unsigned int i = 0; i < WRITER_BUFFERS; i++)
+    {
+#if defined(_WIN32)
+        _aligned_free(stream->buffers[i]);
+#else
+        free(stream->buffers[i]);
+#endif
+    }
+
+    error = stream->error;
+    free(stream->arith);
+    free(stream);
+    return error;
+}
+
+//==========================================================================
+// Close a memory stream and hand its memory to the caller.
+//
+// Parameters:
+//  stream - The output stream, it is freed by this call
+//  size   - A pointer to store the number of bytes in the stream in
+//
+// Return:
+//  The stream data, it must be released with free
+//==========================================================================
+unsigned char * stream_close_memory(OutStream * stream, size_t * size)
+{
+    unsigned char * memory = stream->memory;
+
+    *size = stream->memory_size + stream->length;
+    free(stream->arith);
+    free(stream);
+
+    return memory;
+}
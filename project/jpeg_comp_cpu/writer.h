@@ -0,0 +1,196 @@
+//==========================================================================
+// This file contains the buffered output stream that the JPEG file is
+// written through. The encoder fills one buffer while a background thread
+// writes the previously filled buffers out to disk.
+//==========================================================================
+
+#ifndef WRITER_H
+#define WRITER_H
+
+#include <stddef.h>
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+//==========================================================================
+// The background writer thread is only available on POSIX platforms, on
+// other platforms the buffers are written out synchronously.
+//==========================================================================
+#if !defined(_WIN32)
+#define WRITER_THREADS
+#include <pthread.h>
+#endif
+
+//==========================================================================
+// Number and size of the output buffers. The size is a multiple of the
+// O_DIRECT alignment.
+//==========================================================================
+#define WRITER_BUFFERS     3
+#define WRITER_BUFFER_SIZE (1024 * 1024)
+#define WRITER_ALIGN       4096
+
+//==========================================================================
+// Flags for stream_open
+//
+//  WRITER_SYNC   - Write the buffers out on the encoding thread
+//  WRITER_DIRECT - Open the file with O_DIRECT to bypass the page cache
+//  WRITER_FSYNC  - Call fsync on the file before it is closed
+//  WRITER_MEMORY - Set by stream_open_memory, the stream is kept in memory
+//==========================================================================
+#define WRITER_SYNC   0x1
+#define WRITER_DIRECT 0x2
+#define WRITER_FSYNC  0x4
+#define WRITER_MEMORY 0x8
+
+struct ArithCoder;
+
+//==========================================================================
+// Structure to hold the output stream information
+//==========================================================================
+typedef struct
+{
+    int fd;
+    unsigned int flags;
+    int direct;
+    int error;
+
+    // Output Buffers
+    unsigned char * buffers[WRITER_BUFFERS];
+    size_t lengths[WRITER_BUFFERS];
+    unsigned int fill_idx;
+    unsigned char * data;
+    size_t length;
+
+    // Memory Stream, data Points to the End of the Memory
+    unsigned char * memory;
+    size_t memory_size;
+    size_t memory_capacity;
+
+    // Entropy Coded Bit Buffer (see write_stream)
+    unsigned char current_byte;
+    unsigned char current_bit_cnt;
+
+    // Arithmetic Coder, NULL for Huffman, Freed With the Stream (see arith.h)
+    struct ArithCoder * arith;
+
+#ifdef WRITER_THREADS
+    // Background Writer
+    pthread_t thread;
+    pthread_mutex_t lock;
+    pthread_cond_t cond;
+    unsigned int write_idx;
+    unsigned int pending;
+    int stop;
+#endif
+} OutStream;
+
+//==========================================================================
+// Open an output stream.
+//
+// Parameters:
+//  file_name - Output File Name
+//  flags     - Any of the WRITER_* flags
+//
+// Return:
+//  The opened stream or NULL if the file could not be opened
+//==========================================================================
+OutStream * stream_open(const char * file_name, unsigned int flags);
+
+//==========================================================================
+// Open an output stream on a file that is already open, such as a pipe.
+// The file is closed when the stream is closed.
+//
+// Parameters:
+//  fd    - The open file descriptor
+//  flags - Any of the WRITER_* flags, WRITER_DIRECT is ignored
+//
+// Return:
+//  The opened stream
+//==========================================================================
+OutStream * stream_open_fd(int fd, unsigned int flags);
+
+//==========================================================================
+// Open a stream that is kept in memory. The encoder writes straight into
+// the memory, which grows as it is filled.
+//
+// Return:
+//  The opened stream
+//==========================================================================
+OutStream * stream_open_memory();
+
+//==========================================================================
+// Empty a memory stream so it can be used again. The memory is kept, so a
+// stream that is reused for a series of images stops allocating once it
+// has grown to fit the largest one.
+//
+// Parameters:
+//  stream - The memory stream
+//==========================================================================
+void stream_reset_memory(OutStream * stream);
+
+//==========================================================================
+// Hand the buffer that is being filled to the writer and switch to the
+// next free buffer. This will block if all of the buffers are waiting to
+// be written.
+//
+// Parameters:
+//  stream - The output stream
+//==========================================================================
+void stream_submit(OutStream * stream);
+
+//==========================================================================
+// Write a block of data to the stream.
+//
+// Parameters:
+//  stream - The output stream
+//  data   - The data to write
+//  length - The number of bytes to write
+//==========================================================================
+void stream_write(OutStream * stream, const void * data, size_t length);
+
+//==========================================================================
+// Write a single byte to the stream.
+//
+// Parameters:
+//  stream - The output stream
+//  value  - The byte to write
+//==========================================================================
+static inline void stream_put(OutStream * stream, unsigned char value)
+{
+    if (stream->length == WRITER_BUFFER_SIZE)
+    {
+        stream_submit(stream);
+    }
+
+    stream->data[stream->length++] = value;
+}
+
+//==========================================================================
+// Write out everything in the stream and close the file.
+//
+// Parameters:
+//  stream - The output stream, it is freed by this call
+//
+// Return:
+//  0 on success, -1 if any of the writes failed
+//==========================================================================
+int stream_close(OutStream * stream);
+
+//==========================================================================
+// Close a memory stream and hand its memory to the caller.
+//
+// Parameters:
+//  stream - The output stream, it is freed by this call
+//  size   - A pointer to store the number of bytes in the stream in
+//
+// Return:
+//  The stream data, it must be released with free
+//==========================================================================
+unsigned char * stream_close_memory(OutStream * stream, size_t * size);
+
+#ifdef __cplusplus
+}
+#endif
+
+#endif /* WRITER_H */